@@ -81,6 +81,7 @@ typedef struct {
 	double target_temperature, current_temperature;
 	long cooler_power;
 	bool guide_relays[4];
+	bool guide_stop_pending_ra, guide_stop_pending_dec;
 	unsigned char *buffer;
 	long int buffer_size;
 	pthread_mutex_t usb_mutex;
@@ -408,15 +409,33 @@ static void ccd_temperature_callback(indigo_device *device) {
 }
 
 
-static void guider_timer_callback_ra(indigo_device *device) {
+static void guider_pulse_stop_ra(indigo_device *device) {
 	PRIVATE_DATA->guider_timer_ra = NULL;
 	int id = PRIVATE_DATA->dev_id;
 
-	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
-	ASIPulseGuideOff(id, ASI_GUIDE_EAST);
-	ASIPulseGuideOff(id, ASI_GUIDE_WEST);
-	pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+	/* dispatcher can't wait for image download, pulse is stopped by guider_timer_callback_ra() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->usb_mutex) == 0) {
+		ASIPulseGuideOff(id, ASI_GUIDE_EAST);
+		ASIPulseGuideOff(id, ASI_GUIDE_WEST);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_ra = true;
+	}
+}
+
 
+static void guider_timer_callback_ra(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_ra != NULL)
+		return;
+	if (PRIVATE_DATA->guide_stop_pending_ra) {
+		pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
+		ASIPulseGuideOff(PRIVATE_DATA->dev_id, ASI_GUIDE_EAST);
+		ASIPulseGuideOff(PRIVATE_DATA->dev_id, ASI_GUIDE_WEST);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	}
 	if (PRIVATE_DATA->guide_relays[ASI_GUIDE_EAST] || PRIVATE_DATA->guide_relays[ASI_GUIDE_WEST]) {
 		GUIDER_GUIDE_EAST_ITEM->number.value = 0;
 		GUIDER_GUIDE_WEST_ITEM->number.value = 0;
@@ -428,15 +447,33 @@ static void guider_timer_callback_ra(indigo_device *device) {
 }
 
 
-static void guider_timer_callback_dec(indigo_device *device) {
+static void guider_pulse_stop_dec(indigo_device *device) {
 	PRIVATE_DATA->guider_timer_dec = NULL;
 	int id = PRIVATE_DATA->dev_id;
 
-	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
-	ASIPulseGuideOff(id, ASI_GUIDE_SOUTH);
-	ASIPulseGuideOff(id, ASI_GUIDE_NORTH);
-	pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+	/* dispatcher can't wait for image download, pulse is stopped by guider_timer_callback_dec() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->usb_mutex) == 0) {
+		ASIPulseGuideOff(id, ASI_GUIDE_SOUTH);
+		ASIPulseGuideOff(id, ASI_GUIDE_NORTH);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_dec = true;
+	}
+}
+
 
+static void guider_timer_callback_dec(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_dec != NULL)
+		return;
+	if (PRIVATE_DATA->guide_stop_pending_dec) {
+		pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
+		ASIPulseGuideOff(PRIVATE_DATA->dev_id, ASI_GUIDE_SOUTH);
+		ASIPulseGuideOff(PRIVATE_DATA->dev_id, ASI_GUIDE_NORTH);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	}
 	if (PRIVATE_DATA->guide_relays[ASI_GUIDE_NORTH] || PRIVATE_DATA->guide_relays[ASI_GUIDE_SOUTH]) {
 		GUIDER_GUIDE_NORTH_ITEM->number.value = 0;
 		GUIDER_GUIDE_SOUTH_ITEM->number.value = 0;
@@ -993,7 +1030,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 			pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 
 			if (res) INDIGO_ERROR(indigo_error("indigo_ccd_asi: ASIPulseGuideOn(%d, ASI_GUIDE_NORTH) = %d", id, res));
-			PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+			PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 			PRIVATE_DATA->guide_relays[ASI_GUIDE_NORTH] = true;
 		} else {
 			int duration = GUIDER_GUIDE_SOUTH_ITEM->number.value;
@@ -1003,7 +1040,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 
 				if (res) INDIGO_ERROR(indigo_error("indigo_ccd_asi: ASIPulseGuideOn(%d, ASI_GUIDE_SOUTH) = %d", id, res));
-				PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+				PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 				PRIVATE_DATA->guide_relays[ASI_GUIDE_SOUTH] = true;
 			}
 		}
@@ -1026,7 +1063,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 			pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 
 			if (res) INDIGO_ERROR(indigo_error("indigo_ccd_asi: ASIPulseGuideOn(%d, ASI_GUIDE_EAST) = %d", id, res));
-			PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+			PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 			PRIVATE_DATA->guide_relays[ASI_GUIDE_EAST] = true;
 		} else {
 			int duration = GUIDER_GUIDE_WEST_ITEM->number.value;
@@ -1036,7 +1073,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 
 				if (res) INDIGO_ERROR(indigo_error("indigo_ccd_asi: ASIPulseGuideOn(%d, ASI_GUIDE_WEST) = %d", id, res));
-				PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+				PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 				PRIVATE_DATA->guide_relays[ASI_GUIDE_WEST] = true;
 			}
 		}
@@ -1154,14 +1191,16 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		ccd_attach,
 		asi_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	static indigo_device guider_template = {
 		"", NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 
 	struct libusb_device_descriptor descriptor;
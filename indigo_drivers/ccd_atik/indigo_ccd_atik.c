@@ -292,9 +292,15 @@ static indigo_result ccd_detach(indigo_device *device) {
 
 // -------------------------------------------------------------------------------- INDIGO guider device implementation
 
-static void guider_timer_callback(indigo_device *device) {
+static void guider_pulse_stop(indigo_device *device) {
 	PRIVATE_DATA->guider_timer = NULL;
 	libatik_guide_relays(PRIVATE_DATA->device_context, 0);
+}
+
+static void guider_timer_callback(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer != NULL)
+		return;
 	if (PRIVATE_DATA->relay_mask & (ATIK_GUIDE_NORTH | ATIK_GUIDE_SOUTH)) {
 		GUIDER_GUIDE_NORTH_ITEM->number.value = 0;
 		GUIDER_GUIDE_SOUTH_ITEM->number.value = 0;
@@ -358,12 +364,12 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 		int duration = GUIDER_GUIDE_NORTH_ITEM->number.value;
 		if (duration > 0) {
 			PRIVATE_DATA->relay_mask |= ATIK_GUIDE_NORTH;
-			PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+			PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 		} else {
 			int duration = GUIDER_GUIDE_SOUTH_ITEM->number.value;
 			if (duration > 0) {
 				PRIVATE_DATA->relay_mask |= ATIK_GUIDE_SOUTH;
-				PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+				PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 			}
 		}
 		libatik_guide_relays(PRIVATE_DATA->device_context, PRIVATE_DATA->relay_mask);
@@ -378,12 +384,12 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 		int duration = GUIDER_GUIDE_EAST_ITEM->number.value;
 		if (duration > 0) {
 			PRIVATE_DATA->relay_mask |= ATIK_GUIDE_EAST;
-			PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+			PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 		} else {
 			int duration = GUIDER_GUIDE_WEST_ITEM->number.value;
 			if (duration > 0) {
 				PRIVATE_DATA->relay_mask |= ATIK_GUIDE_WEST;
-				PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+				PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 			}
 		}
 		libatik_guide_relays(PRIVATE_DATA->device_context, PRIVATE_DATA->relay_mask);
@@ -502,21 +508,24 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		ccd_attach,
 		indigo_ccd_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	static indigo_device guider_template = {
 		"", NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 	static indigo_device wheel_template = {
 		"", NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		wheel_attach,
 		indigo_wheel_enumerate_properties,
 		wheel_change_property,
-		wheel_detach
+		wheel_detach,
+		NULL
 	};
 	pthread_mutex_lock(&device_mutex);
 	switch (event) {
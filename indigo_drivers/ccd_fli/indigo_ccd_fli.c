@@ -1016,7 +1016,8 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		ccd_attach,
 		fli_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 
 	struct libusb_device_descriptor descriptor;
@@ -439,7 +439,8 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		ccd_attach,
 		indigo_ccd_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	pthread_mutex_lock(&device_mutex);
 	switch (event) {
@@ -272,14 +272,16 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		ccd_attach,
 		indigo_ccd_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	static indigo_device guider_template = {
 		"", NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 
 	pthread_mutex_lock(&device_mutex);
@@ -139,6 +139,7 @@ typedef struct {
 	int count_open;
 	indigo_timer *exposure_timer, *temperature_timer;
 	indigo_timer *guider_timer_ra, *guider_timer_dec;
+	bool guide_stop_pending_ra, guide_stop_pending_dec;
 	double target_temperature, current_temperature;
 	double cooler_power;
 	unsigned char *buffer;
@@ -978,13 +979,9 @@ static indigo_result guider_attach(indigo_device *device) {
 }
 
 
-static void guider_timer_callback_ra(indigo_device *device) {
+static void guider_relays_off(indigo_device *device, ushort relays) {
 	int res;
 	ushort relay_map = 0;
-
-	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
-
-	PRIVATE_DATA->guider_timer_ra = NULL;
 	int driver_handle = PRIVATE_DATA->driver_handle;
 
 	res = sbig_get_relaymap(driver_handle, &relay_map);
@@ -992,54 +989,77 @@ static void guider_timer_callback_ra(indigo_device *device) {
 		INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_get_relaymap(%d) = %d", driver_handle, res));
 	}
 
-	relay_map &= ~(RELAY_EAST | RELAY_WEST);
+	relay_map &= ~relays;
 
 	res = sbig_set_relaymap(driver_handle, relay_map);
 	if (res != CE_NO_ERROR) {
 		INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relaymap(%d) = %d", driver_handle, res));
 	}
+}
 
+
+static void guider_pulse_stop_ra(indigo_device *device) {
+	PRIVATE_DATA->guider_timer_ra = NULL;
+	/* dispatcher can't wait for image download, pulse is stopped by guider_timer_callback_ra() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->usb_mutex) == 0) {
+		guider_relays_off(device, RELAY_EAST | RELAY_WEST);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_ra = true;
+	}
+}
+
+
+static void guider_timer_callback_ra(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_ra != NULL)
+		return;
 	if (PRIVATE_DATA->relay_map & (RELAY_EAST | RELAY_WEST)) {
 		GUIDER_GUIDE_EAST_ITEM->number.value = 0;
 		GUIDER_GUIDE_WEST_ITEM->number.value = 0;
 		GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_OK_STATE;
 		indigo_update_property(device, GUIDER_GUIDE_RA_PROPERTY, NULL);
 	}
-	PRIVATE_DATA->relay_map = relay_map;
-
+	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
+	if (PRIVATE_DATA->guide_stop_pending_ra) {
+		guider_relays_off(device, RELAY_EAST | RELAY_WEST);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	}
+	PRIVATE_DATA->relay_map &= ~(RELAY_EAST | RELAY_WEST);
 	pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 }
 
 
-static void guider_timer_callback_dec(indigo_device *device) {
-	int res;
-	ushort relay_map = 0;
-
-	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
-
-	PRIVATE_DATA->guider_timer_ra = NULL;
-	int driver_handle = PRIVATE_DATA->driver_handle;
-
-	res = sbig_get_relaymap(driver_handle, &relay_map);
-	if (res != CE_NO_ERROR) {
-		INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_get_relaymap(%d) = %d", driver_handle, res));
+static void guider_pulse_stop_dec(indigo_device *device) {
+	PRIVATE_DATA->guider_timer_dec = NULL;
+	/* dispatcher can't wait for image download, pulse is stopped by guider_timer_callback_dec() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->usb_mutex) == 0) {
+		guider_relays_off(device, RELAY_NORTH | RELAY_SOUTH);
+		pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_dec = true;
 	}
+}
 
-	relay_map &= ~(RELAY_NORTH | RELAY_SOUTH);
-
-	res = sbig_set_relaymap(driver_handle, relay_map);
-	if (res != CE_NO_ERROR) {
-		INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relaymap(%d) = %d", driver_handle, res));
-	}
 
+static void guider_timer_callback_dec(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_dec != NULL)
+		return;
 	if (PRIVATE_DATA->relay_map & (RELAY_NORTH | RELAY_SOUTH)) {
 		GUIDER_GUIDE_NORTH_ITEM->number.value = 0;
 		GUIDER_GUIDE_SOUTH_ITEM->number.value = 0;
 		GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_OK_STATE;
 		indigo_update_property(device, GUIDER_GUIDE_DEC_PROPERTY, NULL);
 	}
-	PRIVATE_DATA->relay_map = relay_map;
-
+	pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
+	if (PRIVATE_DATA->guide_stop_pending_dec) {
+		guider_relays_off(device, RELAY_NORTH | RELAY_SOUTH);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	}
+	PRIVATE_DATA->relay_map &= ~(RELAY_NORTH | RELAY_SOUTH);
 	pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 }
 
@@ -1076,7 +1096,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 			pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
 			res = sbig_set_relays(driver_handle, RELAY_NORTH);
 			if (res != CE_NO_ERROR) INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relays(%d, RELAY_NORTH) = %d", driver_handle, res));
-			PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+			PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 			PRIVATE_DATA->relay_map |= RELAY_NORTH;
 			pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 		} else {
@@ -1085,7 +1105,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
 				res = sbig_set_relays(driver_handle, RELAY_SOUTH);
 				if (res != CE_NO_ERROR) INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relays(%d, RELAY_SOUTH) = %d", driver_handle, res));
-				PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+				PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 				PRIVATE_DATA->relay_map |= RELAY_SOUTH;
 				pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 			}
@@ -1107,7 +1127,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 			pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
 			res = sbig_set_relays(driver_handle, RELAY_EAST);
 			if (res != CE_NO_ERROR) INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relays(%d, RELAY_EAST) = %d", driver_handle, res));
-			PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+			PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 			PRIVATE_DATA->relay_map |= RELAY_EAST;
 			pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 		} else {
@@ -1116,7 +1136,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				pthread_mutex_lock(&PRIVATE_DATA->usb_mutex);
 				res = sbig_set_relays(driver_handle, RELAY_WEST);
 				if (res != CE_NO_ERROR) INDIGO_ERROR(indigo_error("indigo_ccd_sbig: sbig_set_relays(%d, RELAY_WEST) = %d", driver_handle, res));
-				PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+				PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 				PRIVATE_DATA->relay_map |= RELAY_WEST;
 				pthread_mutex_unlock(&PRIVATE_DATA->usb_mutex);
 			}
@@ -1313,7 +1333,8 @@ static bool plug_device(char *cam_name, unsigned short device_type, unsigned lon
 		ccd_attach,
 		sbig_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 
 	static indigo_device guider_template = {
@@ -1321,7 +1342,8 @@ static bool plug_device(char *cam_name, unsigned short device_type, unsigned lon
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 
 	short res = set_sbig_handle(global_handle);
@@ -1609,7 +1631,8 @@ indigo_result indigo_ccd_sbig(indigo_driver_action action, indigo_driver_info *i
 		eth_attach,
 		indigo_device_enumerate_properties,
 		eth_change_property,
-		eth_detach
+		eth_detach,
+		NULL
 	};
 
 	SET_DRIVER_INFO(info, "SBIG Camera", __FUNCTION__, DRIVER_VERSION, last_action);
@@ -144,12 +144,14 @@ static void exposure_timer_callback(indigo_device *device) {
 		indigo_update_property(device, CCD_EXPOSURE_PROPERTY, NULL);
 		simulator_private_data *private_data = PRIVATE_DATA;
 		unsigned short *raw = (unsigned short *)(private_data->image+FITS_HEADER_SIZE);
-		int horizontal_bin = (int)CCD_BIN_HORIZONTAL_ITEM->number.value;
-		int vertical_bin = (int)CCD_BIN_VERTICAL_ITEM->number.value;
-		int frame_left = (int)CCD_FRAME_LEFT_ITEM->number.value / horizontal_bin;
-		int frame_top = (int)CCD_FRAME_TOP_ITEM->number.value / vertical_bin;
-		int frame_width = (int)CCD_FRAME_WIDTH_ITEM->number.value / horizontal_bin;
-		int frame_height = (int)CCD_FRAME_HEIGHT_ITEM->number.value / vertical_bin;
+		int frame_left = (int)CCD_FRAME_LEFT_ITEM->number.value;
+		int frame_top = (int)CCD_FRAME_TOP_ITEM->number.value;
+		int frame_width = (int)CCD_FRAME_WIDTH_ITEM->number.value;
+		int frame_height = (int)CCD_FRAME_HEIGHT_ITEM->number.value;
+		if (frame_left + frame_width > WIDTH)
+			frame_width = WIDTH - frame_left;
+		if (frame_top + frame_height > HEIGHT)
+			frame_height = HEIGHT - frame_top;
 		int size = frame_width * frame_height;
 		int gain = (int)(CCD_GAIN_ITEM->number.value / 100);
 		int offset = (int)CCD_OFFSET_ITEM->number.value;
@@ -157,9 +159,9 @@ static void exposure_timer_callback(indigo_device *device) {
 		
 		if (device == PRIVATE_DATA->imager) {
 			for (int j = 0; j < frame_height; j++) {
-				int jj = (frame_top + j) * vertical_bin;
+				int jj = frame_top + j;
 				for (int i = 0; i < frame_width; i++) {
-					raw[j * frame_width + i] = background[jj * WIDTH + (frame_left + i) * horizontal_bin] + (rand() & 0x7F);
+					raw[j * frame_width + i] = background[jj * WIDTH + frame_left + i] + (rand() & 0x7F);
 				}
 			}
 		} else {
@@ -171,12 +173,12 @@ static void exposure_timer_callback(indigo_device *device) {
 			double x_offset = PRIVATE_DATA->ra_offset * COS - PRIVATE_DATA->dec_offset * SIN + rand() / (double)RAND_MAX/10 - 0.1;
 			double y_offset = PRIVATE_DATA->ra_offset * SIN + PRIVATE_DATA->dec_offset * COS + rand() / (double)RAND_MAX/10 - 0.1;
 			for (int i = 0; i < STARS; i++) {
-				double center_x = (private_data->star_x[i] + x_offset) / horizontal_bin;
+				double center_x = private_data->star_x[i] + x_offset;
 				if (center_x < 0)
 					center_x += WIDTH;
 				if (center_x >= WIDTH)
 					center_x -= WIDTH;
-				double center_y = (private_data->star_y[i] + y_offset) / vertical_bin;
+				double center_y = private_data->star_y[i] + y_offset;
 				if (center_y < 0)
 					center_y += HEIGHT;
 				if (center_y >= HEIGHT)
@@ -184,14 +186,14 @@ static void exposure_timer_callback(indigo_device *device) {
 				center_x -= frame_left;
 				center_y -= frame_top;
 				int a = private_data->star_a[i];
-				int xMax = (int)round(center_x) + 4 / horizontal_bin;
-				int yMax = (int)round(center_y) + 4 / vertical_bin;
-				for (int y = yMax - 8 / vertical_bin; y <= yMax; y++) {
+				int xMax = (int)round(center_x) + 4;
+				int yMax = (int)round(center_y) + 4;
+				for (int y = yMax - 8; y <= yMax; y++) {
 					if (y < 0 || y >= frame_height)
 						continue;
 					int yw = y * frame_width;
 					double yy = center_y - y;
-					for (int x = xMax - 8 / horizontal_bin; x <= xMax; x++) {
+					for (int x = xMax - 8; x <= xMax; x++) {
 						if (x < 0 || x >= frame_width)
 							continue;
 						double xx = center_x - x;
@@ -216,7 +218,7 @@ static void exposure_timer_callback(indigo_device *device) {
 			memcpy(raw, tmp, 2 * size);
 			free(tmp);
 		}
-		indigo_process_image(device, private_data->image, frame_width, frame_height, true, NULL);
+		indigo_process_image_with_software_binning(device, private_data->image, frame_left, frame_top, frame_width, frame_height, true, NULL);
 		CCD_EXPOSURE_PROPERTY->state = INDIGO_OK_STATE;
 		indigo_update_property(device, CCD_EXPOSURE_PROPERTY, NULL);
 	}
@@ -280,6 +282,7 @@ static indigo_result ccd_attach(indigo_device *device) {
 		CCD_BIN_PROPERTY->perm = INDIGO_RW_PERM;
 		CCD_INFO_MAX_HORIZONAL_BIN_ITEM->number.value = CCD_BIN_HORIZONTAL_ITEM->number.max = 4;
 		CCD_INFO_MAX_VERTICAL_BIN_ITEM->number.value = CCD_BIN_VERTICAL_ITEM->number.max = 4;
+		CCD_BIN_MODE_PROPERTY->hidden = false;
 		CCD_MODE_PROPERTY->perm = INDIGO_RW_PERM;
 		CCD_MODE_PROPERTY->count = 3;
 		char name[32];
@@ -399,8 +402,14 @@ static indigo_result ccd_detach(indigo_device *device) {
 
 // -------------------------------------------------------------------------------- INDIGO guider device implementation
 
-static void guider_timer_callback(indigo_device *device) {
+static void guider_pulse_stop(indigo_device *device) {
 	PRIVATE_DATA->guider_timer = NULL;
+}
+
+static void guider_timer_callback(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer != NULL)
+		return;
 	if (GUIDER_GUIDE_NORTH_ITEM->number.value != 0 || GUIDER_GUIDE_SOUTH_ITEM->number.value != 0) {
 		PRIVATE_DATA->dec_offset += (GUIDER_GUIDE_NORTH_ITEM->number.value - GUIDER_GUIDE_SOUTH_ITEM->number.value) / 100;
 		GUIDER_GUIDE_NORTH_ITEM->number.value = 0;
@@ -443,12 +452,12 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 		int duration = GUIDER_GUIDE_NORTH_ITEM->number.value;
 		if (duration > 0) {
 			GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_BUSY_STATE;
-			PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+			PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 		} else {
 			int duration = GUIDER_GUIDE_SOUTH_ITEM->number.value;
 			if (duration > 0) {
 				GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_BUSY_STATE;
-				PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+				PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 			}
 		}
 		indigo_update_property(device, GUIDER_GUIDE_DEC_PROPERTY, NULL);
@@ -461,12 +470,12 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 		int duration = GUIDER_GUIDE_EAST_ITEM->number.value;
 		if (duration > 0) {
 			GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_BUSY_STATE;
-			PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+			PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 		} else {
 			int duration = GUIDER_GUIDE_WEST_ITEM->number.value;
 			if (duration > 0) {
 				GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_BUSY_STATE;
-				PRIVATE_DATA->guider_timer = indigo_set_timer(device, duration/1000.0, guider_timer_callback);
+				PRIVATE_DATA->guider_timer = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop, guider_timer_callback);
 			}
 		}
 		indigo_update_property(device, GUIDER_GUIDE_RA_PROPERTY, NULL);
@@ -673,35 +682,40 @@ indigo_result indigo_ccd_simulator(indigo_driver_action action, indigo_driver_in
 		ccd_attach,
 		indigo_ccd_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	static indigo_device imager_wheel_template = {
 		CCD_SIMULATOR_WHEEL_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		wheel_attach,
 		indigo_wheel_enumerate_properties,
 		wheel_change_property,
-		wheel_detach
+		wheel_detach,
+		NULL
 	};
 	static indigo_device imager_focuser_template = {
 		CCD_SIMULATOR_FOCUSER_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		focuser_attach,
 		indigo_focuser_enumerate_properties,
 		focuser_change_property,
-		focuser_detach
+		focuser_detach,
+		NULL
 	};
 	static indigo_device guider_camera_template = {
 		CCD_SIMULATOR_GUIDER_CAMERA_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		ccd_attach,
 		indigo_ccd_enumerate_properties,
 		ccd_change_property,
-		ccd_detach
+		ccd_detach,
+		NULL
 	};
 	static indigo_device guider_template = {
 		CCD_SIMULATOR_GUIDER_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 	
 	static indigo_driver_action last_action = INDIGO_DRIVER_SHUTDOWN;
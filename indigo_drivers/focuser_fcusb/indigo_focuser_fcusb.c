@@ -202,7 +202,8 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		focuser_attach,
 		focuser_enumerate_properties,
 		focuser_change_property,
-		focuser_detach
+		focuser_detach,
+		NULL
 	};
 
 	pthread_mutex_lock(&device_mutex);
@@ -512,7 +512,8 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		focuser_attach,
 		indigo_focuser_enumerate_properties,
 		focuser_change_property,
-		focuser_detach
+		focuser_detach,
+		NULL
 	};
 
 	struct libusb_device_descriptor descriptor;
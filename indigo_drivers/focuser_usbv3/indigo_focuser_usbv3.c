@@ -381,7 +381,8 @@ indigo_result indigo_focuser_usbv3(indigo_driver_action action, indigo_driver_in
 		focuser_attach,
 		focuser_enumerate_properties,
 		focuser_change_property,
-		focuser_detach
+		focuser_detach,
+		NULL
 	};
 	
 	SET_DRIVER_INFO(info, "USB_Focus v3 Focuser", __FUNCTION__, DRIVER_VERSION, last_action);
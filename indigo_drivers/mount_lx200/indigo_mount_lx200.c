@@ -738,14 +738,16 @@ indigo_result indigo_mount_lx200(indigo_driver_action action, indigo_driver_info
 		mount_attach,
 		mount_enumerate_properties,
 		mount_change_property,
-		mount_detach
+		mount_detach,
+		NULL
 	};
 	static indigo_device mount_guider_template = {
 		MOUNT_LX200_GUIDER_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		indigo_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 	
 	static indigo_driver_action last_action = INDIGO_DRIVER_SHUTDOWN;
@@ -68,6 +68,7 @@ typedef struct {
 	int vendor_id;
 	pthread_mutex_t serial_mutex;
 	indigo_timer *position_timer, *guider_timer_ra, *guider_timer_dec, *park_timer;
+	bool guide_stop_pending_ra, guide_stop_pending_dec;
 	int guide_rate;
 	indigo_property *command_guide_rate_property;
 } nexstar_private_data;
@@ -751,18 +752,38 @@ static indigo_result nexstar_guider_enumerate_properties(indigo_device *device,
 }
 
 
-static void guider_timer_callback_ra(indigo_device *device) {
-	PRIVATE_DATA->guider_timer_ra = NULL;
+static void guider_stop_ra(indigo_device *device) {
 	int dev_id = PRIVATE_DATA->dev_id;
-	int res;
-
-	pthread_mutex_lock(&PRIVATE_DATA->serial_mutex);
-	res = tc_slew_fixed(dev_id, TC_AXIS_RA, TC_DIR_POSITIVE, 0); // STOP move
-	pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+	int res = tc_slew_fixed(dev_id, TC_AXIS_RA, TC_DIR_POSITIVE, 0); // STOP move
 	if (res != RC_OK) {
 		INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", dev_id, res));
 	}
+}
+
 
+static void guider_pulse_stop_ra(indigo_device *device) {
+	PRIVATE_DATA->guider_timer_ra = NULL;
+	/* dispatcher can't wait for pending serial command, pulse is stopped by guider_timer_callback_ra() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->serial_mutex) == 0) {
+		guider_stop_ra(device);
+		pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_ra = true;
+	}
+}
+
+
+static void guider_timer_callback_ra(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_ra != NULL)
+		return;
+	if (PRIVATE_DATA->guide_stop_pending_ra) {
+		pthread_mutex_lock(&PRIVATE_DATA->serial_mutex);
+		guider_stop_ra(device);
+		pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+		PRIVATE_DATA->guide_stop_pending_ra = false;
+	}
 	GUIDER_GUIDE_EAST_ITEM->number.value = 0;
 	GUIDER_GUIDE_WEST_ITEM->number.value = 0;
 	GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_OK_STATE;
@@ -770,18 +791,38 @@ static void guider_timer_callback_ra(indigo_device *device) {
 }
 
 
-static void guider_timer_callback_dec(indigo_device *device) {
-	PRIVATE_DATA->guider_timer_dec = NULL;
+static void guider_stop_dec(indigo_device *device) {
 	int dev_id = PRIVATE_DATA->dev_id;
-	int res;
-
-	pthread_mutex_lock(&PRIVATE_DATA->serial_mutex);
-	res = tc_slew_fixed(dev_id, TC_AXIS_DE, TC_DIR_POSITIVE, 0); // STOP move
-	pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+	int res = tc_slew_fixed(dev_id, TC_AXIS_DE, TC_DIR_POSITIVE, 0); // STOP move
 	if (res != RC_OK) {
 		INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", dev_id, res));
 	}
+}
+
 
+static void guider_pulse_stop_dec(indigo_device *device) {
+	PRIVATE_DATA->guider_timer_dec = NULL;
+	/* dispatcher can't wait for pending serial command, pulse is stopped by guider_timer_callback_dec() then */
+	if (pthread_mutex_trylock(&PRIVATE_DATA->serial_mutex) == 0) {
+		guider_stop_dec(device);
+		pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	} else {
+		PRIVATE_DATA->guide_stop_pending_dec = true;
+	}
+}
+
+
+static void guider_timer_callback_dec(indigo_device *device) {
+	/* new pulse was started meanwhile */
+	if (PRIVATE_DATA->guider_timer_dec != NULL)
+		return;
+	if (PRIVATE_DATA->guide_stop_pending_dec) {
+		pthread_mutex_lock(&PRIVATE_DATA->serial_mutex);
+		guider_stop_dec(device);
+		pthread_mutex_unlock(&PRIVATE_DATA->serial_mutex);
+		PRIVATE_DATA->guide_stop_pending_dec = false;
+	}
 	GUIDER_GUIDE_NORTH_ITEM->number.value = 0;
 	GUIDER_GUIDE_SOUTH_ITEM->number.value = 0;
 	GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_OK_STATE;
@@ -860,7 +901,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", PRIVATE_DATA->dev_id, res));
 			}
 			GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_BUSY_STATE;
-			PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+			PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 		} else {
 			int duration = GUIDER_GUIDE_SOUTH_ITEM->number.value;
 			if (duration > 0) {
@@ -871,7 +912,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 					INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", PRIVATE_DATA->dev_id, res));
 				}
 				GUIDER_GUIDE_DEC_PROPERTY->state = INDIGO_BUSY_STATE;
-				PRIVATE_DATA->guider_timer_dec = indigo_set_timer(device, duration/1000.0, guider_timer_callback_dec);
+				PRIVATE_DATA->guider_timer_dec = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_dec, guider_timer_callback_dec);
 			}
 		}
 		indigo_update_property(device, GUIDER_GUIDE_DEC_PROPERTY, NULL);
@@ -890,7 +931,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 				INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", PRIVATE_DATA->dev_id, res));
 			}
 			GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_BUSY_STATE;
-			PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+			PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 		} else {
 			int duration = GUIDER_GUIDE_WEST_ITEM->number.value;
 			if (duration > 0) {
@@ -901,7 +942,7 @@ static indigo_result guider_change_property(indigo_device *device, indigo_client
 					INDIGO_ERROR(indigo_error("indigo_mount_nexstar: tc_slew_fixed(%d) = %d", PRIVATE_DATA->dev_id, res));
 				}
 				GUIDER_GUIDE_RA_PROPERTY->state = INDIGO_BUSY_STATE;
-				PRIVATE_DATA->guider_timer_ra = indigo_set_timer(device, duration/1000.0, guider_timer_callback_ra);
+				PRIVATE_DATA->guider_timer_ra = indigo_set_precise_timer(device, duration/1000.0, guider_pulse_stop_ra, guider_timer_callback_ra);
 			}
 		}
 		indigo_update_property(device, GUIDER_GUIDE_RA_PROPERTY, NULL);
@@ -939,14 +980,16 @@ indigo_result indigo_mount_nexstar(indigo_driver_action action, indigo_driver_in
 		mount_attach,
 		indigo_mount_enumerate_properties,
 		mount_change_property,
-		mount_detach
+		mount_detach,
+		NULL
 	};
 	static indigo_device mount_guider_template = {
 		MOUNT_NEXSTAR_GUIDER_NAME, NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
 		guider_attach,
 		nexstar_guider_enumerate_properties,
 		guider_change_property,
-		guider_detach
+		guider_detach,
+		NULL
 	};
 
 	static indigo_driver_action last_action = INDIGO_DRIVER_SHUTDOWN;
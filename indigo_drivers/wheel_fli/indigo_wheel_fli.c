@@ -344,7 +344,8 @@ static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotp
 		wheel_attach,
 		indigo_wheel_enumerate_properties,
 		wheel_change_property,
-		wheel_detach
+		wheel_detach,
+		NULL
 	};
 
 	struct libusb_device_descriptor descriptor;
@@ -30,24 +30,35 @@
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <poll.h>
+#include <strings.h>
 
 #include "indigo_bus.h"
 #include "indigo_names.h"
 #include "indigo_io.h"
+#include "indigo_timer.h"
+#include "indigo_base64.h"
 
 #define MAX_DEVICES 32
-#define MAX_CLIENTS 8
+#define MAX_CLIENTS 256
 #define MAX_BLOBS	32
 
 #define BUFFER_SIZE	1024
 
+#define HTTP_CONNECTIONS				8
+#define HTTP_PREFETCHES					8
+#define HTTP_DOWNLOAD_THREADS		4
+#define HTTP_TIMEOUT						10
+
 static indigo_device *devices[MAX_DEVICES];
 static indigo_client *clients[MAX_CLIENTS];
 static indigo_property *blobs[MAX_BLOBS];
+static unsigned long blob_sequences[MAX_BLOBS];
 static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t client_mutex = PTHREAD_MUTEX_INITIALIZER;
 static bool is_started = false;
@@ -93,6 +104,8 @@ void (*indigo_log_message_handler)(const char *message) = NULL;
 
 bool indigo_use_host_suffix = true;
 
+unsigned long indigo_update_sequence = 0;
+
 const char **indigo_main_argv = NULL;
 int indigo_main_argc = 0;
 
@@ -356,8 +369,17 @@ indigo_result indigo_change_property(indigo_client *client, indigo_property *pro
 			route = route || !strcmp(property->device, device->name);
 			route = route || (indigo_use_host_suffix && *device->name == '@' && strstr(property->device, device->name));
 			route = route || (!indigo_use_host_suffix && *device->name == '@');
-			if (route)
-				device->last_result = device->change_property(device, client, property);
+			if (route) {
+				/* device detached from change_property resets device->executor, released executor is kept until leave */
+				indigo_executor *executor = device->executor;
+				if (executor != NULL) {
+					indigo_executor_enter(executor);
+					device->last_result = device->change_property(device, client, property);
+					indigo_executor_leave(executor);
+				} else {
+					device->last_result = device->change_property(device, client, property);
+				}
+			}
 		}
 	}
 	return INDIGO_OK;
@@ -396,6 +418,14 @@ indigo_result indigo_update_property(indigo_device *device, indigo_property *pro
 			va_end(args);
 		}
 		property->version = device ? device->version : INDIGO_VERSION_CURRENT;
+		unsigned long sequence = __sync_add_and_fetch(&indigo_update_sequence, 1);
+		if (property->type == INDIGO_BLOB_VECTOR) {
+			for (int i = 0; i < MAX_BLOBS; i++)
+				if (blobs[i] == property) {
+					blob_sequences[i] = sequence;
+					break;
+				}
+		}
 		for (int i = 0; i < MAX_CLIENTS; i++) {
 			indigo_client *client = clients[i];
 			if (client != NULL && client->update_property != NULL)
@@ -568,6 +598,7 @@ indigo_property *indigo_init_blob_property(indigo_property *property, const char
 	for (int i = 0; i < MAX_BLOBS; i++)
 		if (blobs[i] == NULL) {
 			blobs[i] = property;
+			blob_sequences[i] = 0;
 			break;
 		}
 	return property;
@@ -594,12 +625,19 @@ void indigo_release_property(indigo_property *property) {
 }
 
 indigo_result indigo_validate_blob(indigo_item *item) {
+	return indigo_validate_blob_sequence(item, NULL);
+}
+
+indigo_result indigo_validate_blob_sequence(indigo_item *item, unsigned long *sequence) {
 	for (int i = 0; i < MAX_BLOBS; i++) {
 		indigo_property *property = blobs[i];
 		if (property != NULL) {
 			for (int j = 0; j < property->count; j++) {
-				if (item == &property->items[j])
+				if (item == &property->items[j]) {
+					if (sequence != NULL)
+						*sequence = blob_sequences[i];
 					return INDIGO_OK;
+				}
 			}
 		}
 	}
@@ -666,75 +704,363 @@ void *indigo_alloc_blob_buffer(long size) {
 	return malloc(size);
 }
 
-bool indigo_populate_http_blob_item(indigo_item *blob_item) {
-	char host[BUFFER_SIZE] = {0};
-	int port = 80;
-	char file[BUFFER_SIZE] = {0};
-	char request[BUFFER_SIZE];
-	char http_line[BUFFER_SIZE];
-	char http_response[BUFFER_SIZE];
-	long content_len = 0;;
-	int http_result = 0;
-	char *image_type;
+/* idle keep-alive connections to BLOB servers */
+typedef struct {
+	char host[INDIGO_NAME_SIZE];
+	int port;
 	int socket;
-	int res;
-	int count;
+} http_connection;
+
+/* BLOB downloaded ahead of indigo_populate_http_blob_item() call */
+typedef enum {
+	PREFETCH_FREE = 0,
+	PREFETCH_PENDING,
+	PREFETCH_DONE,
+	PREFETCH_FAILED
+} prefetch_state;
+
+typedef struct {
+	prefetch_state state;
+	bool restart;
+	unsigned long sequence;
+	indigo_item item;
+} http_prefetch;
+
+typedef struct http_job {
+	struct http_job *next;
+	indigo_item *item;
+	indigo_blob_download_callback callback;
+	void *data;
+	http_prefetch *prefetch;
+} http_job;
+
+static http_connection http_connections[HTTP_CONNECTIONS];
+static http_prefetch http_prefetches[HTTP_PREFETCHES];
+static unsigned long http_prefetch_sequence = 0;
+static http_job *http_jobs_head = NULL, *http_jobs_tail = NULL;
+static int http_thread_count = 0;
+static pthread_mutex_t http_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_job_signal = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t http_prefetch_signal = PTHREAD_COND_INITIALIZER;
+static pthread_once_t http_once = PTHREAD_ONCE_INIT;
+
+bool indigo_prefetch_blob_urls = false;
+
+/* empty pool slots have socket -1, 0 is valid descriptor */
+static void http_init(void) {
+	for (int i = 0; i < HTTP_CONNECTIONS; i++)
+		http_connections[i].socket = -1;
+}
+
+static int http_connection_get(const char *host, int port, bool *reused) {
+	pthread_once(&http_once, http_init);
+	pthread_mutex_lock(&http_mutex);
+	for (int i = 0; i < HTTP_CONNECTIONS; i++) {
+		http_connection *connection = http_connections + i;
+		if (connection->socket >= 0 && connection->port == port && !strcmp(connection->host, host)) {
+			int socket = connection->socket;
+			connection->socket = -1;
+			/* idle connection is readable only if server closed it */
+			struct pollfd fd = { socket, POLLIN, 0 };
+			if (poll(&fd, 1, 0) != 0) {
+				close(socket);
+				continue;
+			}
+			pthread_mutex_unlock(&http_mutex);
+			*reused = true;
+			return socket;
+		}
+	}
+	pthread_mutex_unlock(&http_mutex);
+	*reused = false;
+	return indigo_open_tcp(host, port);
+}
+
+static void http_connection_put(const char *host, int port, int socket, bool keep_alive) {
+	if (keep_alive) {
+		pthread_once(&http_once, http_init);
+		pthread_mutex_lock(&http_mutex);
+		for (int i = 0; i < HTTP_CONNECTIONS; i++) {
+			http_connection *connection = http_connections + i;
+			if (connection->socket < 0) {
+				strncpy(connection->host, host, INDIGO_NAME_SIZE - 1);
+				connection->port = port;
+				connection->socket = socket;
+				pthread_mutex_unlock(&http_mutex);
+				return;
+			}
+		}
+		pthread_mutex_unlock(&http_mutex);
+	}
+	close(socket);
+}
 
-	if ((blob_item->blob.url[0] == '\0') || strcmp(blob_item->name, CCD_IMAGE_ITEM_NAME)) {
-		INDIGO_DEBUG(indigo_debug("%s(): url == \"\" or item != \"%s\"", __FUNCTION__, CCD_IMAGE_ITEM_NAME));
+static bool http_get(int socket, const char *host, const char *file, indigo_item *blob_item, bool *keep_alive, bool *no_response) {
+	char buffer[4 * BUFFER_SIZE];
+	long length = 0;
+	char *body = NULL;
+	*keep_alive = false;
+	*no_response = true;
+	/* stalled server must not block the download forever */
+	struct timeval timeout = { HTTP_TIMEOUT, 0 };
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	int request_length = snprintf(buffer, sizeof(buffer), "GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", file, host);
+	if (!indigo_write(socket, buffer, request_length)) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			INDIGO_ERROR(indigo_error("Request for %s timed out", file));
+			*no_response = false;
+		}
 		return false;
 	}
-	sscanf(blob_item->blob.url, "http://%255[^:]:%5d/%1024[^\n]", host, &port, file);
-	socket = indigo_open_tcp(host, port);
-	if (socket < 0) {
+	/* header is read in blocks, the rest of the block is the beginning of the body */
+	while (body == NULL) {
+		if (length >= sizeof(buffer) - 1) {
+			INDIGO_DEBUG(indigo_debug("%s(): header too long", __FUNCTION__));
+			return false;
+		}
+		long bytes_read = read(socket, buffer + length, sizeof(buffer) - 1 - length);
+		if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* not worth retry with another connection */
+			INDIGO_ERROR(indigo_error("Response for %s timed out", file));
+			*no_response = false;
+			return false;
+		}
+		if (bytes_read <= 0)
+			return false;
+		*no_response = false;
+		length += bytes_read;
+		buffer[length] = 0;
+		body = strstr(buffer, "\r\n\r\n");
+	}
+	*body = 0;
+	body += 4;
+	int http_result = 0, minor_version = 1;
+	if (sscanf(buffer, "HTTP/1.%d %d", &minor_version, &http_result) != 2 || http_result != 200) {
+		INDIGO_DEBUG(indigo_debug("%s(): http_line = \"%.*s\"", __FUNCTION__, (int)strcspn(buffer, "\r\n"), buffer));
 		return false;
 	}
+	long content_len = -1;
+	*keep_alive = minor_version >= 1;
+	for (char *line = strstr(buffer, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (!strncasecmp(line, "Content-Length:", 15))
+			content_len = atol(line + 15);
+		else if (!strncasecmp(line, "Connection:", 11))
+			*keep_alive = strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) != 0;
+	}
+	INDIGO_DEBUG(indigo_debug("%s(): http_result = %d, content_len = %ld", __FUNCTION__, http_result, content_len));
+	if (content_len <= 0) {
+		*keep_alive = false;
+		return false;
+	}
+	long buffered = length - (body - buffer);
+	if (buffered > content_len) {
+		/* pipelined data are not expected */
+		*keep_alive = false;
+		buffered = content_len;
+	}
+	if (blob_item->blob.value == NULL || blob_item->blob.size != content_len) {
+		void *value = realloc(blob_item->blob.value, content_len);
+		if (value == NULL) {
+			*keep_alive = false;
+			return false;
+		}
+		blob_item->blob.value = value;
+	}
+	blob_item->blob.size = content_len;
+	memcpy(blob_item->blob.value, body, buffered);
+	errno = 0;
+	if (buffered < content_len && indigo_read(socket, (char *)blob_item->blob.value + buffered, content_len - buffered) != content_len - buffered) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			INDIGO_ERROR(indigo_error("Download of %s timed out", file));
+		*keep_alive = false;
+		return false;
+	}
+	char *image_type = strrchr(file, '.');
+	if (image_type)
+		strncpy(blob_item->blob.format, image_type, INDIGO_NAME_SIZE);
+	return true;
+}
 
-	snprintf(request, BUFFER_SIZE, "GET /%s HTTP/1.1\r\n\r\n", file);
-	res = indigo_write(socket, request, strlen(request));
-	if (res == false)
-		goto clean_return;
-
-	res = indigo_read_line(socket, http_line, BUFFER_SIZE);
-	if (res < 0)
-		goto clean_return;
-
-	count = sscanf(http_line, "HTTP/1.1 %d %255[^\n]", &http_result, http_response);
-	if ((count != 2) || (http_result != 200)){
-		INDIGO_DEBUG(indigo_debug("%s(): http_line = \"%s\"", __FUNCTION__, http_line));
-		shutdown(socket, SHUT_RDWR);
-		close(socket);
+static bool http_download(indigo_item *blob_item) {
+	char host[BUFFER_SIZE] = {0};
+	int port = 80;
+	char file[BUFFER_SIZE] = {0};
+	if (blob_item->blob.url[0] == '\0') {
+		INDIGO_DEBUG(indigo_debug("%s(): url == \"\"", __FUNCTION__));
 		return false;
 	}
-	INDIGO_DEBUG(indigo_debug("%s(): http_result = %d, response = \"%s\"", __FUNCTION__, http_result, http_response));
+	sscanf(blob_item->blob.url, "http://%255[^:]:%5d/%1023[^\n]", host, &port, file);
+	while (true) {
+		bool reused, keep_alive, no_response;
+		int socket = http_connection_get(host, port, &reused);
+		if (socket < 0)
+			return false;
+		bool result = http_get(socket, host, file, blob_item, &keep_alive, &no_response);
+		http_connection_put(host, port, socket, result && keep_alive);
+		/* idle connection may be closed by the server just before the request, retry with new one */
+		if (result || !reused || !no_response) {
+			INDIGO_DEBUG(indigo_debug("%s() = %d", __FUNCTION__, result));
+			return result;
+		}
+	}
+}
 
-	do {
-		res = indigo_read_line(socket, http_line, BUFFER_SIZE);
-		if (res < 0)
-			goto clean_return;
-		INDIGO_DEBUG(indigo_debug("%s(): http_line = \"%s\"", __FUNCTION__, http_line));
-		count = sscanf(http_line, "Content-Length: %20ld[^\n]", &content_len);
-	} while (http_line[0] != '\0');
+static void *http_download_thread(void *arg) {
+	pthread_mutex_lock(&http_mutex);
+	while (true) {
+		while (http_jobs_head == NULL)
+			pthread_cond_wait(&http_job_signal, &http_mutex);
+		http_job *job = http_jobs_head;
+		http_jobs_head = job->next;
+		if (http_jobs_head == NULL)
+			http_jobs_tail = NULL;
+		if (job->prefetch != NULL) {
+			http_prefetch *prefetch = job->prefetch;
+			indigo_item item = prefetch->item;
+			bool result;
+			do {
+				prefetch->restart = false;
+				pthread_mutex_unlock(&http_mutex);
+				result = http_download(&item);
+				pthread_mutex_lock(&http_mutex);
+			} while (prefetch->restart);
+			prefetch->item = item;
+			prefetch->state = result ? PREFETCH_DONE : PREFETCH_FAILED;
+			pthread_cond_broadcast(&http_prefetch_signal);
+		} else {
+			pthread_mutex_unlock(&http_mutex);
+			bool result = http_download(job->item);
+			job->callback(job->item, result, job->data);
+			pthread_mutex_lock(&http_mutex);
+		}
+		free(job);
+	}
+	return NULL;
+}
 
-	INDIGO_DEBUG(indigo_debug("%s(): content_len = %ld", __FUNCTION__, content_len));
+/* must be called with http_mutex locked */
+static indigo_result http_enqueue(http_job *job) {
+	if (http_thread_count < HTTP_DOWNLOAD_THREADS) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, http_download_thread, NULL) == 0) {
+			pthread_detach(thread);
+			http_thread_count++;
+		} else if (http_thread_count == 0) {
+			free(job);
+			return INDIGO_FAILED;
+		}
+	}
+	job->next = NULL;
+	if (http_jobs_tail != NULL)
+		http_jobs_tail->next = job;
+	else
+		http_jobs_head = job;
+	http_jobs_tail = job;
+	pthread_cond_signal(&http_job_signal);
+	return INDIGO_OK;
+}
 
-	if (content_len) {
-		image_type = strrchr(file, '.');
-		if (image_type) strncpy(blob_item->blob.format, image_type, INDIGO_NAME_SIZE);
-		blob_item->blob.size = content_len;
-		blob_item->blob.value = realloc(blob_item->blob.value, blob_item->blob.size);
-		res = (indigo_read(socket, blob_item->blob.value, blob_item->blob.size) >= 0) ? true : false;
-	} else {
-		res = false;
+bool indigo_populate_http_blob_item(indigo_item *blob_item) {
+	if (blob_item->blob.encoded_value != NULL) {
+		/* BLOB kept encoded by the XML parser is decoded on the first request only */
+		static pthread_mutex_t decode_mutex = PTHREAD_MUTEX_INITIALIZER;
+		pthread_mutex_lock(&decode_mutex);
+		if (blob_item->blob.value == NULL) {
+			void *value = malloc(blob_item->blob.encoded_size / 4 * 3 + 3);
+			assert(value != NULL);
+			base64_decode_fast(value, (unsigned char *)blob_item->blob.encoded_value, blob_item->blob.encoded_size);
+			blob_item->blob.value = value;
+		}
+		pthread_mutex_unlock(&decode_mutex);
+		return true;
 	}
+	pthread_mutex_lock(&http_mutex);
+	for (int i = 0; i < HTTP_PREFETCHES; i++) {
+		http_prefetch *prefetch = http_prefetches + i;
+		if (prefetch->state != PREFETCH_FREE && !strcmp(prefetch->item.blob.url, blob_item->blob.url)) {
+			while (prefetch->state == PREFETCH_PENDING)
+				pthread_cond_wait(&http_prefetch_signal, &http_mutex);
+			bool result = prefetch->state == PREFETCH_DONE;
+			if (result) {
+				if (blob_item->blob.value != NULL)
+					free(blob_item->blob.value);
+				blob_item->blob.value = prefetch->item.blob.value;
+				blob_item->blob.size = prefetch->item.blob.size;
+				strncpy(blob_item->blob.format, prefetch->item.blob.format, INDIGO_NAME_SIZE);
+			} else if (prefetch->item.blob.value != NULL) {
+				free(prefetch->item.blob.value);
+			}
+			prefetch->item.blob.value = NULL;
+			prefetch->state = PREFETCH_FREE;
+			pthread_mutex_unlock(&http_mutex);
+			if (result)
+				return true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&http_mutex);
+	return http_download(blob_item);
+}
 
-	clean_return:
-	INDIGO_DEBUG(indigo_debug("%s() = %d", __FUNCTION__, res));
-	shutdown(socket, SHUT_RDWR);
-	close(socket);
-	return res;
+indigo_result indigo_populate_http_blob_item_async(indigo_item *blob_item, indigo_blob_download_callback callback, void *data) {
+	assert(blob_item != NULL);
+	assert(callback != NULL);
+	http_job *job = malloc(sizeof(http_job));
+	assert(job != NULL);
+	memset(job, 0, sizeof(http_job));
+	job->item = blob_item;
+	job->callback = callback;
+	job->data = data;
+	pthread_mutex_lock(&http_mutex);
+	indigo_result result = http_enqueue(job);
+	pthread_mutex_unlock(&http_mutex);
+	return result;
 }
 
+void indigo_prefetch_http_blob(const char *url) {
+	if (url == NULL || *url == 0)
+		return;
+	pthread_mutex_lock(&http_mutex);
+	http_prefetch *prefetch = NULL;
+	for (int i = 0; i < HTTP_PREFETCHES; i++) {
+		http_prefetch *candidate = http_prefetches + i;
+		if (candidate->state != PREFETCH_FREE && !strcmp(candidate->item.blob.url, url)) {
+			if (candidate->state == PREFETCH_PENDING) {
+				/* URL is reused for the next BLOB, download it again when the current one is done */
+				candidate->restart = true;
+				pthread_mutex_unlock(&http_mutex);
+				return;
+			}
+			prefetch = candidate;
+			break;
+		}
+		/* free slot or the oldest download not claimed so far */
+		if (prefetch != NULL && prefetch->state == PREFETCH_FREE)
+			continue;
+		if (candidate->state == PREFETCH_FREE || (candidate->state != PREFETCH_PENDING && (prefetch == NULL || candidate->sequence < prefetch->sequence)))
+			prefetch = candidate;
+	}
+	if (prefetch == NULL) {
+		pthread_mutex_unlock(&http_mutex);
+		return;
+	}
+	void *value = prefetch->state == PREFETCH_FREE ? NULL : prefetch->item.blob.value;
+	memset(&prefetch->item, 0, sizeof(indigo_item));
+	prefetch->item.blob.value = value;
+	strncpy(prefetch->item.blob.url, url, INDIGO_VALUE_SIZE - 1);
+	prefetch->state = PREFETCH_PENDING;
+	prefetch->restart = false;
+	prefetch->sequence = ++http_prefetch_sequence;
+	http_job *job = malloc(sizeof(http_job));
+	assert(job != NULL);
+	memset(job, 0, sizeof(http_job));
+	job->prefetch = prefetch;
+	if (http_enqueue(job) != INDIGO_OK)
+		prefetch->state = PREFETCH_FAILED;
+	pthread_mutex_unlock(&http_mutex);
+}
 
 bool indigo_property_match(indigo_property *property, indigo_property *other) {
 	assert(property != NULL);
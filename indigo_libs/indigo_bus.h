@@ -128,7 +128,8 @@ typedef enum {
 	INDIGO_ENABLE_BLOB_ALSO,
 	INDIGO_ENABLE_BLOB_NEVER,
 	INDIGO_ENABLE_BLOB_ONLY,
-	INDIGO_ENABLE_BLOB_URL
+	INDIGO_ENABLE_BLOB_URL,
+	INDIGO_ENABLE_BLOB_SHARED
 } indigo_enable_blob;
 
 /** Property item definition.
@@ -169,6 +170,8 @@ typedef struct {
 			char url[INDIGO_VALUE_SIZE];		///< item URL on source server
 			long size;                      ///< item size (for blob properties) in bytes
 			void *value;                    ///< item value (for blob properties)
+			void *encoded_value;            ///< item value in base64 as received from remote server or NULL (for blob properties)
+			long encoded_size;              ///< size of encoded item value (for blob properties)
 		} blob;
 	};
 } indigo_item;
@@ -211,6 +214,7 @@ typedef struct indigo_device {
 	/** callback called when device is detached from the bus
 	 */
 	indigo_result (*detach)(indigo_device *device);
+	struct indigo_executor *executor;   ///< serial executor for timer callbacks and change requests (optional)
 } indigo_device;
 
 /** Client structure definition
@@ -310,6 +314,10 @@ extern indigo_result indigo_define_property(indigo_device *device, indigo_proper
  */
 extern indigo_result indigo_update_property(indigo_device *device, indigo_property *property, const char *format, ...);
 
+/** Sequence number of the last property update broadcast, BLOB value delivered to several clients within one broadcast is copied only once.
+ */
+extern unsigned long indigo_update_sequence;
+
 /** Broadcast property removal.
  */
 extern indigo_result indigo_delete_property(indigo_device *device, indigo_property *property, const char *format, ...);
@@ -359,6 +367,10 @@ extern void indigo_release_property(indigo_property *property);
  */
 extern indigo_result indigo_validate_blob(indigo_item *item);
 
+/** Validate address of item of registered BLOB property and get indigo_update_sequence of its last update (identifies the current BLOB value).
+ */
+extern indigo_result indigo_validate_blob_sequence(indigo_item *item, unsigned long *sequence);
+
 /** Initialize text item.
  */
 extern void indigo_init_text_item(indigo_item *item, const char *name, const char *label, const char *format, ...);
@@ -375,10 +387,26 @@ extern void indigo_init_light_item(indigo_item *item, const char *name, const ch
  */
 extern void indigo_init_blob_item(indigo_item *item, const char *name, const char *label);
 
-/** populate BLOB item if url is given. 
+/** populate BLOB item if url is given (prefetched data or idle keep-alive connection to the server are used if available) or decode it if only base64 encoded value is kept.
  */ 
 extern bool indigo_populate_http_blob_item(indigo_item *blob_item);
 
+/** Callback called on download thread when asynchronous BLOB download is finished.
+ */
+typedef void (*indigo_blob_download_callback)(indigo_item *blob_item, bool success, void *data);
+
+/** populate BLOB item if url is given on download thread, the item must stay valid until callback is called.
+ */
+extern indigo_result indigo_populate_http_blob_item_async(indigo_item *blob_item, indigo_blob_download_callback callback, void *data);
+
+/** Start download of BLOB from url, subsequent indigo_populate_http_blob_item() call with the same url waits for it and uses its data.
+ */
+extern void indigo_prefetch_http_blob(const char *url);
+
+/** Prefetch BLOBs as soon as their url is received by XML protocol parser.
+ */
+extern bool indigo_prefetch_blob_urls;
+
 /** Test, if property matches other property.
  */
 extern bool indigo_property_match(indigo_property *property, indigo_property *other);
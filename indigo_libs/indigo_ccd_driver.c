@@ -23,6 +23,10 @@
  \file indigo_ccd_driver.c
  */
 
+#if defined(INDIGO_LINUX)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -31,13 +35,29 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <jpeglib.h>
 
 #include "indigo_ccd_driver.h"
 #include "indigo_io.h"
 
+static void pipeline_create(indigo_device *device);
+static void pipeline_drain(indigo_device *device);
+static void pipeline_release(indigo_device *device);
+static void local_writer_flush(indigo_device *device);
+static void stack_create(indigo_device *device);
+static void stack_release(indigo_device *device);
+static void stack_reset(indigo_device *device);
+static void calibration_create(indigo_device *device);
+static void calibration_release(indigo_device *device);
+static bool calibration_load(indigo_device *device, char *message);
+static void calibration_select(indigo_device *device);
+
 static void countdown_timer_callback(indigo_device *device) {
 	if (CCD_CONTEXT->countdown_enabled && CCD_EXPOSURE_PROPERTY->state == INDIGO_BUSY_STATE && CCD_EXPOSURE_ITEM->number.value >= 1) {
 		indigo_reschedule_timer(device, 1.0, &CCD_CONTEXT->countdown_timer);
@@ -123,6 +143,13 @@ indigo_result indigo_ccd_attach(indigo_device *device, unsigned version) {
 				return INDIGO_FAILED;
 			indigo_init_number_item(CCD_BIN_HORIZONTAL_ITEM, CCD_BIN_HORIZONTAL_ITEM_NAME, "Horizontal binning", 0, 1, 1, 1);
 			indigo_init_number_item(CCD_BIN_VERTICAL_ITEM, CCD_BIN_VERTICAL_ITEM_NAME, "Vertical binning", 0, 1, 1, 1);
+			// -------------------------------------------------------------------------------- CCD_BIN_MODE
+			CCD_BIN_MODE_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_BIN_MODE_PROPERTY_NAME, CCD_IMAGE_GROUP, "Software binning mode", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 2);
+			if (CCD_BIN_MODE_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			CCD_BIN_MODE_PROPERTY->hidden = true;
+			indigo_init_switch_item(CCD_BIN_MODE_SUM_ITEM, CCD_BIN_MODE_SUM_ITEM_NAME, "Sum", false);
+			indigo_init_switch_item(CCD_BIN_MODE_AVERAGE_ITEM, CCD_BIN_MODE_AVERAGE_ITEM_NAME, "Average", true);
 			// -------------------------------------------------------------------------------- CCD_GAIN
 			CCD_GAIN_PROPERTY = indigo_init_number_property(NULL, device->name, CCD_GAIN_PROPERTY_NAME, CCD_MAIN_GROUP, "Gain", INDIGO_IDLE_STATE, INDIGO_RW_PERM, 1);
 			if (CCD_GAIN_PROPERTY == NULL)
@@ -150,12 +177,13 @@ indigo_result indigo_ccd_attach(indigo_device *device, unsigned version) {
 			indigo_init_switch_item(CCD_FRAME_TYPE_DARK_ITEM, CCD_FRAME_TYPE_DARK_ITEM_NAME, "Dark", false);
 			indigo_init_switch_item(CCD_FRAME_TYPE_FLAT_ITEM, CCD_FRAME_TYPE_FLAT_ITEM_NAME, "Flat", false);
 			// -------------------------------------------------------------------------------- CCD_IMAGE_FORMAT
-			CCD_IMAGE_FORMAT_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_IMAGE_FORMAT_PROPERTY_NAME, CCD_IMAGE_GROUP, "Image format", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 3);
+			CCD_IMAGE_FORMAT_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_IMAGE_FORMAT_PROPERTY_NAME, CCD_IMAGE_GROUP, "Image format", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 4);
 			if (CCD_IMAGE_FORMAT_PROPERTY == NULL)
 				return INDIGO_FAILED;
 			indigo_init_switch_item(CCD_IMAGE_FORMAT_FITS_ITEM, CCD_IMAGE_FORMAT_FITS_ITEM_NAME, "FITS format", true);
 			indigo_init_switch_item(CCD_IMAGE_FORMAT_RAW_ITEM, CCD_IMAGE_FORMAT_RAW_ITEM_NAME, "Raw data", false);
 			indigo_init_switch_item(CCD_IMAGE_FORMAT_JPEG_ITEM, CCD_IMAGE_FORMAT_JPEG_ITEM_NAME, "JPEG format", false);
+			indigo_init_switch_item(CCD_IMAGE_FORMAT_FITS_RICE_ITEM, CCD_IMAGE_FORMAT_FITS_RICE_ITEM_NAME, "FITS format (Rice compressed)", false);
 			// -------------------------------------------------------------------------------- CCD_IMAGE
 			CCD_IMAGE_PROPERTY = indigo_init_blob_property(NULL, device->name, CCD_IMAGE_PROPERTY_NAME, CCD_IMAGE_GROUP, "Image data", INDIGO_IDLE_STATE, 1);
 			if (CCD_IMAGE_PROPERTY == NULL)
@@ -166,6 +194,50 @@ indigo_result indigo_ccd_attach(indigo_device *device, unsigned version) {
 			if (CCD_IMAGE_FILE_PROPERTY == NULL)
 				return INDIGO_FAILED;
 			indigo_init_text_item(CCD_IMAGE_FILE_ITEM, CCD_IMAGE_FILE_ITEM_NAME, "Filename", "None");
+			// -------------------------------------------------------------------------------- CCD_IMAGE_ANALYSIS
+			CCD_IMAGE_ANALYSIS_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_IMAGE_ANALYSIS_PROPERTY_NAME, CCD_IMAGE_GROUP, "Image analysis", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 2);
+			if (CCD_IMAGE_ANALYSIS_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_switch_item(CCD_IMAGE_ANALYSIS_ENABLED_ITEM, CCD_IMAGE_ANALYSIS_ENABLED_ITEM_NAME, "Enabled", false);
+			indigo_init_switch_item(CCD_IMAGE_ANALYSIS_DISABLED_ITEM, CCD_IMAGE_ANALYSIS_DISABLED_ITEM_NAME, "Disabled", true);
+			// -------------------------------------------------------------------------------- CCD_IMAGE_STATS
+			CCD_IMAGE_STATS_PROPERTY = indigo_init_number_property(NULL, device->name, CCD_IMAGE_STATS_PROPERTY_NAME, CCD_IMAGE_GROUP, "Image statistics", INDIGO_IDLE_STATE, INDIGO_RO_PERM, 9);
+			if (CCD_IMAGE_STATS_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_number_item(CCD_IMAGE_STATS_MIN_ITEM, CCD_IMAGE_STATS_MIN_ITEM_NAME, "Minimum", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_MAX_ITEM, CCD_IMAGE_STATS_MAX_ITEM_NAME, "Maximum", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_MEAN_ITEM, CCD_IMAGE_STATS_MEAN_ITEM_NAME, "Mean", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_MEDIAN_ITEM, CCD_IMAGE_STATS_MEDIAN_ITEM_NAME, "Median", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_BACKGROUND_ITEM, CCD_IMAGE_STATS_BACKGROUND_ITEM_NAME, "Background", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_NOISE_ITEM, CCD_IMAGE_STATS_NOISE_ITEM_NAME, "Background noise", 0, 65535, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_STARS_ITEM, CCD_IMAGE_STATS_STARS_ITEM_NAME, "Stars", 0, 100000, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_HFR_ITEM, CCD_IMAGE_STATS_HFR_ITEM_NAME, "HFR (px)", 0, 100, 0, 0);
+			indigo_init_number_item(CCD_IMAGE_STATS_FWHM_ITEM, CCD_IMAGE_STATS_FWHM_ITEM_NAME, "FWHM (px)", 0, 100, 0, 0);
+			// -------------------------------------------------------------------------------- CCD_STACK
+			CCD_STACK_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_STACK_PROPERTY_NAME, CCD_IMAGE_GROUP, "Live stacking", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 3);
+			if (CCD_STACK_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_switch_item(CCD_STACK_DISABLED_ITEM, CCD_STACK_DISABLED_ITEM_NAME, "Disabled", true);
+			indigo_init_switch_item(CCD_STACK_MEAN_ITEM, CCD_STACK_MEAN_ITEM_NAME, "Mean", false);
+			indigo_init_switch_item(CCD_STACK_SIGMA_CLIP_ITEM, CCD_STACK_SIGMA_CLIP_ITEM_NAME, "Sigma clipped mean", false);
+			// -------------------------------------------------------------------------------- CCD_STACK_SETTINGS
+			CCD_STACK_SETTINGS_PROPERTY = indigo_init_number_property(NULL, device->name, CCD_STACK_SETTINGS_PROPERTY_NAME, CCD_IMAGE_GROUP, "Live stacking settings", INDIGO_IDLE_STATE, INDIGO_RW_PERM, 2);
+			if (CCD_STACK_SETTINGS_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_number_item(CCD_STACK_SETTINGS_INTERVAL_ITEM, CCD_STACK_SETTINGS_INTERVAL_ITEM_NAME, "Publish interval (frames)", 1, 1000, 1, 1);
+			indigo_init_number_item(CCD_STACK_SETTINGS_SIGMA_ITEM, CCD_STACK_SETTINGS_SIGMA_ITEM_NAME, "Rejection threshold (sigma)", 1, 10, 0.1, 3);
+			// -------------------------------------------------------------------------------- CCD_STACK_IMAGE
+			CCD_STACK_IMAGE_PROPERTY = indigo_init_blob_property(NULL, device->name, CCD_STACK_IMAGE_PROPERTY_NAME, CCD_IMAGE_GROUP, "Stacked image", INDIGO_IDLE_STATE, 1);
+			if (CCD_STACK_IMAGE_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_blob_item(CCD_STACK_IMAGE_ITEM, CCD_STACK_IMAGE_ITEM_NAME, "Stacked image data");
+			// -------------------------------------------------------------------------------- CCD_CALIBRATION
+			CCD_CALIBRATION_PROPERTY = indigo_init_text_property(NULL, device->name, CCD_CALIBRATION_PROPERTY_NAME, CCD_IMAGE_GROUP, "Calibration masters", INDIGO_IDLE_STATE, INDIGO_RW_PERM, 3);
+			if (CCD_CALIBRATION_PROPERTY == NULL)
+				return INDIGO_FAILED;
+			indigo_init_text_item(CCD_CALIBRATION_DARK_ITEM, CCD_CALIBRATION_DARK_ITEM_NAME, "Master dark", "");
+			indigo_init_text_item(CCD_CALIBRATION_BIAS_ITEM, CCD_CALIBRATION_BIAS_ITEM_NAME, "Master bias", "");
+			indigo_init_text_item(CCD_CALIBRATION_FLAT_ITEM, CCD_CALIBRATION_FLAT_ITEM_NAME, "Master flat", "");
 			// -------------------------------------------------------------------------------- CCD_COOLER
 			CCD_COOLER_PROPERTY = indigo_init_switch_property(NULL, device->name, CCD_COOLER_PROPERTY_NAME, CCD_COOLER_GROUP, "Cooler status", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 2);
 			if (CCD_COOLER_PROPERTY == NULL)
@@ -186,6 +258,15 @@ indigo_result indigo_ccd_attach(indigo_device *device, unsigned version) {
 			CCD_TEMPERATURE_PROPERTY->hidden = true;
 			indigo_init_number_item(CCD_TEMPERATURE_ITEM, CCD_TEMPERATURE_ITEM_NAME, "Temperature (C)", -50, 50, 1, 0);
 			// --------------------------------------------------------------------------------
+			pthread_mutexattr_t attr;
+			pthread_mutexattr_init(&attr);
+			pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+			pthread_mutex_init(&CCD_CONTEXT->image_mutex, &attr);
+			pthread_mutexattr_destroy(&attr);
+			if (indigo_use_image_pipeline && CCD_CONTEXT->pipeline == NULL)
+				pipeline_create(device);
+			stack_create(device);
+			calibration_create(device);
 			return INDIGO_OK;
 		}
 	}
@@ -204,6 +285,18 @@ indigo_result indigo_ccd_enumerate_properties(indigo_device *device, indigo_clie
 				indigo_define_property(device, CCD_LOCAL_MODE_PROPERTY, NULL);
 			if (indigo_property_match(CCD_IMAGE_FILE_PROPERTY, property))
 				indigo_define_property(device, CCD_IMAGE_FILE_PROPERTY, NULL);
+			if (indigo_property_match(CCD_IMAGE_ANALYSIS_PROPERTY, property))
+				indigo_define_property(device, CCD_IMAGE_ANALYSIS_PROPERTY, NULL);
+			if (indigo_property_match(CCD_IMAGE_STATS_PROPERTY, property))
+				indigo_define_property(device, CCD_IMAGE_STATS_PROPERTY, NULL);
+			if (indigo_property_match(CCD_STACK_PROPERTY, property))
+				indigo_define_property(device, CCD_STACK_PROPERTY, NULL);
+			if (indigo_property_match(CCD_STACK_SETTINGS_PROPERTY, property))
+				indigo_define_property(device, CCD_STACK_SETTINGS_PROPERTY, NULL);
+			if (indigo_property_match(CCD_STACK_IMAGE_PROPERTY, property))
+				indigo_define_property(device, CCD_STACK_IMAGE_PROPERTY, NULL);
+			if (indigo_property_match(CCD_CALIBRATION_PROPERTY, property))
+				indigo_define_property(device, CCD_CALIBRATION_PROPERTY, NULL);
 			if (indigo_property_match(CCD_MODE_PROPERTY, property))
 				indigo_define_property(device, CCD_MODE_PROPERTY, NULL);
 			if (indigo_property_match(CCD_EXPOSURE_PROPERTY, property))
@@ -214,6 +307,8 @@ indigo_result indigo_ccd_enumerate_properties(indigo_device *device, indigo_clie
 				indigo_define_property(device, CCD_FRAME_PROPERTY, NULL);
 			if (indigo_property_match(CCD_BIN_PROPERTY, property))
 				indigo_define_property(device, CCD_BIN_PROPERTY, NULL);
+			if (indigo_property_match(CCD_BIN_MODE_PROPERTY, property))
+				indigo_define_property(device, CCD_BIN_MODE_PROPERTY, NULL);
 			if (indigo_property_match(CCD_OFFSET_PROPERTY, property))
 				indigo_define_property(device, CCD_OFFSET_PROPERTY, NULL);
 			if (indigo_property_match(CCD_GAIN_PROPERTY, property))
@@ -245,6 +340,10 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 	assert(property != NULL);
 	if (indigo_property_match(CONNECTION_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CONNECTION
+		/* images queued before disconnect are published before properties are deleted */
+		if (!IS_CONNECTED && CCD_CONTEXT->pipeline)
+			pipeline_drain(device);
+		pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
 		if (IS_CONNECTED) {
 			indigo_define_property(device, CCD_INFO_PROPERTY, NULL);
 			indigo_define_property(device, CCD_UPLOAD_MODE_PROPERTY, NULL);
@@ -254,12 +353,19 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			indigo_define_property(device, CCD_ABORT_EXPOSURE_PROPERTY, NULL);
 			indigo_define_property(device, CCD_FRAME_PROPERTY, NULL);
 			indigo_define_property(device, CCD_BIN_PROPERTY, NULL);
+			indigo_define_property(device, CCD_BIN_MODE_PROPERTY, NULL);
 			indigo_define_property(device, CCD_OFFSET_PROPERTY, NULL);
 			indigo_define_property(device, CCD_GAIN_PROPERTY, NULL);
 			indigo_define_property(device, CCD_GAMMA_PROPERTY, NULL);
 			indigo_define_property(device, CCD_FRAME_TYPE_PROPERTY, NULL);
 			indigo_define_property(device, CCD_IMAGE_FORMAT_PROPERTY, NULL);
 			indigo_define_property(device, CCD_IMAGE_FILE_PROPERTY, NULL);
+			indigo_define_property(device, CCD_IMAGE_ANALYSIS_PROPERTY, NULL);
+			indigo_define_property(device, CCD_IMAGE_STATS_PROPERTY, NULL);
+			indigo_define_property(device, CCD_STACK_PROPERTY, NULL);
+			indigo_define_property(device, CCD_STACK_SETTINGS_PROPERTY, NULL);
+			indigo_define_property(device, CCD_STACK_IMAGE_PROPERTY, NULL);
+			indigo_define_property(device, CCD_CALIBRATION_PROPERTY, NULL);
 			indigo_define_property(device, CCD_IMAGE_PROPERTY, NULL);
 			indigo_define_property(device, CCD_COOLER_PROPERTY, NULL);
 			indigo_define_property(device, CCD_COOLER_POWER_PROPERTY, NULL);
@@ -273,17 +379,25 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			indigo_delete_property(device, CCD_ABORT_EXPOSURE_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_FRAME_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_BIN_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_BIN_MODE_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_OFFSET_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_GAIN_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_GAMMA_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_FRAME_TYPE_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_IMAGE_FORMAT_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_IMAGE_FILE_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_IMAGE_ANALYSIS_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_IMAGE_STATS_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_STACK_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_STACK_SETTINGS_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_STACK_IMAGE_PROPERTY, NULL);
+			indigo_delete_property(device, CCD_CALIBRATION_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_IMAGE_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_COOLER_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_COOLER_POWER_PROPERTY, NULL);
 			indigo_delete_property(device, CCD_TEMPERATURE_PROPERTY, NULL);
 		}
+		pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
 	} else if (indigo_property_match(CONFIG_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CONFIG
 		if (indigo_switch_match(CONFIG_SAVE_ITEM, property)) {
@@ -292,15 +406,21 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			indigo_save_property(device, NULL, CCD_LOCAL_MODE_PROPERTY);
 			indigo_save_property(device, NULL, CCD_FRAME_PROPERTY);
 			indigo_save_property(device, NULL, CCD_BIN_PROPERTY);
+			indigo_save_property(device, NULL, CCD_BIN_MODE_PROPERTY);
 			indigo_save_property(device, NULL, CCD_OFFSET_PROPERTY);
 			indigo_save_property(device, NULL, CCD_GAMMA_PROPERTY);
 			indigo_save_property(device, NULL, CCD_GAIN_PROPERTY);
 			indigo_save_property(device, NULL, CCD_FRAME_TYPE_PROPERTY);
 			indigo_save_property(device, NULL, CCD_IMAGE_FORMAT_PROPERTY);
+			indigo_save_property(device, NULL, CCD_IMAGE_ANALYSIS_PROPERTY);
+			indigo_save_property(device, NULL, CCD_STACK_PROPERTY);
+			indigo_save_property(device, NULL, CCD_STACK_SETTINGS_PROPERTY);
+			indigo_save_property(device, NULL, CCD_CALIBRATION_PROPERTY);
 		}
 	} else if (indigo_property_match(CCD_EXPOSURE_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CCD_EXPOSURE
 		if (CCD_EXPOSURE_PROPERTY->state == INDIGO_BUSY_STATE) {
+			pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
 			if (CCD_UPLOAD_MODE_LOCAL_ITEM->sw.value) {
 				if (CCD_IMAGE_FILE_PROPERTY->state != INDIGO_BUSY_STATE) {
 					CCD_IMAGE_FILE_PROPERTY->state = INDIGO_BUSY_STATE;
@@ -312,6 +432,7 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 					indigo_update_property(device, CCD_IMAGE_PROPERTY, NULL);
 				}
 			}
+			pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
 			if (CCD_EXPOSURE_ITEM->number.value >= 1) {
 				CCD_CONTEXT->countdown_timer = indigo_set_timer(device, 1.0, countdown_timer_callback);
 			}
@@ -323,8 +444,10 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			CCD_EXPOSURE_PROPERTY->state = INDIGO_ALERT_STATE;
 			CCD_EXPOSURE_ITEM->number.value = 0;
 			indigo_update_property(device, CCD_EXPOSURE_PROPERTY, NULL);
+			pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
 			CCD_IMAGE_PROPERTY->state = INDIGO_ALERT_STATE;
 			indigo_update_property(device, CCD_IMAGE_PROPERTY, NULL);
+			pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
 			CCD_ABORT_EXPOSURE_PROPERTY->state = INDIGO_OK_STATE;
 		} else {
 			CCD_ABORT_EXPOSURE_PROPERTY->state = INDIGO_ALERT_STATE;
@@ -369,6 +492,14 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			CCD_BIN_PROPERTY->state = INDIGO_OK_STATE;
 			indigo_update_property(device, CCD_BIN_PROPERTY, NULL);
 		}
+		calibration_select(device);
+		return INDIGO_OK;
+	} else if (indigo_property_match(CCD_BIN_MODE_PROPERTY, property)) {
+		// -------------------------------------------------------------------------------- CCD_BIN_MODE
+		indigo_property_copy_values(CCD_BIN_MODE_PROPERTY, property, false);
+		CCD_BIN_MODE_PROPERTY->state = INDIGO_OK_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_BIN_MODE_PROPERTY, NULL);
 		return INDIGO_OK;
 	} else if (indigo_property_match(CCD_MODE_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CCD_MODE
@@ -390,6 +521,7 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			CCD_MODE_PROPERTY->state = INDIGO_OK_STATE;
 			indigo_update_property(device, CCD_MODE_PROPERTY, NULL);
 		}
+		calibration_select(device);
 		return INDIGO_OK;
 	} else if (indigo_property_match(CCD_OFFSET_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CCD_OFFSET
@@ -406,6 +538,7 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 			CCD_GAIN_PROPERTY->state = INDIGO_OK_STATE;
 			indigo_update_property(device, CCD_GAIN_PROPERTY, NULL);
 		}
+		calibration_select(device);
 		return INDIGO_OK;
 	} else if (indigo_property_match(CCD_GAMMA_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CCD_GAMMA
@@ -429,6 +562,36 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 		if (IS_CONNECTED)
 			indigo_update_property(device, CCD_IMAGE_FORMAT_PROPERTY, NULL);
 		return INDIGO_OK;
+	} else if (indigo_property_match(CCD_IMAGE_ANALYSIS_PROPERTY, property)) {
+		// -------------------------------------------------------------------------------- CCD_IMAGE_ANALYSIS
+		indigo_property_copy_values(CCD_IMAGE_ANALYSIS_PROPERTY, property, false);
+		CCD_IMAGE_ANALYSIS_PROPERTY->state = INDIGO_OK_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_IMAGE_ANALYSIS_PROPERTY, NULL);
+		return INDIGO_OK;
+	} else if (indigo_property_match(CCD_STACK_PROPERTY, property)) {
+		// -------------------------------------------------------------------------------- CCD_STACK
+		indigo_property_copy_values(CCD_STACK_PROPERTY, property, false);
+		stack_reset(device);
+		CCD_STACK_PROPERTY->state = INDIGO_OK_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_STACK_PROPERTY, NULL);
+		return INDIGO_OK;
+	} else if (indigo_property_match(CCD_STACK_SETTINGS_PROPERTY, property)) {
+		// -------------------------------------------------------------------------------- CCD_STACK_SETTINGS
+		indigo_property_copy_values(CCD_STACK_SETTINGS_PROPERTY, property, false);
+		CCD_STACK_SETTINGS_PROPERTY->state = INDIGO_OK_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_STACK_SETTINGS_PROPERTY, NULL);
+		return INDIGO_OK;
+	} else if (indigo_property_match(CCD_CALIBRATION_PROPERTY, property)) {
+		// -------------------------------------------------------------------------------- CCD_CALIBRATION
+		indigo_property_copy_values(CCD_CALIBRATION_PROPERTY, property, false);
+		char message[INDIGO_VALUE_SIZE];
+		CCD_CALIBRATION_PROPERTY->state = calibration_load(device, message) ? INDIGO_OK_STATE : INDIGO_ALERT_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_CALIBRATION_PROPERTY, CCD_CALIBRATION_PROPERTY->state == INDIGO_OK_STATE ? NULL : message);
+		return INDIGO_OK;
 	} else if (indigo_property_match(CCD_UPLOAD_MODE_PROPERTY, property)) {
 		// -------------------------------------------------------------------------------- CCD_IMAGE_UPLOAD_MODE
 		indigo_property_copy_values(CCD_UPLOAD_MODE_PROPERTY, property, false);
@@ -450,6 +613,11 @@ indigo_result indigo_ccd_change_property(indigo_device *device, indigo_client *c
 
 indigo_result indigo_ccd_detach(indigo_device *device) {
 	assert(device != NULL);
+	if (CCD_CONTEXT->pipeline)
+		pipeline_release(device);
+	local_writer_flush(device);
+	stack_release(device);
+	calibration_release(device);
 	indigo_release_property(CCD_INFO_PROPERTY);
 	indigo_release_property(CCD_UPLOAD_MODE_PROPERTY);
 	indigo_release_property(CCD_LOCAL_MODE_PROPERTY);
@@ -458,44 +626,1897 @@ indigo_result indigo_ccd_detach(indigo_device *device) {
 	indigo_release_property(CCD_ABORT_EXPOSURE_PROPERTY);
 	indigo_release_property(CCD_FRAME_PROPERTY);
 	indigo_release_property(CCD_BIN_PROPERTY);
+	indigo_release_property(CCD_BIN_MODE_PROPERTY);
 	indigo_release_property(CCD_GAIN_PROPERTY);
 	indigo_release_property(CCD_GAMMA_PROPERTY);
 	indigo_release_property(CCD_OFFSET_PROPERTY);
 	indigo_release_property(CCD_FRAME_TYPE_PROPERTY);
 	indigo_release_property(CCD_IMAGE_FORMAT_PROPERTY);
 	indigo_release_property(CCD_IMAGE_FILE_PROPERTY);
+	indigo_release_property(CCD_IMAGE_ANALYSIS_PROPERTY);
+	indigo_release_property(CCD_IMAGE_STATS_PROPERTY);
+	indigo_release_property(CCD_STACK_PROPERTY);
+	indigo_release_property(CCD_STACK_SETTINGS_PROPERTY);
+	indigo_release_property(CCD_STACK_IMAGE_PROPERTY);
+	indigo_release_property(CCD_CALIBRATION_PROPERTY);
 	indigo_release_property(CCD_IMAGE_PROPERTY);
 	indigo_release_property(CCD_TEMPERATURE_PROPERTY);
 	indigo_release_property(CCD_COOLER_PROPERTY);
 	indigo_release_property(CCD_COOLER_POWER_PROPERTY);
+	pthread_mutex_destroy(&CCD_CONTEXT->image_mutex);
 	return indigo_device_detach(device);
 }
 
-void indigo_process_image(indigo_device *device, void *data, int frame_width, int frame_height, bool little_endian, indigo_fits_keyword *keywords) {
-	assert(device != NULL);
-	assert(data != NULL);
-	INDIGO_DEBUG(clock_t start = clock());
+/* in-place pixel conversion kernels, loops are kept simple enough to be vectorized by compiler, on x86_64 linux
+   there are also SSSE3 and AVX2 clones selected at load time (baseline SSE2 can't vectorize 3 byte strides) */
 
-	int horizontal_bin = CCD_BIN_HORIZONTAL_ITEM->number.value;
-	int vertical_bin = CCD_BIN_VERTICAL_ITEM->number.value;
+#if defined(INDIGO_LINUX) && defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define VECTORIZED_KERNEL __attribute__((target_clones("avx2", "ssse3", "default")))
+#else
+#define VECTORIZED_KERNEL
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_LITTLE_ENDIAN	true
+#define FITS_SIGN_BIT			0x0080
+#else
+#define HOST_LITTLE_ENDIAN	false
+#define FITS_SIGN_BIT			0x8000
+#endif
+
+VECTORIZED_KERNEL static void swap_16bit(uint16_t *restrict data, long size) {
+	for (long i = 0; i < size; i++) {
+		uint16_t value = data[i];
+		data[i] = (uint16_t)(value << 8 | value >> 8);
+	}
+}
+
+/* 16-bit unsigned to big endian signed with BZERO = 32768, i.e. swap bytes (if needed) and flip sign bit */
+VECTORIZED_KERNEL static void fits_16bit(uint16_t *restrict data, long size, bool little_endian) {
+	if (little_endian == HOST_LITTLE_ENDIAN) {
+		for (long i = 0; i < size; i++) {
+			uint16_t value = data[i];
+			data[i] = (uint16_t)(value << 8 | value >> 8) ^ FITS_SIGN_BIT;
+		}
+	} else {
+		for (long i = 0; i < size; i++)
+			data[i] ^= FITS_SIGN_BIT;
+	}
+}
+
+VECTORIZED_KERNEL static void swap_rgb24(unsigned char *restrict data, long size) {
+	for (long i = 0; i < 3 * size; i += 3) {
+		/* green is stored too, complete groups are easier to vectorize */
+		unsigned char r = data[i], g = data[i + 1], b = data[i + 2];
+		data[i] = b;
+		data[i + 1] = g;
+		data[i + 2] = r;
+	}
+}
+
+/* interleaved RGB (or BGR) to R, G and B planes, rows are split one by one and row sized chunks are then permuted in place */
+VECTORIZED_KERNEL static void planar_rgb24(unsigned char *data, int width, int height, bool bgr) {
+	unsigned char *row = malloc(3 * width);
+	unsigned char *visited = malloc((3 * height + 7) / 8);
+	assert(row != NULL && visited != NULL);
+	/* planes are always stored in R, G, B order */
+	unsigned char *restrict first = bgr ? row + 2 * width : row;
+	unsigned char *restrict second = row + width;
+	unsigned char *restrict third = bgr ? row : row + 2 * width;
+	for (int y = 0; y < height; y++) {
+		unsigned char *restrict pixel = data + 3L * y * width;
+		for (int x = 0; x < width; x++) {
+			first[x] = pixel[3 * x];
+			second[x] = pixel[3 * x + 1];
+			third[x] = pixel[3 * x + 2];
+		}
+		memcpy(pixel, row, 3 * width);
+	}
+	/* chunk (y, c) at index 3 * y + c goes to c * height + y */
+	long count = 3L * height;
+	memset(visited, 0, (count + 7) / 8);
+	for (long start = 0; start < count; start++) {
+		if (visited[start >> 3] & (1 << (start & 7)))
+			continue;
+		memcpy(row, data + start * width, width);
+		long target = start;
+		while (true) {
+			visited[target >> 3] |= 1 << (target & 7);
+			long source = 3 * (target % height) + target / height;
+			if (source == start) {
+				memcpy(data + target * width, row, width);
+				break;
+			}
+			memcpy(data + target * width, data + source * width, width);
+			target = source;
+		}
+	}
+	free(visited);
+	free(row);
+}
+
+/* software binning, pixels (or color components) of bin x bin blocks are summed to 32-bit row accumulator and then stored as sum
+   (clipped) or average, 2x2, 3x3 and 4x4 have separate loops with constant stride to be vectorized */
+
+VECTORIZED_KERNEL static void bin_row_16bit(const uint16_t *restrict source, uint32_t *restrict sum, int width, int bin) {
+	switch (bin) {
+		case 1:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[x];
+			break;
+		case 2:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[2 * x] + source[2 * x + 1];
+			break;
+		case 3:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[3 * x] + source[3 * x + 1] + source[3 * x + 2];
+			break;
+		case 4:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[4 * x] + source[4 * x + 1] + source[4 * x + 2] + source[4 * x + 3];
+			break;
+		default:
+			for (int x = 0; x < width; x++)
+				for (int i = 0; i < bin; i++)
+					sum[x] += source[bin * x + i];
+			break;
+	}
+}
+
+VECTORIZED_KERNEL static void bin_row_8bit(const uint8_t *restrict source, uint32_t *restrict sum, int width, int bin) {
+	switch (bin) {
+		case 1:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[x];
+			break;
+		case 2:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[2 * x] + source[2 * x + 1];
+			break;
+		case 3:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[3 * x] + source[3 * x + 1] + source[3 * x + 2];
+			break;
+		case 4:
+			for (int x = 0; x < width; x++)
+				sum[x] += source[4 * x] + source[4 * x + 1] + source[4 * x + 2] + source[4 * x + 3];
+			break;
+		default:
+			for (int x = 0; x < width; x++)
+				for (int i = 0; i < bin; i++)
+					sum[x] += source[bin * x + i];
+			break;
+	}
+}
+
+/* RGB components are binned separately */
+static void bin_row_rgb24(const uint8_t *restrict source, uint32_t *restrict sum, int width, int bin) {
+	for (int x = 0; x < width; x++)
+		for (int i = 0; i < bin; i++) {
+			sum[3 * x] += source[3 * (bin * x + i)];
+			sum[3 * x + 1] += source[3 * (bin * x + i) + 1];
+			sum[3 * x + 2] += source[3 * (bin * x + i) + 2];
+		}
+}
+
+VECTORIZED_KERNEL static void bin_store_16bit(const uint32_t *restrict sum, uint16_t *restrict target, int width, float scale) {
+	for (int x = 0; x < width; x++) {
+		float value = sum[x] * scale + 0.5f;
+		target[x] = value > 65535 ? 65535 : (uint16_t)value;
+	}
+}
+
+VECTORIZED_KERNEL static void bin_store_8bit(const uint32_t *restrict sum, uint8_t *restrict target, int width, float scale) {
+	for (int x = 0; x < width; x++) {
+		float value = sum[x] * scale + 0.5f;
+		target[x] = value > 255 ? 255 : (uint8_t)value;
+	}
+}
+
+/* rows are processed top down, target row never overlaps source rows not yet read, so binning and cropping can be done in place */
+static void bin_image(void *data, int width, int left, int top, int target_width, int target_height, int components, int bytes_per_pixel, int horizontal_bin, int vertical_bin, bool average) {
+	int row_components = target_width * components;
+	uint32_t *sum = malloc(row_components * sizeof(uint32_t));
+	assert(sum != NULL);
+	float scale = average ? 1.0f / (horizontal_bin * vertical_bin) : 1.0f;
+	for (int y = 0; y < target_height; y++) {
+		memset(sum, 0, row_components * sizeof(uint32_t));
+		for (int i = 0; i < vertical_bin; i++) {
+			long offset = ((long)(top + y * vertical_bin + i) * width + left) * components;
+			if (components == 3)
+				bin_row_rgb24((uint8_t *)data + offset, sum, target_width, horizontal_bin);
+			else if (bytes_per_pixel == 2)
+				bin_row_16bit((uint16_t *)data + offset, sum, target_width, horizontal_bin);
+			else
+				bin_row_8bit((uint8_t *)data + offset, sum, target_width, horizontal_bin);
+		}
+		if (bytes_per_pixel == 2)
+			bin_store_16bit(sum, (uint16_t *)data + (long)y * row_components, row_components, scale);
+		else
+			bin_store_8bit(sum, (uint8_t *)data + (long)y * row_components, row_components, scale);
+	}
+	free(sum);
+}
+
+/* chunks of image processed in parallel are passed to persistent pool of workers, caller processes chunks as well, so the work is done
+   even if all workers are busy (e.g. by other devices) or can't be started */
+
+#define PARALLEL_MAX_WORKERS	7
+
+typedef struct parallel_job {
+	void *(*process)(void *);
+	char *chunks;
+	size_t chunk_size;
+	int count;
+	int next;
+	int pending;
+	struct parallel_job *next_job;
+} parallel_job;
+
+static pthread_mutex_t parallel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t parallel_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t parallel_done_cond = PTHREAD_COND_INITIALIZER;
+static parallel_job *parallel_jobs = NULL;
+static int parallel_worker_count = 0;
+
+/* processes one chunk of the first job with chunks left, parallel_mutex is locked */
+static bool parallel_process_chunk() {
+	parallel_job *job = parallel_jobs;
+	if (job == NULL)
+		return false;
+	int index = job->next++;
+	if (job->next == job->count)
+		parallel_jobs = job->next_job;
+	pthread_mutex_unlock(&parallel_mutex);
+	job->process(job->chunks + index * job->chunk_size);
+	pthread_mutex_lock(&parallel_mutex);
+	if (--job->pending == 0)
+		pthread_cond_broadcast(&parallel_done_cond);
+	return true;
+}
+
+static void *parallel_worker(void *arg) {
+	pthread_mutex_lock(&parallel_mutex);
+	while (true) {
+		if (!parallel_process_chunk())
+			pthread_cond_wait(&parallel_work_cond, &parallel_mutex);
+	}
+	return NULL;
+}
+
+/* calls process() for each of count chunks (array of chunk_size items) and waits until all of them are done */
+static void parallel_for(void *chunks, int count, size_t chunk_size, void *(*process)(void *)) {
+	if (count <= 1) {
+		if (count == 1)
+			process(chunks);
+		return;
+	}
+	parallel_job job = { process, chunks, chunk_size, count, 0, count, NULL };
+	pthread_mutex_lock(&parallel_mutex);
+	while (parallel_worker_count < count - 1 && parallel_worker_count < PARALLEL_MAX_WORKERS) {
+		pthread_t thread;
+		int result = pthread_create(&thread, NULL, parallel_worker, NULL);
+		if (result != 0) {
+			INDIGO_ERROR(indigo_error("Can't create image processing worker (%s)", strerror(result)));
+			break;
+		}
+		pthread_detach(thread);
+		parallel_worker_count++;
+	}
+	parallel_job **tail = &parallel_jobs;
+	while (*tail != NULL)
+		tail = &(*tail)->next_job;
+	*tail = &job;
+	pthread_cond_broadcast(&parallel_work_cond);
+	while (job.next < job.count) {
+		/* chunks of earlier jobs can be taken as well, it doesn't matter */
+		parallel_process_chunk();
+	}
+	while (job.pending > 0)
+		pthread_cond_wait(&parallel_done_cond, &parallel_mutex);
+	pthread_mutex_unlock(&parallel_mutex);
+}
+
+/* Bayer mosaic of color sensors is interpolated bilinearly for previews, pattern is encoded as 1 + x + 2y, where x, y is position of red
+   pixel in 2x2 cell (0 for no pattern). Rows are split to bands processed in parallel, row kernel handles interior pixels in pairs of
+   color (red or blue) and green pixel, borders are interpolated with mirrored neighbours */
+
+#define DEBAYER_MAX_CHUNKS				8
+#define DEBAYER_MIN_CHUNK_PIXELS	(1024 * 1024)
+
+static int bayer_pattern(const char *name) {
+	if (!strncmp(name, "RGGB", 4))
+		return 1;
+	if (!strncmp(name, "GRBG", 4))
+		return 2;
+	if (!strncmp(name, "GBRG", 4))
+		return 3;
+	if (!strncmp(name, "BGGR", 4))
+		return 4;
+	return 0;
+}
+
+#define DEBAYER_KERNELS(type, suffix) \
+static void debayer_pixel_##suffix(const type *up, const type *row, const type *down, type *out, int width, int x, int red_x, bool red_row) { \
+	int left = x > 0 ? x - 1 : x + 1, right = x < width - 1 ? x + 1 : x - 1; \
+	int c = red_row ? 0 : 2, o = 2 - c; \
+	type *rgb = out + 3 * x; \
+	if ((x & 1) == (red_row ? red_x : 1 - red_x)) { \
+		rgb[c] = row[x]; \
+		rgb[1] = (up[x] + down[x] + row[left] + row[right] + 2) / 4; \
+		rgb[o] = (up[left] + up[right] + down[left] + down[right] + 2) / 4; \
+	} else { \
+		rgb[1] = row[x]; \
+		rgb[c] = (row[left] + row[right] + 1) / 2; \
+		rgb[o] = (up[x] + down[x] + 1) / 2; \
+	} \
+} \
+\
+VECTORIZED_KERNEL static void debayer_row_##suffix(const type *restrict up, const type *restrict row, const type *restrict down, type *restrict out, int width, int red_x, bool red_row) { \
+	int c = red_row ? 0 : 2, o = 2 - c; \
+	int first = red_row ? red_x : 1 - red_x; \
+	if (first == 0) \
+		first = 2; \
+	int pairs = (width - 1 - first) / 2; \
+	for (int x = 0; x < first; x++) \
+		debayer_pixel_##suffix(up, row, down, out, width, x, red_x, red_row); \
+	const type *restrict u = up + first, *restrict r = row + first, *restrict d = down + first; \
+	type *restrict rgb = out + 3 * first; \
+	for (int i = 0; i < pairs; i++, u += 2, r += 2, d += 2, rgb += 6) { \
+		rgb[c] = r[0]; \
+		rgb[1] = (u[0] + d[0] + r[-1] + r[1] + 2) / 4; \
+		rgb[o] = (u[-1] + u[1] + d[-1] + d[1] + 2) / 4; \
+		rgb[3 + c] = (r[0] + r[2] + 1) / 2; \
+		rgb[4] = r[1]; \
+		rgb[3 + o] = (u[1] + d[1] + 1) / 2; \
+	} \
+	for (int x = first + 2 * pairs; x < width; x++) \
+		debayer_pixel_##suffix(up, row, down, out, width, x, red_x, red_row); \
+}
+
+DEBAYER_KERNELS(uint16_t, 16bit)
+DEBAYER_KERNELS(uint8_t, 8bit)
+
+typedef struct {
+	void *data;
+	void *rgb;
+	int width;
+	int height;
+	int first_row;
+	int rows;
+	int bytes_per_pixel;
+	int pattern;
+} debayer_chunk;
+
+static void *debayer_chunk_process(debayer_chunk *chunk) {
+	int width = chunk->width, height = chunk->height;
+	int red_x = (chunk->pattern - 1) & 1, red_y = ((chunk->pattern - 1) >> 1) & 1;
+	for (int y = chunk->first_row; y < chunk->first_row + chunk->rows; y++) {
+		long up = y > 0 ? y - 1 : y + 1, down = y < height - 1 ? y + 1 : y - 1;
+		bool red_row = (y & 1) == red_y;
+		if (chunk->bytes_per_pixel == 2) {
+			uint16_t *data = chunk->data;
+			debayer_row_16bit(data + up * width, data + (long)y * width, data + down * width, (uint16_t *)chunk->rgb + 3L * y * width, width, red_x, red_row);
+		} else {
+			uint8_t *data = chunk->data;
+			debayer_row_8bit(data + up * width, data + (long)y * width, data + down * width, (uint8_t *)chunk->rgb + 3L * y * width, width, red_x, red_row);
+		}
+	}
+	return NULL;
+}
+
+/* returns interleaved RGB image with the same bytes per component as input (host byte order) */
+static void *debayer(void *data, int width, int height, int bytes_per_pixel, int pattern) {
+	if (pattern < 1 || pattern > 4 || width < 2 || height < 2)
+		return NULL;
+	void *rgb = malloc(3L * width * height * bytes_per_pixel);
+	if (rgb == NULL)
+		return NULL;
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > DEBAYER_MAX_CHUNKS)
+		count = DEBAYER_MAX_CHUNKS;
+	if (count > (long)width * height / DEBAYER_MIN_CHUNK_PIXELS)
+		count = (int)((long)width * height / DEBAYER_MIN_CHUNK_PIXELS);
+	if (count < 1)
+		count = 1;
+	debayer_chunk chunks[DEBAYER_MAX_CHUNKS];
+	int rows = (height + count - 1) / count;
+	for (int i = 0; i < count; i++) {
+		debayer_chunk *chunk = chunks + i;
+		chunk->data = data;
+		chunk->rgb = rgb;
+		chunk->width = width;
+		chunk->height = height;
+		chunk->first_row = i * rows;
+		chunk->rows = chunk->first_row + rows > height ? height - chunk->first_row : rows;
+		chunk->bytes_per_pixel = bytes_per_pixel;
+		chunk->pattern = pattern;
+	}
+	parallel_for(chunks, count, sizeof(debayer_chunk), (void *(*)(void *))debayer_chunk_process);
+	return rgb;
+}
+
+/* JPEG preview is encoded in horizontal strips in parallel, each strip is complete JPEG with the same tables and
+   restart interval equal to strip size, so strips can be joined to single image with RST markers in between */
+
+#define JPEG_MAX_STRIPS			8
+#define JPEG_MIN_STRIP_PIXELS	(1024 * 1024)
+#define JPEG_STRIP_ALIGNMENT	16
+
+/* 16-bit previews are stretched, black and white points are percentiles and median is mapped to background level by midtone transfer function */
+#define STRETCH_BLACK_PERCENTILE	0.001
+#define STRETCH_WHITE_PERCENTILE	0.9999
+#define STRETCH_BACKGROUND				0.25
+
+typedef struct {
+	unsigned char *data;
+	int width;
+	int first_row;
+	int rows;
+	int components;
+	int bytes_per_pixel;
+	bool bgr;
+	unsigned char *lut;
+	unsigned restart_interval;
+	unsigned *histogram;
+	unsigned char *mem;
+	unsigned long mem_size;
+} jpeg_strip;
+
+static void *jpeg_strip_histogram(jpeg_strip *strip) {
+	uint16_t *restrict b16 = (uint16_t *)strip->data + (long)strip->first_row * strip->width * strip->components;
+	long size = (long)strip->rows * strip->width * strip->components;
+	unsigned *restrict histogram = strip->histogram;
+	for (long i = 0; i < size; i++)
+		histogram[b16[i]]++;
+	return NULL;
+}
+
+static void stretch_lut(unsigned *histogram, long size, unsigned char *lut) {
+	long black_count = (long)(size * STRETCH_BLACK_PERCENTILE), median_count = size / 2, white_count = (long)(size * STRETCH_WHITE_PERCENTILE);
+	int black = -1, median = -1, white = 65535;
+	long count = 0;
+	for (int i = 0; i < 65536; i++) {
+		count += histogram[i];
+		if (black < 0 && count > black_count)
+			black = i;
+		if (median < 0 && count > median_count)
+			median = i;
+		if (count > white_count) {
+			white = i;
+			break;
+		}
+	}
+	if (white <= black)
+		white = black + 1;
+	/* midtone balance m maps median to STRETCH_BACKGROUND, MTF(m, x) = (m - 1) x / ((2m - 1) x - m) */
+	double x = (median - black) / (double)(white - black);
+	double m = x > 0 ? x * (STRETCH_BACKGROUND - 1) / ((2 * STRETCH_BACKGROUND - 1) * x - STRETCH_BACKGROUND) : 0.5;
+	if (m <= 0 || m >= 1)
+		m = 0.5;
+	INDIGO_DEBUG(indigo_debug("JPEG stretch black = %d, median = %d, white = %d, midtones = %g", black, median, white, m));
+	for (int i = 0; i < 65536; i++) {
+		if (i <= black) {
+			lut[i] = 0;
+		} else if (i >= white) {
+			lut[i] = 255;
+		} else {
+			x = (i - black) / (double)(white - black);
+			lut[i] = (unsigned char)(255 * (m - 1) * x / ((2 * m - 1) * x - m) + 0.5);
+		}
+	}
+}
+
+static void *jpeg_strip_encode(jpeg_strip *strip) {
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &strip->mem, &strip->mem_size);
+	cinfo.image_width = strip->width;
+	cinfo.image_height = strip->rows;
+	cinfo.input_components = strip->components;
+	cinfo.in_color_space = strip->components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	cinfo.restart_interval = strip->restart_interval;
+	jpeg_start_compress(&cinfo, TRUE);
+	long row_size = (long)strip->width * strip->components;
+	unsigned char *row = NULL;
+	if (strip->bytes_per_pixel == 2 || strip->bgr) {
+		row = malloc(row_size);
+		assert(row != NULL);
+	}
+	while (cinfo.next_scanline < cinfo.image_height) {
+		long y = strip->first_row + cinfo.next_scanline;
+		JSAMPROW row_pointer[1];
+		if (strip->bytes_per_pixel == 2) {
+			/* 16 to 8 bit stretch is done on the fly */
+			uint16_t *restrict b16 = (uint16_t *)strip->data + y * row_size;
+			unsigned char *restrict b8 = row;
+			unsigned char *restrict lut = strip->lut;
+			for (long i = 0; i < row_size; i++)
+				b8[i] = lut[b16[i]];
+			row_pointer[0] = row;
+		} else if (strip->bgr) {
+			unsigned char *restrict bgr = strip->data + y * row_size;
+			unsigned char *restrict rgb = row;
+			for (long i = 0; i < row_size; i += 3) {
+				rgb[i] = bgr[i + 2];
+				rgb[i + 1] = bgr[i + 1];
+				rgb[i + 2] = bgr[i];
+			}
+			row_pointer[0] = row;
+		} else {
+			row_pointer[0] = strip->data + y * row_size;
+		}
+		jpeg_write_scanlines(&cinfo, row_pointer, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	if (row)
+		free(row);
+	return NULL;
+}
+
+/* returns offset of entropy coded data, patches image height in SOF */
+static long jpeg_strip_header(unsigned char *mem, unsigned long mem_size, int height) {
+	long pos = 2;
+	while (pos + 4 <= mem_size && mem[pos] == 0xFF) {
+		unsigned char marker = mem[pos + 1];
+		long length = mem[pos + 2] << 8 | mem[pos + 3];
+		if (marker >= 0xC0 && marker <= 0xC2) {
+			mem[pos + 5] = height >> 8;
+			mem[pos + 6] = height & 0xFF;
+		} else if (marker == 0xDA) {
+			return pos + 2 + length;
+		}
+		pos += 2 + length;
+	}
+	return -1;
+}
+
+static unsigned char *jpeg_encode(unsigned char *data, int width, int height, int components, int bytes_per_pixel, bool bgr, unsigned long *size) {
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > JPEG_MAX_STRIPS)
+		count = JPEG_MAX_STRIPS;
+	if (count > (long)width * height / JPEG_MIN_STRIP_PIXELS)
+		count = (int)((long)width * height / JPEG_MIN_STRIP_PIXELS);
+	int strip_height = (height / (count > 1 ? count : 1) + JPEG_STRIP_ALIGNMENT - 1) / JPEG_STRIP_ALIGNMENT * JPEG_STRIP_ALIGNMENT;
+	count = strip_height > 0 && height > strip_height ? (height + strip_height - 1) / strip_height : 1;
+	jpeg_strip strips[JPEG_MAX_STRIPS];
+	for (int i = 0; i < count; i++) {
+		jpeg_strip *strip = strips + i;
+		memset(strip, 0, sizeof(jpeg_strip));
+		strip->data = data;
+		strip->width = width;
+		strip->first_row = i * strip_height;
+		strip->rows = count == 1 ? height : (i == count - 1 ? height - strip->first_row : strip_height);
+		strip->components = components;
+		strip->bytes_per_pixel = bytes_per_pixel;
+		strip->bgr = bgr;
+		/* MCU is 8x8 for grayscale and 16x16 for default 2x2 chroma subsampling, interval is 16-bit value */
+		int mcu = components == 1 ? 8 : 16;
+		unsigned restart_interval = (width + mcu - 1) / mcu * (strip_height / mcu);
+		if (restart_interval > 0xFFFF)
+			restart_interval = (width + mcu - 1) / mcu;
+		strip->restart_interval = count == 1 ? 0 : restart_interval;
+	}
+	unsigned char *lut = NULL;
+	if (bytes_per_pixel == 2) {
+		unsigned *histograms = calloc((size_t)count * 65536, sizeof(unsigned));
+		assert(histograms != NULL);
+		lut = malloc(65536);
+		assert(lut != NULL);
+		for (int i = 0; i < count; i++) {
+			strips[i].histogram = histograms + i * 65536;
+			strips[i].lut = lut;
+		}
+		parallel_for(strips, count, sizeof(jpeg_strip), (void *(*)(void *))jpeg_strip_histogram);
+		for (int i = 1; i < count; i++) {
+			for (int j = 0; j < 65536; j++)
+				histograms[j] += strips[i].histogram[j];
+		}
+		stretch_lut(histograms, (long)width * height * components, lut);
+		free(histograms);
+	}
+	parallel_for(strips, count, sizeof(jpeg_strip), (void *(*)(void *))jpeg_strip_encode);
+	if (lut)
+		free(lut);
+	if (count == 1) {
+		*size = strips[0].mem_size;
+		return strips[0].mem;
+	}
+	unsigned long total = 0;
+	for (int i = 0; i < count; i++)
+		total += strips[i].mem_size + 2;
+	unsigned char *mem = malloc(total);
+	assert(mem != NULL);
+	unsigned long mem_size = 0;
+	int restart = 0;
+	for (int i = 0; i < count; i++) {
+		jpeg_strip *strip = strips + i;
+		long offset = jpeg_strip_header(strip->mem, strip->mem_size, height);
+		assert(offset > 0);
+		if (i == 0) {
+			memcpy(mem, strip->mem, offset);
+			mem_size = offset;
+		} else {
+			mem[mem_size++] = 0xFF;
+			mem[mem_size++] = 0xD0 + restart++ % 8;
+		}
+		/* entropy coded data without EOI, RST markers inside of strip are renumbered */
+		unsigned char *entropy = mem + mem_size;
+		long length = strip->mem_size - offset - 2;
+		memcpy(entropy, strip->mem + offset, length);
+		for (unsigned char *marker = memchr(entropy, 0xFF, length); marker != NULL && marker + 1 < entropy + length; marker = memchr(marker + 2, 0xFF, entropy + length - marker - 2)) {
+			if ((marker[1] & 0xF8) == 0xD0)
+				marker[1] = 0xD0 + restart++ % 8;
+		}
+		mem_size += length;
+		free(strip->mem);
+	}
+	mem[mem_size++] = 0xFF;
+	mem[mem_size++] = 0xD9;
+	*size = mem_size;
+	return mem;
+}
+
+/* Rice compressed FITS follows tiled image convention used by fpack, every image row (or row of one color plane) is a separate tile,
+   bit stream is the same as produced by fits_rcomp() and fits_rcomp_short() in cfitsio, tiles are compressed in parallel by row groups */
+
+#define RICE_BLOCK_SIZE				32
+#define RICE_MAX_CHUNKS				8
+#define RICE_MIN_CHUNK_PIXELS	(1024 * 1024)
+
+typedef struct {
+	unsigned char *out;
+	uint64_t buffer;
+	int bits;
+} rice_bits;
+
+typedef struct {
+	unsigned char *data;
+	int width;
+	int first_row;
+	int rows;
+	int bytepix;
+	unsigned char *mem;
+	unsigned *tile_sizes;
+	unsigned long mem_size;
+} rice_chunk;
+
+static inline void rice_put(rice_bits *bits, unsigned value, int count) {
+	bits->buffer = (bits->buffer << count) | (value & (unsigned)((1ULL << count) - 1));
+	bits->bits += count;
+	while (bits->bits >= 8) {
+		bits->bits -= 8;
+		*bits->out++ = (unsigned char)(bits->buffer >> bits->bits);
+	}
+}
+
+static unsigned long rice_tile_max(int width, int bytepix) {
+	return (unsigned long)width * bytepix + (width / RICE_BLOCK_SIZE + 1) + 8;
+}
+
+/* 16-bit values are in host byte order and they are compressed as signed FITS values (with BZERO 32768), 8-bit values are compressed as they are */
+static unsigned rice_compress_tile(unsigned char *data, int width, int bytepix, unsigned char *out) {
+	int fsbits = bytepix == 2 ? 4 : 3;
+	int fsmax = bytepix == 2 ? 14 : 6;
+	int bbits = 8 * bytepix;
+	unsigned mask = (1U << bbits) - 1, sign = 1U << (bbits - 1);
+	unsigned diff[RICE_BLOCK_SIZE];
+	rice_bits bits = { out, 0, 0 };
+	unsigned last = bytepix == 2 ? ((uint16_t *)data)[0] ^ 0x8000 : data[0];
+	rice_put(&bits, last, bbits);
+	for (int i = 0; i < width; i += RICE_BLOCK_SIZE) {
+		int block = width - i < RICE_BLOCK_SIZE ? width - i : RICE_BLOCK_SIZE;
+		double sum = 0;
+		for (int j = 0; j < block; j++) {
+			unsigned next = bytepix == 2 ? ((uint16_t *)data)[i + j] ^ 0x8000 : data[i + j];
+			unsigned delta = (next - last) & mask;
+			diff[j] = delta & sign ? ((~delta << 1) | 1) & mask : delta << 1;
+			sum += diff[j];
+			last = next;
+		}
+		double dpsum = (sum - (block / 2) - 1) / block;
+		if (dpsum < 0)
+			dpsum = 0;
+		unsigned psum = ((unsigned)dpsum & mask) >> 1;
+		int fs;
+		for (fs = 0; psum > 0; fs++)
+			psum >>= 1;
+		if (fs >= fsmax) {
+			rice_put(&bits, fsmax + 1, fsbits);
+			for (int j = 0; j < block; j++)
+				rice_put(&bits, diff[j], bbits);
+		} else if (fs == 0 && sum == 0) {
+			rice_put(&bits, 0, fsbits);
+		} else {
+			rice_put(&bits, fs + 1, fsbits);
+			for (int j = 0; j < block; j++) {
+				unsigned top = diff[j] >> fs;
+				for (; top >= 32; top -= 32)
+					rice_put(&bits, 0, 32);
+				rice_put(&bits, 1, top + 1);
+				if (fs > 0)
+					rice_put(&bits, diff[j], fs);
+			}
+		}
+	}
+	if (bits.bits > 0)
+		*bits.out++ = (unsigned char)(bits.buffer << (8 - bits.bits));
+	return (unsigned)(bits.out - out);
+}
+
+static void *rice_chunk_compress(rice_chunk *chunk) {
+	unsigned long row_size = (unsigned long)chunk->width * chunk->bytepix;
+	unsigned char *out = chunk->mem = malloc(rice_tile_max(chunk->width, chunk->bytepix) * chunk->rows);
+	assert(out != NULL);
+	for (int i = 0; i < chunk->rows; i++) {
+		unsigned size = rice_compress_tile(chunk->data + (chunk->first_row + i) * row_size, chunk->width, chunk->bytepix, out);
+		chunk->tile_sizes[chunk->first_row + i] = size;
+		out += size;
+	}
+	chunk->mem_size = out - chunk->mem;
+	return NULL;
+}
+
+static void rice_card(char **header, const char *format, ...) {
+	char card[81];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(card, sizeof(card), format, args);
+	va_end(args);
+	memset(*header, ' ', 80);
+	memcpy(*header, card, length < 80 ? length : 80);
+	*header += 80;
+}
+
+static inline void rice_put_int(unsigned char *out, unsigned value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+/* data are planes of width x height pixels in host byte order, image_header is FITS header of uncompressed image, its keywords are moved to compressed HDU */
+static unsigned char *rice_encode(unsigned char *data, int width, int height, int planes, int bytepix, const char *image_header, unsigned long *size) {
+	int rows = height * planes;
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > RICE_MAX_CHUNKS)
+		count = RICE_MAX_CHUNKS;
+	if (count > (long)width * rows / RICE_MIN_CHUNK_PIXELS)
+		count = (int)((long)width * rows / RICE_MIN_CHUNK_PIXELS);
+	if (count < 1)
+		count = 1;
+	rice_chunk chunks[RICE_MAX_CHUNKS];
+	unsigned *tile_sizes = malloc(rows * sizeof(unsigned));
+	assert(tile_sizes != NULL);
+	int chunk_rows = (rows + count - 1) / count;
+	for (int i = 0; i < count; i++) {
+		rice_chunk *chunk = chunks + i;
+		chunk->data = data;
+		chunk->width = width;
+		chunk->first_row = i * chunk_rows;
+		chunk->rows = i == count - 1 ? rows - chunk->first_row : chunk_rows;
+		chunk->bytepix = bytepix;
+		chunk->tile_sizes = tile_sizes;
+	}
+	parallel_for(chunks, count, sizeof(rice_chunk), (void *(*)(void *))rice_chunk_compress);
+	unsigned long heap_size = 0;
+	unsigned max_tile = 0;
+	for (int i = 0; i < count; i++)
+		heap_size += chunks[i].mem_size;
+	for (int i = 0; i < rows; i++)
+		if (max_tile < tile_sizes[i])
+			max_tile = tile_sizes[i];
+	/* primary HDU is empty, compressed image is in binary table extension, its header takes at most 3 blocks */
+	unsigned long table_size = 8UL * rows;
+	unsigned long data_size = (table_size + heap_size + 2879) / 2880 * 2880;
+	unsigned char *mem = malloc(4 * 2880 + data_size);
+	assert(mem != NULL);
+	char *header = (char *)mem;
+	rice_card(&header, "SIMPLE  =                    T / file conforms to FITS standard");
+	rice_card(&header, "BITPIX  =                    8 / number of bits per data pixel");
+	rice_card(&header, "NAXIS   =                    0 / number of data axes");
+	rice_card(&header, "EXTEND  =                    T / FITS dataset may contain extensions");
+	rice_card(&header, "END");
+	memset(header, ' ', (char *)mem + 2880 - header);
+	header = (char *)mem + 2880;
+	rice_card(&header, "XTENSION= 'BINTABLE'           / binary table extension");
+	rice_card(&header, "BITPIX  =                    8 / 8-bit bytes");
+	rice_card(&header, "NAXIS   =                    2 / 2-dimensional binary table");
+	rice_card(&header, "NAXIS1  =                    8 / width of table in bytes");
+	rice_card(&header, "NAXIS2  = %20d / number of rows in table", rows);
+	rice_card(&header, "PCOUNT  = %20lu / size of special data area", heap_size);
+	rice_card(&header, "GCOUNT  =                    1 / one data group (required keyword)");
+	rice_card(&header, "TFIELDS =                    1 / number of fields in each row");
+	rice_card(&header, "TTYPE1  = 'COMPRESSED_DATA'    / label for field   1");
+	rice_card(&header, "TFORM1  = '1PB(%u)'%*c / data format of field: variable length array", max_tile, (int)(13 - snprintf(NULL, 0, "%u", max_tile)), ' ');
+	rice_card(&header, "ZIMAGE  =                    T / extension contains compressed image");
+	rice_card(&header, "ZSIMPLE =                    T / file does conform to FITS standard");
+	rice_card(&header, "ZBITPIX = %20d / data type of original image", 8 * bytepix);
+	rice_card(&header, "ZNAXIS  = %20d / dimension of original image", planes > 1 ? 3 : 2);
+	rice_card(&header, "ZNAXIS1 = %20d / length of original image axis", width);
+	rice_card(&header, "ZNAXIS2 = %20d / length of original image axis", height);
+	if (planes > 1)
+		rice_card(&header, "ZNAXIS3 = %20d / length of original image axis", planes);
+	rice_card(&header, "ZTILE1  = %20d / size of tiles to be compressed", width);
+	rice_card(&header, "ZTILE2  =                    1 / size of tiles to be compressed");
+	if (planes > 1)
+		rice_card(&header, "ZTILE3  =                    1 / size of tiles to be compressed");
+	rice_card(&header, "ZCMPTYPE= 'RICE_1'             / compression algorithm");
+	rice_card(&header, "ZNAME1  = 'BLOCKSIZE'          / compression block size");
+	rice_card(&header, "ZVAL1   = %20d / pixels per block", RICE_BLOCK_SIZE);
+	rice_card(&header, "ZNAME2  = 'BYTEPIX'            / bytes per pixel (1, 2, 4, or 8)");
+	rice_card(&header, "ZVAL2   = %20d / bytes per pixel (1, 2, 4, or 8)", bytepix);
+	for (const char *card = image_header; card < image_header + FITS_HEADER_SIZE; card += 80) {
+		if (!strncmp(card, "END ", 4))
+			break;
+		if (!strncmp(card, "SIMPLE ", 7) || !strncmp(card, "BITPIX ", 7) || !strncmp(card, "NAXIS", 5) || !strncmp(card, "EXTEND ", 7))
+			continue;
+		memcpy(header, card, 80);
+		header += 80;
+	}
+	rice_card(&header, "END");
+	unsigned long header_size = (header - (char *)mem + 2879) / 2880 * 2880;
+	memset(header, ' ', (char *)mem + header_size - header);
+	unsigned char *table = mem + header_size;
+	unsigned offset = 0;
+	for (int i = 0; i < rows; i++) {
+		rice_put_int(table + 8 * i, tile_sizes[i]);
+		rice_put_int(table + 8 * i + 4, offset);
+		offset += tile_sizes[i];
+	}
+	unsigned char *heap = table + table_size;
+	for (int i = 0; i < count; i++) {
+		memcpy(heap, chunks[i].mem, chunks[i].mem_size);
+		heap += chunks[i].mem_size;
+		free(chunks[i].mem);
+	}
+	memset(heap, 0, table + data_size - heap);
+	free(tile_sizes);
+	*size = header_size + data_size;
+	return mem;
+}
+
+/* image analysis works on 16-bit luminance (RGB channels are summed), statistics are taken from histogram, background is median and noise
+   is MAD based sigma, stars are local maxima above background + 5 sigma with at least two neighbours above threshold (to reject hot pixels),
+   HFR and FWHM (from area above half maximum) are medians over measured stars, both histogram and star detection run in parallel row chunks */
+
+#define ANALYSIS_MAX_CHUNKS				8
+#define ANALYSIS_MIN_CHUNK_PIXELS	(1024 * 1024)
+#define ANALYSIS_STAR_RADIUS			8
+#define ANALYSIS_MAX_STARS				1024
+#define ANALYSIS_THRESHOLD				5
+
+typedef struct {
+	double min, max, mean, median, background, noise, hfr, fwhm;
+	int stars;
+} image_stats;
+
+typedef struct {
+	double x, y, flux;
+} image_star;
+
+typedef struct {
+	uint16_t *pixels;
+	int width;
+	int height;
+	int first_row;
+	int rows;
+	unsigned *histogram;
+	int background;
+	int threshold;
+	int stars;
+	int measured;
+	double hfr[ANALYSIS_MAX_STARS];
+	double fwhm[ANALYSIS_MAX_STARS];
+	image_star star[ANALYSIS_MAX_STARS];
+} analysis_chunk;
+
+static void *analysis_chunk_histogram(analysis_chunk *chunk) {
+	uint16_t *restrict pixels = chunk->pixels + (long)chunk->first_row * chunk->width;
+	long size = (long)chunk->rows * chunk->width;
+	unsigned *restrict histogram = chunk->histogram;
+	for (long i = 0; i < size; i++)
+		histogram[pixels[i]]++;
+	return NULL;
+}
+
+static void analysis_measure_star(analysis_chunk *chunk, int x, int y) {
+	int width = chunk->width, r = ANALYSIS_STAR_RADIUS;
+	double background = chunk->background;
+	double half = (chunk->pixels[(long)y * width + x] - background) / 2;
+	double sum = 0, sum_x = 0, sum_y = 0;
+	int area = 0;
+	for (int j = -r; j <= r; j++) {
+		uint16_t *row = chunk->pixels + (long)(y + j) * width + x;
+		for (int i = -r; i <= r; i++) {
+			double value = row[i] - background;
+			if (value > 0) {
+				sum += value;
+				sum_x += value * i;
+				sum_y += value * j;
+				if (value > half)
+					area++;
+			}
+		}
+	}
+	if (sum <= 0)
+		return;
+	double cx = sum_x / sum, cy = sum_y / sum, sum_r = 0;
+	for (int j = -r; j <= r; j++) {
+		uint16_t *row = chunk->pixels + (long)(y + j) * width + x;
+		for (int i = -r; i <= r; i++) {
+			double value = row[i] - background;
+			if (value > 0)
+				sum_r += value * sqrt((i - cx) * (i - cx) + (j - cy) * (j - cy));
+		}
+	}
+	chunk->hfr[chunk->measured] = sum_r / sum;
+	chunk->fwhm[chunk->measured] = 2 * sqrt(area / M_PI);
+	chunk->star[chunk->measured].x = x + cx;
+	chunk->star[chunk->measured].y = y + cy;
+	chunk->star[chunk->measured].flux = sum;
+	chunk->measured++;
+}
+
+static void *analysis_chunk_stars(analysis_chunk *chunk) {
+	int width = chunk->width, height = chunk->height, r = ANALYSIS_STAR_RADIUS;
+	int threshold = chunk->threshold;
+	int first = chunk->first_row > r ? chunk->first_row : r;
+	int last = chunk->first_row + chunk->rows < height - r ? chunk->first_row + chunk->rows : height - r;
+	for (int y = first; y < last; y++) {
+		uint16_t *row = chunk->pixels + (long)y * width;
+		for (int x = r; x < width - r; x++) {
+			int value = row[x];
+			if (value <= threshold)
+				continue;
+			/* local maximum in 5x5 window, ties are resolved in favour of first pixel in scan order */
+			bool peak = true;
+			int neighbours = 0;
+			for (int j = -2; j <= 2 && peak; j++) {
+				uint16_t *other = row + (long)j * width + x;
+				for (int i = -2; i <= 2; i++) {
+					if (i == 0 && j == 0)
+						continue;
+					int other_value = other[i];
+					if (other_value > value || (other_value == value && (j < 0 || (j == 0 && i < 0)))) {
+						peak = false;
+						break;
+					}
+					if (i >= -1 && i <= 1 && j >= -1 && j <= 1 && other_value > threshold)
+						neighbours++;
+				}
+			}
+			if (!peak || neighbours < 2)
+				continue;
+			chunk->stars++;
+			if (chunk->measured < ANALYSIS_MAX_STARS)
+				analysis_measure_star(chunk, x, y);
+		}
+	}
+	return NULL;
+}
+
+static int analysis_compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int analysis_compare_flux(const void *a, const void *b) {
+	double x = ((const image_star *)a)->flux, y = ((const image_star *)b)->flux;
+	return x > y ? -1 : x < y ? 1 : 0;
+}
+
+/* if star_list is not NULL, up to *star_count brightest measured stars are returned there */
+static void image_analysis(void *data, int width, int height, int components, int bytes_per_pixel, bool little_endian, image_stats *stats, image_star *star_list, int *star_count) {
+	long size = (long)width * height;
+	uint16_t *pixels = data;
+	if (components == 3) {
+		pixels = malloc(size * sizeof(uint16_t));
+		assert(pixels != NULL);
+		unsigned char *b8 = data;
+		for (long i = 0; i < size; i++)
+			pixels[i] = b8[3 * i] + b8[3 * i + 1] + b8[3 * i + 2];
+	} else if (bytes_per_pixel == 1) {
+		pixels = malloc(size * sizeof(uint16_t));
+		assert(pixels != NULL);
+		unsigned char *b8 = data;
+		for (long i = 0; i < size; i++)
+			pixels[i] = b8[i];
+	} else if (little_endian != HOST_LITTLE_ENDIAN) {
+		pixels = malloc(size * sizeof(uint16_t));
+		assert(pixels != NULL);
+		memcpy(pixels, data, size * sizeof(uint16_t));
+		swap_16bit(pixels, size);
+	}
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > ANALYSIS_MAX_CHUNKS)
+		count = ANALYSIS_MAX_CHUNKS;
+	if (count > size / ANALYSIS_MIN_CHUNK_PIXELS)
+		count = (int)(size / ANALYSIS_MIN_CHUNK_PIXELS);
+	if (count < 1)
+		count = 1;
+	analysis_chunk *chunks = malloc(count * sizeof(analysis_chunk));
+	assert(chunks != NULL);
+	unsigned *histograms = calloc((size_t)count * 65536, sizeof(unsigned));
+	assert(histograms != NULL);
+	int chunk_rows = (height + count - 1) / count;
+	for (int i = 0; i < count; i++) {
+		analysis_chunk *chunk = chunks + i;
+		chunk->pixels = pixels;
+		chunk->width = width;
+		chunk->height = height;
+		chunk->first_row = i * chunk_rows;
+		chunk->rows = i == count - 1 ? height - chunk->first_row : chunk_rows;
+		chunk->histogram = histograms + i * 65536;
+		chunk->stars = chunk->measured = 0;
+	}
+	parallel_for(chunks, count, sizeof(analysis_chunk), (void *(*)(void *))analysis_chunk_histogram);
+	for (int i = 1; i < count; i++) {
+		for (int j = 0; j < 65536; j++)
+			histograms[j] += chunks[i].histogram[j];
+	}
+	int min = -1, max = 0, median = -1;
+	double sum = 0;
+	long cumulative = 0;
+	for (int i = 0; i < 65536; i++) {
+		unsigned n = histograms[i];
+		if (n == 0)
+			continue;
+		if (min < 0)
+			min = i;
+		max = i;
+		sum += (double)n * i;
+		cumulative += n;
+		if (median < 0 && cumulative > size / 2)
+			median = i;
+	}
+	/* median of absolute deviations, histogram is walked in both directions from median */
+	long mad_count = histograms[median];
+	int mad = 0;
+	while (mad_count <= size / 2 && mad < 65536) {
+		mad++;
+		if (median - mad >= 0)
+			mad_count += histograms[median - mad];
+		if (median + mad < 65536)
+			mad_count += histograms[median + mad];
+	}
+	double noise = 1.4826 * mad;
+	stats->min = min;
+	stats->max = max;
+	stats->mean = sum / size;
+	stats->median = median;
+	stats->background = median;
+	stats->noise = noise;
+	int threshold = median + (int)ceil(ANALYSIS_THRESHOLD * (noise < 1 ? 1 : noise));
+	for (int i = 0; i < count; i++) {
+		chunks[i].background = median;
+		chunks[i].threshold = threshold;
+	}
+	parallel_for(chunks, count, sizeof(analysis_chunk), (void *(*)(void *))analysis_chunk_stars);
+	int stars = chunks[0].stars, measured = chunks[0].measured;
+	for (int i = 1; i < count; i++) {
+		stars += chunks[i].stars;
+		for (int j = 0; j < chunks[i].measured && measured < ANALYSIS_MAX_STARS; j++, measured++) {
+			chunks[0].hfr[measured] = chunks[i].hfr[j];
+			chunks[0].fwhm[measured] = chunks[i].fwhm[j];
+			chunks[0].star[measured] = chunks[i].star[j];
+		}
+	}
+	stats->stars = stars;
+	stats->hfr = stats->fwhm = 0;
+	if (star_list != NULL) {
+		qsort(chunks[0].star, measured, sizeof(image_star), analysis_compare_flux);
+		if (*star_count > measured)
+			*star_count = measured;
+		memcpy(star_list, chunks[0].star, *star_count * sizeof(image_star));
+	}
+	if (measured > 0) {
+		qsort(chunks[0].hfr, measured, sizeof(double), analysis_compare);
+		qsort(chunks[0].fwhm, measured, sizeof(double), analysis_compare);
+		stats->hfr = chunks[0].hfr[measured / 2];
+		stats->fwhm = chunks[0].fwhm[measured / 2];
+	}
+	free(histograms);
+	free(chunks);
+	if (pixels != data)
+		free(pixels);
+}
+
+/* calibration masters are FITS files (8, 16 or -32 BITPIX, single plane) read to memory, so rewritten master file can't fault running calibration, rows of masters are converted to float on the fly,
+   light frame is calibrated as (light - dark) / normalized (flat - bias), if there is no dark, bias is subtracted instead, masters are kept for
+   last few combinations of mode, binning and gain, so switching between them doesn't reload files */
+
+#define CALIBRATION_MAX_CHUNKS			8
+#define CALIBRATION_MIN_CHUNK_PIXELS	(1024 * 1024)
+#define CALIBRATION_SETS							4
+
+typedef struct {
+	char mode[INDIGO_NAME_SIZE];
+	int horizontal_bin;
+	int vertical_bin;
+	double gain;
+} calibration_key;
+
+typedef struct {
+	void *buffer;
+	size_t buffer_size;
+	unsigned char *data;
+	int width;
+	int height;
+	int bitpix;
+	double zero;
+	double scale;
+	double mean;
+} calibration_master;
+
+typedef struct {
+	calibration_key key;
+	char file_names[3][INDIGO_VALUE_SIZE];
+	calibration_master dark;
+	calibration_master bias;
+	calibration_master flat;
+	unsigned long used;
+} calibration_set;
+
+typedef struct indigo_ccd_calibration {
+	pthread_mutex_t mutex;
+	calibration_set sets[CALIBRATION_SETS];
+	unsigned long clock;
+} indigo_ccd_calibration;
+
+typedef struct {
+	calibration_master *dark;
+	calibration_master *bias;
+	calibration_master *flat;
+	void *data;
+	int width;
+	int first_row;
+	int rows;
+	int bytes_per_pixel;
+	bool swap;
+	float flat_scale;
+} calibration_chunk;
+
+static void calibration_free(calibration_master *master) {
+	if (master->buffer)
+		free(master->buffer);
+	memset(master, 0, sizeof(calibration_master));
+}
+
+static void master_row(calibration_master *master, long offset, int size, float *restrict value) {
+	float zero = (float)master->zero, scale = (float)master->scale;
+	switch (master->bitpix) {
+		case 8: {
+			uint8_t *restrict data = master->data + offset;
+			for (int i = 0; i < size; i++)
+				value[i] = zero + scale * data[i];
+			break;
+		}
+		case 16: {
+			uint16_t *restrict data = (uint16_t *)master->data + offset;
+			for (int i = 0; i < size; i++) {
+				uint16_t raw = HOST_LITTLE_ENDIAN ? (uint16_t)(data[i] << 8 | data[i] >> 8) : data[i];
+				value[i] = zero + scale * (int16_t)raw;
+			}
+			break;
+		}
+		case -32: {
+			uint32_t *restrict data = (uint32_t *)master->data + offset;
+			for (int i = 0; i < size; i++) {
+				union { uint32_t raw; float value; } pixel = { HOST_LITTLE_ENDIAN ? __builtin_bswap32(data[i]) : data[i] };
+				value[i] = zero + scale * pixel.value;
+			}
+			break;
+		}
+	}
+}
+
+static bool calibration_read(const char *file_name, calibration_master *master, char *message) {
+	int handle = open(file_name, O_RDONLY);
+	if (handle < 0) {
+		snprintf(message, INDIGO_VALUE_SIZE, "Can't open %s (%s)", file_name, strerror(errno));
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(handle, &file_stat) < 0 || file_stat.st_size < FITS_HEADER_SIZE) {
+		close(handle);
+		snprintf(message, INDIGO_VALUE_SIZE, "%s is not a FITS file", file_name);
+		return false;
+	}
+	master->buffer_size = file_stat.st_size;
+	master->buffer = malloc(master->buffer_size);
+	assert(master->buffer != NULL);
+	size_t total = 0;
+	while (total < master->buffer_size) {
+		ssize_t bytes_read = read(handle, (char *)master->buffer + total, master->buffer_size - total);
+		if (bytes_read <= 0) {
+			if (bytes_read == 0)
+				errno = EIO;
+			break;
+		}
+		total += bytes_read;
+	}
+	close(handle);
+	if (total < master->buffer_size) {
+		snprintf(message, INDIGO_VALUE_SIZE, "Can't read %s (%s)", file_name, strerror(errno));
+		calibration_free(master);
+		return false;
+	}
+	int naxis = -1;
+	master->scale = 1;
+	long offset = -1;
+	for (char *card = master->buffer; card + 80 <= (char *)master->buffer + master->buffer_size; card += 80) {
+		char value[72];
+		memcpy(value, card + 9, 71);
+		value[71] = 0;
+		if (!strncmp(card, "BITPIX  =", 9))
+			master->bitpix = atoi(value);
+		else if (!strncmp(card, "NAXIS   =", 9))
+			naxis = atoi(value);
+		else if (!strncmp(card, "NAXIS1  =", 9))
+			master->width = atoi(value);
+		else if (!strncmp(card, "NAXIS2  =", 9))
+			master->height = atoi(value);
+		else if (!strncmp(card, "BZERO   =", 9))
+			master->zero = atof(value);
+		else if (!strncmp(card, "BSCALE  =", 9))
+			master->scale = atof(value);
+		else if (!strncmp(card, "END     ", 8)) {
+			offset = (card - (char *)master->buffer) / 2880 * 2880 + 2880;
+			break;
+		}
+	}
+	long size = (long)master->width * master->height;
+	if (offset < 0 || naxis != 2 || (master->bitpix != 8 && master->bitpix != 16 && master->bitpix != -32) || size <= 0 || offset + size * abs(master->bitpix) / 8 > master->buffer_size) {
+		calibration_free(master);
+		snprintf(message, INDIGO_VALUE_SIZE, "%s is not supported (single plane 8, 16 or -32 bit FITS image is expected)", file_name);
+		return false;
+	}
+	master->data = (unsigned char *)master->buffer + offset;
+	float *row = malloc(master->width * sizeof(float));
+	assert(row != NULL);
+	double sum = 0;
+	for (int y = 0; y < master->height; y++) {
+		master_row(master, (long)y * master->width, master->width, row);
+		double row_sum = 0;
+		for (int x = 0; x < master->width; x++)
+			row_sum += row[x];
+		sum += row_sum;
+	}
+	free(row);
+	master->mean = sum / size;
+	INDIGO_DEBUG(indigo_debug("Calibration master %s %dx%d BITPIX %d loaded, mean = %g", file_name, master->width, master->height, master->bitpix, master->mean));
+	return true;
+}
+
+static void calibration_key_get(indigo_device *device, calibration_key *key) {
+	memset(key, 0, sizeof(calibration_key));
+	for (int i = 0; i < CCD_MODE_PROPERTY->count; i++) {
+		indigo_item *item = CCD_MODE_PROPERTY->items + i;
+		if (item->sw.value) {
+			strcpy(key->mode, item->name);
+			break;
+		}
+	}
+	key->horizontal_bin = (int)CCD_BIN_HORIZONTAL_ITEM->number.value;
+	key->vertical_bin = (int)CCD_BIN_VERTICAL_ITEM->number.value;
+	key->gain = CCD_GAIN_ITEM->number.value;
+}
+
+/* set used by given key or NULL, calibration->mutex is locked */
+static calibration_set *calibration_find(indigo_ccd_calibration *calibration, calibration_key *key) {
+	for (int i = 0; i < CALIBRATION_SETS; i++) {
+		calibration_set *set = calibration->sets + i;
+		if (set->used && !strcmp(set->key.mode, key->mode) && set->key.horizontal_bin == key->horizontal_bin && set->key.vertical_bin == key->vertical_bin && set->key.gain == key->gain) {
+			set->used = ++calibration->clock;
+			return set;
+		}
+	}
+	return NULL;
+}
+
+static void calibration_create(indigo_device *device) {
+	indigo_ccd_calibration *calibration = calloc(1, sizeof(indigo_ccd_calibration));
+	assert(calibration != NULL);
+	pthread_mutex_init(&calibration->mutex, NULL);
+	CCD_CONTEXT->calibration = calibration;
+}
+
+static void calibration_release(indigo_device *device) {
+	indigo_ccd_calibration *calibration = CCD_CONTEXT->calibration;
+	if (calibration == NULL)
+		return;
+	for (int i = 0; i < CALIBRATION_SETS; i++) {
+		calibration_free(&calibration->sets[i].dark);
+		calibration_free(&calibration->sets[i].bias);
+		calibration_free(&calibration->sets[i].flat);
+	}
+	pthread_mutex_destroy(&calibration->mutex);
+	free(calibration);
+	CCD_CONTEXT->calibration = NULL;
+}
+
+/* masters are read before lock is taken, so frame being calibrated is not blocked by file I/O, they replace set for current mode, binning
+   and gain (or the least recently used one) */
+static bool calibration_load(indigo_device *device, char *message) {
+	indigo_ccd_calibration *calibration = CCD_CONTEXT->calibration;
+	if (calibration == NULL)
+		return false;
+	char *file_names[3] = { CCD_CALIBRATION_DARK_ITEM->text.value, CCD_CALIBRATION_BIAS_ITEM->text.value, CCD_CALIBRATION_FLAT_ITEM->text.value };
+	calibration_master masters[3];
+	bool result = true;
+	*message = 0;
+	memset(masters, 0, sizeof(masters));
+	for (int i = 0; i < 3; i++) {
+		if (*file_names[i] && !calibration_read(file_names[i], masters + i, message))
+			result = false;
+	}
+	if (masters[2].buffer && masters[1].buffer && (masters[2].width != masters[1].width || masters[2].height != masters[1].height)) {
+		snprintf(message, INDIGO_VALUE_SIZE, "Flat and bias masters differ in size");
+		calibration_free(masters + 1);
+		result = false;
+	}
+	if (masters[2].buffer && masters[2].mean - masters[1].mean <= 0) {
+		snprintf(message, INDIGO_VALUE_SIZE, "Flat master is empty");
+		calibration_free(masters + 2);
+		result = false;
+	}
+	if (!result)
+		indigo_error("Calibration: %s", message);
+	calibration_key key;
+	calibration_key_get(device, &key);
+	calibration_master old[3];
+	pthread_mutex_lock(&calibration->mutex);
+	calibration_set *set = calibration_find(calibration, &key);
+	if (set == NULL) {
+		set = calibration->sets;
+		for (int i = 1; i < CALIBRATION_SETS; i++)
+			if (calibration->sets[i].used < set->used)
+				set = calibration->sets + i;
+		set->key = key;
+		set->used = ++calibration->clock;
+	}
+	old[0] = set->dark;
+	old[1] = set->bias;
+	old[2] = set->flat;
+	set->dark = masters[0];
+	set->bias = masters[1];
+	set->flat = masters[2];
+	for (int i = 0; i < 3; i++)
+		strcpy(set->file_names[i], masters[i].buffer ? file_names[i] : "");
+	pthread_mutex_unlock(&calibration->mutex);
+	for (int i = 0; i < 3; i++)
+		calibration_free(old + i);
+	return result;
+}
+
+/* CCD_CALIBRATION shows masters of current mode, binning and gain */
+static void calibration_select(indigo_device *device) {
+	indigo_ccd_calibration *calibration = CCD_CONTEXT->calibration;
+	if (calibration == NULL)
+		return;
+	calibration_key key;
+	calibration_key_get(device, &key);
+	pthread_mutex_lock(&calibration->mutex);
+	calibration_set *set = calibration_find(calibration, &key);
+	bool changed = false;
+	for (int i = 0; i < 3; i++) {
+		char *value = CCD_CALIBRATION_PROPERTY->items[i].text.value;
+		const char *file_name = set ? set->file_names[i] : "";
+		if (strcmp(value, file_name)) {
+			strcpy(value, file_name);
+			changed = true;
+		}
+	}
+	pthread_mutex_unlock(&calibration->mutex);
+	if (changed) {
+		CCD_CALIBRATION_PROPERTY->state = INDIGO_OK_STATE;
+		if (IS_CONNECTED)
+			indigo_update_property(device, CCD_CALIBRATION_PROPERTY, NULL);
+	}
+}
+
+VECTORIZED_KERNEL static void calibration_subtract(float *restrict value, const float *restrict master, int size) {
+	for (int i = 0; i < size; i++)
+		value[i] -= master[i];
+}
+
+VECTORIZED_KERNEL static void calibration_divide(float *restrict value, const float *restrict flat, int size, float scale) {
+	for (int i = 0; i < size; i++) {
+		float divisor = flat[i] * scale;
+		value[i] = divisor > 0 ? value[i] / divisor : value[i];
+	}
+}
+
+static void *calibration_chunk_process(calibration_chunk *chunk) {
+	int width = chunk->width;
+	calibration_master *dark = chunk->dark, *bias = chunk->bias, *flat = chunk->flat;
+	float *value = malloc(3 * width * sizeof(float));
+	assert(value != NULL);
+	float *master = value + width, *flat_bias = master + width;
+	float max = chunk->bytes_per_pixel == 2 ? 65535 : 255;
+	for (int y = chunk->first_row; y < chunk->first_row + chunk->rows; y++) {
+		long offset = (long)y * width;
+		if (chunk->bytes_per_pixel == 2) {
+			uint16_t *pixels = (uint16_t *)chunk->data + offset;
+			if (chunk->swap) {
+				for (int i = 0; i < width; i++)
+					value[i] = (uint16_t)(pixels[i] << 8 | pixels[i] >> 8);
+			} else {
+				for (int i = 0; i < width; i++)
+					value[i] = pixels[i];
+			}
+		} else {
+			uint8_t *pixels = (uint8_t *)chunk->data + offset;
+			for (int i = 0; i < width; i++)
+				value[i] = pixels[i];
+		}
+		if (dark || bias) {
+			master_row(dark ? dark : bias, offset, width, master);
+			calibration_subtract(value, master, width);
+		}
+		if (flat) {
+			master_row(flat, offset, width, flat_bias);
+			if (bias) {
+				if (dark)
+					master_row(bias, offset, width, master);
+				calibration_subtract(flat_bias, master, width);
+			}
+			calibration_divide(value, flat_bias, width, chunk->flat_scale);
+		}
+		if (chunk->bytes_per_pixel == 2) {
+			uint16_t *pixels = (uint16_t *)chunk->data + offset;
+			for (int i = 0; i < width; i++) {
+				float pixel = value[i] + 0.5f;
+				pixels[i] = pixel < 0 ? 0 : pixel > max ? (uint16_t)max : (uint16_t)pixel;
+			}
+		} else {
+			uint8_t *pixels = (uint8_t *)chunk->data + offset;
+			for (int i = 0; i < width; i++) {
+				float pixel = value[i] + 0.5f;
+				pixels[i] = pixel < 0 ? 0 : pixel > max ? (uint8_t)max : (uint8_t)pixel;
+			}
+		}
+	}
+	free(value);
+	return NULL;
+}
+
+/* returns true if frame was calibrated, calibrated 16-bit frame is in host byte order */
+static bool calibration_apply(indigo_ccd_calibration *calibration, calibration_key *key, void *data, int width, int height, int bytes_per_pixel, bool little_endian) {
+	if (calibration == NULL)
+		return false;
+	pthread_mutex_lock(&calibration->mutex);
+	calibration_set *set = calibration_find(calibration, key);
+	if (set == NULL) {
+		pthread_mutex_unlock(&calibration->mutex);
+		return false;
+	}
+	/* masters of different size (e.g. other ROI) are ignored */
+	bool dark = set->dark.data && set->dark.width == width && set->dark.height == height;
+	bool bias = set->bias.data && set->bias.width == width && set->bias.height == height;
+	bool flat = set->flat.data && set->flat.width == width && set->flat.height == height;
+	if (!dark && !bias && !flat) {
+		pthread_mutex_unlock(&calibration->mutex);
+		return false;
+	}
+	INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > CALIBRATION_MAX_CHUNKS)
+		count = CALIBRATION_MAX_CHUNKS;
+	if (count > (long)width * height / CALIBRATION_MIN_CHUNK_PIXELS)
+		count = (int)((long)width * height / CALIBRATION_MIN_CHUNK_PIXELS);
+	if (count < 1)
+		count = 1;
+	calibration_chunk chunks[CALIBRATION_MAX_CHUNKS];
+	int rows = (height + count - 1) / count;
+	for (int i = 0; i < count; i++) {
+		calibration_chunk *chunk = chunks + i;
+		chunk->dark = dark ? &set->dark : NULL;
+		chunk->bias = bias ? &set->bias : NULL;
+		chunk->flat = flat ? &set->flat : NULL;
+		chunk->data = data;
+		chunk->width = width;
+		chunk->first_row = i * rows;
+		chunk->rows = chunk->first_row + rows > height ? height - chunk->first_row : rows;
+		chunk->bytes_per_pixel = bytes_per_pixel;
+		chunk->swap = bytes_per_pixel == 2 && little_endian != HOST_LITTLE_ENDIAN;
+		chunk->flat_scale = flat ? (float)(1 / (set->flat.mean - (bias ? set->bias.mean : 0))) : 1;
+	}
+	parallel_for(chunks, count, sizeof(calibration_chunk), (void *(*)(void *))calibration_chunk_process);
+	pthread_mutex_unlock(&calibration->mutex);
+	INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+	INDIGO_DEBUG(indigo_debug("Calibration (%s%s) in %gs", dark ? "dark " : bias ? "bias " : "", flat ? "flat" : "", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
+	return true;
+}
+
+/* XXX in local mode prefix is replaced by sequence number, next number for each file name pattern is found by single directory scan
+   and cached, so it is not necessary to stat() all previous files for every image */
+
+#define SEQUENCE_CACHE_SIZE	16
+
+/* format is one character longer than file name pattern (XXX -> %03d) */
+#define SEQUENCE_FORMAT_SIZE	(INDIGO_VALUE_SIZE + 1)
+
+static struct {
+	char format[SEQUENCE_FORMAT_SIZE];
+	int next;
+	unsigned long used;
+} sequence_cache[SEQUENCE_CACHE_SIZE];
+static unsigned long sequence_clock = 0;
+static pthread_mutex_t sequence_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int sequence_scan(const char *path, const char *tail) {
+	char dir_name[INDIGO_VALUE_SIZE];
+	const char *head = strrchr(path, '/');
+	if (head == NULL) {
+		strcpy(dir_name, ".");
+		head = path;
+	} else {
+		strncpy(dir_name, path, head - path + 1);
+		dir_name[head - path + 1] = 0;
+		head++;
+	}
+	int head_length = (int)strlen(head);
+	int last = 0;
+	DIR *dir = opendir(dir_name);
+	if (dir) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			char *name = entry->d_name;
+			if (strncmp(name, head, head_length))
+				continue;
+			char *digits = name + head_length, *end = digits;
+			while (isdigit(*end))
+				end++;
+			if (end - digits < 3 || strcmp(end, tail))
+				continue;
+			int number = atoi(digits);
+			if (last < number)
+				last = number;
+		}
+		closedir(dir);
+	}
+	return last + 1;
+}
+
+static void sequence_file_name(const char *dir, const char *prefix, const char *sufix, char *file_name) {
+	char format[SEQUENCE_FORMAT_SIZE];
+	const char *xxx = strstr(prefix, "XXX");
+	strcpy(format, dir);
+	strncat(format, prefix, xxx - prefix);
+	strcat(format, "%03d");
+	strcat(format, xxx + 3);
+	strcat(format, sufix);
+	pthread_mutex_lock(&sequence_mutex);
+	int slot = 0;
+	for (int i = 0; i < SEQUENCE_CACHE_SIZE; i++) {
+		if (!strcmp(sequence_cache[i].format, format)) {
+			slot = i;
+			break;
+		}
+		if (sequence_cache[i].used < sequence_cache[slot].used)
+			slot = i;
+	}
+	if (strcmp(sequence_cache[slot].format, format)) {
+		char path[INDIGO_VALUE_SIZE], tail[INDIGO_VALUE_SIZE];
+		strcpy(path, dir);
+		strncat(path, prefix, xxx - prefix);
+		strcpy(tail, xxx + 3);
+		strcat(tail, sufix);
+		strcpy(sequence_cache[slot].format, format);
+		sequence_cache[slot].next = strchr(tail, '/') ? 1 : sequence_scan(path, tail);
+	}
+	sequence_cache[slot].used = ++sequence_clock;
+	/* files created by somebody else since last scan are still skipped */
+	struct stat sb;
+	while (true) {
+		snprintf(file_name, INDIGO_VALUE_SIZE, format, sequence_cache[slot].next++);
+		if (stat(file_name, &sb) != 0 || !S_ISREG(sb.st_mode))
+			break;
+	}
+	pthread_mutex_unlock(&sequence_mutex);
+}
+
+/* with image pipeline local files are written by background writer, image is copied to (page aligned) queued buffer and CCD_IMAGE_FILE is
+   updated after the file is written, otherwise the file is written directly from image buffer before exposure is reported as finished */
+
+#define LOCAL_WRITER_QUEUE_SIZE	8
+#define LOCAL_WRITER_ALIGNMENT	4096
+#define LOCAL_WRITER_MAX_BATCH	64
+
+typedef struct local_write {
+	indigo_device *device;
+	char file_name[INDIGO_VALUE_SIZE];
+	void *data;
+	long size;
+	bool direct;
+	struct local_write *next;
+} local_write;
+
+bool indigo_local_write_preallocate = true;
+bool indigo_local_write_direct = false;
+int indigo_local_write_fsync_batch = 0;
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static local_write *writer_head = NULL, *writer_tail = NULL, *writer_current = NULL;
+static int writer_count = 0;
+
+static bool local_write_file(local_write *request, int *handle) {
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (request->direct)
+		flags |= O_DIRECT;
+#endif
+	*handle = open(request->file_name, flags, 0644);
+#ifdef O_DIRECT
+	/* some filesystems don't support direct I/O */
+	if (*handle < 0 && (flags & O_DIRECT) && errno == EINVAL)
+		*handle = open(request->file_name, flags & ~O_DIRECT, 0644);
+#endif
+	if (*handle < 0)
+		return false;
+#ifdef INDIGO_MACOS
+	if (request->direct)
+		fcntl(*handle, F_NOCACHE, 1);
+#endif
+#ifdef INDIGO_LINUX
+	/* preallocation is just a hint, filesystem may not support it */
+	if (indigo_local_write_preallocate)
+		fallocate(*handle, 0, 0, request->size);
+#endif
+	long size = request->size;
+	if (request->direct)
+		size = (size + LOCAL_WRITER_ALIGNMENT - 1) / LOCAL_WRITER_ALIGNMENT * LOCAL_WRITER_ALIGNMENT;
+	if (!indigo_write(*handle, request->data, size))
+		return false;
+	if (size != request->size && ftruncate(*handle, request->size) < 0)
+		return false;
+	return true;
+}
+
+static void *local_writer_thread(void *arg) {
+	int handles[LOCAL_WRITER_MAX_BATCH];
+	int handle_count = 0;
+	pthread_mutex_lock(&writer_mutex);
+	while (true) {
+		local_write *request = writer_head;
+		if (request == NULL) {
+			pthread_cond_wait(&writer_cond, &writer_mutex);
+			continue;
+		}
+		if ((writer_head = request->next) == NULL)
+			writer_tail = NULL;
+		writer_current = request;
+		pthread_mutex_unlock(&writer_mutex);
+		indigo_device *device = request->device;
+		INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
+		int handle;
+		bool written = local_write_file(request, &handle);
+		char *message = written ? NULL : strerror(errno);
+		/* files are kept open until fsync batch is complete or there is nothing else to write */
+		int batch = indigo_local_write_fsync_batch < LOCAL_WRITER_MAX_BATCH ? indigo_local_write_fsync_batch : LOCAL_WRITER_MAX_BATCH;
+		if (handle >= 0) {
+			if (batch > 0)
+				handles[handle_count++] = handle;
+			else
+				close(handle);
+		}
+		if (handle_count > 0 && (handle_count >= batch || writer_head == NULL)) {
+			for (int i = 0; i < handle_count; i++) {
+				fsync(handles[i]);
+				close(handles[i]);
+			}
+			handle_count = 0;
+		}
+		pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
+		if (written) {
+			snprintf(CCD_IMAGE_FILE_ITEM->text.value, INDIGO_VALUE_SIZE, "%s", request->file_name);
+			CCD_IMAGE_FILE_PROPERTY->state = INDIGO_OK_STATE;
+		} else {
+			CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
+		}
+		indigo_update_property(device, CCD_IMAGE_FILE_PROPERTY, message);
+		pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
+		INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+		INDIGO_DEBUG(indigo_debug("Local save of %s in %gs", request->file_name, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
+		free(request->data);
+		free(request);
+		pthread_mutex_lock(&writer_mutex);
+		writer_current = NULL;
+		writer_count--;
+		pthread_cond_broadcast(&writer_cond);
+	}
+	return NULL;
+}
+
+static void local_writer_start(void) {
+	pthread_t thread;
+	pthread_create(&thread, NULL, local_writer_thread, NULL);
+	pthread_detach(thread);
+}
+
+static void local_writer_enqueue(indigo_device *device, const char *file_name, void *data, long size) {
+	pthread_once(&writer_once, local_writer_start);
+	local_write *request = malloc(sizeof(local_write));
+	assert(request != NULL);
+	long aligned_size = (size + LOCAL_WRITER_ALIGNMENT - 1) / LOCAL_WRITER_ALIGNMENT * LOCAL_WRITER_ALIGNMENT;
+	if (posix_memalign(&request->data, LOCAL_WRITER_ALIGNMENT, aligned_size))
+		request->data = NULL;
+	assert(request->data != NULL);
+	memcpy(request->data, data, size);
+	memset(request->data + size, 0, aligned_size - size);
+	request->device = device;
+	strncpy(request->file_name, file_name, INDIGO_VALUE_SIZE - 1);
+	request->file_name[INDIGO_VALUE_SIZE - 1] = 0;
+	request->size = size;
+	request->direct = indigo_local_write_direct;
+	request->next = NULL;
+	pthread_mutex_lock(&writer_mutex);
+	while (writer_count >= LOCAL_WRITER_QUEUE_SIZE)
+		pthread_cond_wait(&writer_cond, &writer_mutex);
+	writer_count++;
+	if (writer_tail)
+		writer_tail->next = request;
+	else
+		writer_head = request;
+	writer_tail = request;
+	pthread_cond_broadcast(&writer_cond);
+	pthread_mutex_unlock(&writer_mutex);
+}
+
+static void local_save(indigo_device *device, const char *file_name, void *data, long size) {
+	if (CCD_CONTEXT->pipeline != NULL) {
+		local_writer_enqueue(device, file_name, data, size);
+		return;
+	}
+	/* image buffer is not aligned for direct I/O */
+	local_write request = { device, "", data, size, false, NULL };
+	strncpy(request.file_name, file_name, INDIGO_VALUE_SIZE - 1);
+	int handle;
+	pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
+	if (local_write_file(&request, &handle)) {
+		strncpy(CCD_IMAGE_FILE_ITEM->text.value, file_name, INDIGO_VALUE_SIZE - 1);
+		CCD_IMAGE_FILE_ITEM->text.value[INDIGO_VALUE_SIZE - 1] = 0;
+		CCD_IMAGE_FILE_PROPERTY->state = INDIGO_OK_STATE;
+		if (indigo_local_write_fsync_batch > 0)
+			fsync(handle);
+		close(handle);
+		indigo_update_property(device, CCD_IMAGE_FILE_PROPERTY, NULL);
+	} else {
+		char *message = strerror(errno);
+		CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
+		if (handle >= 0)
+			close(handle);
+		indigo_update_property(device, CCD_IMAGE_FILE_PROPERTY, message);
+	}
+	pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
+}
+
+static void local_writer_flush(indigo_device *device) {
+	pthread_mutex_lock(&writer_mutex);
+	while (true) {
+		bool pending = writer_current != NULL && writer_current->device == device;
+		for (local_write *request = writer_head; request && !pending; request = request->next)
+			pending = request->device == device;
+		if (!pending)
+			break;
+		pthread_cond_wait(&writer_cond, &writer_mutex);
+	}
+	pthread_mutex_unlock(&writer_mutex);
+}
+
+/* image processing is split to header, conversion and output steps, header is always written on the caller thread (keywords and
+   property values are not stable later), conversion and output either follow it immediately or run on pipeline threads */
+
+typedef struct image_job {
+	void *data;
+	long capacity;
+	int frame_width;
+	int frame_height;
+	bool little_endian;
+	int byte_per_pixel;
+	int naxis;
+	int size;
+	int blobsize;
+	bool fits, raw, jpeg, fits_rice;
+	bool analysis;
+	int bayer;
+	bool calibrate;
+	calibration_key calibration_key;
+	int stack;
+	double stack_sigma;
+	int stack_interval;
+	image_stats stats;
+	bool local, client;
+	char dir[INDIGO_VALUE_SIZE];
+	char prefix[INDIGO_VALUE_SIZE];
+	struct image_job *next;
+} image_job;
+
+/* pipeline owns a fixed pool of image buffers, so both queues are bounded by pool size and the caller blocks when all buffers are in use,
+   last uploaded buffer is kept until next upload because clients may still read it from CCD_IMAGE property */
+
+#define IMAGE_PIPELINE_DEPTH	4
+
+typedef struct indigo_ccd_pipeline {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	image_job jobs[IMAGE_PIPELINE_DEPTH];
+	image_job *free_jobs;
+	image_job *convert_head, *convert_tail;
+	image_job *output_head, *output_tail;
+	image_job *published;
+	int pending;
+	pthread_t convert_thread;
+	pthread_t output_thread;
+	bool finish_convert;
+	bool finish_output;
+	indigo_device *device;
+} indigo_ccd_pipeline;
+
+bool indigo_use_image_pipeline = false;
+
+#define STACK_ALIGN_STARS	32
+
+static void stack_add(indigo_device *device, image_job *job, image_star *stars, int star_count);
+
+static void process_image_header(indigo_device *device, image_job *job, indigo_fits_keyword *keywords) {
+	void *data = job->data;
+	int frame_width = job->frame_width;
+	int frame_height = job->frame_height;
 	int byte_per_pixel = CCD_FRAME_BITS_PER_PIXEL_ITEM->number.value / 8;
 	int naxis = 2;
 	int size = frame_width * frame_height;
 	int blobsize = byte_per_pixel * size;
-	if (byte_per_pixel == 2 && !little_endian) {
-		short *raw = (short *)(data + FITS_HEADER_SIZE);
-		int size = CCD_INFO_WIDTH_ITEM->number.value * CCD_INFO_HEIGHT_ITEM->number.value;
-		for (int i = 0; i < size; i++) {
-			int value = *raw;
-			*raw++ = (value & 0xff) << 8 | (value & 0xff00) >> 8;
-		}
-	} else if (byte_per_pixel == 3) {
+	if (byte_per_pixel == 3) {
 		byte_per_pixel = 1;
 		naxis = 3;
 		blobsize = 3 * size;
 	}
-	if (CCD_IMAGE_FORMAT_FITS_ITEM->sw.value) {
-		INDIGO_DEBUG(clock_t start = clock());
+	job->byte_per_pixel = byte_per_pixel;
+	job->naxis = naxis;
+	job->size = size;
+	job->blobsize = blobsize;
+	job->fits = CCD_IMAGE_FORMAT_FITS_ITEM->sw.value;
+	job->raw = CCD_IMAGE_FORMAT_RAW_ITEM->sw.value;
+	job->jpeg = CCD_IMAGE_FORMAT_JPEG_ITEM->sw.value;
+	job->fits_rice = CCD_IMAGE_FORMAT_FITS_RICE_ITEM->sw.value;
+	job->analysis = CCD_IMAGE_ANALYSIS_ENABLED_ITEM->sw.value;
+	job->calibrate = CCD_FRAME_TYPE_LIGHT_ITEM->sw.value && naxis == 2;
+	if (job->calibrate)
+		calibration_key_get(device, &job->calibration_key);
+	job->stack = CCD_STACK_MEAN_ITEM->sw.value ? 1 : CCD_STACK_SIGMA_CLIP_ITEM->sw.value ? 2 : 0;
+	job->stack_sigma = CCD_STACK_SETTINGS_SIGMA_ITEM->number.value;
+	job->stack_interval = CCD_STACK_SETTINGS_INTERVAL_ITEM->number.value < 1 ? 1 : (int)CCD_STACK_SETTINGS_INTERVAL_ITEM->number.value;
+	job->bayer = 0;
+	if (keywords && naxis == 2) {
+		int x_offset = 0, y_offset = 0;
+		for (indigo_fits_keyword *keyword = keywords; keyword->type; keyword++) {
+			if (keyword->type == INDIGO_FITS_STRING && !strcmp(keyword->name, "BAYERPAT"))
+				job->bayer = bayer_pattern(keyword->string);
+			else if (keyword->type == INDIGO_FITS_NUMBER && !strcmp(keyword->name, "XBAYROFF"))
+				x_offset = (int)keyword->number;
+			else if (keyword->type == INDIGO_FITS_NUMBER && !strcmp(keyword->name, "YBAYROFF"))
+				y_offset = (int)keyword->number;
+		}
+		if (job->bayer)
+			job->bayer = 1 + (((job->bayer - 1) ^ (x_offset & 1) ^ ((y_offset & 1) << 1)) & 3);
+	}
+	job->local = CCD_UPLOAD_MODE_LOCAL_ITEM->sw.value;
+	job->client = CCD_UPLOAD_MODE_CLIENT_ITEM->sw.value || CCD_UPLOAD_MODE_BOTH_ITEM->sw.value;
+	strncpy(job->dir, CCD_LOCAL_MODE_DIR_ITEM->text.value, INDIGO_VALUE_SIZE);
+	strncpy(job->prefix, CCD_LOCAL_MODE_PREFIX_ITEM->text.value, INDIGO_VALUE_SIZE);
+	if (job->fits || job->fits_rice || job->stack) {
+		int horizontal_bin = CCD_BIN_HORIZONTAL_ITEM->number.value;
+		int vertical_bin = CCD_BIN_VERTICAL_ITEM->number.value;
 		time_t timer;
 		struct tm* tm_info;
 		char now[20];
@@ -597,42 +2618,68 @@ void indigo_process_image(indigo_device *device, void *data, int frame_width, in
 		}
 		t = sprintf(header += 80, "END");
 		header[t] = ' ';
-		if (byte_per_pixel == 2) {
-			short *raw = (short *)(data + FITS_HEADER_SIZE);
-			int size = CCD_INFO_WIDTH_ITEM->number.value * CCD_INFO_HEIGHT_ITEM->number.value;
-				for (int i = 0; i < size; i++) {
-					int value = *raw - 32768;
-					*raw++ = (value & 0xff) << 8 | (value & 0xff00) >> 8;
-				}
+	}
+}
+
+static void process_image_convert(indigo_device *device, image_job *job) {
+	void *data = job->data;
+	if (job->calibrate && calibration_apply(CCD_CONTEXT->calibration, &job->calibration_key, data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, job->byte_per_pixel, job->little_endian))
+		job->little_endian = HOST_LITTLE_ENDIAN;
+	int byte_per_pixel = job->byte_per_pixel;
+	int naxis = job->naxis;
+	int size = job->size;
+	bool little_endian = job->little_endian;
+	bool planar = false;
+	if (job->analysis || job->stack) {
+		INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
+		image_star stars[STACK_ALIGN_STARS];
+		int star_count = STACK_ALIGN_STARS;
+		image_analysis(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, naxis == 3 ? 3 : 1, byte_per_pixel, little_endian, &job->stats, job->stack ? stars : NULL, &star_count);
+		INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+		INDIGO_DEBUG(indigo_debug("Image analysis in %gs", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
+		if (job->stack)
+			stack_add(device, job, stars, star_count);
+	}
+	if (byte_per_pixel == 2 && !little_endian && !job->fits && !job->fits_rice) {
+		swap_16bit(data + FITS_HEADER_SIZE, size);
+	}
+	if (job->fits_rice) {
+		INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
+		if (byte_per_pixel == 2 && little_endian != HOST_LITTLE_ENDIAN) {
+			swap_16bit(data + FITS_HEADER_SIZE, size);
+			little_endian = HOST_LITTLE_ENDIAN;
 		} else if (byte_per_pixel == 1 && naxis == 3) {
-			unsigned char *raw = malloc(3 * size);
-			unsigned char *red = raw;
-			unsigned char *green = raw + size;
-			unsigned char *blue = raw + 2 * size;
-			unsigned char *tmp = data + FITS_HEADER_SIZE;
-			if (little_endian) {
-				for (int i = 0; i < size; i++) {
-					*blue++ = *tmp++;
-					*green++ = *tmp++;
-					*red++ = *tmp++;
-				}
-			} else {
-				for (int i = 0; i < size; i++) {
-					*red++ = *tmp++;
-					*green++ = *tmp++;
-					*blue++ = *tmp++;
-				}
-			}
-			memcpy(data + FITS_HEADER_SIZE, raw, 3 * size);
-			free(raw);
+			planar_rgb24(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, little_endian);
+			planar = true;
+		}
+		unsigned long mem_size = 0;
+		unsigned char *mem = rice_encode(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, naxis == 3 ? 3 : 1, byte_per_pixel, data, &mem_size);
+		/* image which doesn't fit to original buffer after compression is stored as uncompressed FITS */
+		if (mem_size <= FITS_HEADER_SIZE + job->blobsize) {
+			memcpy(data, mem, mem_size);
+			job->blobsize = (int)mem_size;
+		} else {
+			job->fits_rice = false;
+			job->fits = true;
+		}
+		free(mem);
+		INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+		INDIGO_DEBUG(indigo_debug("RAW to Rice compressed FITS conversion in %gs (%lu bytes)", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, mem_size));
+	}
+	if (job->fits) {
+		INDIGO_DEBUG(clock_t start = clock());
+		if (byte_per_pixel == 2) {
+			fits_16bit(data + FITS_HEADER_SIZE, size, little_endian);
+		} else if (byte_per_pixel == 1 && naxis == 3 && !planar) {
+			planar_rgb24(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, little_endian);
 		}
-		int padding = 2880 - blobsize % 2880;
+		int padding = 2880 - job->blobsize % 2880;
 		if (padding) {
-			memset(data + FITS_HEADER_SIZE + blobsize, 0, padding);
-			blobsize += padding;
+			memset(data + FITS_HEADER_SIZE + job->blobsize, 0, padding);
+			job->blobsize += padding;
 		}
 		INDIGO_DEBUG(indigo_debug("RAW to FITS conversion in %gs", (clock() - start) / (double)CLOCKS_PER_SEC));
-	} else if (CCD_IMAGE_FORMAT_RAW_ITEM->sw.value) {
+	} else if (job->raw) {
 		indigo_raw_header *header = (indigo_raw_header *)(data + FITS_HEADER_SIZE - sizeof(indigo_raw_header));
 		if (naxis == 2 && byte_per_pixel == 1)
 			header->signature = INDIGO_RAW_MONO8;
@@ -640,187 +2687,627 @@ void indigo_process_image(indigo_device *device, void *data, int frame_width, in
 			header->signature = INDIGO_RAW_MONO16;
 		else if (naxis == 3 && byte_per_pixel == 1) {
 			header->signature = INDIGO_RAW_RGB24;
-			if (!little_endian) {
-				unsigned char *b8 = data + FITS_HEADER_SIZE;
-				for (int i = 0; i < size; i++) {
-					unsigned char b = *b8;
-					unsigned char r = *(b8 + 2);
-					*b8 = r;
-					*(b8 + 2) = b;
-					b8 += 3;
-				}
-			}
+			if (!little_endian)
+				swap_rgb24(data + FITS_HEADER_SIZE, size);
 		}
-		header->width = frame_width;
-		header->height = frame_height;
-	} else if (CCD_IMAGE_FORMAT_JPEG_ITEM->sw.value) {
-		INDIGO_DEBUG(clock_t start = clock());
-		unsigned char *mem = NULL;
+		header->width = job->frame_width;
+		header->height = job->frame_height;
+	} else if (job->jpeg) {
+		INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
 		unsigned long mem_size = 0;
-		struct jpeg_compress_struct cinfo;
-		struct jpeg_error_mgr jerr;
-		cinfo.err = jpeg_std_error(&jerr);
-		jpeg_create_compress(&cinfo);
-		jpeg_mem_dest(&cinfo, &mem, &mem_size);
-		cinfo.image_width = frame_width;
-		cinfo.image_height = frame_height;
-		if (naxis == 2) {
-			if (byte_per_pixel == 1) {
-			} else if (byte_per_pixel == 2) {
-				unsigned short *b16 = data + FITS_HEADER_SIZE;
-				unsigned short max = 0;
-				for (int i = 0; i < size; i++) {
-					unsigned short value = *b16++;
-					if (max < value)
-						max = value;
-				}
-				int shift = 0;
-				if (max > 0x8000)
-					shift = 8;
-				else if (max > 0x4000)
-					shift = 7;
-				else if (max > 0x2000)
-					shift = 6;
-				else if (max > 0x1000)
-					shift = 5;
-				else if (max > 0x800)
-					shift = 4;
-				else if (max > 0x400)
-					shift = 3;
-				else if (max > 0x200)
-					shift = 2;
-				else if (max > 0x100)
-					shift = 1;
-				unsigned char *b8 = data + FITS_HEADER_SIZE;
-				b16 = data + FITS_HEADER_SIZE;
-				if (shift > 0) {
-					for (int i = 0; i < size; i++)
-						*b8++ = *b16++ >> shift;
-				} else {
-					for (int i = 0; i < size; i++)
-						*b8++ = *b16++;
-				}
-			}
-			cinfo.input_components = 1;
-			cinfo.in_color_space = JCS_GRAYSCALE;
-		} else if (naxis == 3 ) {
-			cinfo.input_components = 3;
-			cinfo.in_color_space = JCS_RGB;
-			if (little_endian) {
-				unsigned char *b8 = data + FITS_HEADER_SIZE;
-				for (int i = 0; i < size; i++) {
-					unsigned char b = *b8;
-					unsigned char r = *(b8 + 2);
-					*b8 = r;
-					*(b8 + 2) = b;
-					b8 += 3;
-				}
-			}
+		unsigned char *mem = NULL;
+		void *rgb = job->bayer ? debayer(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, byte_per_pixel, job->bayer) : NULL;
+		if (rgb) {
+			INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+			INDIGO_DEBUG(indigo_debug("Debayering in %gs", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
+			mem = jpeg_encode(rgb, job->frame_width, job->frame_height, 3, byte_per_pixel, false, &mem_size);
+			free(rgb);
+		} else {
+			mem = jpeg_encode(data + FITS_HEADER_SIZE, job->frame_width, job->frame_height, naxis == 3 ? 3 : 1, byte_per_pixel, naxis == 3 && little_endian, &mem_size);
 		}
-		jpeg_set_defaults(&cinfo);
-		JSAMPROW row_pointer[1];
-		jpeg_start_compress( &cinfo, TRUE);
-		unsigned char *tmp = data + FITS_HEADER_SIZE;
-		while( cinfo.next_scanline < cinfo.image_height ) {
-			row_pointer[0] = &tmp[cinfo.next_scanline * cinfo.image_width *  cinfo.input_components];
-			jpeg_write_scanlines(&cinfo, row_pointer, 1);
-		}
-		jpeg_finish_compress( &cinfo );
-		jpeg_destroy_compress( &cinfo );
 		if (mem_size < size) {
 			memcpy(data, mem, mem_size);
 		}
-		blobsize = (int)mem_size;
+		job->blobsize = (int)mem_size;
 		free(mem);
-		INDIGO_DEBUG(indigo_debug("RAW to JPEG conversion in %gs", (clock() - start) / (double)CLOCKS_PER_SEC));
+		INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+		INDIGO_DEBUG(indigo_debug("RAW to JPEG conversion in %gs", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
 	}
-	if (CCD_UPLOAD_MODE_LOCAL_ITEM->sw.value) {
-		char *dir = CCD_LOCAL_MODE_DIR_ITEM->text.value;
-		char *prefix = CCD_LOCAL_MODE_PREFIX_ITEM->text.value;
+}
+
+static void process_image_publish(indigo_device *device, image_job *job, indigo_property *property, const char *format, ...) {
+	void *data = job->data;
+	int blobsize = job->blobsize;
+	pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
+	indigo_item *item = property->items;
+	*item->blob.url = 0;
+	if (job->fits) {
+		item->blob.value = data;
+		item->blob.size = FITS_HEADER_SIZE + blobsize;
+		strncpy(item->blob.format, ".fits", INDIGO_NAME_SIZE);
+	} else if (job->raw) {
+		item->blob.value = data + FITS_HEADER_SIZE - sizeof(indigo_raw_header);
+		item->blob.size = blobsize + sizeof(indigo_raw_header);
+		strncpy(item->blob.format, ".raw", INDIGO_NAME_SIZE);
+	} else if (job->jpeg) {
+		item->blob.value = data;
+		item->blob.size = blobsize;
+		strncpy(item->blob.format, ".jpeg", INDIGO_NAME_SIZE);
+	} else if (job->fits_rice) {
+		item->blob.value = data;
+		item->blob.size = blobsize;
+		strncpy(item->blob.format, ".fits.fz", INDIGO_NAME_SIZE);
+	}
+	property->state = INDIGO_OK_STATE;
+	if (format) {
+		char message[INDIGO_VALUE_SIZE];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(message, INDIGO_VALUE_SIZE, format, args);
+		va_end(args);
+		indigo_update_property(device, property, message);
+	} else {
+		indigo_update_property(device, property, NULL);
+	}
+	pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
+}
+
+static void process_image_output(indigo_device *device, image_job *job) {
+	INDIGO_DEBUG(clock_t start = clock());
+	void *data = job->data;
+	int blobsize = job->blobsize;
+	if (job->analysis) {
+		pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
+		CCD_IMAGE_STATS_MIN_ITEM->number.value = job->stats.min;
+		CCD_IMAGE_STATS_MAX_ITEM->number.value = job->stats.max;
+		CCD_IMAGE_STATS_MEAN_ITEM->number.value = job->stats.mean;
+		CCD_IMAGE_STATS_MEDIAN_ITEM->number.value = job->stats.median;
+		CCD_IMAGE_STATS_BACKGROUND_ITEM->number.value = job->stats.background;
+		CCD_IMAGE_STATS_NOISE_ITEM->number.value = job->stats.noise;
+		CCD_IMAGE_STATS_STARS_ITEM->number.value = job->stats.stars;
+		CCD_IMAGE_STATS_HFR_ITEM->number.value = job->stats.hfr;
+		CCD_IMAGE_STATS_FWHM_ITEM->number.value = job->stats.fwhm;
+		CCD_IMAGE_STATS_PROPERTY->state = INDIGO_OK_STATE;
+		indigo_update_property(device, CCD_IMAGE_STATS_PROPERTY, NULL);
+		pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
+	}
+	if (job->local) {
+		char *dir = job->dir;
+		char *prefix = job->prefix;
 		char *sufix;
-		if (CCD_IMAGE_FORMAT_FITS_ITEM->sw.value) {
+		if (job->fits) {
 			sufix = ".fits";
-		} else if (CCD_IMAGE_FORMAT_RAW_ITEM->sw.value) {
+		} else if (job->raw) {
 			sufix = ".raw";
-		} else if (CCD_IMAGE_FORMAT_JPEG_ITEM->sw.value) {
+		} else if (job->jpeg) {
 			sufix = ".jpeg";
+		} else if (job->fits_rice) {
+			sufix = ".fits.fz";
 		}
-		int handle = 0;
-		char *message = NULL;
 		if (strlen(dir) + strlen(prefix) + strlen(sufix) < INDIGO_VALUE_SIZE) {
 			char file_name[INDIGO_VALUE_SIZE];
-			char *xxx = strstr(prefix, "XXX");
-			if (xxx == NULL) {
+			if (strstr(prefix, "XXX") == NULL) {
 				strcpy(file_name, dir);
 				strcat(file_name, prefix);
 				strcat(file_name, sufix);
 			} else {
-				char format[INDIGO_VALUE_SIZE];
-				strcpy(format, dir);
-				strncat(format, prefix, xxx - prefix);
-				strcat(format, "%03d");
-				strcat(format, xxx+3);
-				strcat(format, sufix);
-				struct stat sb;
-				int i = 1;
-				while (true) {
-					snprintf(file_name, sizeof(file_name), format, i);
-					if (stat(file_name, &sb) == 0 && S_ISREG(sb.st_mode))
-						i++;
-					else
-						break;
-				}
+				sequence_file_name(dir, prefix, sufix, file_name);
 			}
-			strncpy(CCD_IMAGE_FILE_ITEM->text.value, file_name, INDIGO_VALUE_SIZE);
-			CCD_IMAGE_FILE_PROPERTY->state = INDIGO_OK_STATE;
-			handle = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (handle) {
-				if (CCD_IMAGE_FORMAT_FITS_ITEM->sw.value) {
-					if (!indigo_write(handle, data, FITS_HEADER_SIZE + blobsize)) {
-						CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
-						message = strerror(errno);
-					}
-				} else if (CCD_IMAGE_FORMAT_RAW_ITEM->sw.value) {
-					if (!indigo_write(handle, data + FITS_HEADER_SIZE - sizeof(indigo_raw_header), blobsize + sizeof(indigo_raw_header))) {
-						CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
-						message = strerror(errno);
-					}
-				} else if (CCD_IMAGE_FORMAT_JPEG_ITEM->sw.value) {
-					if (!indigo_write(handle, data, blobsize)) {
-						CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
-						message = strerror(errno);
-					}
-				}
-				close(handle);
-			} else {
-				CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
-				message = strerror(errno);
+			if (job->fits) {
+				local_save(device, file_name, data, FITS_HEADER_SIZE + blobsize);
+			} else if (job->raw) {
+				local_save(device, file_name, data + FITS_HEADER_SIZE - sizeof(indigo_raw_header), blobsize + sizeof(indigo_raw_header));
+			} else if (job->jpeg || job->fits_rice) {
+				local_save(device, file_name, data, blobsize);
 			}
 		} else {
+			pthread_mutex_lock(&CCD_CONTEXT->image_mutex);
 			CCD_IMAGE_FILE_PROPERTY->state = INDIGO_ALERT_STATE;
-			message = "dir + prefix + suffix is too long";
+			indigo_update_property(device, CCD_IMAGE_FILE_PROPERTY, "dir + prefix + suffix is too long");
+			pthread_mutex_unlock(&CCD_CONTEXT->image_mutex);
 		}
-		indigo_update_property(device, CCD_IMAGE_FILE_PROPERTY, message);
 		INDIGO_DEBUG(indigo_debug("Local save in %gs", (clock() - start) / (double)CLOCKS_PER_SEC));
 	}
-	if (CCD_UPLOAD_MODE_CLIENT_ITEM->sw.value || CCD_UPLOAD_MODE_BOTH_ITEM->sw.value) {
-		*CCD_IMAGE_ITEM->blob.url = 0;
-		if (CCD_IMAGE_FORMAT_FITS_ITEM->sw.value) {
-			CCD_IMAGE_ITEM->blob.value = data;
-			CCD_IMAGE_ITEM->blob.size = FITS_HEADER_SIZE + blobsize;
-			strncpy(CCD_IMAGE_ITEM->blob.format, ".fits", INDIGO_NAME_SIZE);
-		} else if (CCD_IMAGE_FORMAT_RAW_ITEM->sw.value) {
-			CCD_IMAGE_ITEM->blob.value = data + FITS_HEADER_SIZE - sizeof(indigo_raw_header);
-			CCD_IMAGE_ITEM->blob.size = blobsize + sizeof(indigo_raw_header);
-			strncpy(CCD_IMAGE_ITEM->blob.format, ".raw", INDIGO_NAME_SIZE);
-		} else if (CCD_IMAGE_FORMAT_JPEG_ITEM->sw.value) {
-			CCD_IMAGE_ITEM->blob.value = data;
-			CCD_IMAGE_ITEM->blob.size = blobsize;
-			strncpy(CCD_IMAGE_ITEM->blob.format, ".jpeg", INDIGO_NAME_SIZE);
-		}
-		CCD_IMAGE_PROPERTY->state = INDIGO_OK_STATE;
-		indigo_update_property(device, CCD_IMAGE_PROPERTY, NULL);
+	if (job->client) {
+		process_image_publish(device, job, CCD_IMAGE_PROPERTY, NULL);
 		INDIGO_DEBUG(indigo_debug("Client upload in %gs", (clock() - start) / (double)CLOCKS_PER_SEC));
 	}
 }
 
+/* live stack is aligned to the first frame after reset by translation found from brightest stars, frames are accumulated to float
+   running mean (and sum of squared deviations for sigma clipping, where pixels too far from current mean are rejected), stacked image
+   is converted to the same format as subs and published in CCD_STACK_IMAGE after every CCD_STACK_SETTINGS.INTERVAL frames, two image
+   buffers are used in turn because clients may still read the last published one */
+
+#define STACK_MATCH_TOLERANCE	2.0
+#define STACK_MAX_CHUNKS			8
+#define STACK_MIN_CHUNK_PIXELS	(1024 * 1024)
+
+typedef struct indigo_ccd_stack {
+	pthread_mutex_t mutex;
+	bool reset;
+	int width, height, components, bytes_per_pixel, bayer;
+	int frames, rejected;
+	float *mean;
+	float *m2;
+	uint16_t *count;
+	image_star reference[STACK_ALIGN_STARS];
+	int reference_count;
+	unsigned char *images[2];
+	long capacities[2];
+	int published;
+} indigo_ccd_stack;
+
+typedef struct {
+	indigo_ccd_stack *stack;
+	image_job *job;
+	int first_row;
+	int rows;
+	int dx, dy;
+	bool clip;
+	float kappa2;
+} stack_chunk;
+
+static void stack_create(indigo_device *device) {
+	indigo_ccd_stack *stack = calloc(1, sizeof(indigo_ccd_stack));
+	assert(stack != NULL);
+	pthread_mutex_init(&stack->mutex, NULL);
+	stack->reset = true;
+	stack->published = -1;
+	CCD_CONTEXT->stack = stack;
+}
+
+static void stack_free_buffers(indigo_ccd_stack *stack) {
+	if (stack->mean)
+		free(stack->mean);
+	if (stack->m2)
+		free(stack->m2);
+	if (stack->count)
+		free(stack->count);
+	stack->mean = stack->m2 = NULL;
+	stack->count = NULL;
+}
+
+static void stack_release(indigo_device *device) {
+	indigo_ccd_stack *stack = CCD_CONTEXT->stack;
+	if (stack == NULL)
+		return;
+	stack_free_buffers(stack);
+	for (int i = 0; i < 2; i++) {
+		if (stack->images[i])
+			free(stack->images[i]);
+	}
+	pthread_mutex_destroy(&stack->mutex);
+	free(stack);
+	CCD_CONTEXT->stack = NULL;
+}
+
+static void stack_reset(indigo_device *device) {
+	indigo_ccd_stack *stack = CCD_CONTEXT->stack;
+	if (stack == NULL)
+		return;
+	pthread_mutex_lock(&stack->mutex);
+	stack->reset = true;
+	pthread_mutex_unlock(&stack->mutex);
+}
+
+/* translation with the largest number of matching star pairs, averaged over matching pairs */
+static bool stack_align(image_star *reference, int reference_count, image_star *stars, int count, double *dx, double *dy) {
+	*dx = *dy = 0;
+	if (reference_count == 0)
+		return true;
+	int required = reference_count < 3 || count < 3 ? 1 : 3;
+	int best = 0;
+	for (int i = 0; i < reference_count; i++) {
+		for (int j = 0; j < count; j++) {
+			double tx = stars[j].x - reference[i].x, ty = stars[j].y - reference[i].y;
+			double sum_x = 0, sum_y = 0;
+			int matches = 0;
+			for (int k = 0; k < reference_count; k++) {
+				for (int l = 0; l < count; l++) {
+					double ex = stars[l].x - reference[k].x, ey = stars[l].y - reference[k].y;
+					if (fabs(ex - tx) < STACK_MATCH_TOLERANCE && fabs(ey - ty) < STACK_MATCH_TOLERANCE) {
+						sum_x += ex;
+						sum_y += ey;
+						matches++;
+						break;
+					}
+				}
+			}
+			if (matches > best) {
+				best = matches;
+				*dx = sum_x / matches;
+				*dy = sum_y / matches;
+			}
+		}
+	}
+	return best >= required;
+}
+
+VECTORIZED_KERNEL static void stack_row_mean(float *restrict mean, uint16_t *restrict count, const float *restrict value, int size) {
+	for (int i = 0; i < size; i++) {
+		float n = count[i] + 1.0f;
+		mean[i] += (value[i] - mean[i]) / n;
+		count[i] = (uint16_t)n;
+	}
+}
+
+VECTORIZED_KERNEL static void stack_row_clip(float *restrict mean, float *restrict m2, uint16_t *restrict count, const float *restrict value, int size, float kappa2) {
+	for (int i = 0; i < size; i++) {
+		float n = count[i];
+		float delta = value[i] - mean[i];
+		float variance = n > 1 ? m2[i] / (n - 1) : 0;
+		if (variance < 1)
+			variance = 1;
+		float accept = n < 3 || delta * delta <= kappa2 * variance ? 1.0f : 0.0f;
+		n += accept;
+		float m = mean[i] + accept * delta / (n > 0 ? n : 1);
+		m2[i] += accept * delta * (value[i] - m);
+		mean[i] = m;
+		count[i] = (uint16_t)n;
+	}
+}
+
+static void *stack_chunk_process(stack_chunk *chunk) {
+	indigo_ccd_stack *stack = chunk->stack;
+	image_job *job = chunk->job;
+	int width = stack->width, components = stack->components;
+	int dx = chunk->dx, dy = chunk->dy;
+	int first = dx < 0 ? -dx : 0, last = dx > 0 ? width - dx : width;
+	if (last <= first)
+		return NULL;
+	int size = (last - first) * components;
+	float *value = malloc(size * sizeof(float));
+	assert(value != NULL);
+	bool swap = stack->bytes_per_pixel == 2 && job->little_endian != HOST_LITTLE_ENDIAN;
+	for (int y = chunk->first_row; y < chunk->first_row + chunk->rows; y++) {
+		int source_y = y + dy;
+		if (source_y < 0 || source_y >= stack->height)
+			continue;
+		long source = ((long)source_y * width + first + dx) * components;
+		if (stack->bytes_per_pixel == 2) {
+			uint16_t *pixels = (uint16_t *)(job->data + FITS_HEADER_SIZE) + source;
+			if (swap) {
+				for (int i = 0; i < size; i++)
+					value[i] = (uint16_t)(pixels[i] << 8 | pixels[i] >> 8);
+			} else {
+				for (int i = 0; i < size; i++)
+					value[i] = pixels[i];
+			}
+		} else {
+			uint8_t *pixels = (uint8_t *)(job->data + FITS_HEADER_SIZE) + source;
+			for (int i = 0; i < size; i++)
+				value[i] = pixels[i];
+		}
+		long target = ((long)y * width + first) * components;
+		if (chunk->clip)
+			stack_row_clip(stack->mean + target, stack->m2 + target, stack->count + target, value, size, chunk->kappa2);
+		else
+			stack_row_mean(stack->mean + target, stack->count + target, value, size);
+	}
+	free(value);
+	return NULL;
+}
+
+static void stack_add(indigo_device *device, image_job *job, image_star *stars, int star_count) {
+	indigo_ccd_stack *stack = CCD_CONTEXT->stack;
+	if (stack == NULL)
+		return;
+	INDIGO_DEBUG(struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start));
+	int components = job->naxis == 3 ? 3 : 1;
+	long size = (long)job->frame_width * job->frame_height * components;
+	double dx = 0, dy = 0;
+	pthread_mutex_lock(&stack->mutex);
+	if (stack->reset || stack->frames == 0 || stack->width != job->frame_width || stack->height != job->frame_height || stack->components != components || stack->bytes_per_pixel != job->byte_per_pixel || stack->bayer != job->bayer) {
+		stack_free_buffers(stack);
+		stack->mean = calloc(size, sizeof(float));
+		stack->count = calloc(size, sizeof(uint16_t));
+		if (job->stack == 2)
+			stack->m2 = calloc(size, sizeof(float));
+		if (stack->mean == NULL || stack->count == NULL || (job->stack == 2 && stack->m2 == NULL)) {
+			stack_free_buffers(stack);
+			pthread_mutex_unlock(&stack->mutex);
+			INDIGO_ERROR(indigo_error("Live stacking: not enough memory"));
+			return;
+		}
+		stack->width = job->frame_width;
+		stack->height = job->frame_height;
+		stack->components = components;
+		stack->bytes_per_pixel = job->byte_per_pixel;
+		stack->bayer = job->bayer;
+		stack->frames = stack->rejected = 0;
+		stack->reference_count = star_count < STACK_ALIGN_STARS ? star_count : STACK_ALIGN_STARS;
+		memcpy(stack->reference, stars, stack->reference_count * sizeof(image_star));
+		stack->reset = false;
+	} else if (!stack_align(stack->reference, stack->reference_count, stars, star_count, &dx, &dy)) {
+		stack->rejected++;
+		pthread_mutex_unlock(&stack->mutex);
+		INDIGO_DEBUG(indigo_debug("Live stacking: frame rejected, %d stars can't be aligned", star_count));
+		return;
+	}
+	if (job->stack == 2 && stack->m2 == NULL) {
+		/* mode was switched to sigma clipping without reset, variance is collected from now */
+		stack->m2 = calloc(size, sizeof(float));
+		assert(stack->m2 != NULL);
+	}
+	/* shift is rounded to whole pixels (and whole CFA cells for Bayer mosaic) */
+	int shift_x, shift_y;
+	if (stack->bayer) {
+		shift_x = 2 * (int)round(dx / 2);
+		shift_y = 2 * (int)round(dy / 2);
+	} else {
+		shift_x = (int)round(dx);
+		shift_y = (int)round(dy);
+	}
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (count > STACK_MAX_CHUNKS)
+		count = STACK_MAX_CHUNKS;
+	if (count > (long)stack->width * stack->height / STACK_MIN_CHUNK_PIXELS)
+		count = (int)((long)stack->width * stack->height / STACK_MIN_CHUNK_PIXELS);
+	if (count < 1)
+		count = 1;
+	stack_chunk chunks[STACK_MAX_CHUNKS];
+	int rows = (stack->height + count - 1) / count;
+	for (int i = 0; i < count; i++) {
+		stack_chunk *chunk = chunks + i;
+		chunk->stack = stack;
+		chunk->job = job;
+		chunk->first_row = i * rows;
+		chunk->rows = chunk->first_row + rows > stack->height ? stack->height - chunk->first_row : rows;
+		chunk->dx = shift_x;
+		chunk->dy = shift_y;
+		chunk->clip = job->stack == 2;
+		chunk->kappa2 = (float)(job->stack_sigma * job->stack_sigma);
+	}
+	parallel_for(chunks, count, sizeof(stack_chunk), (void *(*)(void *))stack_chunk_process);
+	stack->frames++;
+	INDIGO_DEBUG(struct timespec end; clock_gettime(CLOCK_MONOTONIC, &end));
+	INDIGO_DEBUG(indigo_debug("Live stacking: frame %d shifted by %d, %d stacked in %gs", stack->frames, shift_x, shift_y, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9));
+	if (stack->frames % job->stack_interval) {
+		pthread_mutex_unlock(&stack->mutex);
+		return;
+	}
+	/* stacked image is rounded to original pixel format in host byte order, FITS header of current frame is reused */
+	int slot = stack->published == 0 ? 1 : 0;
+	long capacity = FITS_HEADER_SIZE + size * stack->bytes_per_pixel + 2880;
+	if (stack->capacities[slot] < capacity) {
+		if (stack->images[slot])
+			free(stack->images[slot]);
+		stack->images[slot] = malloc(capacity);
+		assert(stack->images[slot] != NULL);
+		stack->capacities[slot] = capacity;
+	}
+	unsigned char *image = stack->images[slot];
+	float max = stack->bytes_per_pixel == 2 ? 65535 : 255;
+	for (long i = 0; i < size; i++) {
+		float value = stack->mean[i] + 0.5f;
+		if (value > max)
+			value = max;
+		if (stack->bytes_per_pixel == 2)
+			((uint16_t *)(image + FITS_HEADER_SIZE))[i] = (uint16_t)value;
+		else
+			image[FITS_HEADER_SIZE + i] = (uint8_t)value;
+	}
+	memcpy(image, job->data, FITS_HEADER_SIZE);
+	for (char *card = (char *)image; card + 160 <= (char *)image + FITS_HEADER_SIZE; card += 80) {
+		if (!strncmp(card, "END     ", 8)) {
+			int t = sprintf(card, "STACKCNT= %20d / number of stacked frames", stack->frames);
+			card[t] = ' ';
+			t = sprintf(card += 80, "END");
+			card[t] = ' ';
+			break;
+		}
+	}
+	int frames = stack->frames, rejected = stack->rejected;
+	stack->published = slot;
+	image_job stack_job = *job;
+	stack_job.data = image;
+	stack_job.little_endian = HOST_LITTLE_ENDIAN;
+	stack_job.blobsize = (int)(size * stack->bytes_per_pixel);
+	stack_job.analysis = false;
+	stack_job.calibrate = false;
+	stack_job.stack = 0;
+	stack_job.local = false;
+	pthread_mutex_unlock(&stack->mutex);
+	process_image_convert(device, &stack_job);
+	process_image_publish(device, &stack_job, CCD_STACK_IMAGE_PROPERTY, "Stacked %d frames (%d rejected)", frames, rejected);
+}
+
+static void *pipeline_convert_thread(indigo_ccd_pipeline *pipeline) {
+	indigo_device *device = pipeline->device;
+	pthread_mutex_lock(&pipeline->mutex);
+	while (true) {
+		image_job *job = pipeline->convert_head;
+		if (job == NULL) {
+			if (pipeline->finish_convert)
+				break;
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+			continue;
+		}
+		if ((pipeline->convert_head = job->next) == NULL)
+			pipeline->convert_tail = NULL;
+		pthread_mutex_unlock(&pipeline->mutex);
+		process_image_convert(device, job);
+		pthread_mutex_lock(&pipeline->mutex);
+		job->next = NULL;
+		if (pipeline->output_tail)
+			pipeline->output_tail->next = job;
+		else
+			pipeline->output_head = job;
+		pipeline->output_tail = job;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
+
+static void *pipeline_output_thread(indigo_ccd_pipeline *pipeline) {
+	indigo_device *device = pipeline->device;
+	pthread_mutex_lock(&pipeline->mutex);
+	while (true) {
+		image_job *job = pipeline->output_head;
+		if (job == NULL) {
+			if (pipeline->finish_output)
+				break;
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+			continue;
+		}
+		if ((pipeline->output_head = job->next) == NULL)
+			pipeline->output_tail = NULL;
+		pthread_mutex_unlock(&pipeline->mutex);
+		process_image_output(device, job);
+		pthread_mutex_lock(&pipeline->mutex);
+		if (job->client) {
+			if (pipeline->published) {
+				pipeline->published->next = pipeline->free_jobs;
+				pipeline->free_jobs = pipeline->published;
+			}
+			pipeline->published = job;
+		} else {
+			job->next = pipeline->free_jobs;
+			pipeline->free_jobs = job;
+		}
+		pipeline->pending--;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
+
+static void pipeline_create(indigo_device *device) {
+	indigo_ccd_pipeline *pipeline = malloc(sizeof(indigo_ccd_pipeline));
+	assert(pipeline != NULL);
+	memset(pipeline, 0, sizeof(indigo_ccd_pipeline));
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	pipeline->device = device;
+	for (int i = 0; i < IMAGE_PIPELINE_DEPTH; i++) {
+		pipeline->jobs[i].next = pipeline->free_jobs;
+		pipeline->free_jobs = pipeline->jobs + i;
+	}
+	pthread_create(&pipeline->convert_thread, NULL, (void *(*)(void *))pipeline_convert_thread, pipeline);
+	pthread_create(&pipeline->output_thread, NULL, (void *(*)(void *))pipeline_output_thread, pipeline);
+	CCD_CONTEXT->pipeline = pipeline;
+}
+
+/* waits until all queued images are converted and published */
+static void pipeline_drain(indigo_device *device) {
+	indigo_ccd_pipeline *pipeline = CCD_CONTEXT->pipeline;
+	pthread_mutex_lock(&pipeline->mutex);
+	while (pipeline->pending > 0)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static void pipeline_release(indigo_device *device) {
+	indigo_ccd_pipeline *pipeline = CCD_CONTEXT->pipeline;
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->finish_convert = true;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+	pthread_join(pipeline->convert_thread, NULL);
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->finish_output = true;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+	pthread_join(pipeline->output_thread, NULL);
+	CCD_IMAGE_ITEM->blob.value = NULL;
+	CCD_IMAGE_ITEM->blob.size = 0;
+	for (int i = 0; i < IMAGE_PIPELINE_DEPTH; i++)
+		if (pipeline->jobs[i].data)
+			free(pipeline->jobs[i].data);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+	free(pipeline);
+	CCD_CONTEXT->pipeline = NULL;
+}
+
+void indigo_process_image(indigo_device *device, void *data, int frame_width, int frame_height, bool little_endian, indigo_fits_keyword *keywords) {
+	assert(device != NULL);
+	assert(data != NULL);
+	indigo_ccd_pipeline *pipeline = CCD_CONTEXT->pipeline;
+	if (pipeline == NULL) {
+		image_job job = { .data = data, .frame_width = frame_width, .frame_height = frame_height, .little_endian = little_endian };
+		process_image_header(device, &job, keywords);
+		process_image_convert(device, &job);
+		process_image_output(device, &job);
+		return;
+	}
+	INDIGO_DEBUG(clock_t start = clock());
+	pthread_mutex_lock(&pipeline->mutex);
+	while (pipeline->free_jobs == NULL)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	image_job *job = pipeline->free_jobs;
+	pipeline->free_jobs = job->next;
+	pthread_mutex_unlock(&pipeline->mutex);
+	long capacity = FITS_HEADER_SIZE + (long)CCD_FRAME_BITS_PER_PIXEL_ITEM->number.value / 8 * frame_width * frame_height + 2880;
+	if (job->capacity < capacity) {
+		if (job->data)
+			free(job->data);
+		job->data = malloc(capacity);
+		assert(job->data != NULL);
+		job->capacity = capacity;
+	}
+	job->frame_width = frame_width;
+	job->frame_height = frame_height;
+	job->little_endian = little_endian;
+	process_image_header(device, job, keywords);
+	memcpy(job->data + FITS_HEADER_SIZE, data + FITS_HEADER_SIZE, job->blobsize);
+	pthread_mutex_lock(&pipeline->mutex);
+	job->next = NULL;
+	if (pipeline->convert_tail)
+		pipeline->convert_tail->next = job;
+	else
+		pipeline->convert_head = job;
+	pipeline->convert_tail = job;
+	pipeline->pending++;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+	INDIGO_DEBUG(indigo_debug("Image queued for processing in %gs", (clock() - start) / (double)CLOCKS_PER_SEC));
+}
+
+void indigo_process_image_with_software_binning(indigo_device *device, void *data, int frame_left, int frame_top, int frame_width, int frame_height, bool little_endian, indigo_fits_keyword *keywords) {
+	assert(device != NULL);
+	assert(data != NULL);
+	INDIGO_DEBUG(clock_t start = clock());
+	int horizontal_bin = CCD_BIN_HORIZONTAL_ITEM->number.value;
+	int vertical_bin = CCD_BIN_VERTICAL_ITEM->number.value;
+	if (horizontal_bin < 1)
+		horizontal_bin = 1;
+	if (vertical_bin < 1)
+		vertical_bin = 1;
+	/* CCD_FRAME is intersected with area which was actually read */
+	int left = (int)CCD_FRAME_LEFT_ITEM->number.value - frame_left;
+	int top = (int)CCD_FRAME_TOP_ITEM->number.value - frame_top;
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	int width = (int)CCD_FRAME_WIDTH_ITEM->number.value;
+	int height = (int)CCD_FRAME_HEIGHT_ITEM->number.value;
+	if (width <= 0 || left + width > frame_width)
+		width = frame_width - left;
+	if (height <= 0 || top + height > frame_height)
+		height = frame_height - top;
+	int target_width = width / horizontal_bin;
+	int target_height = height / vertical_bin;
+	int bytes_per_pixel = CCD_FRAME_BITS_PER_PIXEL_ITEM->number.value / 8;
+	int components = bytes_per_pixel == 3 ? 3 : 1;
+	if (bytes_per_pixel == 3)
+		bytes_per_pixel = 1;
+	if (target_width < 1 || target_height < 1) {
+		indigo_error("Software binning: empty frame");
+		return;
+	}
+	if (horizontal_bin == 1 && vertical_bin == 1 && left == 0 && top == 0 && target_width == frame_width && target_height == frame_height) {
+		indigo_process_image(device, data, frame_width, frame_height, little_endian, keywords);
+		return;
+	}
+	if (bytes_per_pixel == 2 && little_endian != HOST_LITTLE_ENDIAN) {
+		swap_16bit(data + FITS_HEADER_SIZE, (long)frame_width * frame_height);
+		little_endian = HOST_LITTLE_ENDIAN;
+	}
+	bin_image(data + FITS_HEADER_SIZE, frame_width, left, top, target_width, target_height, components, bytes_per_pixel, horizontal_bin, vertical_bin, CCD_BIN_MODE_AVERAGE_ITEM->sw.value);
+	INDIGO_DEBUG(indigo_debug("Software %dx%d binning of %dx%d frame to %dx%d in %gs", horizontal_bin, vertical_bin, frame_width, frame_height, target_width, target_height, (clock() - start) / (double)CLOCKS_PER_SEC));
+	indigo_process_image(device, data, target_width, target_height, little_endian, keywords);
+}
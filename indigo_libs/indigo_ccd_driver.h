@@ -165,6 +165,18 @@ extern "C" {
  */
 #define CCD_BIN_VERTICAL_ITEM             (CCD_BIN_PROPERTY->items+1)
 
+/** CCD_BIN_MODE property pointer, property is optional (hidden by default, drivers using software binning should show it), property change request is fully handled by indigo_ccd_change_property().
+ */
+#define CCD_BIN_MODE_PROPERTY             (CCD_CONTEXT->ccd_bin_mode_property)
+
+/** CCD_BIN_MODE.SUM property item pointer.
+ */
+#define CCD_BIN_MODE_SUM_ITEM             (CCD_BIN_MODE_PROPERTY->items+0)
+
+/** CCD_BIN_MODE.AVERAGE property item pointer.
+ */
+#define CCD_BIN_MODE_AVERAGE_ITEM         (CCD_BIN_MODE_PROPERTY->items+1)
+
 /** CCD_MODE property pointer, property is mandatory.
  */
 #define CCD_MODE_PROPERTY									(CCD_CONTEXT->ccd_mode_property)
@@ -233,6 +245,10 @@ extern "C" {
  */
 #define CCD_IMAGE_FORMAT_JPEG_ITEM        (CCD_IMAGE_FORMAT_PROPERTY->items+2)
 
+/** CCD_IMAGE_FORMAT.FITS_RICE property item pointer.
+ */
+#define CCD_IMAGE_FORMAT_FITS_RICE_ITEM   (CCD_IMAGE_FORMAT_PROPERTY->items+3)
+
 /** CCD_IMAGE_FILE property pointer, property is mandatory, read-only property.
  */
 #define CCD_IMAGE_FILE_PROPERTY           (CCD_CONTEXT->ccd_image_file_property)
@@ -241,6 +257,112 @@ extern "C" {
  */
 #define CCD_IMAGE_FILE_ITEM               (CCD_IMAGE_FILE_PROPERTY->items+0)
 
+/** CCD_IMAGE_ANALYSIS property pointer, property is mandatory, property change request is fully handled by indigo_ccd_change_property().
+ */
+#define CCD_IMAGE_ANALYSIS_PROPERTY       (CCD_CONTEXT->ccd_image_analysis_property)
+
+/** CCD_IMAGE_ANALYSIS.ENABLED property item pointer.
+ */
+#define CCD_IMAGE_ANALYSIS_ENABLED_ITEM   (CCD_IMAGE_ANALYSIS_PROPERTY->items+0)
+
+/** CCD_IMAGE_ANALYSIS.DISABLED property item pointer.
+ */
+#define CCD_IMAGE_ANALYSIS_DISABLED_ITEM  (CCD_IMAGE_ANALYSIS_PROPERTY->items+1)
+
+/** CCD_IMAGE_STATS property pointer, property is mandatory, read-only property, it is updated by indigo_process_image() if image analysis is enabled.
+ */
+#define CCD_IMAGE_STATS_PROPERTY          (CCD_CONTEXT->ccd_image_stats_property)
+
+/** CCD_IMAGE_STATS.MIN property item pointer.
+ */
+#define CCD_IMAGE_STATS_MIN_ITEM          (CCD_IMAGE_STATS_PROPERTY->items+0)
+
+/** CCD_IMAGE_STATS.MAX property item pointer.
+ */
+#define CCD_IMAGE_STATS_MAX_ITEM          (CCD_IMAGE_STATS_PROPERTY->items+1)
+
+/** CCD_IMAGE_STATS.MEAN property item pointer.
+ */
+#define CCD_IMAGE_STATS_MEAN_ITEM         (CCD_IMAGE_STATS_PROPERTY->items+2)
+
+/** CCD_IMAGE_STATS.MEDIAN property item pointer.
+ */
+#define CCD_IMAGE_STATS_MEDIAN_ITEM       (CCD_IMAGE_STATS_PROPERTY->items+3)
+
+/** CCD_IMAGE_STATS.BACKGROUND property item pointer.
+ */
+#define CCD_IMAGE_STATS_BACKGROUND_ITEM   (CCD_IMAGE_STATS_PROPERTY->items+4)
+
+/** CCD_IMAGE_STATS.NOISE property item pointer.
+ */
+#define CCD_IMAGE_STATS_NOISE_ITEM        (CCD_IMAGE_STATS_PROPERTY->items+5)
+
+/** CCD_IMAGE_STATS.STARS property item pointer.
+ */
+#define CCD_IMAGE_STATS_STARS_ITEM        (CCD_IMAGE_STATS_PROPERTY->items+6)
+
+/** CCD_IMAGE_STATS.HFR property item pointer.
+ */
+#define CCD_IMAGE_STATS_HFR_ITEM          (CCD_IMAGE_STATS_PROPERTY->items+7)
+
+/** CCD_IMAGE_STATS.FWHM property item pointer.
+ */
+#define CCD_IMAGE_STATS_FWHM_ITEM         (CCD_IMAGE_STATS_PROPERTY->items+8)
+
+/** CCD_STACK property pointer, property is mandatory, property change request is fully handled by indigo_ccd_change_property(), any change restarts the stack.
+ */
+#define CCD_STACK_PROPERTY                (CCD_CONTEXT->ccd_stack_property)
+
+/** CCD_STACK.DISABLED property item pointer.
+ */
+#define CCD_STACK_DISABLED_ITEM           (CCD_STACK_PROPERTY->items+0)
+
+/** CCD_STACK.MEAN property item pointer.
+ */
+#define CCD_STACK_MEAN_ITEM               (CCD_STACK_PROPERTY->items+1)
+
+/** CCD_STACK.SIGMA_CLIP property item pointer.
+ */
+#define CCD_STACK_SIGMA_CLIP_ITEM         (CCD_STACK_PROPERTY->items+2)
+
+/** CCD_STACK_SETTINGS property pointer, property is mandatory, property change request is fully handled by indigo_ccd_change_property().
+ */
+#define CCD_STACK_SETTINGS_PROPERTY       (CCD_CONTEXT->ccd_stack_settings_property)
+
+/** CCD_STACK_SETTINGS.INTERVAL property item pointer (stacked image is published after every INTERVAL frames).
+ */
+#define CCD_STACK_SETTINGS_INTERVAL_ITEM  (CCD_STACK_SETTINGS_PROPERTY->items+0)
+
+/** CCD_STACK_SETTINGS.SIGMA property item pointer (rejection threshold of SIGMA_CLIP mode).
+ */
+#define CCD_STACK_SETTINGS_SIGMA_ITEM     (CCD_STACK_SETTINGS_PROPERTY->items+1)
+
+/** CCD_STACK_IMAGE property pointer, property is mandatory, read-only property.
+ */
+#define CCD_STACK_IMAGE_PROPERTY          (CCD_CONTEXT->ccd_stack_image_property)
+
+/** CCD_STACK_IMAGE.IMAGE property item pointer.
+ */
+#define CCD_STACK_IMAGE_ITEM              (CCD_STACK_IMAGE_PROPERTY->items+0)
+
+/** CCD_CALIBRATION property pointer, property is mandatory, property change request is fully handled by indigo_ccd_change_property(),
+ masters are loaded to memory for current mode, binning and gain and applied to light frames of the same size, empty file name disables the master.
+ Masters of last few modes are kept, property shows masters of the selected one.
+ */
+#define CCD_CALIBRATION_PROPERTY          (CCD_CONTEXT->ccd_calibration_property)
+
+/** CCD_CALIBRATION.DARK property item pointer (master dark FITS file, subtracted instead of bias).
+ */
+#define CCD_CALIBRATION_DARK_ITEM         (CCD_CALIBRATION_PROPERTY->items+0)
+
+/** CCD_CALIBRATION.BIAS property item pointer (master bias FITS file, subtracted from lights without dark and from flat).
+ */
+#define CCD_CALIBRATION_BIAS_ITEM         (CCD_CALIBRATION_PROPERTY->items+1)
+
+/** CCD_CALIBRATION.FLAT property item pointer (master flat FITS file, lights are divided by normalized flat).
+ */
+#define CCD_CALIBRATION_FLAT_ITEM         (CCD_CALIBRATION_PROPERTY->items+2)
+
 /** CCD_IMAGE property pointer, property is mandatory, read-only property.
  */
 #define CCD_IMAGE_PROPERTY                (CCD_CONTEXT->ccd_image_property)
@@ -310,6 +432,7 @@ typedef struct {
 	indigo_property *ccd_abort_exposure_property; ///< CCD_ABORT_EXPOSURE property pointer
 	indigo_property *ccd_frame_property;          ///< CCD_FRAME property pointer
 	indigo_property *ccd_bin_property;            ///< CCD_BIN property pointer
+	indigo_property *ccd_bin_mode_property;       ///< CCD_BIN_MODE property pointer
 	indigo_property *ccd_offset_property;         ///< CCD_OFFSET property pointer
 	indigo_property *ccd_gain_property;           ///< CCD_GAIN property pointer
 	indigo_property *ccd_gamma_property;          ///< CCD_GAMMA property pointer
@@ -317,9 +440,19 @@ typedef struct {
 	indigo_property *ccd_image_format_property;   ///< CCD_IMAGE_FORMAT property pointer
 	indigo_property *ccd_image_property;          ///< CCD_IMAGE property pointer
 	indigo_property *ccd_image_file_property;     ///< CCD_IMAGE_FILE property pointer
+	indigo_property *ccd_image_analysis_property; ///< CCD_IMAGE_ANALYSIS property pointer
+	indigo_property *ccd_image_stats_property;    ///< CCD_IMAGE_STATS property pointer
+	indigo_property *ccd_stack_property;          ///< CCD_STACK property pointer
+	indigo_property *ccd_stack_settings_property; ///< CCD_STACK_SETTINGS property pointer
+	indigo_property *ccd_stack_image_property;    ///< CCD_STACK_IMAGE property pointer
+	indigo_property *ccd_calibration_property;    ///< CCD_CALIBRATION property pointer
 	indigo_property *ccd_temperature_property;    ///< CCD_TEMPERATURE property pointer
 	indigo_property *ccd_cooler_property;         ///< CCD_COOLER property pointer
 	indigo_property *ccd_cooler_power_property;   ///< CCD_COOLER_POWER property pointer
+	struct indigo_ccd_pipeline *pipeline;         ///< image processing pipeline (if enabled)
+	struct indigo_ccd_stack *stack;               ///< live stacking state
+	struct indigo_ccd_calibration *calibration;   ///< calibration masters loaded to memory
+	pthread_mutex_t image_mutex;                  ///< recursive lock for updates of image properties (they are published by pipeline threads too)
 } indigo_ccd_context;
 
 /** Suspend countdown.
@@ -356,10 +489,34 @@ typedef struct {
 	const char *comment;
 } indigo_fits_keyword;
 
+/** Preallocate space for locally saved images (Linux only).
+ */
+extern bool indigo_local_write_preallocate;
+
+/** Bypass page cache when locally saved images are written by image pipeline (O_DIRECT on Linux, F_NOCACHE on macOS).
+ */
+extern bool indigo_local_write_direct;
+
+/** Fsync locally saved images in batches of given number of files (or when writer queue is empty), 0 = never. Without image pipeline any non-zero value means fsync of each file.
+ */
+extern int indigo_local_write_fsync_batch;
+
+/** Process images on per-device pipeline threads. Image is copied to pooled buffer and indigo_process_image() returns as soon as FITS header
+ is written, conversion, local save and upload overlap with next exposure. Must be set before CCD devices are attached.
+ CCD_IMAGE, CCD_IMAGE_FILE, CCD_IMAGE_STATS and CCD_STACK_IMAGE are then updated from pipeline threads, drivers updating them directly should hold CCD_CONTEXT->image_mutex.
+ */
+extern bool indigo_use_image_pipeline;
+
 /** Process raw image in image buffer (starting on data + FITS_HEADER_SIZE offset).
+ If image pipeline is enabled, buffer can be reused by driver immediately after return.
  */
 extern void indigo_process_image(indigo_device *device, void *data, int frame_width, int frame_height, bool little_endian, indigo_fits_keyword *keywords);
 
+/** Crop and bin unbinned raw image read from sensor area frame_left, frame_top, frame_width x frame_height to CCD_FRAME and CCD_BIN
+ in place (summed or averaged according to CCD_BIN_MODE) and process it by indigo_process_image().
+ */
+extern void indigo_process_image_with_software_binning(indigo_device *device, void *data, int frame_left, int frame_top, int frame_width, int frame_height, bool little_endian, indigo_fits_keyword *keywords);
+
 #ifdef __cplusplus
 }
 #endif
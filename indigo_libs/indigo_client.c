@@ -39,11 +39,21 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "indigo_client_xml.h"
+#include "indigo_io.h"
 #include "indigo_client.h"
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reconnect_cond = PTHREAD_COND_INITIALIZER;
+
+int indigo_server_connect_timeout = 5000;
+int indigo_server_reconnect_min_delay = 500;
+int indigo_server_reconnect_max_delay = 30000;
+int indigo_server_keepalive = 10;
+void (*indigo_server_state_handler)(indigo_server_entry *server) = NULL;
 
 indigo_driver_entry indigo_available_drivers[INDIGO_MAX_DRIVERS];
 indigo_server_entry indigo_available_servers[INDIGO_MAX_SERVERS];
@@ -120,6 +130,55 @@ indigo_result indigo_add_driver(driver_entry_point entry_point, bool init, indig
 	return add_driver(entry_point, NULL, init, driver);
 }
 
+static double elapsed_ms(struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+typedef struct {
+	indigo_driver_entry **drivers;
+	int count;
+	int next;
+} init_queue;
+
+static void *init_thread(init_queue *queue) {
+	while (true) {
+		int index = __sync_fetch_and_add(&queue->next, 1);
+		if (index >= queue->count)
+			break;
+		indigo_driver_entry *driver = queue->drivers[index];
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		driver->initialized = driver->driver(INDIGO_DRIVER_INIT, NULL) == INDIGO_OK;
+		driver->init_time = elapsed_ms(&start);
+		if (driver->initialized) {
+			INDIGO_LOG(indigo_log("Driver %s initialized in %.1fms", driver->name, driver->init_time));
+		} else {
+			INDIGO_ERROR(indigo_error("Driver %s failed to initialize in %.1fms", driver->name, driver->init_time));
+		}
+	}
+	return NULL;
+}
+
+void indigo_init_drivers(indigo_driver_entry **drivers, int count) {
+	/* initialization is dominated by USB and network enumeration, not CPU */
+	init_queue queue = { drivers, count, 0 };
+	pthread_t threads[INDIGO_MAX_INIT_THREADS];
+	int thread_count = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (thread_count < INDIGO_MAX_INIT_THREADS - 1 && thread_count < count - 1) {
+		if (pthread_create(&threads[thread_count], NULL, (void *(*)(void *))init_thread, &queue) != 0)
+			break;
+		thread_count++;
+	}
+	init_thread(&queue);
+	for (int i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	INDIGO_LOG(indigo_log("%d drivers initialized in %.1fms", count, elapsed_ms(&start)));
+}
+
 #if defined(INDIGO_MACOS)
 #define SO_NAME ".dylib"
 #else
@@ -172,43 +231,101 @@ void indigo_service_name(const char *host, int port, char *name) {
 	}
 }
 
+static void set_server_state(indigo_server_entry *server, indigo_server_state state) {
+	if (server->state != state) {
+		server->state = state;
+		if (indigo_server_state_handler != NULL)
+			indigo_server_state_handler(server);
+	}
+}
+
+static void reconnect_delay(indigo_server_entry *server, unsigned *seed) {
+	/* exponential backoff, random jitter spreads reconnections of many clients after remote server restart */
+	long delay = indigo_server_reconnect_min_delay;
+	for (int i = 1; i < server->attempt && delay < indigo_server_reconnect_max_delay; i++)
+		delay *= 2;
+	if (delay > indigo_server_reconnect_max_delay)
+		delay = indigo_server_reconnect_max_delay;
+	delay = delay / 2 + rand_r(seed) % (delay / 2 + 1);
+	INDIGO_DEBUG(indigo_debug("Server %s:%d reconnect in %ldms", server->host, server->port, delay));
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += delay / 1000;
+	deadline.tv_nsec += (delay % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&mutex);
+	while (server->socket >= 0) {
+		if (pthread_cond_timedwait(&reconnect_cond, &mutex, &deadline) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
 static void *server_thread(indigo_server_entry *server) {
 	INDIGO_LOG(indigo_log("Server %s:%d thread started", server->host, server->port));
+	unsigned seed = (unsigned)time(NULL) ^ (unsigned)(intptr_t)server;
+	server->attempt = 0;
 	while (server->socket >= 0) {
-		server->socket = 0;
-		struct hostent *host_entry = gethostbyname(server->host);
-		if (host_entry == NULL) {
-			INDIGO_ERROR(indigo_error("Can't resolve host name %s (%s)", server->host, strerror(errno)));
-		} else if ((server->socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-			INDIGO_ERROR(indigo_error("Can't create socket (%s)", strerror(errno)));
+		bool unix_socket = *server->host == '/';
+		set_server_state(server, INDIGO_SERVER_CONNECTING);
+		int handle;
+		if (unix_socket) {
+			/* host name starting with '/' is unix domain socket path of local server */
+			handle = indigo_open_unix(server->host);
 		} else {
-			struct sockaddr_in serv_addr;
-			memcpy(&serv_addr.sin_addr, host_entry->h_addr_list[0], host_entry->h_length);
-			serv_addr.sin_family = AF_INET;
-			serv_addr.sin_port = htons(server->port);
-			if (connect(server->socket, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-				close(server->socket);
-				server->socket = 0;
+			handle = indigo_connect_tcp(server->host, server->port, indigo_server_connect_timeout);
+			if (handle >= 0 && indigo_server_keepalive > 0)
+				indigo_set_keepalive(handle, indigo_server_keepalive, 2, 3);
+		}
+		if (handle < 0) {
+			if (server->attempt == 0) {
+				INDIGO_ERROR(indigo_error("Can't connect to server %s:%d (%s)", server->host, server->port, strerror(errno)));
+			} else {
+				INDIGO_DEBUG(indigo_debug("Can't connect to server %s:%d (%s)", server->host, server->port, strerror(errno)));
+			}
+		} else {
+			pthread_mutex_lock(&mutex);
+			if (server->socket < 0) {
+				close(handle);
+				handle = -1;
+			} else {
+				server->socket = handle;
 			}
+			pthread_mutex_unlock(&mutex);
 		}
-		if (server->socket > 0) {
+		if (handle >= 0) {
+			server->attempt = 0;
 			if (*server->name == 0) {
 				indigo_service_name(server->host, server->port, server->name);
 			}
-			char  url[INDIGO_NAME_SIZE];
-			snprintf(url, sizeof(url), "http://%s:%d", server->host, server->port);
+			char  url[INDIGO_NAME_SIZE] = "";
+			if (!unix_socket)
+				snprintf(url, sizeof(url), "http://%s:%d", server->host, server->port);
 			INDIGO_LOG(indigo_log("Server %s:%d (%s, %s) connected", server->host, server->port, server->name, url));
-			server->protocol_adapter = indigo_xml_client_adapter(server->name, url, server->socket, server->socket);
+			set_server_state(server, INDIGO_SERVER_CONNECTED);
+			server->protocol_adapter = indigo_xml_client_adapter(server->name, url, handle, handle);
 			indigo_attach_device(server->protocol_adapter);
 			indigo_xml_parse(server->protocol_adapter, NULL);
 			indigo_detach_device(server->protocol_adapter);
 			free(server->protocol_adapter->device_context);
 			free(server->protocol_adapter);
-			close(server->socket);
+			pthread_mutex_lock(&mutex);
+			if (server->socket >= 0)
+				server->socket = 0;
+			pthread_mutex_unlock(&mutex);
+			close(handle);
 			INDIGO_LOG(indigo_log("Server %s:%d disconnected", server->host, server->port));
 		}
-		sleep(5);
+		if (server->socket >= 0) {
+			server->attempt++;
+			set_server_state(server, INDIGO_SERVER_FAILED);
+			reconnect_delay(server, &seed);
+		}
 	}
+	set_server_state(server, INDIGO_SERVER_IDLE);
 	server->thread_started = false;
 	INDIGO_LOG(indigo_log("Server %s:%d thread stopped", server->host, server->port));
 	return NULL;
@@ -218,7 +335,7 @@ indigo_result indigo_connect_server(const char *name, const char *host, int port
 	int empty_slot = used_server_slots;
 	pthread_mutex_lock(&mutex);
 	for (int dc = 0; dc < used_server_slots;  dc++) {
-		if (indigo_available_servers[dc].socket > 0 && !strcmp(indigo_available_servers[dc].host, host) && indigo_available_servers[dc].port == port) {
+		if (indigo_available_servers[dc].thread_started && !strcmp(indigo_available_servers[dc].host, host) && indigo_available_servers[dc].port == port) {
 			INDIGO_LOG(indigo_log("Server %s:%d already connected", indigo_available_servers[dc].host, indigo_available_servers[dc].port));
 			if (server != NULL)
 				*server = &indigo_available_servers[dc];
@@ -240,6 +357,7 @@ indigo_result indigo_connect_server(const char *name, const char *host, int port
 	strncpy(indigo_available_servers[empty_slot].host, host, INDIGO_NAME_SIZE);
 	indigo_available_servers[empty_slot].port = port;
 	indigo_available_servers[empty_slot].socket = 0;
+	indigo_available_servers[empty_slot].state = INDIGO_SERVER_IDLE;
 	if (pthread_create(&indigo_available_servers[empty_slot].thread, NULL, (void*)(void *)server_thread, &indigo_available_servers[empty_slot]) != 0) {
 		pthread_mutex_unlock(&mutex);
 		return INDIGO_FAILED;
@@ -256,9 +374,11 @@ indigo_result indigo_connect_server(const char *name, const char *host, int port
 indigo_result indigo_disconnect_server(indigo_server_entry *server) {
 	assert(server != NULL);
 	pthread_mutex_lock(&mutex);
+	/* socket is closed by server thread, shutdown just terminates the parser */
 	if (server->socket > 0)
-		close(server->socket);
+		shutdown(server->socket, SHUT_RDWR);
 	server->socket = -1;
+	pthread_cond_broadcast(&reconnect_cond);
 	pthread_mutex_unlock(&mutex);
 	return INDIGO_OK;
 }
@@ -267,7 +387,16 @@ static void *subprocess_thread(indigo_subprocess_entry *subprocess) {
 	INDIGO_LOG(indigo_log("Subprocess %s thread started", subprocess->executable));
 	while (subprocess->pid >= 0) {
 		int input[2], output[2];
-		if (pipe(input) < 0 || pipe(output) < 0) {
+		if (indigo_use_shared_blobs) {
+			/* unix domain socket instead of pipes lets INDIGO aware subprocess deliver BLOBs in shared memory, shared BLOBs are requested
+			   only after subprocess switched to INDIGO protocol, so INDI drivers just read and write the socket as they would pipes */
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, input) < 0) {
+				INDIGO_ERROR(indigo_error("Can't create local socket for subprocess %s (%s)", subprocess->executable, strerror(errno)));
+				return NULL;
+			}
+			output[0] = input[1];
+			output[1] = input[0];
+		} else if (pipe(input) < 0 || pipe(output) < 0) {
 			INDIGO_ERROR(indigo_error("Can't create local pipe for subprocess %s (%s)", subprocess->executable, strerror(errno)));
 			return NULL;
 		}
@@ -280,10 +409,14 @@ static void *subprocess_thread(indigo_subprocess_entry *subprocess) {
 			dup2(output[0], 0);
 			close(1);
 			dup2(input[1], 1);
+			close(input[0]);
+			if (output[1] != input[0])
+				close(output[1]);
 			execl(subprocess->executable, subprocess->executable, NULL);
 		} else {
 			close(input[1]);
-			close(output[0]);
+			if (output[0] != input[1])
+				close(output[0]);
 			subprocess->protocol_adapter = indigo_xml_client_adapter(subprocess->executable, "", input[0], output[1]);
 			indigo_attach_device(subprocess->protocol_adapter);
 			indigo_xml_parse(subprocess->protocol_adapter, NULL);
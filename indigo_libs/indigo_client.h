@@ -38,6 +38,7 @@ extern "C" {
 
 #define INDIGO_MAX_DRIVERS    100
 #define INDIGO_MAX_SERVERS    10
+#define INDIGO_MAX_INIT_THREADS	8
 
 /** Driver entry type.
  */
@@ -47,8 +48,18 @@ typedef struct {
 	driver_entry_point driver;              ///< driver entry point
 	void *dl_handle;                        ///< dynamic library handle (NULL for statically linked driver)
 	bool initialized;												///< driver is initialized
+	double init_time;                       ///< duration of last initialization in ms
 } indigo_driver_entry;
 
+/** Remote server connection state.
+ */
+typedef enum {
+	INDIGO_SERVER_IDLE = 0,                 ///< thread is not running
+	INDIGO_SERVER_CONNECTING,               ///< connection attempt in progress
+	INDIGO_SERVER_CONNECTED,                ///< connection established
+	INDIGO_SERVER_FAILED                    ///< connection failed or lost, waiting for next attempt
+} indigo_server_state;
+
 /** Remote server entry type.
  */
 typedef struct {
@@ -59,6 +70,8 @@ typedef struct {
 	bool thread_started;                    ///< client thread started/stopped
 	int socket;                             ///< stream socket
 	indigo_device *protocol_adapter;        ///< server protocol adapter
+	indigo_server_state state;              ///< connection state
+	int attempt;                            ///< failed connection attempts since last successful one
 } indigo_server_entry;
 
 /** Remote server entry type.
@@ -71,6 +84,23 @@ typedef struct {
 	indigo_device *protocol_adapter;        ///< server protocol adapter
 } indigo_subprocess_entry;
 
+/** Remote server connect timeout in ms.
+ */
+extern int indigo_server_connect_timeout;
+
+/** Minimal and maximal delay between remote server reconnection attempts in ms (exponential backoff with jitter).
+ */
+extern int indigo_server_reconnect_min_delay;
+extern int indigo_server_reconnect_max_delay;
+
+/** TCP keepalive idle time for remote server connections in seconds (0 disables keepalive).
+ */
+extern int indigo_server_keepalive;
+
+/** Remote server connection state change handler (called from server thread).
+ */
+extern void (*indigo_server_state_handler)(indigo_server_entry *server);
+
 /** Array of all available drivers (statically & dynamically linked).
  */
 extern indigo_driver_entry indigo_available_drivers[INDIGO_MAX_DRIVERS];
@@ -91,6 +121,10 @@ extern indigo_result indigo_add_driver(driver_entry_point entry_point, bool init
  */
 extern indigo_result indigo_remove_driver(indigo_driver_entry *driver);
 
+/** Initialize drivers concurrently on up to INDIGO_MAX_INIT_THREADS threads and log duration of each initialization.
+ */
+extern void indigo_init_drivers(indigo_driver_entry **drivers, int count);
+
 /** Load & add dynamically linked driver.
  */
 extern indigo_result indigo_load_driver(const char *name, bool init, indigo_driver_entry **driver);
@@ -99,7 +133,7 @@ extern indigo_result indigo_load_driver(const char *name, bool init, indigo_driv
  */
 void indigo_service_name(const char *host, int port, char *name);
 
-/** Connect and start thread for remote server.
+/** Connect and start thread for remote server (host name starting with '/' is path of server unix domain socket).
  */
 extern indigo_result indigo_connect_server(const char *name, const char *host, int port, indigo_server_entry **server);
 
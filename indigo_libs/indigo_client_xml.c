@@ -127,7 +127,8 @@ static indigo_result xml_client_parser_detach(indigo_device *device) {
 	assert(device != NULL);
 	indigo_adapter_context *device_context = (indigo_adapter_context *)device->device_context;
 	close(device_context->input);
-	close(device_context->output);
+	if (device_context->output != device_context->input)
+		close(device_context->output);
 	return INDIGO_OK;
 }
 
@@ -137,7 +138,8 @@ indigo_device *indigo_xml_client_adapter(char *name, char *url_prefix, int input
 		NULL,
 		xml_client_parser_enumerate_properties,
 		xml_client_parser_change_property,
-		xml_client_parser_detach
+		xml_client_parser_detach,
+		NULL
 	};
 	indigo_device *device = malloc(sizeof(indigo_device));
 	assert(device != NULL);
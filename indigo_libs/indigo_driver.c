@@ -130,9 +130,13 @@ static void refresh_ports(indigo_device *device) {
 #endif
 }
 
+bool indigo_use_device_executors = false;
+
 indigo_result indigo_device_attach(indigo_device *device, indigo_version version, int interface) {
 	assert(device != NULL);
 	assert(device != NULL);
+	if (device->executor == NULL && indigo_use_device_executors)
+		device->executor = indigo_executor_create();
 	if (DEVICE_CONTEXT == NULL) {
 		device->device_context = malloc(sizeof(indigo_device_context));
 		assert(DEVICE_CONTEXT != NULL);
@@ -303,6 +307,10 @@ indigo_result indigo_device_change_property(indigo_device *device, indigo_client
 indigo_result indigo_device_detach(indigo_device *device) {
 	assert(device != NULL);
 	indigo_cancel_all_timers(device);
+	if (device->executor != NULL) {
+		indigo_executor_release(device->executor);
+		device->executor = NULL;
+	}
 	indigo_release_property(CONNECTION_PROPERTY);
 	indigo_release_property(INFO_PROPERTY);
 	indigo_release_property(DEVICE_PORT_PROPERTY);
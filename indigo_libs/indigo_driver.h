@@ -232,6 +232,11 @@ typedef struct {
 
 #define IS_CONNECTED	(CONNECTION_CONNECTED_ITEM->sw.value && CONNECTION_PROPERTY->state == INDIGO_OK_STATE)
 
+/** Create serial executor for each attached device, so its timer callbacks and property change requests never run concurrently.
+ Drivers can also set device->executor explicitly before calling indigo_device_attach().
+ */
+extern bool indigo_use_device_executors;
+
 /** Attach callback function.
  */
 extern indigo_result indigo_device_attach(indigo_device *device, indigo_version version, int interface);
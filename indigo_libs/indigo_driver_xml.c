@@ -44,6 +44,9 @@
 #include <ctype.h>
 #include <pthread.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
 
 #include "indigo_xml.h"
 #include "indigo_io.h"
@@ -54,7 +57,62 @@
 #define RAW_BUF_SIZE 98304
 #define BASE64_BUF_SIZE 131072  /* BASE64_BUF_SIZE >= (RAW_BUF_SIZE + 2) / 3 * 4 */
 
-static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+indigo_blob_policy indigo_xml_blob_policy = INDIGO_BLOB_POLICY_DELIVER_ALL;
+
+/* protects static buffers used by message_attribute() and indigo_xml_escape() */
+static pthread_mutex_t format_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	char *data;
+	long length;
+	long size;
+} xml_output;
+
+/* BLOB value copy shared by all clients the same update is queued for */
+typedef struct blob_snapshot {
+	struct blob_snapshot *next;
+	int references;
+	indigo_item *source;						///< original item
+	void *source_value;						///< original item value
+	long size;
+	bool encoded;
+	unsigned long sequence;				///< update broadcast the copy was made for
+	char data[];
+} blob_snapshot;
+
+/* protects live snapshot list and reference counts */
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static blob_snapshot *snapshots = NULL;
+
+typedef struct output_entry {
+	struct output_entry *next;
+	xml_output text;							///< formatted message or NULL
+	indigo_property *blob_property;	///< BLOB property snapshot or NULL
+	blob_snapshot **blob_values;		///< shared item values of BLOB property snapshot
+	indigo_item *blob_items;			///< items of original BLOB property, BLOB URL refers to them
+	char message[INDIGO_VALUE_SIZE];
+	bool has_message;
+} output_entry;
+
+/* indigo_adapter_context must be the first member, the adapter is used as indigo_adapter_context elsewhere */
+typedef struct {
+	indigo_adapter_context context;
+	pthread_mutex_t mutex;
+	pthread_cond_t signal;
+	pthread_t writer;
+	bool writer_started;
+	bool writer_exit;
+	int writer_handle;
+	output_entry *head;
+	output_entry *tail;
+	long bytes_queued;
+	long bytes_sent;
+	long blobs_sent;
+	long blobs_skipped;
+	indigo_shared_buffer *shared_buffers[INDIGO_SHARED_BUFFER_SLOTS];
+	long shared_capacities[INDIGO_SHARED_BUFFER_SLOTS];
+	int shared_next;
+} xml_adapter_context;
 
 static const char *message_attribute(const char *message) {
 	if (message) {
@@ -65,177 +123,503 @@ static const char *message_attribute(const char *message) {
 	return "";
 }
 
+static void xml_printf(xml_output *output, const char *format, ...) {
+	va_list args;
+	if (output->data == NULL) {
+		output->size = 4096;
+		output->data = malloc(output->size);
+		assert(output->data != NULL);
+	}
+	while (true) {
+		va_start(args, format);
+		long length = vsnprintf(output->data + output->length, output->size - output->length, format, args);
+		va_end(args);
+		if (output->length + length < output->size) {
+			output->length += length;
+			break;
+		}
+		output->size = (output->size + length) * 2 + 1024;
+		output->data = realloc(output->data, output->size);
+		assert(output->data != NULL);
+	}
+}
+
+static bool blob_pass_through(indigo_client *client, indigo_property *property, indigo_item *item) {
+	/* payload received from remote server can be forwarded as is only in the same (2.0) encoding */
+	return item->blob.encoded_value != NULL && item->blob.encoded_size == (item->blob.size + 2) / 3 * 4 && property->version >= INDIGO_VERSION_2_0 && (client->enable_blob == INDIGO_ENABLE_BLOB_ALSO || client->enable_blob == INDIGO_ENABLE_BLOB_ONLY);
+}
+
+/* returns slot of free reusable buffer big enough for the BLOB, *fd is set if the buffer is new and must be sent with the message */
+static int shared_buffer_slot(xml_adapter_context *client_context, long size, int *fd) {
+	*fd = -1;
+	for (int i = 0; i < INDIGO_SHARED_BUFFER_SLOTS; i++) {
+		int slot = (client_context->shared_next + i) % INDIGO_SHARED_BUFFER_SLOTS;
+		indigo_shared_buffer *buffer = client_context->shared_buffers[slot];
+		if (buffer != NULL && !__sync_bool_compare_and_swap(&buffer->busy, 0, 1))
+			continue;
+		if (buffer == NULL || client_context->shared_capacities[slot] < size) {
+			if (buffer != NULL)
+				munmap(buffer, INDIGO_SHARED_BUFFER_HEADER + client_context->shared_capacities[slot]);
+			client_context->shared_buffers[slot] = NULL;
+			/* some headroom for frames of varying size */
+			long capacity = size + size / 8;
+			if ((*fd = indigo_shared_buffer_create(capacity, &buffer)) < 0)
+				return -1;
+			buffer->busy = 1;
+			client_context->shared_buffers[slot] = buffer;
+			client_context->shared_capacities[slot] = capacity;
+		}
+		client_context->shared_next = (slot + 1) % INDIGO_SHARED_BUFFER_SLOTS;
+		return slot;
+	}
+	return -1;
+}
+
+static long xml_write_blob_vector(indigo_client *client, int handle, indigo_property *property, indigo_item *url_items, const char *message) {
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	long bytes_sent = 0;
+	xml_output output = { 0 };
+	pthread_mutex_lock(&format_mutex);
+	xml_printf(&output, "<setBLOBVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
+	pthread_mutex_unlock(&format_mutex);
+	if (property->state == INDIGO_OK_STATE) {
+		for (int i = 0; i < property->count; i++) {
+			indigo_item *item = &property->items[i];
+			long input_length = item->blob.size;
+			unsigned char *data = item->blob.value;
+			int shared_fd, slot;
+			if (client->enable_blob == INDIGO_ENABLE_BLOB_URL) {
+				if (*item->blob.url == 0)
+					xml_printf(&output, "<oneBLOB name='%s' path='/blob/%p%s'/>\n", indigo_item_name(client->version, property, item), url_items + i, item->blob.format);
+				else
+					xml_printf(&output, "<oneBLOB name='%s' url='%s'/>\n", indigo_item_name(client->version, property, item), item->blob.url);
+			} else if (client->enable_blob == INDIGO_ENABLE_BLOB_SHARED && input_length > 0 && data != NULL && (slot = shared_buffer_slot(client_context, input_length, &shared_fd)) >= 0) {
+				/* reusable buffer is released by the receiver, descriptor is sent only when the buffer is (re)allocated */
+				memcpy((char *)client_context->shared_buffers[slot] + INDIGO_SHARED_BUFFER_HEADER, data, input_length);
+				indigo_write(handle, output.data, output.length);
+				bytes_sent += output.length;
+				output.length = 0;
+				char buffer[INDIGO_VALUE_SIZE];
+				int length = snprintf(buffer, sizeof(buffer), "<oneBLOB name='%s' format='%s' size='%ld' slot='%d'%s/>\n", indigo_item_name(client->version, property, item), item->blob.format, item->blob.size, slot, shared_fd >= 0 ? " shared='1'" : "");
+				INDIGO_DEBUG_PROTOCOL(indigo_debug("sent: %s", buffer));
+				if (shared_fd >= 0) {
+					indigo_send_fd(handle, shared_fd, buffer, length);
+					close(shared_fd);
+				} else {
+					indigo_write(handle, buffer, length);
+				}
+				bytes_sent += length;
+			} else if (client->enable_blob == INDIGO_ENABLE_BLOB_SHARED && (shared_fd = indigo_shared_memory(data, input_length)) >= 0) {
+				indigo_write(handle, output.data, output.length);
+				bytes_sent += output.length;
+				output.length = 0;
+				char buffer[INDIGO_VALUE_SIZE];
+				int length = snprintf(buffer, sizeof(buffer), "<oneBLOB name='%s' format='%s' size='%ld' shared='1'/>\n", indigo_item_name(client->version, property, item), item->blob.format, item->blob.size);
+				INDIGO_DEBUG_PROTOCOL(indigo_debug("sent: %s", buffer));
+				indigo_send_fd(handle, shared_fd, buffer, length);
+				bytes_sent += length;
+				close(shared_fd);
+			} else {
+				xml_printf(&output, "<oneBLOB name='%s' format='%s' size='%ld'>\n", indigo_item_name(client->version, property, item), item->blob.format, item->blob.size);
+				indigo_write(handle, output.data, output.length);
+				bytes_sent += output.length;
+				output.length = 0;
+				if (blob_pass_through(client, property, item)) {
+					indigo_write(handle, item->blob.encoded_value, item->blob.encoded_size);
+					bytes_sent += item->blob.encoded_size;
+					xml_printf(&output, "</oneBLOB>\n");
+					continue;
+				}
+				int handle2 = dup(handle);
+				FILE *fh = fdopen(handle2, "w");
+				if (property->version >= INDIGO_VERSION_2_0) {
+					while (input_length) {
+						char encoded_data[BASE64_BUF_SIZE + 1];
+						long len = (RAW_BUF_SIZE < input_length) ?  RAW_BUF_SIZE : input_length;
+						long enclen = base64_encode((unsigned char*)encoded_data, (unsigned char*)data, len);
+						fwrite(encoded_data, 1, enclen, fh);
+						bytes_sent += enclen;
+						input_length -= len;
+						data += len;
+					}
+				} else {
+					char encoded_data[74];
+					while (input_length) {
+						/* 54 raw = 72 encoded */
+						long len = (54 < input_length) ?  54 : input_length;
+						long enclen = base64_encode((unsigned char*)encoded_data, (unsigned char*)data, len);
+						encoded_data[enclen] = '\n';
+						fwrite(encoded_data, 1, enclen, fh);
+						bytes_sent += enclen;
+						input_length -= len;
+						data += len;
+					}
+				}
+				fflush(fh);
+				fclose(fh);
+				xml_printf(&output, "</oneBLOB>\n");
+			}
+		}
+	}
+	xml_printf(&output, "</setBLOBVector>\n");
+	INDIGO_DEBUG_PROTOCOL(indigo_debug("sent: %.*s", (int)output.length, output.data));
+	indigo_write(handle, output.data, output.length);
+	bytes_sent += output.length;
+	free(output.data);
+	return bytes_sent;
+}
+
+/* returns copy of BLOB item value, the copy made for other client within the same update broadcast is reused */
+static blob_snapshot *blob_snapshot_acquire(indigo_item *item, bool encoded, unsigned long sequence) {
+	void *value = encoded ? item->blob.encoded_value : item->blob.value;
+	long size = encoded ? item->blob.encoded_size : item->blob.size;
+	pthread_mutex_lock(&snapshot_mutex);
+	for (blob_snapshot *snapshot = snapshots; snapshot != NULL; snapshot = snapshot->next) {
+		if (snapshot->source == item && snapshot->source_value == value && snapshot->size == size && snapshot->encoded == encoded && snapshot->sequence == sequence) {
+			snapshot->references++;
+			pthread_mutex_unlock(&snapshot_mutex);
+			return snapshot;
+		}
+	}
+	pthread_mutex_unlock(&snapshot_mutex);
+	blob_snapshot *snapshot = malloc(sizeof(blob_snapshot) + size);
+	assert(snapshot != NULL);
+	memcpy(snapshot->data, value, size);
+	snapshot->references = 1;
+	snapshot->source = item;
+	snapshot->source_value = value;
+	snapshot->size = size;
+	snapshot->encoded = encoded;
+	snapshot->sequence = sequence;
+	pthread_mutex_lock(&snapshot_mutex);
+	snapshot->next = snapshots;
+	snapshots = snapshot;
+	pthread_mutex_unlock(&snapshot_mutex);
+	return snapshot;
+}
+
+static void blob_snapshot_release(blob_snapshot *snapshot) {
+	pthread_mutex_lock(&snapshot_mutex);
+	if (--snapshot->references > 0) {
+		pthread_mutex_unlock(&snapshot_mutex);
+		return;
+	}
+	for (blob_snapshot **link = &snapshots; *link != NULL; link = &(*link)->next) {
+		if (*link == snapshot) {
+			*link = snapshot->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&snapshot_mutex);
+	free(snapshot);
+}
+
+static void output_entry_release(output_entry *entry) {
+	if (entry->text.data != NULL)
+		free(entry->text.data);
+	if (entry->blob_property != NULL) {
+		for (int i = 0; i < entry->blob_property->count; i++) {
+			if (entry->blob_values[i] != NULL)
+				blob_snapshot_release(entry->blob_values[i]);
+		}
+		free(entry->blob_values);
+		free(entry->blob_property);
+	}
+	free(entry);
+}
+
+static void *xml_writer_thread(indigo_client *client) {
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	int handle = client_context->writer_handle;
+	pthread_mutex_lock(&client_context->mutex);
+	while (true) {
+		while (client_context->head == NULL && !client_context->writer_exit)
+			pthread_cond_wait(&client_context->signal, &client_context->mutex);
+		if (client_context->writer_exit)
+			break;
+		output_entry *entry = client_context->head;
+		client_context->head = entry->next;
+		if (client_context->head == NULL)
+			client_context->tail = NULL;
+		pthread_mutex_unlock(&client_context->mutex);
+		long bytes_sent = 0;
+		if (entry->blob_property != NULL) {
+			bytes_sent = xml_write_blob_vector(client, handle, entry->blob_property, entry->blob_items, entry->has_message ? entry->message : NULL);
+		} else {
+			INDIGO_DEBUG_PROTOCOL(indigo_debug("sent: %.*s", (int)entry->text.length, entry->text.data));
+			if (indigo_write(handle, entry->text.data, entry->text.length))
+				bytes_sent = entry->text.length;
+		}
+		pthread_mutex_lock(&client_context->mutex);
+		client_context->bytes_sent += bytes_sent;
+		if (entry->blob_property != NULL)
+			client_context->blobs_sent++;
+		else
+			client_context->bytes_queued -= entry->text.length;
+		output_entry_release(entry);
+	}
+	pthread_mutex_unlock(&client_context->mutex);
+	return NULL;
+}
+
+/* must be called with client_context->mutex locked */
+static void xml_enqueue(indigo_client *client, output_entry *entry) {
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	if (!client_context->writer_started) {
+		/* writer has its own descriptor, the connection handle is closed by the parser before adapter is released */
+		client_context->writer_handle = dup(client_context->context.output);
+		client_context->writer_exit = false;
+		if (pthread_create(&client_context->writer, NULL, (void *(*)(void *))xml_writer_thread, client) != 0) {
+			indigo_error("Can't create writer thread (%s)", strerror(errno));
+			close(client_context->writer_handle);
+			output_entry_release(entry);
+			return;
+		}
+		client_context->writer_started = true;
+	}
+	entry->next = NULL;
+	if (client_context->tail != NULL)
+		client_context->tail->next = entry;
+	else
+		client_context->head = entry;
+	client_context->tail = entry;
+	pthread_cond_signal(&client_context->signal);
+}
+
+static void xml_output_flush(indigo_client *client, xml_output *output) {
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	if (output->length == 0) {
+		if (output->data != NULL)
+			free(output->data);
+		return;
+	}
+	pthread_mutex_lock(&client_context->mutex);
+	if (client_context->writer_started || indigo_xml_blob_policy == INDIGO_BLOB_POLICY_SKIP_STALE) {
+		output_entry *entry = malloc(sizeof(output_entry));
+		assert(entry != NULL);
+		memset(entry, 0, sizeof(output_entry));
+		entry->text = *output;
+		client_context->bytes_queued += output->length;
+		xml_enqueue(client, entry);
+	} else {
+		INDIGO_DEBUG_PROTOCOL(indigo_debug("sent: %.*s", (int)output->length, output->data));
+		if (indigo_write(client_context->context.output, output->data, output->length))
+			client_context->bytes_sent += output->length;
+		free(output->data);
+	}
+	pthread_mutex_unlock(&client_context->mutex);
+}
+
+static output_entry *blob_output_entry(indigo_client *client, indigo_property *property, const char *message, unsigned long sequence) {
+	output_entry *entry = malloc(sizeof(output_entry));
+	assert(entry != NULL);
+	memset(entry, 0, sizeof(output_entry));
+	int size = sizeof(indigo_property) + property->count * sizeof(indigo_item);
+	entry->blob_property = malloc(size);
+	assert(entry->blob_property != NULL);
+	memcpy(entry->blob_property, property, size);
+	entry->blob_values = calloc(property->count, sizeof(blob_snapshot *));
+	assert(entry->blob_values != NULL);
+	entry->blob_items = property->items;
+	bool inline_data = client->enable_blob != INDIGO_ENABLE_BLOB_URL && property->state == INDIGO_OK_STATE;
+	for (int i = 0; i < property->count; i++) {
+		indigo_item *item = entry->blob_property->items + i;
+		item->blob.encoded_value = NULL;
+		if (inline_data && blob_pass_through(client, property, property->items + i)) {
+			entry->blob_values[i] = blob_snapshot_acquire(property->items + i, true, sequence);
+			item->blob.value = NULL;
+			item->blob.encoded_value = entry->blob_values[i]->data;
+		} else if (inline_data && item->blob.value != NULL && item->blob.size > 0) {
+			entry->blob_values[i] = blob_snapshot_acquire(property->items + i, false, sequence);
+			item->blob.value = entry->blob_values[i]->data;
+		} else {
+			item->blob.value = NULL;
+			if (inline_data)
+				item->blob.size = 0;
+		}
+	}
+	if (message != NULL) {
+		strncpy(entry->message, message, INDIGO_VALUE_SIZE - 1);
+		entry->has_message = true;
+	}
+	return entry;
+}
+
+static void xml_blob_flush(indigo_client *client, indigo_property *property, const char *message, unsigned long sequence) {
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	pthread_mutex_lock(&client_context->mutex);
+	if (!client_context->writer_started && indigo_xml_blob_policy != INDIGO_BLOB_POLICY_SKIP_STALE) {
+		client_context->bytes_sent += xml_write_blob_vector(client, client_context->context.output, property, property->items, message);
+		client_context->blobs_sent++;
+		pthread_mutex_unlock(&client_context->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&client_context->mutex);
+	/* data are copied without client lock held, once the writer is used it is used till the adapter is released */
+	output_entry *entry = blob_output_entry(client, property, message, sequence);
+	pthread_mutex_lock(&client_context->mutex);
+	/* BLOB not yet picked by writer is stale, replace it with the new one */
+	output_entry *previous = NULL;
+	for (output_entry *stale = client_context->head; stale != NULL; previous = stale, stale = stale->next) {
+		if (stale->blob_property != NULL && !strcmp(stale->blob_property->device, property->device) && !strcmp(stale->blob_property->name, property->name)) {
+			if (previous != NULL)
+				previous->next = stale->next;
+			else
+				client_context->head = stale->next;
+			if (client_context->tail == stale)
+				client_context->tail = previous;
+			output_entry_release(stale);
+			client_context->blobs_skipped++;
+			INDIGO_DEBUG(indigo_debug("Stale BLOB %s.%s skipped", property->device, property->name));
+			break;
+		}
+	}
+	xml_enqueue(client, entry);
+	pthread_mutex_unlock(&client_context->mutex);
+}
+
 static indigo_result xml_device_adapter_define_property(indigo_client *client, struct indigo_device *device, indigo_property *property, const char *message) {
 	assert(device != NULL);
 	assert(client != NULL);
 	assert(property != NULL);
 	if (client->version == INDIGO_VERSION_NONE)
 		return INDIGO_OK;
-	pthread_mutex_lock(&write_mutex);
-	indigo_adapter_context *client_context = (indigo_adapter_context *)client->client_context;
-	assert(client_context != NULL);
-	int handle = client_context->output;
+	assert(client->client_context != NULL);
+	xml_output output = { 0 };
+	pthread_mutex_lock(&format_mutex);
 	switch (property->type) {
 	case INDIGO_TEXT_VECTOR:
-		indigo_printf(handle, "<defTextVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
+		xml_printf(&output, "<defTextVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
 		for (int i = 0; i < property->count; i++) {
 			indigo_item *item = &property->items[i];
-			indigo_printf(handle, "<defText name='%s' label='%s'>%s</defText>\n", indigo_item_name(client->version, property, item), item->label, item->text.value);
+			xml_printf(&output, "<defText name='%s' label='%s'>%s</defText>\n", indigo_item_name(client->version, property, item), item->label, item->text.value);
 		}
-		indigo_printf(handle, "</defTextVector>\n");
+		xml_printf(&output, "</defTextVector>\n");
 		break;
 	case INDIGO_NUMBER_VECTOR:
-		indigo_printf(handle, "<defNumberVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
+		xml_printf(&output, "<defNumberVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
 		for (int i = 0; i < property->count; i++) {
 			indigo_item *item = &property->items[i];
 			if (client->version >= INDIGO_VERSION_2_0 && property->perm != INDIGO_RO_PERM)
-				indigo_printf(handle, "<defNumber name='%s' label='%s' format='%s' min='%g' max='%g' step='%g' target='%g'>%g</defNumber>\n", indigo_item_name(client->version, property, item), item->label, item->number.format, item->number.min, item->number.max, item->number.step, item->number.target, item->number.value);
+				xml_printf(&output, "<defNumber name='%s' label='%s' format='%s' min='%g' max='%g' step='%g' target='%g'>%g</defNumber>\n", indigo_item_name(client->version, property, item), item->label, item->number.format, item->number.min, item->number.max, item->number.step, item->number.target, item->number.value);
 			else
-				indigo_printf(handle, "<defNumber name='%s' label='%s' format='%s' min='%g' max='%g' step='%g'>%g</defNumber>\n", indigo_item_name(client->version, property, item), item->label, item->number.format, item->number.min, item->number.max, item->number.step, item->number.value);
+				xml_printf(&output, "<defNumber name='%s' label='%s' format='%s' min='%g' max='%g' step='%g'>%g</defNumber>\n", indigo_item_name(client->version, property, item), item->label, item->number.format, item->number.min, item->number.max, item->number.step, item->number.value);
 		}
-		indigo_printf(handle, "</defNumberVector>\n");
+		xml_printf(&output, "</defNumberVector>\n");
 		break;
 	case INDIGO_SWITCH_VECTOR:
-		indigo_printf(handle, "<defSwitchVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s' rule='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], indigo_switch_rule_text[property->rule], message_attribute(message));
+		xml_printf(&output, "<defSwitchVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s' rule='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], indigo_switch_rule_text[property->rule], message_attribute(message));
 		for (int i = 0; i < property->count; i++) {
 			indigo_item *item = &property->items[i];
-			indigo_printf(handle, "<defSwitch name='%s' label='%s'>%s</defSwitch>\n", indigo_item_name(client->version, property, item), item->label, item->sw.value ? "On" : "Off");
+			xml_printf(&output, "<defSwitch name='%s' label='%s'>%s</defSwitch>\n", indigo_item_name(client->version, property, item), item->label, item->sw.value ? "On" : "Off");
 		}
-		indigo_printf(handle, "</defSwitchVector>\n");
+		xml_printf(&output, "</defSwitchVector>\n");
 		break;
 	case INDIGO_LIGHT_VECTOR:
-		indigo_printf(handle, "<defLightVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
+		xml_printf(&output, "<defLightVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
 		for (int i = 0; i < property->count; i++) {
 			indigo_item *item = &property->items[i];
-			indigo_printf(handle, " <defLight name='%s' label='%s'>%s</defLight>\n", indigo_item_name(client->version, property, item), item->label, indigo_property_state_text[item->light.value]);
+			xml_printf(&output, " <defLight name='%s' label='%s'>%s</defLight>\n", indigo_item_name(client->version, property, item), item->label, indigo_property_state_text[item->light.value]);
 		}
-		indigo_printf(handle, "</defLightVector>\n");
+		xml_printf(&output, "</defLightVector>\n");
 		break;
 	case INDIGO_BLOB_VECTOR:
-		indigo_printf(handle, "<defBLOBVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
+		xml_printf(&output, "<defBLOBVector device='%s' name='%s' group='%s' label='%s' perm='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_xml_escape(property->group), indigo_xml_escape(property->label), indigo_property_perm_text[property->perm], indigo_property_state_text[property->state], message_attribute(message));
 		for (int i = 0; i < property->count; i++) {
 			indigo_item *item = &property->items[i];
 			if (client->enable_blob == INDIGO_ENABLE_BLOB_URL) {
 				if (*item->blob.url == 0)
-					indigo_printf(handle, "<defBLOB name='%s' label='%s' path='/blob/%p%s'/>\n", indigo_item_name(client->version, property, item), item->label, item, item->blob.format);
+					xml_printf(&output, "<defBLOB name='%s' label='%s' path='/blob/%p%s'/>\n", indigo_item_name(client->version, property, item), item->label, item, item->blob.format);
 				else
-					indigo_printf(handle, "<defBLOB name='%s' label='%s' url='%s'/>\n", indigo_item_name(client->version, property, item), item->label, item->blob.url);
+					xml_printf(&output, "<defBLOB name='%s' label='%s' url='%s'/>\n", indigo_item_name(client->version, property, item), item->label, item->blob.url);
 			} else {
-				indigo_printf(handle, "<defBLOB name='%s' label='%s'/>\n", indigo_item_name(client->version, property, item), item->label);
+				xml_printf(&output, "<defBLOB name='%s' label='%s'/>\n", indigo_item_name(client->version, property, item), item->label);
 			}
 		}
-		indigo_printf(handle, "</defBLOBVector>\n");
+		xml_printf(&output, "</defBLOBVector>\n");
 		break;
 	}
-	pthread_mutex_unlock(&write_mutex);
+	pthread_mutex_unlock(&format_mutex);
+	xml_output_flush(client, &output);
 	return INDIGO_OK;
 }
 
 static indigo_result xml_device_adapter_update_property(indigo_client *client, indigo_device *device, indigo_property *property, const char *message) {
-	FILE* fh;
-	int handle2;
+	indigo_property *blob_property = NULL;
+	unsigned long sequence = __sync_add_and_fetch(&indigo_update_sequence, 0);
 	assert(device != NULL);
 	assert(client != NULL);
 	assert(property != NULL);
 	if (client->version == INDIGO_VERSION_NONE)
 		return INDIGO_OK;
-	pthread_mutex_lock(&write_mutex);
-	indigo_adapter_context *client_context = (indigo_adapter_context *)client->client_context;
-	assert(client_context != NULL);
-	int handle = client_context->output;
+	assert(client->client_context != NULL);
+	if (property->type == INDIGO_BLOB_VECTOR && client->enable_blob != INDIGO_ENABLE_BLOB_NEVER && client->enable_blob != INDIGO_ENABLE_BLOB_URL && property->state == INDIGO_OK_STATE) {
+		/* BLOB forwarded from remote server by URL is downloaded and BLOB kept encoded is decoded only if some client needs the data, format_mutex is not held meanwhile */
+		for (int i = 0; i < property->count; i++) {
+			indigo_item *item = property->items + i;
+			if (item->blob.value != NULL && item->blob.size != 0)
+				continue;
+			if (item->blob.encoded_value != NULL ? !blob_pass_through(client, property, item) : *item->blob.url != '\0') {
+				if (!indigo_populate_http_blob_item(item))
+					INDIGO_ERROR(indigo_error("Can't download BLOB from %s", item->blob.url));
+			}
+		}
+	}
+	xml_output output = { 0 };
+	pthread_mutex_lock(&format_mutex);
 	switch (property->type) {
 		case INDIGO_TEXT_VECTOR:
 			if (client->enable_blob != INDIGO_ENABLE_BLOB_ONLY) {
-				indigo_printf(handle, "<setTextVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
+				xml_printf(&output, "<setTextVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
 				for (int i = 0; i < property->count; i++) {
 					indigo_item *item = &property->items[i];
-					indigo_printf(handle, "<oneText name='%s'>%s</oneText>\n", indigo_item_name(client->version, property, item), indigo_xml_escape(item->text.value));
+					xml_printf(&output, "<oneText name='%s'>%s</oneText>\n", indigo_item_name(client->version, property, item), indigo_xml_escape(item->text.value));
 				}
-				indigo_printf(handle, "</setTextVector>\n");
+				xml_printf(&output, "</setTextVector>\n");
 			}
 			break;
 		case INDIGO_NUMBER_VECTOR:
 			if (client->enable_blob != INDIGO_ENABLE_BLOB_ONLY) {
-				indigo_printf(handle, "<setNumberVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
+				xml_printf(&output, "<setNumberVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
 				for (int i = 0; i < property->count; i++) {
 					indigo_item *item = &property->items[i];
 					if (client->version >= INDIGO_VERSION_2_0 && property->perm != INDIGO_RO_PERM)
-						indigo_printf(handle, "<oneNumber name='%s' target='%g'>%g</oneNumber>\n", indigo_item_name(client->version, property, item), item->number.target, item->number.value);
+						xml_printf(&output, "<oneNumber name='%s' target='%g'>%g</oneNumber>\n", indigo_item_name(client->version, property, item), item->number.target, item->number.value);
 					else
-						indigo_printf(handle, "<oneNumber name='%s'>%g</oneNumber>\n", indigo_item_name(client->version, property, item), item->number.value);
+						xml_printf(&output, "<oneNumber name='%s'>%g</oneNumber>\n", indigo_item_name(client->version, property, item), item->number.value);
 				}
-				indigo_printf(handle, "</setNumberVector>\n");
+				xml_printf(&output, "</setNumberVector>\n");
 			}
 			break;
 		case INDIGO_SWITCH_VECTOR:
 			if (client->enable_blob != INDIGO_ENABLE_BLOB_ONLY) {
-				indigo_printf(handle, "<setSwitchVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
+				xml_printf(&output, "<setSwitchVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
 				for (int i = 0; i < property->count; i++) {
 					indigo_item *item = &property->items[i];
-					indigo_printf(handle, "<oneSwitch name='%s'>%s</oneSwitch>\n", indigo_item_name(client->version, property, item), item->sw.value ? "On" : "Off");
+					xml_printf(&output, "<oneSwitch name='%s'>%s</oneSwitch>\n", indigo_item_name(client->version, property, item), item->sw.value ? "On" : "Off");
 				}
-				indigo_printf(handle, "</setSwitchVector>\n");
+				xml_printf(&output, "</setSwitchVector>\n");
 			}
 			break;
 		case INDIGO_LIGHT_VECTOR:
 			if (client->enable_blob != INDIGO_ENABLE_BLOB_ONLY) {
-				indigo_printf(handle, "<setLightVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
+				xml_printf(&output, "<setLightVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
 				for (int i = 0; i < property->count; i++) {
 					indigo_item *item = &property->items[i];
-					indigo_printf(handle, "<oneLight name='%s'>%s</oneLight>\n", indigo_item_name(client->version, property, item), indigo_property_state_text[item->light.value]);
+					xml_printf(&output, "<oneLight name='%s'>%s</oneLight>\n", indigo_item_name(client->version, property, item), indigo_property_state_text[item->light.value]);
 				}
-				indigo_printf(handle, "</setLightVector>\n");
+				xml_printf(&output, "</setLightVector>\n");
 			}
 			break;
 		case INDIGO_BLOB_VECTOR:
-			if (client->enable_blob != INDIGO_ENABLE_BLOB_NEVER) {
-				indigo_printf(handle, "<setBLOBVector device='%s' name='%s' state='%s'%s>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), indigo_property_state_text[property->state], message_attribute(message));
-				if (property->state == INDIGO_OK_STATE) {
-					for (int i = 0; i < property->count; i++) {
-						indigo_item *item = &property->items[i];
-						long input_length = item->blob.size;
-						unsigned char *data = item->blob.value;
-						if (client->enable_blob == INDIGO_ENABLE_BLOB_URL) {
-							if (*item->blob.url == 0)
-								indigo_printf(handle, "<oneBLOB name='%s' path='/blob/%p%s'/>\n", indigo_item_name(client->version, property, item), item, item->blob.format);
-							else
-								indigo_printf(handle, "<oneBLOB name='%s' url='%s'/>\n", indigo_item_name(client->version, property, item), item->blob.url);
-						} else {
-							indigo_printf(handle, "<oneBLOB name='%s' format='%s' size='%ld'>\n", indigo_item_name(client->version, property, item), item->blob.format, item->blob.size);
-							handle2 = dup(handle);
-							fh = fdopen(handle2, "w");
-							if (property->version >= INDIGO_VERSION_2_0) {
-								while (input_length) {
-									char encoded_data[BASE64_BUF_SIZE + 1];
-									long len = (RAW_BUF_SIZE < input_length) ?  RAW_BUF_SIZE : input_length;
-									long enclen = base64_encode((unsigned char*)encoded_data, (unsigned char*)data, len);
-									fwrite(encoded_data, 1, enclen, fh);
-									input_length -= len;
-									data += len;
-								}
-							} else {
-								static char encoded_data[74];
-								while (input_length) {
-									/* 54 raw = 72 encoded */
-									long len = (54 < input_length) ?  54 : input_length;
-									long enclen = base64_encode((unsigned char*)encoded_data, (unsigned char*)data, len);
-									encoded_data[enclen] = '\n';
-									fwrite(encoded_data, 1, enclen, fh);
-									input_length -= len;
-									data += len;
-								}
-							}
-							fflush(fh);
-							fclose(fh);
-							indigo_printf(handle, "</oneBLOB>\n");
-						}
-					}
-				}
-				indigo_printf(handle, "</setBLOBVector>\n");
-			}
+			if (client->enable_blob != INDIGO_ENABLE_BLOB_NEVER)
+				blob_property = property;
 			break;
 	}
-	pthread_mutex_unlock(&write_mutex);
+	pthread_mutex_unlock(&format_mutex);
+	xml_output_flush(client, &output);
+	if (blob_property != NULL)
+		xml_blob_flush(client, blob_property, message, sequence);
 	return INDIGO_OK;
 }
 
@@ -245,15 +629,15 @@ static indigo_result xml_device_adapter_delete_property(indigo_client *client, i
 	assert(property != NULL);
 	if (client->version == INDIGO_VERSION_NONE)
 		return INDIGO_OK;
-	pthread_mutex_lock(&write_mutex);
-	indigo_adapter_context *client_context = (indigo_adapter_context *)client->client_context;
-	assert(client_context != NULL);
-	int handle = client_context->output;
+	assert(client->client_context != NULL);
+	xml_output output = { 0 };
+	pthread_mutex_lock(&format_mutex);
 	if (*property->name)
-		indigo_printf(handle, "<delProperty device='%s' name='%s'%s/>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), message_attribute(message));
+		xml_printf(&output, "<delProperty device='%s' name='%s'%s/>\n", indigo_xml_escape(property->device), indigo_property_name(client->version, property), message_attribute(message));
 	else
-		indigo_printf(handle, "<delProperty device='%s'%s/>\n", device->name, message_attribute(message));
-	pthread_mutex_unlock(&write_mutex);
+		xml_printf(&output, "<delProperty device='%s'%s/>\n", device->name, message_attribute(message));
+	pthread_mutex_unlock(&format_mutex);
+	xml_output_flush(client, &output);
 	return INDIGO_OK;
 }
 
@@ -262,13 +646,13 @@ static indigo_result xml_device_adapter_send_message(indigo_client *client, indi
 	assert(client != NULL);
 	if (client->version == INDIGO_VERSION_NONE)
 		return INDIGO_OK;
-	pthread_mutex_lock(&write_mutex);
-	indigo_adapter_context *client_context = (indigo_adapter_context *)client->client_context;
-	assert(client_context != NULL);
-	int handle = client_context->output;
+	assert(client->client_context != NULL);
+	xml_output output = { 0 };
+	pthread_mutex_lock(&format_mutex);
 	if (message)
-		indigo_printf(handle, "<message%s/>\n", message_attribute(message));
-	pthread_mutex_unlock(&write_mutex);
+		xml_printf(&output, "<message%s/>\n", message_attribute(message));
+	pthread_mutex_unlock(&format_mutex);
+	xml_output_flush(client, &output);
 	return INDIGO_OK;
 }
 
@@ -285,10 +669,13 @@ indigo_client *indigo_xml_device_adapter(int input, int ouput) {
 	indigo_client *client = malloc(sizeof(indigo_client));
 	assert(client != NULL);
 	memcpy(client, &client_template, sizeof(indigo_client));
-	indigo_adapter_context *client_context = malloc(sizeof(indigo_adapter_context));
+	xml_adapter_context *client_context = malloc(sizeof(xml_adapter_context));
 	assert(client_context != NULL);
-	client_context->input = input;
-	client_context->output = ouput;
+	memset(client_context, 0, sizeof(xml_adapter_context));
+	client_context->context.input = input;
+	client_context->context.output = ouput;
+	pthread_mutex_init(&client_context->mutex, NULL);
+	pthread_cond_init(&client_context->signal, NULL);
 	client->client_context = client_context;
 	return client;
 }
@@ -296,7 +683,33 @@ indigo_client *indigo_xml_device_adapter(int input, int ouput) {
 void indigo_release_xml_device_adapter(indigo_client *client) {
 	assert(client != NULL);
 	assert(client->client_context != NULL);
-	free(client->client_context);
+	xml_adapter_context *client_context = (xml_adapter_context *)client->client_context;
+	pthread_mutex_lock(&client_context->mutex);
+	if (client_context->writer_started) {
+		client_context->writer_exit = true;
+		pthread_cond_signal(&client_context->signal);
+		/* connection is gone, unblock pending write */
+		shutdown(client_context->writer_handle, SHUT_RDWR);
+		pthread_mutex_unlock(&client_context->mutex);
+		pthread_join(client_context->writer, NULL);
+		pthread_mutex_lock(&client_context->mutex);
+		close(client_context->writer_handle);
+		client_context->writer_started = false;
+	}
+	while (client_context->head != NULL) {
+		output_entry *entry = client_context->head;
+		client_context->head = entry->next;
+		output_entry_release(entry);
+	}
+	for (int i = 0; i < INDIGO_SHARED_BUFFER_SLOTS; i++) {
+		if (client_context->shared_buffers[i] != NULL)
+			munmap(client_context->shared_buffers[i], INDIGO_SHARED_BUFFER_HEADER + client_context->shared_capacities[i]);
+	}
+	INDIGO_LOG(indigo_log("XML adapter: %ld bytes sent, %ld BLOBs sent, %ld BLOBs skipped", client_context->bytes_sent, client_context->blobs_sent, client_context->blobs_skipped));
+	pthread_mutex_unlock(&client_context->mutex);
+	pthread_mutex_destroy(&client_context->mutex);
+	pthread_cond_destroy(&client_context->signal);
+	free(client_context);
 	free(client);
 }
 
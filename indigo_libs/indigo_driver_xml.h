@@ -33,6 +33,17 @@
 extern "C" {
 #endif
 
+/** Policy for BLOBs sent to clients not able to keep up with the data rate.
+ */
+typedef enum {
+	INDIGO_BLOB_POLICY_DELIVER_ALL,	///< every BLOB is written synchronously to the client
+	INDIGO_BLOB_POLICY_SKIP_STALE		///< output is queued per client and BLOB not yet sent is replaced by the newer one
+} indigo_blob_policy;
+
+/** BLOB delivery policy for XML wire protocol client side adapters.
+ */
+extern indigo_blob_policy indigo_xml_blob_policy;
+
 /** Create initialized instance of XML wire protocol client side adapter.
  */
 extern indigo_client *indigo_xml_device_adapter(int input, int ouput);
@@ -24,6 +24,10 @@
  \file indigo_io.c
  */
 
+#if defined(INDIGO_LINUX)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -34,9 +38,15 @@
 #include <errno.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "indigo_bus.h"
@@ -72,37 +82,313 @@ int indigo_open_serial(const char *dev_file) {
 	return dev_fd;
 }
 
+int indigo_connect_tcp(const char *host, int port, int timeout) {
+	struct addrinfo hints, *addresses, *address;
+	char service[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	snprintf(service, sizeof(service), "%d", port);
+	int result = getaddrinfo(host, service, &hints, &addresses);
+	if (result != 0) {
+		if (result != EAI_SYSTEM)
+			errno = EHOSTUNREACH;
+		return -1;
+	}
+	/* connection to all resolved addresses is attempted in parallel, the first one to complete wins */
+	struct pollfd fds[INDIGO_MAX_CONNECT_ADDRESSES];
+	int count = 0, pending = 0, sock = -1, error = ETIMEDOUT;
+	for (address = addresses; address != NULL && count < INDIGO_MAX_CONNECT_ADDRESSES && sock < 0; address = address->ai_next) {
+		int handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (handle < 0) {
+			error = errno;
+			continue;
+		}
+		fcntl(handle, F_SETFL, fcntl(handle, F_GETFL) | O_NONBLOCK);
+		if (connect(handle, address->ai_addr, address->ai_addrlen) == 0) {
+			sock = handle;
+		} else if (errno == EINPROGRESS) {
+			fds[count].fd = handle;
+			fds[count].events = POLLOUT;
+			fds[count].revents = 0;
+			count++;
+			pending++;
+		} else {
+			error = errno;
+			close(handle);
+		}
+	}
+	freeaddrinfo(addresses);
+	struct timespec now, deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	while (sock < 0 && pending > 0) {
+		int remaining = -1;
+		if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = (int)((deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000);
+			if (remaining <= 0) {
+				error = ETIMEDOUT;
+				break;
+			}
+		}
+		int ready = poll(fds, count, remaining);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready <= 0) {
+			error = ready < 0 ? errno : ETIMEDOUT;
+			break;
+		}
+		for (int i = 0; i < count; i++) {
+			if (fds[i].fd < 0 || fds[i].revents == 0)
+				continue;
+			int so_error = 0;
+			socklen_t length = sizeof(so_error);
+			if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &length) < 0)
+				so_error = errno;
+			if (so_error == 0 && sock < 0) {
+				sock = fds[i].fd;
+			} else {
+				if (so_error != 0)
+					error = so_error;
+				close(fds[i].fd);
+			}
+			fds[i].fd = -1;
+			pending--;
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		if (fds[i].fd >= 0)
+			close(fds[i].fd);
+	}
+	if (sock < 0) {
+		errno = error;
+		return -1;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+	return sock;
+}
+
+void indigo_set_keepalive(int handle, int idle, int interval, int count) {
+	int value = 1;
+	setsockopt(handle, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value));
+#if defined(TCP_KEEPIDLE)
+	setsockopt(handle, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#elif defined(TCP_KEEPALIVE)
+	setsockopt(handle, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle));
+#endif
+#if defined(TCP_KEEPINTVL)
+	setsockopt(handle, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+#endif
+#if defined(TCP_KEEPCNT)
+	setsockopt(handle, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+#if defined(TCP_USER_TIMEOUT)
+	/* keepalive probes are not sent while unacknowledged data are pending, limit their lifetime as well */
+	unsigned user_timeout = (unsigned)(idle + interval * count) * 1000;
+	setsockopt(handle, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+#endif
+}
+
 int indigo_open_tcp(const char *host, int port) {
-	struct sockaddr_in srv_info;
-	struct hostent *he;
 	int sock;
 	struct timeval timeout;
 	timeout.tv_sec = 5;
 	timeout.tv_usec = 0;
-	if ((he = gethostbyname(host))==NULL) {
+	if ((sock = indigo_connect_tcp(host, port, 5000)) < 0) {
 		return -1;
 	}
-	if ((sock = socket(AF_INET, SOCK_STREAM, 0))== -1) {
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+		close(sock);
 		return -1;
 	}
-	memset(&srv_info, 0, sizeof(srv_info));
-	srv_info.sin_family = AF_INET;
-	srv_info.sin_port = htons(port);
-	srv_info.sin_addr = *((struct in_addr *)he->h_addr);
-	if (connect(sock, (struct sockaddr *)&srv_info, sizeof(struct sockaddr))<0) {
+	if (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+		close(sock);
 		return -1;
 	}
-	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
-		close(sock);
+	return sock;
+}
+
+int indigo_open_unix(const char *path) {
+	struct sockaddr_un srv_info;
+	int sock;
+	if (strlen(path) >= sizeof(srv_info.sun_path)) {
+		errno = ENAMETOOLONG;
 		return -1;
 	}
-	if (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return -1;
+	}
+	memset(&srv_info, 0, sizeof(srv_info));
+	srv_info.sun_family = AF_UNIX;
+	strcpy(srv_info.sun_path, path);
+	if (connect(sock, (struct sockaddr *)&srv_info, sizeof(srv_info)) < 0) {
 		close(sock);
 		return -1;
 	}
 	return sock;
 }
 
+bool indigo_is_unix_socket(int handle) {
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (getsockname(handle, (struct sockaddr *)&address, &length) < 0)
+		return false;
+	return address.ss_family == AF_UNIX;
+}
+
+static int shared_memory_create(long length) {
+	int fd = -1;
+#if defined(INDIGO_LINUX) && defined(MFD_CLOEXEC)
+	fd = memfd_create("indigo_blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+	if (fd < 0) {
+		char name[64];
+		static int counter = 0;
+		snprintf(name, sizeof(name), "/indigo_blob_%d_%d", getpid(), __sync_fetch_and_add(&counter, 1));
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0)
+			return -1;
+		shm_unlink(name);
+	}
+	if (ftruncate(fd, length) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int indigo_shared_memory(const void *data, long length) {
+	int fd = shared_memory_create(length);
+	if (fd < 0)
+		return -1;
+	if (length > 0) {
+		void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		memcpy(memory, data, length);
+		munmap(memory, length);
+	}
+#if defined(INDIGO_LINUX) && defined(F_ADD_SEALS)
+	/* receiver can rely on content and size, fails silently for shm_open() fallback */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	return fd;
+}
+
+int indigo_shared_buffer_create(long capacity, indigo_shared_buffer **buffer) {
+	int fd = shared_memory_create(INDIGO_SHARED_BUFFER_HEADER + capacity);
+	if (fd < 0)
+		return -1;
+	void *memory = mmap(NULL, INDIGO_SHARED_BUFFER_HEADER + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (memory == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	*buffer = memory;
+	(*buffer)->busy = 0;
+	(*buffer)->capacity = capacity;
+	return fd;
+}
+
+indigo_shared_buffer *indigo_shared_buffer_map(int fd, long *capacity) {
+	struct stat stat;
+	if (fstat(fd, &stat) < 0)
+		return NULL;
+	if (stat.st_size < INDIGO_SHARED_BUFFER_HEADER) {
+		errno = EINVAL;
+		return NULL;
+	}
+	indigo_shared_buffer *buffer = mmap(NULL, stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buffer == MAP_FAILED)
+		return NULL;
+	/* capacity in the header is written by the other side, the real object size is used instead */
+	*capacity = stat.st_size - INDIGO_SHARED_BUFFER_HEADER;
+	return buffer;
+}
+
+bool indigo_send_fd(int handle, int fd, const char *buffer, long length) {
+	struct msghdr message;
+	struct iovec iov;
+	union {
+		struct cmsghdr header;
+		char control[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&message, 0, sizeof(message));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = (void *)buffer;
+	iov.iov_len = length;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.control;
+	message.msg_controllen = sizeof(control.control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	long bytes_written;
+	while ((bytes_written = sendmsg(handle, &message, 0)) < 0 && errno == EINTR)
+		;
+	if (bytes_written < 0)
+		return false;
+	/* descriptor travels with the first chunk, rest is plain data */
+	if (bytes_written < length)
+		return indigo_write(handle, buffer + bytes_written, length - bytes_written);
+	return true;
+}
+
+long indigo_recv_fds(int handle, char *buffer, long length, int *fds, int *fd_count) {
+	struct msghdr message;
+	struct iovec iov;
+	union {
+		struct cmsghdr header;
+		char control[CMSG_SPACE(sizeof(int) * INDIGO_MAX_RECEIVED_FDS)];
+	} control;
+	int max_count = *fd_count;
+	*fd_count = 0;
+	memset(&message, 0, sizeof(message));
+	iov.iov_base = buffer;
+	iov.iov_len = length;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.control;
+	message.msg_controllen = sizeof(control.control);
+	long bytes_read;
+	while ((bytes_read = recvmsg(handle, &message, 0)) < 0 && errno == EINTR)
+		;
+	if (bytes_read <= 0)
+		return bytes_read;
+	bool overflow = (message.msg_flags & MSG_CTRUNC) != 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+			for (int i = 0; i < count; i++) {
+				int fd;
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				if (*fd_count < max_count) {
+					fds[(*fd_count)++] = fd;
+				} else {
+					close(fd);
+					overflow = true;
+				}
+			}
+		}
+	}
+	if (overflow) {
+		for (int i = 0; i < *fd_count; i++)
+			close(fds[i]);
+		*fd_count = 0;
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return bytes_read;
+}
+
 int indigo_read(int handle, char *buffer, long length) {
 	long remains = length;
 	long total_bytes = 0;
@@ -38,10 +38,68 @@ extern "C" {
  */
 extern int indigo_open_serial(const char *dev_file);
 
+/** Maximal number of resolved addresses tried in parallel by indigo_connect_tcp().
+ */
+#define INDIGO_MAX_CONNECT_ADDRESSES	8
+
+/** Connect to IPv4 or IPv6 host with timeout in ms (0 means no timeout), returns blocking socket or -1 with errno set.
+ */
+extern int indigo_connect_tcp(const char *host, int port, int timeout);
+
+/** Enable TCP keepalive with idle time, probe interval (both in seconds) and probe count.
+ */
+extern void indigo_set_keepalive(int handle, int idle, int interval, int count);
+
 /** Open network connection.
  */
 extern int indigo_open_tcp(const char *host, int port);
 
+/** Open unix domain socket connection.
+ */
+extern int indigo_open_unix(const char *path);
+
+/** Check if handle is unix domain socket.
+ */
+extern bool indigo_is_unix_socket(int handle);
+
+/** Create anonymous shared memory object filled with data and return its descriptor.
+ */
+extern int indigo_shared_memory(const void *data, long length);
+
+/** Reusable shared memory BLOB buffer header, BLOB data follow at INDIGO_SHARED_BUFFER_HEADER offset.
+ */
+typedef struct {
+	volatile int busy;                      ///< set by sender when buffer is filled, cleared by receiver when content is consumed
+	long capacity;                          ///< data capacity
+} indigo_shared_buffer;
+
+#define INDIGO_SHARED_BUFFER_HEADER	64
+
+/** Number of reusable shared memory BLOB buffers per connection.
+ */
+#define INDIGO_SHARED_BUFFER_SLOTS	4
+
+/** Create reusable shared memory buffer with given data capacity, map it to *buffer and return its descriptor.
+ */
+extern int indigo_shared_buffer_create(long capacity, indigo_shared_buffer **buffer);
+
+/** Map reusable shared memory buffer received from other process, data capacity is returned in *capacity.
+ */
+extern indigo_shared_buffer *indigo_shared_buffer_map(int fd, long *capacity);
+
+/** Maximal number of descriptors received by single indigo_recv_fds() call.
+ */
+#define INDIGO_MAX_RECEIVED_FDS	16
+
+/** Write buffer together with file descriptor (unix domain sockets only).
+ */
+extern bool indigo_send_fd(int handle, int fd, const char *buffer, long length);
+
+/** Read available data and collect file descriptors passed with them (unix domain sockets only), fd_count is capacity on input and count on output.
+ If more descriptors are received than fit, all of them are closed and -1 is returned with errno set to EMSGSIZE.
+ */
+extern long indigo_recv_fds(int handle, char *buffer, long length, int *fds, int *fd_count);
+
 /** Read buffer.
  */
 extern int indigo_read(int handle, char *buffer, long length);
@@ -252,50 +252,76 @@ static void *top_level_handler(parser_state state, char *name, char *value, indi
 	return top_level_handler;
 }
 
-void indigo_json_parse(indigo_device *device, indigo_client *client) {
-	indigo_adapter_context *context = (indigo_adapter_context*)client->client_context;
-	int handle = context->input;
-	char buffer[JSON_BUFFER_SIZE];
-	char *pointer = buffer;
-	char *buffer_end = NULL;
-	char property_buffer[PROPERTY_SIZE];
+struct indigo_json_parser {
+	indigo_device *device;
+	indigo_client *client;
+	parser_handler handler;
+	parser_state state;
+	bool compact;
+	char *property_buffer;
 	char message[INDIGO_VALUE_SIZE];
 	char name_buffer[INDIGO_NAME_SIZE];
-	char *name_pointer = name_buffer;
+	char *name_pointer;
 	char value_buffer[INDIGO_VALUE_SIZE];
-	char *value_pointer = value_buffer;
-	*pointer = 0;
-	char c = 0;
-	char q = '"';
-	int depth = 0;
-	parser_handler handler = top_level_handler;
-	parser_state state = IDLE;
-	indigo_property *property = (indigo_property *)property_buffer;
-	memset(property_buffer, 0, PROPERTY_SIZE);
+	char *value_pointer;
+	char q;
+	int depth;
+};
 
-	while (true) {
-		assert(pointer - buffer <= JSON_BUFFER_SIZE);
+indigo_json_parser *indigo_json_parser_create(indigo_device *device, indigo_client *client, bool compact) {
+	indigo_json_parser *parser = malloc(sizeof(indigo_json_parser));
+	assert(parser != NULL);
+	memset(parser, 0, sizeof(indigo_json_parser));
+	parser->device = device;
+	parser->client = client;
+	/* compact parser keeps property buffer only while a message is being parsed */
+	if (!compact) {
+		parser->property_buffer = malloc(PROPERTY_SIZE);
+		assert(parser->property_buffer != NULL);
+		memset(parser->property_buffer, 0, PROPERTY_SIZE);
+	}
+	parser->compact = compact;
+	parser->name_pointer = parser->name_buffer;
+	parser->value_pointer = parser->value_buffer;
+	parser->handler = top_level_handler;
+	parser->state = IDLE;
+	parser->q = '"';
+	return parser;
+}
+
+bool indigo_json_parser_feed(indigo_json_parser *parser, char *data, long length) {
+	indigo_device *device = parser->device;
+	indigo_client *client = parser->client;
+	parser_handler handler = parser->handler;
+	parser_state state = parser->state;
+	char *message = parser->message;
+	char *name_buffer = parser->name_buffer;
+	char *name_pointer = parser->name_pointer;
+	char *value_buffer = parser->value_buffer;
+	char *value_pointer = parser->value_pointer;
+	char q = parser->q;
+	int depth = parser->depth;
+	char *pointer = data;
+	char *buffer_end = data + length;
+	char c = 0;
+	INDIGO_TRACE_PROTOCOL(indigo_trace("received: %.*s", (int)length, data));
+	while (pointer < buffer_end) {
 		assert(name_pointer - name_buffer <= INDIGO_NAME_SIZE);
-		if (state == ERROR) {
-			indigo_error("JSON Parser: syntax error");
-			goto exit_loop;
-		}
-		while ((c = *pointer++) == 0) {
-			ssize_t count = (int)context->web_socket ? ws_read(handle, buffer, JSON_BUFFER_SIZE) : indigo_read_line(handle, buffer, JSON_BUFFER_SIZE);
-			if (count <= 0) {
-				goto exit_loop;
-			}
-			pointer = buffer;
-			buffer_end = buffer + count;
-			buffer[count] = 0;
-			INDIGO_TRACE_PROTOCOL(indigo_trace("received: %s", buffer));
-		}
+		if (state == ERROR)
+			break;
+		if ((c = *pointer++) == 0)
+			continue;
+		indigo_property *property = (indigo_property *)parser->property_buffer;
 		switch (state) {
 			case ERROR:
-				goto exit_loop;
+				break;
 			case IDLE:
 				if (isspace(c)) {
 				} else if (c == '{') {
+					if (property == NULL) {
+						property = (indigo_property *)(parser->property_buffer = malloc(PROPERTY_SIZE));
+						assert(property != NULL);
+					}
 					name_pointer = name_buffer;
 					*name_pointer = 0;
 					value_pointer = value_buffer;
@@ -456,8 +482,45 @@ void indigo_json_parse(indigo_device *device, indigo_client *client) {
 				assert(false);
 				break;
 		}
+		if (parser->compact && state == IDLE && parser->property_buffer != NULL) {
+			free(parser->property_buffer);
+			parser->property_buffer = NULL;
+		}
+	}
+	parser->handler = handler;
+	parser->state = state;
+	parser->name_pointer = name_pointer;
+	parser->value_pointer = value_pointer;
+	parser->q = q;
+	parser->depth = depth;
+	if (state == ERROR) {
+		indigo_error("JSON Parser: syntax error");
+		return false;
+	}
+	return true;
+}
+
+void indigo_json_parser_release(indigo_json_parser *parser) {
+	if (parser->property_buffer != NULL)
+		free(parser->property_buffer);
+	free(parser);
+}
+
+void indigo_json_parse(indigo_device *device, indigo_client *client) {
+	indigo_adapter_context *context = (indigo_adapter_context*)client->client_context;
+	int handle = context->input;
+	char *buffer = malloc(JSON_BUFFER_SIZE + 1);
+	assert(buffer != NULL);
+	indigo_json_parser *parser = indigo_json_parser_create(device, client, false);
+	while (true) {
+		ssize_t count = (int)context->web_socket ? ws_read(handle, buffer, JSON_BUFFER_SIZE) : indigo_read_line(handle, buffer, JSON_BUFFER_SIZE);
+		if (count <= 0)
+			break;
+		if (!indigo_json_parser_feed(parser, buffer, count))
+			break;
 	}
-exit_loop:
+	indigo_json_parser_release(parser);
+	free(buffer);
 	close(handle);
 	indigo_log("JSON Parser: parser finished");
 }
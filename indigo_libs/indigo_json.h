@@ -47,6 +47,22 @@ extern "C" {
  */
 extern void indigo_json_parse(indigo_device *device, indigo_client *client);
 
+/** Incremental JSON wire protocol parser state.
+ */
+typedef struct indigo_json_parser indigo_json_parser;
+
+/** Create incremental JSON parser (compact parser allocates its buffers on demand only, for use with many idle connections).
+ */
+extern indigo_json_parser *indigo_json_parser_create(indigo_device *device, indigo_client *client, bool compact);
+
+/** Feed incremental JSON parser with next chunk of data (returns false on syntax error).
+ */
+extern bool indigo_json_parser_feed(indigo_json_parser *parser, char *data, long length);
+
+/** Release incremental JSON parser.
+ */
+extern void indigo_json_parser_release(indigo_json_parser *parser);
+
 #ifdef __cplusplus
 }
 #endif
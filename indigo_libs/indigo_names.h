@@ -246,6 +246,19 @@
  */
 #define CCD_BIN_VERTICAL_ITEM_NAME            "VERTICAL"
 
+//----------------------------------------------------------------------
+/** CCD_BIN_MODE property name.
+ */
+#define CCD_BIN_MODE_PROPERTY_NAME            "CCD_BIN_MODE"
+
+/** CCD_BIN_MODE.SUM property item name.
+ */
+#define CCD_BIN_MODE_SUM_ITEM_NAME            "SUM"
+
+/** CCD_BIN_MODE.AVERAGE property item name.
+ */
+#define CCD_BIN_MODE_AVERAGE_ITEM_NAME        "AVERAGE"
+
 //----------------------------------------------------------------------
 /** CCD_MODE property name.
  */
@@ -316,6 +329,10 @@
  */
 #define CCD_IMAGE_FORMAT_JPEG_ITEM_NAME       "JPEG"
 
+/** CCD_IMAGE_FORMAT.FITS_RICE property item name.
+ */
+#define CCD_IMAGE_FORMAT_FITS_RICE_ITEM_NAME  "FITS_RICE"
+
 //----------------------------------------------------------------------
 /** CCD_IMAGE_FILE property name.
  */
@@ -333,6 +350,113 @@
  */
 #define CCD_IMAGE_ITEM_NAME                   "IMAGE"
 
+//----------------------------------------------------------------------
+/** CCD_IMAGE_ANALYSIS property name.
+ */
+#define CCD_IMAGE_ANALYSIS_PROPERTY_NAME      "CCD_IMAGE_ANALYSIS"
+
+/** CCD_IMAGE_ANALYSIS.ENABLED property item name.
+ */
+#define CCD_IMAGE_ANALYSIS_ENABLED_ITEM_NAME  "ENABLED"
+
+/** CCD_IMAGE_ANALYSIS.DISABLED property item name.
+ */
+#define CCD_IMAGE_ANALYSIS_DISABLED_ITEM_NAME "DISABLED"
+
+/** CCD_IMAGE_STATS property name.
+ */
+#define CCD_IMAGE_STATS_PROPERTY_NAME         "CCD_IMAGE_STATS"
+
+/** CCD_IMAGE_STATS.MIN property item name.
+ */
+#define CCD_IMAGE_STATS_MIN_ITEM_NAME         "MIN"
+
+/** CCD_IMAGE_STATS.MAX property item name.
+ */
+#define CCD_IMAGE_STATS_MAX_ITEM_NAME         "MAX"
+
+/** CCD_IMAGE_STATS.MEAN property item name.
+ */
+#define CCD_IMAGE_STATS_MEAN_ITEM_NAME        "MEAN"
+
+/** CCD_IMAGE_STATS.MEDIAN property item name.
+ */
+#define CCD_IMAGE_STATS_MEDIAN_ITEM_NAME      "MEDIAN"
+
+/** CCD_IMAGE_STATS.BACKGROUND property item name.
+ */
+#define CCD_IMAGE_STATS_BACKGROUND_ITEM_NAME  "BACKGROUND"
+
+/** CCD_IMAGE_STATS.NOISE property item name.
+ */
+#define CCD_IMAGE_STATS_NOISE_ITEM_NAME       "NOISE"
+
+/** CCD_IMAGE_STATS.STARS property item name.
+ */
+#define CCD_IMAGE_STATS_STARS_ITEM_NAME       "STARS"
+
+/** CCD_IMAGE_STATS.HFR property item name.
+ */
+#define CCD_IMAGE_STATS_HFR_ITEM_NAME         "HFR"
+
+/** CCD_IMAGE_STATS.FWHM property item name.
+ */
+#define CCD_IMAGE_STATS_FWHM_ITEM_NAME        "FWHM"
+
+//----------------------------------------------------------------------
+/** CCD_STACK property name.
+ */
+#define CCD_STACK_PROPERTY_NAME               "CCD_STACK"
+
+/** CCD_STACK.DISABLED property item name.
+ */
+#define CCD_STACK_DISABLED_ITEM_NAME          "DISABLED"
+
+/** CCD_STACK.MEAN property item name.
+ */
+#define CCD_STACK_MEAN_ITEM_NAME              "MEAN"
+
+/** CCD_STACK.SIGMA_CLIP property item name.
+ */
+#define CCD_STACK_SIGMA_CLIP_ITEM_NAME        "SIGMA_CLIP"
+
+/** CCD_STACK_SETTINGS property name.
+ */
+#define CCD_STACK_SETTINGS_PROPERTY_NAME      "CCD_STACK_SETTINGS"
+
+/** CCD_STACK_SETTINGS.INTERVAL property item name.
+ */
+#define CCD_STACK_SETTINGS_INTERVAL_ITEM_NAME "INTERVAL"
+
+/** CCD_STACK_SETTINGS.SIGMA property item name.
+ */
+#define CCD_STACK_SETTINGS_SIGMA_ITEM_NAME    "SIGMA"
+
+/** CCD_STACK_IMAGE property name.
+ */
+#define CCD_STACK_IMAGE_PROPERTY_NAME         "CCD_STACK_IMAGE"
+
+/** CCD_STACK_IMAGE.IMAGE property item name.
+ */
+#define CCD_STACK_IMAGE_ITEM_NAME             "IMAGE"
+
+//----------------------------------------------------------------------
+/** CCD_CALIBRATION property name.
+ */
+#define CCD_CALIBRATION_PROPERTY_NAME         "CCD_CALIBRATION"
+
+/** CCD_CALIBRATION.DARK property item name.
+ */
+#define CCD_CALIBRATION_DARK_ITEM_NAME        "DARK"
+
+/** CCD_CALIBRATION.BIAS property item name.
+ */
+#define CCD_CALIBRATION_BIAS_ITEM_NAME        "BIAS"
+
+/** CCD_CALIBRATION.FLAT property item name.
+ */
+#define CCD_CALIBRATION_FLAT_ITEM_NAME        "FLAT"
+
 //----------------------------------------------------------------------
 /** CCD_TEMPERATURE property name.
  */
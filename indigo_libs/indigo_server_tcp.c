@@ -38,12 +38,22 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <stdint.h>
+
+#if defined(INDIGO_LINUX)
+#include <sys/epoll.h>
+#endif
 
 #include "indigo_server_tcp.h"
 #include "indigo_driver_xml.h"
 #include "indigo_driver_json.h"
 #include "indigo_client_xml.h"
+#include "indigo_xml.h"
+#include "indigo_json.h"
 #include "indigo_base64.h"
 #include "indigo_io.h"
 
@@ -56,29 +66,261 @@
 
 void sha1(unsigned char h[static SHA1_SIZE], const void *_sha1_restrict p, size_t n);
 
-static int server_socket;
-static struct sockaddr_in server_address;
+#define MAX_LISTENERS	32
+
+static struct {
+	int socket;
+	int thread_count;
+} listeners[MAX_LISTENERS];
+static int listener_count = 0;
+static bool unix_listening = false;
 static bool shutdown_initiated = false;
 static int client_count = 0;
 static indigo_server_tcp_callback server_callback;
 
 int indigo_server_tcp_port = 7624;
 bool indigo_is_ephemeral_port = false;
+bool indigo_server_use_event_loop = false;
+int indigo_server_event_loop_count = 2;
+int indigo_server_worker_count = 4;
+int indigo_server_http_worker_count = 2;
+const char *indigo_server_unix_socket = NULL;
+const char *indigo_server_listen_addresses = NULL;
+int indigo_server_listen_backlog = 128;
+int indigo_server_accept_thread_count = 1;
 
 static struct resource {
 	char *path;
 	unsigned char *data;
 	unsigned length;
 	char *content_type;
+	char etag[24];
 	struct resource *next;
 } *resources = NULL;
 
 #define BUFFER_SIZE	1024
 
+#define RESOURCE_MAX_AGE	3600
+
+/* send to client which doesn't read for so long fails */
+#define SEND_TIMEOUT			10
+/* max. number of buffers discarded before connection is closed */
+#define HTTP_CLOSE_DRAIN	16
+
+typedef enum {
+	HTTP_CLOSE,
+	HTTP_KEEP_ALIVE,
+	HTTP_WEB_SOCKET,
+	HTTP_ERROR
+} http_result;
+
+typedef struct {
+	char websocket_key[256];
+	bool keep_alive;
+	bool range;
+	long range_start;		///< -1 for suffix range
+	long range_end;			///< -1 for open range, suffix length for suffix range
+	char if_none_match[64];
+	char if_range[64];
+} http_request;
+
+static void http_request_init(http_request *request, char *request_line) {
+	memset(request, 0, sizeof(http_request));
+	/* HTTP/1.1 connections are persistent unless client asks otherwise */
+	request->keep_alive = strstr(request_line, "HTTP/1.1") != NULL;
+}
+
+static bool http_header_contains(const char *value, const char *token) {
+	int length = (int)strlen(token);
+	for (; *value; value++)
+		if (!strncasecmp(value, token, length))
+			return true;
+	return false;
+}
+
+static void http_header(char *header, http_request *request) {
+	if (!strncasecmp(header, "Sec-WebSocket-Key: ", 19)) {
+		strncpy(request->websocket_key, header + 19, 128);
+		request->websocket_key[127] = 0;
+	} else if (!strncasecmp(header, "Connection: ", 12)) {
+		if (http_header_contains(header + 12, "close"))
+			request->keep_alive = false;
+		else if (http_header_contains(header + 12, "keep-alive"))
+			request->keep_alive = true;
+	} else if (!strncasecmp(header, "Range: bytes=", 13)) {
+		char *value = header + 13;
+		char *end;
+		if (*value == '-') {
+			request->range_start = -1;
+			request->range_end = strtol(value + 1, &end, 10);
+			request->range = end != value + 1;
+		} else {
+			request->range_start = strtol(value, &end, 10);
+			if (end != value && *end == '-') {
+				value = end + 1;
+				request->range_end = *value ? strtol(value, &end, 10) : -1;
+				/* multiple ranges are not supported, full content is sent instead */
+				request->range = *end == 0;
+			}
+		}
+	} else if (!strncasecmp(header, "If-None-Match: ", 15)) {
+		strncpy(request->if_none_match, header + 15, sizeof(request->if_none_match) - 1);
+	} else if (!strncasecmp(header, "If-Range: ", 10)) {
+		strncpy(request->if_range, header + 10, sizeof(request->if_range) - 1);
+	}
+}
+
+static void http_close(int socket) {
+	/* response is flushed by shutdown, data already received from client are discarded without waiting so that close doesn't reset the connection */
+	char buffer[BUFFER_SIZE];
+	shutdown(socket, SHUT_WR);
+	for (int i = 0; i < HTTP_CLOSE_DRAIN && recv(socket, buffer, BUFFER_SIZE, MSG_DONTWAIT) > 0; i++)
+		;
+	close(socket);
+}
+
+static bool http_send_content(int socket, http_request *request, const char *headers, const char *etag, const unsigned char *data, long length) {
+	long start = 0, end = length - 1;
+	/* range of different entity (or of entity identified by date, Last-Modified is never sent) is ignored and full content is sent */
+	if (request->range && *request->if_range && strcmp(request->if_range, etag))
+		request->range = false;
+	if (request->range) {
+		if (request->range_start == -1) {
+			start = length - request->range_end;
+			if (start < 0)
+				start = 0;
+		} else {
+			start = request->range_start;
+			if (request->range_end != -1 && request->range_end < end)
+				end = request->range_end;
+		}
+		if (start > end) {
+			indigo_printf(socket, "HTTP/1.1 416 Range Not Satisfiable\r\n");
+			indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
+			indigo_printf(socket, "Connection: %s\r\n", request->keep_alive ? "keep-alive" : "close");
+			indigo_printf(socket, "Content-Range: bytes */%ld\r\n", length);
+			indigo_printf(socket, "ETag: %s\r\n", etag);
+			indigo_printf(socket, "Content-Length: 0\r\n");
+			return indigo_printf(socket, "\r\n");
+		}
+		indigo_printf(socket, "HTTP/1.1 206 Partial Content\r\n");
+		indigo_printf(socket, "Content-Range: bytes %ld-%ld/%ld\r\n", start, end, length);
+	} else {
+		indigo_printf(socket, "HTTP/1.1 200 OK\r\n");
+	}
+	indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
+	indigo_printf(socket, "Connection: %s\r\n", request->keep_alive ? "keep-alive" : "close");
+	indigo_printf(socket, "Accept-Ranges: bytes\r\n");
+	indigo_printf(socket, "ETag: %s\r\n", etag);
+	indigo_printf(socket, "%s", headers);
+	indigo_printf(socket, "Content-Length: %ld\r\n", end - start + 1);
+	indigo_printf(socket, "\r\n");
+	return indigo_write(socket, (const char *)data + start, end - start + 1);
+}
+
+static http_result http_response(int socket, char *request_line, http_request *request) {
+	char headers[BUFFER_SIZE];
+	char *path = request_line + 4;
+	char *space = strchr(path, ' ');
+	if (space)
+		*space = 0;
+	char *param = strchr(path, '?');
+	if (param)
+		*param = 0;
+	if (!strcmp(path, "/")) {
+		char *websocket_key = request->websocket_key;
+		if (*websocket_key) {
+			unsigned char shaHash[20];
+			memset(shaHash, 0, sizeof(shaHash));
+			strcat(websocket_key, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+			sha1(shaHash, websocket_key, strlen(websocket_key));
+			indigo_printf(socket, "HTTP/1.1 101 Switching Protocols\r\n");
+			indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
+			indigo_printf(socket, "Upgrade: websocket\r\n");
+			indigo_printf(socket, "Connection: upgrade\r\n");
+			base64_encode((unsigned char *)websocket_key, shaHash, 20);
+			indigo_printf(socket, "Sec-WebSocket-Accept: %s\r\n", websocket_key);
+			indigo_printf(socket, "\r\n");
+			INDIGO_LOG(indigo_log("Protocol switched to JSON-over-WebSockets"));
+			return HTTP_WEB_SOCKET;
+		}
+		static const char *redirect = "<a href='/ctrl'>INDIGO Control Panel</a>";
+		indigo_printf(socket, "HTTP/1.1 301 Moved Permanently\r\n");
+		indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
+		indigo_printf(socket, "Connection: %s\r\n", request->keep_alive ? "keep-alive" : "close");
+		indigo_printf(socket, "Location: /ctrl\r\n");
+		indigo_printf(socket, "Content-type: text/html\r\n");
+		indigo_printf(socket, "Content-Length: %ld\r\n", strlen(redirect));
+		indigo_printf(socket, "\r\n");
+		indigo_printf(socket, "%s", redirect);
+		return request->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+	}
+	if (!strncmp(path, "/blob/", 6)) {
+		indigo_item *item;
+		unsigned long sequence;
+		if (sscanf(path, "/blob/%p.", &item) && indigo_validate_blob_sequence(item, &sequence) == INDIGO_OK) {
+			/* BLOB URL is reused for every new image, so it can't be cached, entity tag identifies the image for resumed downloads */
+			char etag[64];
+			snprintf(etag, sizeof(etag), "\"%p-%lx\"", item, sequence);
+			if (item->blob.value == NULL && item->blob.encoded_value != NULL)
+				indigo_populate_http_blob_item(item);
+			if (!strcmp(item->blob.format, ".jpeg"))
+				snprintf(headers, BUFFER_SIZE, "Cache-Control: no-cache\r\nContent-Type: image/jpeg\r\n");
+			else
+				snprintf(headers, BUFFER_SIZE, "Cache-Control: no-cache\r\nContent-Type: application/octet-stream\r\nContent-Disposition: attachment; filename=\"%p%s\"\r\n", item, item->blob.format);
+			if (!http_send_content(socket, request, headers, etag, item->blob.value, item->blob.size)) {
+				INDIGO_LOG(indigo_log("%s -> Failed (%s)", request_line, strerror(errno)));
+				return HTTP_ERROR;
+			}
+			INDIGO_LOG(indigo_log("%s -> OK (%ld bytes)", request_line, item->blob.size));
+			return request->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+		}
+		indigo_printf(socket, "HTTP/1.1 404 Not found\r\n");
+		indigo_printf(socket, "Connection: close\r\n");
+		indigo_printf(socket, "Content-Type: text/plain\r\n");
+		indigo_printf(socket, "\r\n");
+		indigo_printf(socket, "BLOB not found!\r\n");
+		INDIGO_LOG(indigo_log("%s -> Failed", request_line));
+		return HTTP_CLOSE;
+	}
+	struct resource *resource = resources;
+	while (resource != NULL)
+		if (!strcmp(resource->path, path))
+			break;
+		else
+			resource = resource->next;
+	if (resource == NULL) {
+		indigo_printf(socket, "HTTP/1.1 404 Not found\r\n");
+		indigo_printf(socket, "Connection: close\r\n");
+		indigo_printf(socket, "Content-Type: text/plain\r\n");
+		indigo_printf(socket, "\r\n");
+		indigo_printf(socket, "%s not found!\r\n", path);
+		INDIGO_LOG(indigo_log("%s -> Failed", request_line));
+		return HTTP_CLOSE;
+	}
+	if (!strcmp(request->if_none_match, resource->etag)) {
+		indigo_printf(socket, "HTTP/1.1 304 Not Modified\r\n");
+		indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
+		indigo_printf(socket, "Connection: %s\r\n", request->keep_alive ? "keep-alive" : "close");
+		indigo_printf(socket, "ETag: %s\r\n", resource->etag);
+		indigo_printf(socket, "Cache-Control: public, max-age=%d\r\n", RESOURCE_MAX_AGE);
+		indigo_printf(socket, "\r\n");
+		INDIGO_LOG(indigo_log("%s -> Not modified", request_line));
+		return request->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+	}
+	snprintf(headers, BUFFER_SIZE, "Content-Type: %s\r\nContent-Encoding: gzip\r\nCache-Control: public, max-age=%d\r\n", resource->content_type, RESOURCE_MAX_AGE);
+	if (!http_send_content(socket, request, headers, resource->etag, resource->data, resource->length)) {
+		INDIGO_LOG(indigo_log("%s -> Failed (%s)", request_line, strerror(errno)));
+		return HTTP_ERROR;
+	}
+	INDIGO_LOG(indigo_log("%s -> OK (%d bytes)", request_line, resource->length));
+	return request->keep_alive ? HTTP_KEEP_ALIVE : HTTP_CLOSE;
+}
+
 static void start_worker_thread(int *client_socket) {
 	int socket = *client_socket;
 	INDIGO_LOG(indigo_log("Worker thread started socket = %d", socket));
-	server_callback(++client_count);
+	server_callback(__sync_add_and_fetch(&client_count, 1));
 	int res = 0;
 	char c;
 	if (recv(socket, &c, 1, MSG_PEEK) == 1) {
@@ -99,142 +341,403 @@ static void start_worker_thread(int *client_socket) {
 			indigo_detach_client(protocol_adapter);
 			indigo_release_json_device_adapter(protocol_adapter);
 		} else if (c == 'G') {
-			char request[BUFFER_SIZE];
+			char request_line[BUFFER_SIZE];
 			char header[BUFFER_SIZE];
-			while ((res = indigo_read_line(socket, request, BUFFER_SIZE)) >= 0) {
-				if (!strncmp(request, "GET /", 5)) {
-					char *path = request + 4;
-					char *space = strchr(path, ' ');
-					if (space)
-						*space = 0;
-					char *param = strchr(path, '?');
-					if (param)
-						*param = 0;
-					char websocket_key[256] = "";
-					bool keep_alive = false;
-					while (indigo_read_line(socket, header, BUFFER_SIZE) > 0) {
-						if (!strncasecmp(header, "Sec-WebSocket-Key: ", 19))
-							strcpy(websocket_key, header + 19);
-						if (!strcasecmp(header, "Connection: keep-alive"))
-							keep_alive = true;
+			while ((res = indigo_read_line(socket, request_line, BUFFER_SIZE)) >= 0) {
+				if (!strncmp(request_line, "GET /", 5)) {
+					http_request request;
+					http_request_init(&request, request_line);
+					while (indigo_read_line(socket, header, BUFFER_SIZE) > 0)
+						http_header(header, &request);
+					http_result result = http_response(socket, request_line, &request);
+					if (result == HTTP_WEB_SOCKET) {
+						indigo_client *protocol_adapter = indigo_json_device_adapter(socket, socket, true);
+						assert(protocol_adapter != NULL);
+						indigo_attach_client(protocol_adapter);
+						indigo_json_parse(NULL, protocol_adapter);
+						indigo_detach_client(protocol_adapter);
+						break;
+					}
+					if (result == HTTP_CLOSE) {
+						http_close(socket);
+						break;
 					}
-					if (!strcmp(path, "/")) {
-						if (*websocket_key) {
-							unsigned char shaHash[20];
-							memset(shaHash, 0, sizeof(shaHash));
-							strcat(websocket_key, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
-							sha1(shaHash, websocket_key, strlen(websocket_key));
-							indigo_printf(socket, "HTTP/1.1 101 Switching Protocols\r\n");
-							indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
-							indigo_printf(socket, "Upgrade: websocket\r\n");
-							indigo_printf(socket, "Connection: upgrade\r\n");
-							base64_encode((unsigned char *)websocket_key, shaHash, 20);
-							indigo_printf(socket, "Sec-WebSocket-Accept: %s\r\n", websocket_key);
-							indigo_printf(socket, "\r\n");
-							INDIGO_LOG(indigo_log("Protocol switched to JSON-over-WebSockets"));
-							indigo_client *protocol_adapter = indigo_json_device_adapter(socket, socket, true);
-							assert(protocol_adapter != NULL);
-							indigo_attach_client(protocol_adapter);
-							indigo_json_parse(NULL, protocol_adapter);
-							indigo_detach_client(protocol_adapter);
-							break;
-						} else {
-							indigo_printf(socket, "HTTP/1.1 301 OK\r\n");
-							indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
-							indigo_printf(socket, "Location: /ctrl\r\n");
-							indigo_printf(socket, "Content-type: text/html\r\n");
-							indigo_printf(socket, "\r\n");
-							indigo_printf(socket, "<a href='/ctrl'>INDIGO Control Panel</a>");
-							break;
-						}
-					} else {
-						if (!strncmp(path, "/blob/", 6)) {
-							indigo_item *item;
-							if (sscanf(path, "/blob/%p.", &item) && indigo_validate_blob(item) == INDIGO_OK) {
-								indigo_printf(socket, "HTTP/1.1 200 OK\r\n");
-								indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
-								if (!strcmp(item->blob.format, ".jpeg")) {
-									indigo_printf(socket, "Content-Type: image/jpeg\r\n");
-								} else {
-									indigo_printf(socket, "Content-Type: application/octet-stream\r\n");
-									indigo_printf(socket, "Content-Disposition: attachment; filename=\"%p%s\"\r\n", item, item->blob.format);
-								}
-								if (keep_alive)
-									indigo_printf(socket, "Connection: keep-alive\r\n");
-								indigo_printf(socket, "Content-Length: %ld\r\n", item->blob.size);
-								indigo_printf(socket, "\r\n");
-								indigo_write(socket, item->blob.value, item->blob.size);
-								INDIGO_LOG(indigo_log("%s -> OK (%ld bytes)\r\n", request, item->blob.size));
-							} else {
-								indigo_printf(socket, "HTTP/1.1 404 Not found\r\n");
-								indigo_printf(socket, "Content-Type: text/plain\r\n");
-								indigo_printf(socket, "\r\n");
-								indigo_printf(socket, "BLOB not found!\r\n");
-								shutdown(socket,SHUT_RDWR);
-								sleep(1);
-								close(socket);
-								INDIGO_LOG(indigo_log("%s -> Failed", request));
-								break;
-							}
-						} else {
-							struct resource *resource = resources;
-							while (resource != NULL)
-								if (!strcmp(resource->path, path))
-									break;
-								else
-									resource = resource->next;
-							if (resource == NULL) {
-								indigo_printf(socket, "HTTP/1.1 404 Not found\r\n");
-								indigo_printf(socket, "Content-Type: text/plain\r\n");
-								indigo_printf(socket, "\r\n");
-								indigo_printf(socket, "%s not found!\r\n", path);
-								shutdown(socket,SHUT_RDWR);
-								sleep(1);
-								close(socket);
-								INDIGO_LOG(indigo_log("%s -> Failed", request));
-								break;
-							} else {
-								keep_alive = false;
-								indigo_printf(socket, "HTTP/1.1 200 OK\r\n");
-								indigo_printf(socket, "Server: INDIGO/%d.%d-%d\r\n", (INDIGO_VERSION_CURRENT >> 8) & 0xFF, INDIGO_VERSION_CURRENT & 0xFF, INDIGO_BUILD);
-								if (keep_alive)
-									indigo_printf(socket, "Connection: keep-alive\r\n");
-								indigo_printf(socket, "Content-Type: %s\r\n", resource->content_type);
-								indigo_printf(socket, "Content-Length: %d\r\n", resource->length);
-								indigo_printf(socket, "Content-Encoding: gzip\r\n");
-								indigo_printf(socket, "\r\n");
-								indigo_write(socket, (const char *)resource->data, resource->length);
-								INDIGO_LOG(indigo_log("%s -> OK (%d bytes)", request, resource->length));
-							}
-						}
-						if (!keep_alive) {
-							shutdown(socket, SHUT_RDWR);
-							sleep(1);
-							close(socket);
-							break;
-						}
+					if (result == HTTP_ERROR) {
+						close(socket);
+						break;
 					}
 				}
 			}
 			if (res < 0) { /* Client cosed the connection */
-				shutdown(socket, SHUT_RDWR);
-				sleep(1);
 				close(socket);
 			}
 		} else {
 			INDIGO_LOG(indigo_log("Unrecognised protocol"));
 		}
 	}
-	server_callback(--client_count);
+	server_callback(__sync_sub_and_fetch(&client_count, 1));
 	free(client_socket);
 	INDIGO_LOG(indigo_log("Worker thread finished"));
 }
 
+#if defined(INDIGO_LINUX)
+
+#define EVENT_BUFFER_SIZE		(64 * 1024)
+#define EVENT_QUEUE_SIZE		1024
+#define MAX_EVENT_LOOPS			16
+
+typedef enum {
+	PROTOCOL_UNKNOWN,
+	PROTOCOL_XML,
+	PROTOCOL_JSON,
+	PROTOCOL_WEB_SOCKET,
+	PROTOCOL_HTTP
+} connection_protocol;
+
+typedef struct {
+	int socket;
+	int epoll_fd;
+	connection_protocol protocol;
+	bool closing;
+	indigo_client *protocol_adapter;
+	indigo_xml_parser *xml_parser;
+	indigo_json_parser *json_parser;
+	char *line;
+	int line_length;
+	char *request;
+	http_request http_request;
+	uint8_t ws_header[14];
+	int ws_header_length;
+	uint64_t ws_remains;
+	int ws_mask_index;
+} connection;
+
+static int event_loops[MAX_EVENT_LOOPS];
+static int event_loop_index = 0;
+static bool event_loop_started = false;
+
+typedef struct {
+	connection *connections[EVENT_QUEUE_SIZE];
+	int head;
+	int tail;
+	int length;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} event_queue;
+
+/* HTTP requests (BLOB downloads in particular) block worker until whole response is written, so they are served by separate
+   pool and can't starve parsing of XML and JSON protocol traffic */
+static event_queue protocol_queue = { .mutex = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER };
+static event_queue http_queue = { .mutex = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER };
+
+static void event_queue_put(event_queue *queue, connection *connection) {
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->length == EVENT_QUEUE_SIZE)
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+	queue->connections[queue->tail] = connection;
+	queue->tail = (queue->tail + 1) % EVENT_QUEUE_SIZE;
+	queue->length++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static connection *event_queue_get(event_queue *queue) {
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->length == 0)
+		pthread_cond_wait(&queue->not_empty, &queue->mutex);
+	connection *connection = queue->connections[queue->head];
+	queue->head = (queue->head + 1) % EVENT_QUEUE_SIZE;
+	queue->length--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->mutex);
+	return connection;
+}
+
+static void event_connection_close(connection *connection) {
+	switch (connection->protocol) {
+		case PROTOCOL_XML:
+			indigo_detach_client(connection->protocol_adapter);
+			indigo_xml_parser_release(connection->xml_parser);
+			indigo_release_xml_device_adapter(connection->protocol_adapter);
+			break;
+		case PROTOCOL_JSON:
+		case PROTOCOL_WEB_SOCKET:
+			indigo_detach_client(connection->protocol_adapter);
+			indigo_json_parser_release(connection->json_parser);
+			indigo_release_json_device_adapter(connection->protocol_adapter);
+			break;
+		default:
+			break;
+	}
+	if (connection->line != NULL)
+		free(connection->line);
+	if (connection->request != NULL)
+		free(connection->request);
+	close(connection->socket);
+	server_callback(__sync_sub_and_fetch(&client_count, 1));
+	INDIGO_LOG(indigo_log("Connection closed socket = %d", connection->socket));
+	free(connection);
+}
+
+static bool event_web_socket_data(connection *connection, uint8_t *data, long length) {
+	while (length > 0) {
+		if (connection->ws_remains == 0) {
+			connection->ws_header[connection->ws_header_length++] = *data++;
+			length--;
+			if (connection->ws_header_length < 2)
+				continue;
+			uint8_t *header = connection->ws_header;
+			int payload_length = header[1] & 0x7F;
+			int header_length = 2 + (payload_length == 0x7E ? 2 : payload_length == 0x7F ? 8 : 0) + (header[1] & 0x80 ? 4 : 0);
+			if (connection->ws_header_length < header_length)
+				continue;
+			if ((header[0] & 0x0F) == 0x08) {
+				INDIGO_TRACE_PROTOCOL(indigo_trace("ws_read -> close"));
+				return false;
+			}
+			if (payload_length == 0x7E)
+				connection->ws_remains = ntohs(*((uint16_t *)(header + 2)));
+			else if (payload_length == 0x7F)
+				connection->ws_remains = ntohll(*((uint64_t *)(header + 2)));
+			else
+				connection->ws_remains = payload_length;
+			connection->ws_mask_index = 0;
+			connection->ws_header_length = 0;
+			continue;
+		}
+		uint8_t *header = connection->ws_header;
+		int payload_length = header[1] & 0x7F;
+		uint8_t *masking_key = header + (payload_length == 0x7E ? 4 : payload_length == 0x7F ? 10 : 2);
+		long count = length < connection->ws_remains ? length : (long)connection->ws_remains;
+		if (header[1] & 0x80)
+			for (long i = 0; i < count; i++)
+				data[i] ^= masking_key[connection->ws_mask_index++ % 4];
+		uint8_t opcode = header[0] & 0x0F;
+		if ((opcode == 0x00 || opcode == 0x01) && !indigo_json_parser_feed(connection->json_parser, (char *)data, count))
+			return false;
+		connection->ws_remains -= count;
+		data += count;
+		length -= count;
+	}
+	return true;
+}
+
+static bool event_http_data(connection *connection, char *data, long length) {
+	for (long i = 0; i < length && !connection->closing; i++) {
+		char c = data[i];
+		if (c == '\r')
+			continue;
+		if (c != '\n') {
+			if (connection->line_length < BUFFER_SIZE - 1)
+				connection->line[connection->line_length++] = c;
+			continue;
+		}
+		connection->line[connection->line_length] = 0;
+		connection->line_length = 0;
+		if (*connection->request == 0) {
+			if (!strncmp(connection->line, "GET /", 5)) {
+				strcpy(connection->request, connection->line);
+				http_request_init(&connection->http_request, connection->request);
+			}
+		} else if (*connection->line) {
+			http_header(connection->line, &connection->http_request);
+		} else {
+			http_result result = http_response(connection->socket, connection->request, &connection->http_request);
+			*connection->request = 0;
+			if (result == HTTP_WEB_SOCKET) {
+				free(connection->line);
+				connection->line = NULL;
+				free(connection->request);
+				connection->request = NULL;
+				connection->protocol_adapter = indigo_json_device_adapter(connection->socket, connection->socket, true);
+				assert(connection->protocol_adapter != NULL);
+				connection->json_parser = indigo_json_parser_create(NULL, connection->protocol_adapter, true);
+				connection->protocol = PROTOCOL_WEB_SOCKET;
+				indigo_attach_client(connection->protocol_adapter);
+				return event_web_socket_data(connection, (uint8_t *)data + i + 1, length - i - 1);
+			}
+			if (result == HTTP_ERROR)
+				return false;
+			if (result == HTTP_CLOSE) {
+				/* wait for client to close the connection */
+				shutdown(connection->socket, SHUT_WR);
+				connection->closing = true;
+			}
+		}
+	}
+	return true;
+}
+
+static bool event_connection_data(connection *connection, char *data, long length) {
+	if (connection->closing)
+		return true;
+	if (connection->protocol == PROTOCOL_UNKNOWN) {
+		if (*data == '<') {
+			INDIGO_LOG(indigo_log("Protocol switched to XML"));
+			connection->protocol_adapter = indigo_xml_device_adapter(connection->socket, connection->socket);
+			assert(connection->protocol_adapter != NULL);
+			connection->xml_parser = indigo_xml_parser_create(NULL, connection->protocol_adapter, true);
+			connection->protocol = PROTOCOL_XML;
+			indigo_attach_client(connection->protocol_adapter);
+		} else if (*data == '{') {
+			INDIGO_LOG(indigo_log("Protocol switched to JSON"));
+			connection->protocol_adapter = indigo_json_device_adapter(connection->socket, connection->socket, false);
+			assert(connection->protocol_adapter != NULL);
+			connection->json_parser = indigo_json_parser_create(NULL, connection->protocol_adapter, true);
+			connection->protocol = PROTOCOL_JSON;
+			indigo_attach_client(connection->protocol_adapter);
+		} else if (*data == 'G') {
+			connection->line = malloc(BUFFER_SIZE);
+			connection->request = malloc(BUFFER_SIZE);
+			assert(connection->line != NULL && connection->request != NULL);
+			*connection->request = 0;
+			connection->protocol = PROTOCOL_HTTP;
+		} else {
+			INDIGO_LOG(indigo_log("Unrecognised protocol"));
+			return false;
+		}
+	}
+	switch (connection->protocol) {
+		case PROTOCOL_XML:
+			return indigo_xml_parser_feed(connection->xml_parser, data, length);
+		case PROTOCOL_JSON:
+			return indigo_json_parser_feed(connection->json_parser, data, length);
+		case PROTOCOL_WEB_SOCKET:
+			return event_web_socket_data(connection, (uint8_t *)data, length);
+		case PROTOCOL_HTTP:
+			return event_http_data(connection, data, length);
+		default:
+			return false;
+	}
+}
+
+static void *event_worker_thread(event_queue *queue) {
+	char *buffer = malloc(EVENT_BUFFER_SIZE);
+	assert(buffer != NULL);
+	while (true) {
+		connection *connection = event_queue_get(queue);
+		if (connection->protocol == PROTOCOL_UNKNOWN) {
+			/* connection is not rearmed yet, so it is owned by HTTP worker from now on */
+			char c;
+			if (recv(connection->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 && c == 'G') {
+				connection->line = malloc(BUFFER_SIZE);
+				connection->request = malloc(BUFFER_SIZE);
+				assert(connection->line != NULL && connection->request != NULL);
+				*connection->request = 0;
+				connection->protocol = PROTOCOL_HTTP;
+				event_queue_put(&http_queue, connection);
+				continue;
+			}
+		}
+		long count = recv(connection->socket, buffer, EVENT_BUFFER_SIZE, MSG_DONTWAIT);
+		bool keep_open = true;
+		if (count > 0)
+			keep_open = event_connection_data(connection, buffer, count);
+		else if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			keep_open = false;
+		if (keep_open) {
+			struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = connection };
+			if (epoll_ctl(connection->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event) < 0) {
+				indigo_error("Can't rearm connection (%s)", strerror(errno));
+				keep_open = false;
+			}
+		}
+		if (!keep_open)
+			event_connection_close(connection);
+	}
+	return NULL;
+}
+
+static void *event_loop_thread(int *epoll_fd) {
+	struct epoll_event events[64];
+	while (true) {
+		int count = epoll_wait(*epoll_fd, events, 64, -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			indigo_error("Can't wait for events (%s)", strerror(errno));
+			break;
+		}
+		for (int i = 0; i < count; i++) {
+			connection *connection = events[i].data.ptr;
+			/* connection is armed for one event only, so its protocol can't change until it is processed */
+			event_queue_put(connection->protocol == PROTOCOL_HTTP ? &http_queue : &protocol_queue, connection);
+		}
+	}
+	return NULL;
+}
+
+static bool event_loop_start() {
+	if (event_loop_started)
+		return true;
+	if (indigo_server_event_loop_count < 1)
+		indigo_server_event_loop_count = 1;
+	else if (indigo_server_event_loop_count > MAX_EVENT_LOOPS)
+		indigo_server_event_loop_count = MAX_EVENT_LOOPS;
+	if (indigo_server_worker_count < 1)
+		indigo_server_worker_count = 1;
+	if (indigo_server_http_worker_count < 1)
+		indigo_server_http_worker_count = 1;
+	pthread_t thread;
+	for (int i = 0; i < indigo_server_event_loop_count; i++) {
+		event_loops[i] = epoll_create1(EPOLL_CLOEXEC);
+		if (event_loops[i] < 0) {
+			indigo_error("Can't create event loop (%s)", strerror(errno));
+			return false;
+		}
+		if (pthread_create(&thread, NULL, (void *(*)(void *))&event_loop_thread, event_loops + i) != 0) {
+			indigo_error("Can't create event loop thread (%s)", strerror(errno));
+			return false;
+		}
+		pthread_detach(thread);
+	}
+	for (int i = 0; i < indigo_server_worker_count + indigo_server_http_worker_count; i++) {
+		if (pthread_create(&thread, NULL, (void *(*)(void *))&event_worker_thread, i < indigo_server_worker_count ? &protocol_queue : &http_queue) != 0) {
+			indigo_error("Can't create worker thread (%s)", strerror(errno));
+			return false;
+		}
+		pthread_detach(thread);
+	}
+	INDIGO_LOG(indigo_log("Event loop started with %d loop(s), %d protocol worker(s) and %d HTTP worker(s)", indigo_server_event_loop_count, indigo_server_worker_count, indigo_server_http_worker_count));
+	event_loop_started = true;
+	return true;
+}
+
+static void event_loop_add(int client_socket) {
+	connection *connection = malloc(sizeof(*connection));
+	assert(connection != NULL);
+	memset(connection, 0, sizeof(*connection));
+	connection->socket = client_socket;
+	connection->epoll_fd = event_loops[event_loop_index];
+	event_loop_index = (event_loop_index + 1) % indigo_server_event_loop_count;
+	server_callback(__sync_add_and_fetch(&client_count, 1));
+	INDIGO_LOG(indigo_log("Connection accepted socket = %d", client_socket));
+	struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = connection };
+	if (epoll_ctl(connection->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+		indigo_error("Can't add connection to event loop (%s)", strerror(errno));
+		event_connection_close(connection);
+	}
+}
+
+#endif
+
+static void listeners_close() {
+	for (int i = 0; i < listener_count; i++) {
+		shutdown(listeners[i].socket, SHUT_RDWR);
+		close(listeners[i].socket);
+	}
+	listener_count = 0;
+	if (unix_listening) {
+		unlink(indigo_server_unix_socket);
+		unix_listening = false;
+	}
+}
+
 void indigo_server_shutdown() {
 	if (!shutdown_initiated) {
 		shutdown_initiated = true;
-		shutdown(server_socket, SHUT_RDWR);
-		close(server_socket);
+		listeners_close();
 	}
 }
 
@@ -245,59 +748,300 @@ void indigo_server_add_resource(char *path, unsigned char *data, unsigned length
 	resource->data = data;
 	resource->length = length;
 	resource->content_type = content_type;
+	/* FNV-1a hash of content is used as entity tag */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned i = 0; i < length; i++)
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+	snprintf(resource->etag, sizeof(resource->etag), "\"%016llx\"", (unsigned long long)hash);
 	resource->next = resources;
 	resources = resource;
 }
 
-indigo_result indigo_server_start(indigo_server_tcp_callback callback) {
-	server_callback = callback;
-	int client_socket;
+static void server_accept(int client_socket) {
+	/* client which stopped reading can't block the writer forever */
+	struct timeval timeout = { SEND_TIMEOUT, 0 };
+	if (setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+		indigo_error("Can't set send timeout (%s)", strerror(errno));
+#if defined(INDIGO_LINUX)
+	if (indigo_server_use_event_loop) {
+		/* workers never wait for data, it is just a safety net */
+		if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+			indigo_error("Can't set receive timeout (%s)", strerror(errno));
+		event_loop_add(client_socket);
+		return;
+	}
+#endif
+	pthread_t thread;
+	int *pointer = malloc(sizeof(int));
+	*pointer = client_socket;
+	if (pthread_create(&thread , NULL, (void *(*)(void *))&start_worker_thread, pointer) != 0)
+		indigo_error("Can't create worker thread for connection (%s)", strerror(errno));
+}
+
+static void accept_loop(int server_socket) {
+	while (1) {
+		int client_socket = accept(server_socket, NULL, NULL);
+		if (client_socket == -1) {
+			if (shutdown_initiated)
+				break;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			indigo_error("Can't accept connection (%s)", strerror(errno));
+			/* out of descriptors, give workers a chance to release some */
+			if (errno == EMFILE || errno == ENFILE)
+				usleep(100000);
+		} else {
+			server_accept(client_socket);
+		}
+	}
+}
+
+static void *accept_thread(int *server_socket) {
+	int socket = *server_socket;
+	free(server_socket);
+	accept_loop(socket);
+	return NULL;
+}
+
+static bool listener_add(int socket, int thread_count) {
+	if (listener_count == MAX_LISTENERS) {
+		indigo_error("Too many listeners");
+		close(socket);
+		return false;
+	}
+	listeners[listener_count].socket = socket;
+	listeners[listener_count].thread_count = thread_count;
+	listener_count++;
+	return true;
+}
+
+static int tcp_listener_open(struct sockaddr *address, socklen_t length, bool reuse_port) {
+	char name[INET6_ADDRSTRLEN] = "";
 	int reuse = 1;
-	struct sockaddr_in client_name;
-	unsigned int name_len = sizeof(client_name);
-	server_socket = socket(PF_INET, SOCK_STREAM, 0);
-	if (server_socket == -1)
-		indigo_error("Can't open server socket (%s)", strerror(errno));
-	server_address.sin_family = AF_INET;
-	server_address.sin_port = htons(indigo_server_tcp_port);
-	server_address.sin_addr.s_addr = htonl(INADDR_ANY);
-	if (setsockopt(server_socket, SOL_SOCKET,SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+	if (address->sa_family == AF_INET6) {
+		((struct sockaddr_in6 *)address)->sin6_port = htons(indigo_server_tcp_port);
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *)address)->sin6_addr, name, sizeof(name));
+	} else {
+		((struct sockaddr_in *)address)->sin_port = htons(indigo_server_tcp_port);
+		inet_ntop(AF_INET, &((struct sockaddr_in *)address)->sin_addr, name, sizeof(name));
+	}
+	int server_socket = socket(address->sa_family, SOCK_STREAM, 0);
+	if (server_socket == -1) {
+		indigo_error("Can't open server socket for %s (%s)", name, strerror(errno));
+		return -1;
+	}
+	if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
 		indigo_error("Can't setsockopt for server socket (%s)", strerror(errno));
-		return INDIGO_CANT_START_SERVER;
+		close(server_socket);
+		return -1;
 	}
-	if (bind(server_socket, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
-		indigo_error("Can't bind server socket (%s)", strerror(errno));
-		return INDIGO_CANT_START_SERVER;
+#ifdef SO_REUSEPORT
+	if (reuse_port && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+		indigo_error("Can't setsockopt for server socket (%s)", strerror(errno));
+		close(server_socket);
+		return -1;
 	}
-	unsigned int length = sizeof(server_address);
-	if (getsockname(server_socket, (struct sockaddr *)&server_address, &length) == -1) {
+#endif
+	/* IPv4 is served by separate listener */
+	if (address->sa_family == AF_INET6 && setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &reuse, sizeof(reuse)) < 0) {
+		indigo_error("Can't setsockopt for server socket (%s)", strerror(errno));
 		close(server_socket);
-		return INDIGO_CANT_START_SERVER;
+		return -1;
+	}
+	if (bind(server_socket, address, length) < 0) {
+		indigo_error("Can't bind server socket to %s:%d (%s)", name, indigo_server_tcp_port, strerror(errno));
+		close(server_socket);
+		return -1;
 	}
-	if (listen(server_socket, 5) < 0) {
+	if (indigo_server_tcp_port == 0) {
+		/* ephemeral port is shared by all listeners */
+		struct sockaddr_storage bound_address;
+		socklen_t bound_length = sizeof(bound_address);
+		if (getsockname(server_socket, (struct sockaddr *)&bound_address, &bound_length) == -1) {
+			close(server_socket);
+			return -1;
+		}
+		indigo_server_tcp_port = ntohs(bound_address.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&bound_address)->sin6_port : ((struct sockaddr_in *)&bound_address)->sin_port);
+	}
+	if (listen(server_socket, indigo_server_listen_backlog) < 0) {
 		indigo_error("Can't listen on server socket (%s)", strerror(errno));
 		close(server_socket);
-		return INDIGO_CANT_START_SERVER;
+		return -1;
+	}
+	INDIGO_LOG(indigo_log("Listening on %s%s%s:%d", address->sa_family == AF_INET6 ? "[" : "", name, address->sa_family == AF_INET6 ? "]" : "", indigo_server_tcp_port));
+	return server_socket;
+}
+
+static bool tcp_listen(struct sockaddr *address, socklen_t length) {
+	int thread_count = indigo_server_accept_thread_count < 1 ? 1 : indigo_server_accept_thread_count;
+#ifdef SO_REUSEPORT
+	if (thread_count > 1) {
+		/* kernel distributes incoming connections among sockets bound to the same address */
+		for (int i = 0; i < thread_count; i++) {
+			int server_socket = tcp_listener_open(address, length, true);
+			if (server_socket < 0 || !listener_add(server_socket, 1))
+				return false;
+		}
+		return true;
+	}
+#endif
+	int server_socket = tcp_listener_open(address, length, false);
+	if (server_socket < 0)
+		return false;
+	return listener_add(server_socket, thread_count);
+}
+
+static bool tcp_listen_address(const char *name) {
+	struct addrinfo hints, *info;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(name, NULL, &hints, &info) == 0) {
+		bool result = true;
+		for (struct addrinfo *item = info; item != NULL && result; item = item->ai_next)
+			if (item->ai_family == AF_INET || item->ai_family == AF_INET6)
+				result = tcp_listen(item->ai_addr, item->ai_addrlen);
+		freeaddrinfo(info);
+		return result;
 	}
+	/* not an address or host name, try interface name */
+	struct ifaddrs *interfaces;
+	bool found = false;
+	if (getifaddrs(&interfaces) == 0) {
+		for (struct ifaddrs *interface = interfaces; interface != NULL; interface = interface->ifa_next) {
+			if (interface->ifa_addr == NULL || strcmp(interface->ifa_name, name))
+				continue;
+			if (interface->ifa_addr->sa_family == AF_INET) {
+				struct sockaddr_in address = *(struct sockaddr_in *)interface->ifa_addr;
+				if (!tcp_listen((struct sockaddr *)&address, sizeof(address))) {
+					freeifaddrs(interfaces);
+					return false;
+				}
+				found = true;
+			} else if (interface->ifa_addr->sa_family == AF_INET6) {
+				struct sockaddr_in6 address = *(struct sockaddr_in6 *)interface->ifa_addr;
+				/* link local addresses need scope id set by getifaddrs() */
+				if (!tcp_listen((struct sockaddr *)&address, sizeof(address))) {
+					freeifaddrs(interfaces);
+					return false;
+				}
+				found = true;
+			}
+		}
+		freeifaddrs(interfaces);
+	}
+	if (!found)
+		indigo_error("Can't resolve listen address %s", name);
+	return found;
+}
+
+static bool tcp_listen_all() {
+	if (indigo_server_listen_addresses == NULL || *indigo_server_listen_addresses == 0) {
+		struct sockaddr_in address4;
+		memset(&address4, 0, sizeof(address4));
+		address4.sin_family = AF_INET;
+		address4.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (!tcp_listen((struct sockaddr *)&address4, sizeof(address4)))
+			return false;
+		struct sockaddr_in6 address6;
+		memset(&address6, 0, sizeof(address6));
+		address6.sin6_family = AF_INET6;
+		address6.sin6_addr = in6addr_any;
+		if (!tcp_listen((struct sockaddr *)&address6, sizeof(address6)))
+			INDIGO_LOG(indigo_log("IPv6 is not available"));
+		return true;
+	}
+	char addresses[1024];
+	strncpy(addresses, indigo_server_listen_addresses, sizeof(addresses) - 1);
+	addresses[sizeof(addresses) - 1] = 0;
+	char *saveptr;
+	for (char *name = strtok_r(addresses, ", ", &saveptr); name != NULL; name = strtok_r(NULL, ", ", &saveptr)) {
+		/* IPv6 literals may be enclosed in brackets */
+		if (*name == '[') {
+			name++;
+			char *end = strchr(name, ']');
+			if (end)
+				*end = 0;
+		}
+		if (!tcp_listen_address(name))
+			return false;
+	}
+	return true;
+}
+
+static bool unix_listen() {
+	struct sockaddr_un address;
+	if (strlen(indigo_server_unix_socket) >= sizeof(address.sun_path)) {
+		indigo_error("Unix socket path %s is too long", indigo_server_unix_socket);
+		return false;
+	}
+	int server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_socket == -1) {
+		indigo_error("Can't open unix server socket (%s)", strerror(errno));
+		return false;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, indigo_server_unix_socket);
+	/* remove stale socket left by previous instance */
+	unlink(indigo_server_unix_socket);
+	if (bind(server_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		indigo_error("Can't bind unix server socket %s (%s)", indigo_server_unix_socket, strerror(errno));
+		close(server_socket);
+		return false;
+	}
+	if (listen(server_socket, indigo_server_listen_backlog) < 0) {
+		indigo_error("Can't listen on unix server socket (%s)", strerror(errno));
+		close(server_socket);
+		return false;
+	}
+	INDIGO_LOG(indigo_log("Listening on %s", indigo_server_unix_socket));
+	unix_listening = true;
+	return listener_add(server_socket, 1);
+}
+
+indigo_result indigo_server_start(indigo_server_tcp_callback callback) {
+	server_callback = callback;
 	indigo_is_ephemeral_port = indigo_server_tcp_port == 0;
-	indigo_server_tcp_port = ntohs(server_address.sin_port);
+	listener_count = 0;
+	if (!tcp_listen_all() || (indigo_server_unix_socket != NULL && !unix_listen())) {
+		listeners_close();
+		return INDIGO_CANT_START_SERVER;
+	}
+#if defined(INDIGO_LINUX)
+	if (indigo_server_use_event_loop && !event_loop_start()) {
+		listeners_close();
+		return INDIGO_CANT_START_SERVER;
+	}
+#endif
 	INDIGO_LOG(indigo_log("Server started on %d", indigo_server_tcp_port));
-	server_callback(client_count);
+	server_callback(__sync_add_and_fetch(&client_count, 0));
 	signal(SIGPIPE, SIG_IGN);
-	while (1) {
-		client_socket = accept(server_socket, (struct sockaddr *)&client_name, &name_len);
-		if (client_socket == -1) {
-			if (shutdown_initiated)
-				break;
-			indigo_error("Can't accept connection (%s)", strerror(errno));
-		} else {
-			pthread_t thread;
+	/* the first accept loop runs in the calling thread */
+	int thread_count = 0;
+	for (int i = 0; i < listener_count; i++)
+		thread_count += listeners[i].thread_count;
+	pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+	assert(threads != NULL);
+	thread_count = 0;
+	for (int i = 0; i < listener_count; i++) {
+		for (int j = (i == 0 ? 1 : 0); j < listeners[i].thread_count; j++) {
 			int *pointer = malloc(sizeof(int));
-			*pointer = client_socket;
-			if (pthread_create(&thread , NULL, (void *(*)(void *))&start_worker_thread, pointer) != 0)
-				indigo_error("Can't create worker thread for connection (%s)", strerror(errno));
+			*pointer = listeners[i].socket;
+			if (pthread_create(threads + thread_count, NULL, (void *(*)(void *))&accept_thread, pointer) != 0) {
+				indigo_error("Can't create accept thread (%s)", strerror(errno));
+				free(pointer);
+			} else {
+				thread_count++;
+			}
 		}
 	}
+	accept_loop(listeners[0].socket);
+	/* other accept loops check shutdown_initiated too, it can't be reset before they are finished */
+	for (int i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
 	shutdown_initiated = false;
 	return INDIGO_OK;
 }
@@ -44,6 +44,38 @@ extern int indigo_server_tcp_port;
  */
 extern bool indigo_is_ephemeral_port;
 
+/** Serve connections from epoll based event loops and a bounded worker pool instead of thread per connection (Linux only).
+ */
+extern bool indigo_server_use_event_loop;
+
+/** Number of event loop threads (for event loop mode).
+ */
+extern int indigo_server_event_loop_count;
+
+/** Number of worker threads parsing protocol traffic (for event loop mode).
+ */
+extern int indigo_server_worker_count;
+
+/** Number of worker threads serving HTTP requests and BLOB downloads (for event loop mode).
+ */
+extern int indigo_server_http_worker_count;
+
+/** Path of unix domain socket for local clients (NULL if not used).
+ */
+extern const char *indigo_server_unix_socket;
+
+/** Comma separated list of addresses, host or interface names to listen on (NULL for all IPv4 and IPv6 interfaces).
+ */
+extern const char *indigo_server_listen_addresses;
+
+/** Listen queue length.
+ */
+extern int indigo_server_listen_backlog;
+
+/** Number of accept threads per address (each with own SO_REUSEPORT socket where supported).
+ */
+extern int indigo_server_accept_thread_count;
+
 /** Add static document.
  */
 extern void indigo_server_add_resource(char *path, unsigned char *data, unsigned length, char *content_type);
@@ -28,16 +28,19 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <sched.h>
 
 #include "indigo_timer.h"
 
 #include "indigo_driver.h"
 
 
-#ifdef __MACH__ /* Mac OSX prior Sierra is missing clock_gettime() */
+#ifdef __MACH__ /* Mac OSX prior Sierra is missing clock_gettime() and condition variables can't use monotonic clock */
 #include <mach/clock.h>
 #include <mach/mach.h>
-void utc_time(struct timespec *ts) {
+static void utc_time(struct timespec *ts) {
 	clock_serv_t cclock;
 	mach_timespec_t mts;
 	host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
@@ -46,116 +49,452 @@ void utc_time(struct timespec *ts) {
 	ts->tv_sec = mts.tv_sec;
 	ts->tv_nsec = mts.tv_nsec;
 }
+#define monotonic_time(ts) utc_time(ts)
 #else
-#define utc_time(ts) clock_gettime(CLOCK_REALTIME, ts)
+#define monotonic_time(ts) clock_gettime(CLOCK_MONOTONIC, ts)
 #endif
 
 
 #define NANO	1000000000L
 
-int timer_count = 0;
-indigo_timer *free_timer;
+#define TIMER_HEAP_SIZE					64
+#define TIMER_WORKER_IDLE_TIMEOUT	5
+#define TIMER_WORKER_STARVATION		0.01
+#define PRECISE_TIMER_SPIN				0.001
 
-pthread_mutex_t free_timer_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t cancel_timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* scheduler data of the timer, public part is kept unchanged */
+typedef struct {
+	indigo_timer timer;
+	indigo_timer_callback precise_callback;
+	bool precise;
+	double deadline;
+	int heap_index;
+	indigo_executor *executor;
+	unsigned long ticket;
+	indigo_timer *ready_next;
+} timer_entry;
 
-static void *timer_func(indigo_timer *timer) {
+#define ENTRY(timer) ((timer_entry *)(timer))
+
+static int timer_count = 0;
+static indigo_timer *free_timer = NULL;
+
+/* waiting timers ordered by deadline */
+typedef struct {
+	indigo_timer **timers;
+	int count;
+	int size;
+	pthread_cond_t cond;
+} timer_heap;
+
+/* expired timers are passed to workers through ready queue, precise callbacks are called directly by dispatcher */
+static timer_heap timers = { NULL, 0, 0 };
+static timer_heap precise_timers = { NULL, 0, 0 };
+static indigo_timer *ready_head = NULL, *ready_tail = NULL;
+static int ready_count = 0;
+static int worker_count = 0;
+static int idle_worker_count = 0;
+static indigo_precise_timer_stats precise_stats = { 0, 0, 0 };
+
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static pthread_once_t precise_timer_once = PTHREAD_ONCE_INIT;
+
+bool indigo_precise_timer_realtime = false;
+
+static double current_time() {
+	struct timespec now;
+	monotonic_time(&now);
+	return now.tv_sec + now.tv_nsec / (double)NANO;
+}
+
+static void deadline_timespec(double deadline, struct timespec *ts) {
+	ts->tv_sec = (time_t)deadline;
+	ts->tv_nsec = (long)((deadline - ts->tv_sec) * NANO);
+	normalize_timespec(ts);
+}
+
+static void heap_swap(timer_heap *heap, int i, int j) {
+	indigo_timer *timer = heap->timers[i];
+	heap->timers[i] = heap->timers[j];
+	heap->timers[j] = timer;
+	ENTRY(heap->timers[i])->heap_index = i;
+	ENTRY(heap->timers[j])->heap_index = j;
+}
+
+static void heap_up(timer_heap *heap, int i) {
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (ENTRY(heap->timers[parent])->deadline <= ENTRY(heap->timers[i])->deadline)
+			break;
+		heap_swap(heap, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(timer_heap *heap, int i) {
 	while (true) {
-		while (timer->scheduled) {
-			INDIGO_DEBUG(indigo_debug("timer #%d (of %d) used for %gs", timer->timer_id, timer_count, timer->delay));
-			if (timer->delay > 0) {
-				struct timespec end;
-				utc_time(&end);
-				end.tv_sec += (int)timer->delay;
-				end.tv_nsec += NANO * (timer->delay - (int)timer->delay);
-				normalize_timespec(&end);
-				while (!timer->canceled) {
-					pthread_mutex_lock(&timer->mutex);
-					int rc = pthread_cond_timedwait(&timer->cond, &timer->mutex, &end);
-					pthread_mutex_unlock(&timer->mutex);
-					if (rc == ETIMEDOUT)
-						break;
+		int smallest = i, left = 2 * i + 1, right = left + 1;
+		if (left < heap->count && ENTRY(heap->timers[left])->deadline < ENTRY(heap->timers[smallest])->deadline)
+			smallest = left;
+		if (right < heap->count && ENTRY(heap->timers[right])->deadline < ENTRY(heap->timers[smallest])->deadline)
+			smallest = right;
+		if (smallest == i)
+			break;
+		heap_swap(heap, i, smallest);
+		i = smallest;
+	}
+}
+
+/* all functions below must be called with timer_mutex locked */
+
+static void heap_insert(timer_heap *heap, indigo_timer *timer) {
+	if (heap->count == heap->size) {
+		heap->size = heap->size ? 2 * heap->size : TIMER_HEAP_SIZE;
+		heap->timers = realloc(heap->timers, heap->size * sizeof(indigo_timer *));
+		assert(heap->timers != NULL);
+	}
+	ENTRY(timer)->heap_index = heap->count;
+	heap->timers[heap->count++] = timer;
+	heap_up(heap, ENTRY(timer)->heap_index);
+	if (ENTRY(timer)->heap_index == 0)
+		pthread_cond_signal(&heap->cond);
+}
+
+static void heap_remove(timer_heap *heap, indigo_timer *timer) {
+	int i = ENTRY(timer)->heap_index;
+	ENTRY(timer)->heap_index = -1;
+	if (--heap->count == i)
+		return;
+	heap->timers[i] = heap->timers[heap->count];
+	ENTRY(heap->timers[i])->heap_index = i;
+	heap_up(heap, i);
+	heap_down(heap, ENTRY(heap->timers[i])->heap_index);
+}
+
+static void schedule_timer(indigo_timer *timer) {
+	INDIGO_DEBUG(indigo_debug("%stimer #%d (of %d) used for %gs", ENTRY(timer)->precise ? "precise " : "", timer->timer_id, timer_count, timer->delay));
+	ENTRY(timer)->deadline = current_time() + (timer->delay > 0 ? timer->delay : 0);
+	heap_insert(ENTRY(timer)->precise ? &precise_timers : &timers, timer);
+}
+
+static void unschedule_timer(indigo_timer *timer) {
+	heap_remove(ENTRY(timer)->precise ? &precise_timers : &timers, timer);
+}
+
+static void release_timer(indigo_timer *timer) {
+	INDIGO_DEBUG(indigo_debug("timer #%d done", timer->timer_id));
+	indigo_device *device = timer->device;
+	if (device != NULL) {
+		if (DEVICE_CONTEXT->timers == timer) {
+			DEVICE_CONTEXT->timers = timer->next;
+		} else {
+			indigo_timer *previous = DEVICE_CONTEXT->timers;
+			while (previous != NULL && previous->next != NULL) {
+				if (previous->next == timer) {
+					previous->next = timer->next;
+					break;
 				}
+				previous = previous->next;
 			}
+		}
+	}
+	timer->device = NULL;
+	timer->next = free_timer;
+	free_timer = timer;
+}
+
+static void executor_advance(indigo_executor *executor);
+
+static void fire_timer(indigo_timer *timer) {
+	timer->scheduled = false;
+	if (!timer->canceled) {
+		pthread_mutex_unlock(&timer_mutex);
+		timer->callback(timer->device);
+		pthread_mutex_lock(&timer_mutex);
+	}
+	if (timer->scheduled && !timer->canceled)
+		schedule_timer(timer);
+	else
+		release_timer(timer);
+}
+
+static indigo_timer *ready_pop() {
+	indigo_timer *timer = ready_head;
+	if ((ready_head = ENTRY(timer)->ready_next) == NULL)
+		ready_tail = NULL;
+	ready_count--;
+	ENTRY(timer)->ready_next = NULL;
+	return timer;
+}
+
+static void run_timer(indigo_timer *timer) {
+	indigo_executor *executor = ENTRY(timer)->executor;
+	if (executor != NULL) {
+		executor->owner = pthread_self();
+		executor->depth = 1;
+	}
+	fire_timer(timer);
+	if (executor != NULL) {
+		executor->depth = 0;
+		executor_advance(executor);
+	}
+}
 
-			timer->scheduled = false;
-			if (!timer->canceled) {
-				timer->callback(timer->device);
+static void *dedicated_func(void *arg) {
+	pthread_mutex_lock(&timer_mutex);
+	run_timer(arg);
+	pthread_mutex_unlock(&timer_mutex);
+	return NULL;
+}
+
+static void *worker_func(void *arg) {
+	pthread_mutex_lock(&timer_mutex);
+	/* counted as idle since its creation */
+	idle_worker_count--;
+	while (true) {
+		while (ready_head == NULL) {
+			idle_worker_count++;
+			int rc;
+			if (worker_count > INDIGO_MIN_TIMER_WORKERS) {
+				struct timespec end;
+				deadline_timespec(current_time() + TIMER_WORKER_IDLE_TIMEOUT, &end);
+				rc = pthread_cond_timedwait(&worker_cond, &timer_mutex, &end);
+			} else {
+				rc = pthread_cond_wait(&worker_cond, &timer_mutex);
+			}
+			idle_worker_count--;
+			if (rc == ETIMEDOUT && ready_head == NULL && worker_count > INDIGO_MIN_TIMER_WORKERS) {
+				worker_count--;
+				pthread_mutex_unlock(&timer_mutex);
+				return NULL;
 			}
 		}
+		run_timer(ready_pop());
+	}
+	return NULL;
+}
+
+static void start_worker() {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, worker_func, NULL) == 0) {
+		pthread_detach(thread);
+		worker_count++;
+		idle_worker_count++;
+	}
+}
 
-		INDIGO_DEBUG(indigo_debug("timer #%d done", timer->timer_id));
+static void dispatch_timer(indigo_timer *timer) {
+	if (ready_tail != NULL)
+		ENTRY(ready_tail)->ready_next = timer;
+	else
+		ready_head = timer;
+	ready_tail = timer;
+	ready_count++;
+	if (idle_worker_count == 0 && worker_count < INDIGO_MIN_TIMER_WORKERS)
+		start_worker();
+	else
+		pthread_cond_signal(&worker_cond);
+}
 
-		pthread_mutex_lock(&cancel_timer_mutex);
-		indigo_device *device = timer->device;
-		if (device != NULL) {
-			if (DEVICE_CONTEXT->timers == timer) {
-				DEVICE_CONTEXT->timers = timer->next;
+static void executor_advance(indigo_executor *executor) {
+	executor->serving++;
+	indigo_timer *timer = executor->pending_head;
+	if (timer != NULL && ENTRY(timer)->ticket == executor->serving) {
+		if ((executor->pending_head = ENTRY(timer)->ready_next) == NULL)
+			executor->pending_tail = NULL;
+		ENTRY(timer)->ready_next = NULL;
+		ENTRY(timer)->deadline = current_time();
+		dispatch_timer(timer);
+	} else if (executor->serving == executor->next_ticket && executor->released) {
+		pthread_cond_destroy(&executor->cond);
+		free(executor);
+	} else {
+		pthread_cond_broadcast(&executor->cond);
+	}
+}
+
+static void *scheduler_func(void *arg) {
+	double last_start = 0;
+	pthread_mutex_lock(&timer_mutex);
+	while (true) {
+		double now = current_time();
+		while (timers.count > 0 && ENTRY(timers.timers[0])->deadline <= now) {
+			indigo_timer *timer = timers.timers[0];
+			heap_remove(&timers, timer);
+			indigo_executor *executor = ENTRY(timer)->executor;
+			if (executor == NULL) {
+				dispatch_timer(timer);
 			} else {
-				indigo_timer *previous = DEVICE_CONTEXT->timers;
-				while (previous->next != NULL) {
-					if (previous->next == timer) {
-						previous->next = timer->next;
-						break;
-					}
-					previous = previous->next;
+				/* timer for busy device waits in executor queue without blocking a worker */
+				ENTRY(timer)->ticket = executor->next_ticket++;
+				if (executor->serving == ENTRY(timer)->ticket) {
+					dispatch_timer(timer);
+				} else {
+					if (executor->pending_tail != NULL)
+						ENTRY(executor->pending_tail)->ready_next = timer;
+					else
+						executor->pending_head = timer;
+					executor->pending_tail = timer;
 				}
 			}
 		}
-		pthread_mutex_unlock(&cancel_timer_mutex);
+		/* all workers are blocked by long running callbacks for too long, add another one */
+		double starving = ready_head != NULL ? (ENTRY(ready_head)->deadline > last_start ? ENTRY(ready_head)->deadline : last_start) + TIMER_WORKER_STARVATION : 0;
+		if (starving != 0 && starving <= now && ready_count > idle_worker_count) {
+			if (worker_count < INDIGO_MAX_TIMER_WORKERS) {
+				INDIGO_DEBUG(indigo_debug("timer #%d is waiting for %gs, starting worker #%d", ready_head->timer_id, now - ENTRY(ready_head)->deadline, worker_count));
+				start_worker();
+			} else {
+				/* pool is exhausted by blocked callbacks (e.g. waiting for each other), the timer can't wait for them */
+				indigo_timer *timer = ready_pop();
+				pthread_t thread;
+				INDIGO_LOG(indigo_log("all %d timer workers are blocked, timer #%d is waiting for %gs, starting dedicated thread", worker_count, timer->timer_id, now - ENTRY(timer)->deadline));
+				if (pthread_create(&thread, NULL, dedicated_func, timer) == 0) {
+					pthread_detach(thread);
+				} else {
+					if ((ENTRY(timer)->ready_next = ready_head) == NULL)
+						ready_tail = timer;
+					ready_head = timer;
+					ready_count++;
+				}
+			}
+			last_start = now;
+			continue;
+		}
+		double deadline = timers.count > 0 ? ENTRY(timers.timers[0])->deadline : 0;
+		if (starving != 0 && (deadline == 0 || starving < deadline))
+			deadline = starving;
+		if (deadline == 0) {
+			pthread_cond_wait(&timers.cond, &timer_mutex);
+		} else {
+			struct timespec end;
+			deadline_timespec(deadline, &end);
+			pthread_cond_timedwait(&timers.cond, &timer_mutex, &end);
+		}
+	}
+	return NULL;
+}
 
-		pthread_mutex_lock(&free_timer_mutex);
-		timer->next = free_timer;
-		free_timer = timer;
-		timer->wake = false;
-		pthread_mutex_unlock(&free_timer_mutex);
+static void timer_init() {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+#ifndef __MACH__
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&timers.cond, &attr);
+	pthread_cond_init(&precise_timers.cond, &attr);
+	pthread_cond_init(&worker_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_t thread;
+	pthread_create(&thread, NULL, scheduler_func, NULL);
+	pthread_detach(thread);
+}
 
-		pthread_mutex_lock(&timer->mutex);
-		while (!timer->wake)
-			 pthread_cond_wait(&timer->cond, &timer->mutex);
-		pthread_mutex_unlock(&timer->mutex);
+static void *precise_dispatcher_func(void *arg) {
+	if (indigo_precise_timer_realtime) {
+		struct sched_param param = { sched_get_priority_max(SCHED_FIFO) };
+		int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (rc)
+			INDIGO_ERROR(indigo_error("Can't set real-time priority for precise timers (%s)", strerror(rc)));
+	}
+	pthread_mutex_lock(&timer_mutex);
+	while (true) {
+		if (precise_timers.count == 0) {
+			pthread_cond_wait(&precise_timers.cond, &timer_mutex);
+			continue;
+		}
+		indigo_timer *timer = precise_timers.timers[0];
+		double deadline = ENTRY(timer)->deadline;
+		if (deadline - current_time() > PRECISE_TIMER_SPIN) {
+			struct timespec end;
+			deadline_timespec(deadline - PRECISE_TIMER_SPIN, &end);
+			pthread_cond_timedwait(&precise_timers.cond, &timer_mutex, &end);
+			continue;
+		}
+		/* final approach is busy wait, timer can be canceled meanwhile but not released */
+		heap_remove(&precise_timers, timer);
+		pthread_mutex_unlock(&timer_mutex);
+		double now;
+		while ((now = current_time()) < deadline)
+			;
+		pthread_mutex_lock(&timer_mutex);
+		if (!timer->canceled) {
+			double jitter = now - deadline;
+			precise_stats.count++;
+			precise_stats.average_jitter += (jitter - precise_stats.average_jitter) / precise_stats.count;
+			if (jitter > precise_stats.max_jitter)
+				precise_stats.max_jitter = jitter;
+			INDIGO_DEBUG(indigo_debug("precise timer #%d fired with %gus jitter", timer->timer_id, jitter * 1e6));
+			pthread_mutex_unlock(&timer_mutex);
+			ENTRY(timer)->precise_callback(timer->device);
+			pthread_mutex_lock(&timer_mutex);
+		}
+		/* anything what can block (property updates, I/O) is left to regular callback called by worker */
+		timer->scheduled = false;
+		if (timer->canceled || timer->callback == NULL) {
+			release_timer(timer);
+		} else {
+			indigo_device *device = timer->device;
+			ENTRY(timer)->precise = false;
+			ENTRY(timer)->executor = device == NULL ? NULL : device->executor;
+			timer->delay = 0;
+			schedule_timer(timer);
+		}
 	}
 	return NULL;
 }
 
-indigo_timer *indigo_set_timer(indigo_device *device, double delay, indigo_timer_callback callback) {
+static void precise_timer_init() {
+	pthread_t thread;
+	pthread_create(&thread, NULL, precise_dispatcher_func, NULL);
+	pthread_detach(thread);
+}
+
+static indigo_timer *create_timer(indigo_device *device, double delay, indigo_timer_callback callback, indigo_timer_callback precise_callback) {
+	pthread_once(&timer_once, timer_init);
 	indigo_timer *timer = NULL;
-	pthread_mutex_lock(&free_timer_mutex);
+	pthread_mutex_lock(&timer_mutex);
 	if (free_timer != NULL) {
 		timer = free_timer;
 		free_timer = free_timer->next;
-		timer->wake = true;
-		timer->canceled = false;
-		timer->scheduled = true;
-		timer->delay = delay;
-		if ((timer->device = device) != NULL) {
-			timer->next = DEVICE_CONTEXT->timers;
-			DEVICE_CONTEXT->timers = timer;
-		} else {
-			timer->next = NULL;
-		}
-		timer->callback = callback;
-		pthread_mutex_lock(&timer->mutex);
-		pthread_cond_signal(&timer->cond);
-		pthread_mutex_unlock(&timer->mutex);
 	} else {
-		timer = malloc(sizeof(indigo_timer));
+		timer_entry *entry = malloc(sizeof(timer_entry));
+		assert(entry != NULL);
+		memset(entry, 0, sizeof(timer_entry));
+		timer = &entry->timer;
 		timer->timer_id = timer_count++;
-		pthread_mutex_init(&timer->mutex, NULL);
-		pthread_cond_init(&timer->cond, NULL);
-		timer->canceled = false;
-		timer->scheduled = true;
-		if ((timer->device = device) != NULL) {
-			timer->next = DEVICE_CONTEXT->timers;
-			DEVICE_CONTEXT->timers = timer;
-		} else {
-			timer->next = NULL;
-		}
-		timer->delay = delay;
-		timer->callback = callback;
-		pthread_create(&timer->thread, NULL, (void * (*)(void*))timer_func, timer);
 	}
-	pthread_mutex_unlock(&free_timer_mutex);
+	timer->canceled = false;
+	timer->scheduled = true;
+	timer->delay = delay;
+	ENTRY(timer)->heap_index = -1;
+	ENTRY(timer)->ready_next = NULL;
+	if ((timer->device = device) != NULL) {
+		timer->next = DEVICE_CONTEXT->timers;
+		DEVICE_CONTEXT->timers = timer;
+	} else {
+		timer->next = NULL;
+	}
+	timer->callback = callback;
+	ENTRY(timer)->precise_callback = precise_callback;
+	ENTRY(timer)->precise = precise_callback != NULL;
+	/* precise timers are never delayed by other callbacks of the device */
+	ENTRY(timer)->executor = ENTRY(timer)->precise || device == NULL ? NULL : device->executor;
+	schedule_timer(timer);
+	pthread_mutex_unlock(&timer_mutex);
+	return timer;
+}
+
+indigo_timer *indigo_set_timer(indigo_device *device, double delay, indigo_timer_callback callback) {
+	return create_timer(device, delay, callback, NULL);
+}
+
+indigo_timer *indigo_set_precise_timer(indigo_device *device, double delay, indigo_timer_callback precise_callback, indigo_timer_callback callback) {
+	assert(precise_callback != NULL);
+	indigo_timer *timer = create_timer(device, delay, callback, precise_callback);
+	pthread_once(&precise_timer_once, precise_timer_init);
 	return timer;
 }
 
@@ -163,13 +502,13 @@ indigo_timer *indigo_set_timer(indigo_device *device, double delay, indigo_timer
 
 bool indigo_reschedule_timer(indigo_device *device, double delay, indigo_timer **timer) {
 	bool result = false;
-	pthread_mutex_lock(&cancel_timer_mutex);
+	pthread_mutex_lock(&timer_mutex);
 	if (*timer != NULL) {
 		(*timer)->delay = delay;
 		(*timer)->scheduled = true;
 		result = true;
 	}
-	pthread_mutex_unlock(&cancel_timer_mutex);
+	pthread_mutex_unlock(&timer_mutex);
 	return result;
 }
 
@@ -177,32 +516,81 @@ bool indigo_reschedule_timer(indigo_device *device, double delay, indigo_timer *
 
 bool indigo_cancel_timer(indigo_device *device, indigo_timer **timer) {
 	bool result = false;
-	pthread_mutex_lock(&cancel_timer_mutex);
+	pthread_mutex_lock(&timer_mutex);
 	if (*timer != NULL) {
 		(*timer)->canceled = true;
 		(*timer)->scheduled = false;
-		pthread_mutex_lock(&(*timer)->mutex);
-		pthread_cond_signal(&(*timer)->cond);
-		pthread_mutex_unlock(&(*timer)->mutex);
+		/* waiting timer is released immediately, expired or running one by its worker */
+		if (ENTRY(*timer)->heap_index >= 0) {
+			unschedule_timer(*timer);
+			release_timer(*timer);
+		}
 		*timer = NULL;
 		result = true;
 	}
-	pthread_mutex_unlock(&cancel_timer_mutex);
+	pthread_mutex_unlock(&timer_mutex);
 	return result;
 }
 
 void indigo_cancel_all_timers(indigo_device *device) {
-	pthread_mutex_lock(&cancel_timer_mutex);
+	pthread_mutex_lock(&timer_mutex);
 	indigo_timer *timer;
 	while ((timer = DEVICE_CONTEXT->timers) != NULL) {
 		DEVICE_CONTEXT->timers = timer->next;
 		timer->device = NULL;
 		timer->next = NULL;
 		timer->canceled = true;
-		timer->scheduled = true;
-		pthread_mutex_lock(&timer->mutex);
-		pthread_cond_signal(&timer->cond);
-		pthread_mutex_unlock(&timer->mutex);
+		timer->scheduled = false;
+		if (ENTRY(timer)->heap_index >= 0) {
+			unschedule_timer(timer);
+			release_timer(timer);
+		}
+	}
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+void indigo_get_precise_timer_stats(indigo_precise_timer_stats *stats) {
+	pthread_mutex_lock(&timer_mutex);
+	*stats = precise_stats;
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+indigo_executor *indigo_executor_create() {
+	indigo_executor *executor = malloc(sizeof(indigo_executor));
+	assert(executor != NULL);
+	memset(executor, 0, sizeof(indigo_executor));
+	pthread_cond_init(&executor->cond, NULL);
+	return executor;
+}
+
+void indigo_executor_enter(indigo_executor *executor) {
+	pthread_mutex_lock(&timer_mutex);
+	if (executor->depth > 0 && pthread_equal(executor->owner, pthread_self())) {
+		executor->depth++;
+	} else {
+		unsigned long ticket = executor->next_ticket++;
+		while (executor->serving != ticket)
+			pthread_cond_wait(&executor->cond, &timer_mutex);
+		executor->owner = pthread_self();
+		executor->depth = 1;
+	}
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+void indigo_executor_leave(indigo_executor *executor) {
+	pthread_mutex_lock(&timer_mutex);
+	if (--executor->depth == 0)
+		executor_advance(executor);
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+void indigo_executor_release(indigo_executor *executor) {
+	pthread_mutex_lock(&timer_mutex);
+	executor->released = true;
+	/* executor is freed by the last pending callback if it is busy */
+	if (executor->serving == executor->next_ticket) {
+		pthread_cond_destroy(&executor->cond);
+		free(executor);
 	}
-	pthread_mutex_unlock(&cancel_timer_mutex);
+	pthread_mutex_unlock(&timer_mutex);
 }
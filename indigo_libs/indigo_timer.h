@@ -39,22 +39,46 @@ extern "C" {
  */
 typedef void (*indigo_timer_callback)(indigo_device *device);
 
+/** Minimal number of timer worker threads kept alive.
+ */
+#define INDIGO_MIN_TIMER_WORKERS	4
+
+/** Maximal number of timer worker threads, additional ones are started only if all workers are busy.
+ If all of them are blocked, expired timer gets dedicated thread.
+ */
+#define INDIGO_MAX_TIMER_WORKERS	64
+
 /** Timer structure.
+ Layout is kept for binary compatibility of drivers, scheduler data are private (allocated together with the structure).
  */
 typedef struct indigo_timer {
 	indigo_device *device;                    ///< device associated with timer
 	indigo_timer_callback callback;           ///< callback function pointer
-	bool canceled;                            ///< timer is canceled (darwin only)
-	bool scheduled;
-	double delay;
-	bool wake;
-	int timer_id;
-	pthread_cond_t cond;
-	pthread_mutex_t mutex;
-	pthread_t thread;
-	struct indigo_timer *next;
+	bool canceled;                            ///< timer is canceled
+	bool scheduled;                           ///< timer is scheduled (or rescheduled from callback)
+	double delay;                             ///< delay in seconds
+	bool wake;                                ///< unused
+	int timer_id;                             ///< timer id (for debugging)
+	pthread_cond_t cond;                      ///< unused
+	pthread_mutex_t mutex;                    ///< unused
+	pthread_t thread;                         ///< unused
+	struct indigo_timer *next;                ///< next timer for device (or next free timer)
 } indigo_timer;
 
+/** Serial executor structure.
+ Timer callbacks and property change requests for a device with executor are called one by one in order of arrival, callbacks for different devices still run in parallel.
+ */
+typedef struct indigo_executor {
+	unsigned long next_ticket;                ///< next ticket to be issued
+	unsigned long serving;                    ///< ticket being served
+	pthread_t owner;                          ///< thread running current callback
+	int depth;                                ///< nesting level of owner calls
+	bool released;                            ///< executor should be freed when idle
+	pthread_cond_t cond;                      ///< condition for synchronous callers
+	indigo_timer *pending_head;               ///< expired timers waiting for the device
+	indigo_timer *pending_tail;
+} indigo_executor;
+
 /* fix timespec so that abs(tv_nsec) < 1s */
 #define SEC_NS    1000000000LL       /* 1 sec in nanoseconds */
 static inline void normalize_timespec(struct timespec *ts) {
@@ -83,6 +107,13 @@ static inline void normalize_timespec(struct timespec *ts) {
  */
 extern indigo_timer *indigo_set_timer(indigo_device *device, double delay, indigo_timer_callback callback);
 
+/** Set precise timer.
+ Timer is fired by dedicated dispatcher thread with sub-millisecond accuracy (sleep followed by busy wait for the last millisecond), it is intended for short delays like guiding pulses.
+ Dispatcher calls only precise_callback, it must be short (e.g. stop guiding pulse) and must not update properties, it blocks other precise timers. Callback (if not NULL) is called after it by regular timer worker.
+ It must not wait for locks held during long operations like image download, it should try the lock and leave the work to callback if the lock is busy.
+ */
+extern indigo_timer *indigo_set_precise_timer(indigo_device *device, double delay, indigo_timer_callback precise_callback, indigo_timer_callback callback);
+
 /** Rescheduled timer (if not null).
  */
 extern bool indigo_reschedule_timer(indigo_device *device, double delay, indigo_timer **timer);
@@ -95,6 +126,38 @@ extern bool indigo_cancel_timer(indigo_device *device, indigo_timer **timer);
  */
 extern void indigo_cancel_all_timers(indigo_device *device);
 
+/** Create serial executor.
+ */
+extern indigo_executor *indigo_executor_create();
+
+/** Wait for executor and keep it busy until indigo_executor_leave() is called (nested calls from the same thread are allowed).
+ */
+extern void indigo_executor_enter(indigo_executor *executor);
+
+/** Release executor for the next callback.
+ */
+extern void indigo_executor_leave(indigo_executor *executor);
+
+/** Release executor (it is freed as soon as pending callbacks are done).
+ */
+extern void indigo_executor_release(indigo_executor *executor);
+
+/** Precise timer jitter statistics.
+ */
+typedef struct {
+	long count;                               ///< number of fired precise timers
+	double average_jitter;                    ///< average delay after deadline in seconds
+	double max_jitter;                        ///< maximal delay after deadline in seconds
+} indigo_precise_timer_stats;
+
+/** Get precise timer jitter statistics.
+ */
+extern void indigo_get_precise_timer_stats(indigo_precise_timer_stats *stats);
+
+/** Run precise timer dispatcher with real-time priority (must be set before the first precise timer is used).
+ */
+extern bool indigo_precise_timer_realtime;
+
 #ifdef __cplusplus
 }
 #endif
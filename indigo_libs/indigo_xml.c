@@ -34,6 +34,7 @@
 #include <pthread.h>
 
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include "indigo_base64.h"
 #include "indigo_xml.h"
@@ -42,6 +43,7 @@
 #include "indigo_driver_xml.h"
 
 #define BUFFER_SIZE 524288  /* BUFFER_SIZE % 4 == 0, inportant for base64 */
+#define COMPACT_VALUE_BUFFER_SIZE 4096  /* COMPACT_VALUE_BUFFER_SIZE % 4 == 0, inportant for base64 */
 
 #define PROPERTY_SIZE sizeof(indigo_property)+INDIGO_MAX_ITEMS*(sizeof(indigo_item))
 
@@ -112,15 +114,48 @@ static indigo_rule parse_rule(char *value) {
 	return INDIGO_ANY_OF_MANY_RULE;
 }
 
+#define PROPERTY_CACHE_SIZE	64
+#define ITEM_INDEX_SIZE			(2 * INDIGO_MAX_ITEMS)
+
+/* shared memory BLOB value kept by the cache instead of copy, either one-shot mapping or reusable buffer held busy */
 typedef struct {
-	char property_buffer[PROPERTY_SIZE];
+	void *mapping;
+	long length;
+	indigo_shared_buffer *buffer;
+} shared_blob_reference;
+
+typedef struct property_cache_entry {
+	struct property_cache_entry *next;
+	unsigned hash;
+	indigo_property *property;
+	unsigned char item_index[ITEM_INDEX_SIZE];
+	shared_blob_reference *shared_references;
+} property_cache_entry;
+
+typedef struct {
+	char *property_buffer;
 	indigo_device *device;
 	indigo_client *client;
 	int count;
-	indigo_property **properties;
+	int size;
+	property_cache_entry **properties;
+	int shared_fds[INDIGO_MAX_RECEIVED_FDS];
+	int shared_fd_count;
+	bool shared_blob;
+	void *shared_blobs[INDIGO_MAX_ITEMS];
+	bool properties_requested;
+	int shared_slot;
+	indigo_shared_buffer *shared_buffers[INDIGO_SHARED_BUFFER_SLOTS];
+	long shared_capacities[INDIGO_SHARED_BUFFER_SLOTS];
+	indigo_shared_buffer *shared_used[INDIGO_MAX_ITEMS];
+	char *encoded_blob;
+	long encoded_size;
+	bool protocol_error;
 } parser_context;
 
 bool indigo_use_blob_urls = true;
+bool indigo_use_shared_blobs = true;
+bool indigo_keep_encoded_blobs = false;
 
 typedef void *(* parser_handler)(parser_state state, parser_context *context, char *name, char *value, char *message);
 
@@ -154,6 +189,12 @@ static void *enable_blob_handler(parser_state state, parser_context *context, ch
 			client->enable_blob = INDIGO_ENABLE_BLOB_ONLY;
 		} else if (!strcmp(value, "URL")) {
 			client->enable_blob = INDIGO_ENABLE_BLOB_URL;
+		} else if (!strcmp(value, "Shared")) {
+			/* descriptors can be passed over unix domain sockets only */
+			if (indigo_is_unix_socket(((indigo_adapter_context *)client->client_context)->output))
+				client->enable_blob = INDIGO_ENABLE_BLOB_SHARED;
+			else
+				client->enable_blob = INDIGO_ENABLE_BLOB_ALSO;
 		}
 		INDIGO_DEBUG(indigo_debug("BLOB mode is '%s'", value));
 	}
@@ -191,10 +232,14 @@ static void *get_properties_handler(parser_state state, parser_context *context,
 			indigo_copy_property_name(client->version, property, value);;
 		}
 	} else if (state == END_TAG) {
-		if (client->version == INDIGO_VERSION_LEGACY)
-			client->enable_blob = INDIGO_ENABLE_BLOB_ALSO;
-		else
-			client->enable_blob = INDIGO_ENABLE_BLOB_URL;
+		/* default BLOB mode is set just once, repeated getProperties must not override mode requested by enableBLOB */
+		if (!context->properties_requested) {
+			if (client->version == INDIGO_VERSION_LEGACY)
+				client->enable_blob = INDIGO_ENABLE_BLOB_ALSO;
+			else
+				client->enable_blob = INDIGO_ENABLE_BLOB_URL;
+			context->properties_requested = true;
+		}
 		indigo_enumerate_properties(client, property);
 		memset(property, 0, PROPERTY_SIZE);
 		return top_level_handler;
@@ -342,59 +387,180 @@ static void *switch_protocol_handler(parser_state state, parser_context *context
 	return switch_protocol_handler;
 }
 
-static void set_property(parser_context *context, indigo_property *other, char *message) {
-	for (int index = 0; index < context->count; index++) {
-		indigo_property *property = context->properties[index];
-		if (property != NULL && !strncmp(property->device, other->device, INDIGO_NAME_SIZE) && !strncmp(property->name, other->name, INDIGO_NAME_SIZE)) {
-			property->state = other->state;
-			if (property->type == INDIGO_SWITCH_VECTOR && property->rule != INDIGO_ANY_OF_MANY_RULE) {
-				for (int j = 0; j < property->count; j++) {
-					property->items[j].sw.value = false;
-				}
+static unsigned name_hash(unsigned hash, const char *name) {
+	/* FNV-1a */
+	for (int i = 0; i < INDIGO_NAME_SIZE && name[i]; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619U;
+	return hash;
+}
+
+static unsigned property_hash(const char *device, const char *name) {
+	return name_hash(name_hash(2166136261U, device) * 16777619U, name);
+}
+
+static property_cache_entry **property_cache_lookup(parser_context *context, const char *device, const char *name) {
+	unsigned hash = property_hash(device, name);
+	property_cache_entry **link = &context->properties[hash & (context->size - 1)];
+	while (*link != NULL) {
+		indigo_property *property = (*link)->property;
+		if ((*link)->hash == hash && !strncmp(property->device, device, INDIGO_NAME_SIZE) && !strncmp(property->name, name, INDIGO_NAME_SIZE))
+			break;
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+static void property_cache_add(parser_context *context, indigo_property *property) {
+	if (context->count >= context->size) {
+		int size = context->size * 2;
+		property_cache_entry **properties = malloc(size * sizeof(property_cache_entry *));
+		assert(properties != NULL);
+		memset(properties, 0, size * sizeof(property_cache_entry *));
+		for (int i = 0; i < context->size; i++) {
+			property_cache_entry *entry = context->properties[i];
+			while (entry != NULL) {
+				property_cache_entry *next = entry->next;
+				entry->next = properties[entry->hash & (size - 1)];
+				properties[entry->hash & (size - 1)] = entry;
+				entry = next;
 			}
-			for (int i = 0; i < other->count; i++) {
-				indigo_item *other_item = &other->items[i];
-				for (int j = 0; j < property->count; j++) {
-					indigo_item *property_item = &property->items[j];
-					if (!strcmp(property_item->name, other_item->name)) {
-						switch (property->type) {
-							case INDIGO_TEXT_VECTOR:
-								strncpy(property_item->text.value, other_item->text.value, INDIGO_VALUE_SIZE);
-								break;
-							case INDIGO_NUMBER_VECTOR:
-								property_item->number.value = other_item->number.value;
-								if (property_item->number.value < property_item->number.min)
-									property_item->number.value = property_item->number.min;
-								if (property_item->number.value > property_item->number.max)
-									property_item->number.value = property_item->number.max;
-								property_item->number.target = other_item->number.target;
-								break;
-							case INDIGO_SWITCH_VECTOR:
-								property_item->sw.value = other_item->sw.value;
-								break;
-							case INDIGO_LIGHT_VECTOR:
-								property_item->light.value = other_item->light.value;
-								break;
-							case INDIGO_BLOB_VECTOR:
-								strncpy(property_item->blob.format, other_item->blob.format, INDIGO_NAME_SIZE);
-								strncpy(property_item->blob.url, other_item->blob.url, INDIGO_VALUE_SIZE);
-								property_item->blob.size = other_item->blob.size;
-								if (property_item->blob.value != NULL)
-									property_item->blob.value = realloc(property_item->blob.value, property_item->blob.size);
-								else
-									property_item->blob.value = malloc(property_item->blob.size);
-								memcpy(property_item->blob.value, other_item->blob.value, property_item->blob.size);
-								break;
-						}
-						break;
+		}
+		free(context->properties);
+		context->properties = properties;
+		context->size = size;
+	}
+	property_cache_entry *entry = malloc(sizeof(property_cache_entry));
+	assert(entry != NULL);
+	memset(entry, 0, sizeof(property_cache_entry));
+	entry->hash = property_hash(property->device, property->name);
+	entry->property = property;
+	/* item names of defined property don't change, index is built just once */
+	for (int i = 0; i < property->count; i++) {
+		unsigned slot = name_hash(2166136261U, property->items[i].name) % ITEM_INDEX_SIZE;
+		while (entry->item_index[slot] != 0)
+			slot = (slot + 1) % ITEM_INDEX_SIZE;
+		entry->item_index[slot] = i + 1;
+	}
+	entry->next = context->properties[entry->hash & (context->size - 1)];
+	context->properties[entry->hash & (context->size - 1)] = entry;
+	context->count++;
+}
+
+static void property_cache_release_blob(property_cache_entry *entry, indigo_item *item) {
+	shared_blob_reference *reference = entry->shared_references != NULL ? entry->shared_references + (item - entry->property->items) : NULL;
+	if (reference != NULL && reference->mapping != NULL) {
+		munmap(reference->mapping, reference->length);
+		reference->mapping = NULL;
+	} else if (reference != NULL && reference->buffer != NULL) {
+		/* sender can reuse the buffer */
+		__sync_synchronize();
+		reference->buffer->busy = 0;
+		reference->buffer = NULL;
+	} else if (item->blob.value != NULL) {
+		free(item->blob.value);
+	}
+	item->blob.value = NULL;
+	if (item->blob.encoded_value != NULL) {
+		free(item->blob.encoded_value);
+		item->blob.encoded_value = NULL;
+		item->blob.encoded_size = 0;
+	}
+}
+
+static void property_cache_remove(parser_context *context, property_cache_entry **link) {
+	property_cache_entry *entry = *link;
+	*link = entry->next;
+	if (entry->property->type == INDIGO_BLOB_VECTOR) {
+		for (int i = 0; i < entry->property->count; i++)
+			property_cache_release_blob(entry, entry->property->items + i);
+	}
+	if (entry->shared_references != NULL)
+		free(entry->shared_references);
+	free(entry);
+	context->count--;
+}
+
+static indigo_item *property_cache_item(property_cache_entry *entry, const char *name) {
+	unsigned slot = name_hash(2166136261U, name) % ITEM_INDEX_SIZE;
+	while (entry->item_index[slot] != 0) {
+		indigo_item *item = entry->property->items + entry->item_index[slot] - 1;
+		if (!strncmp(item->name, name, INDIGO_NAME_SIZE))
+			return item;
+		slot = (slot + 1) % ITEM_INDEX_SIZE;
+	}
+	return NULL;
+}
+
+static void set_property(parser_context *context, indigo_property *other, char *message) {
+	property_cache_entry *entry = *property_cache_lookup(context, other->device, other->name);
+	if (entry == NULL)
+		return;
+	indigo_property *property = entry->property;
+	property->state = other->state;
+	if (property->type == INDIGO_SWITCH_VECTOR && property->rule != INDIGO_ANY_OF_MANY_RULE) {
+		for (int j = 0; j < property->count; j++) {
+			property->items[j].sw.value = false;
+		}
+	}
+	for (int i = 0; i < other->count; i++) {
+		indigo_item *other_item = &other->items[i];
+		indigo_item *property_item = property_cache_item(entry, other_item->name);
+		if (property_item == NULL)
+			continue;
+		switch (property->type) {
+			case INDIGO_TEXT_VECTOR:
+				strncpy(property_item->text.value, other_item->text.value, INDIGO_VALUE_SIZE);
+				break;
+			case INDIGO_NUMBER_VECTOR:
+				property_item->number.value = other_item->number.value;
+				if (property_item->number.value < property_item->number.min)
+					property_item->number.value = property_item->number.min;
+				if (property_item->number.value > property_item->number.max)
+					property_item->number.value = property_item->number.max;
+				property_item->number.target = other_item->number.target;
+				break;
+			case INDIGO_SWITCH_VECTOR:
+				property_item->sw.value = other_item->sw.value;
+				break;
+			case INDIGO_LIGHT_VECTOR:
+				property_item->light.value = other_item->light.value;
+				break;
+			case INDIGO_BLOB_VECTOR:
+				strncpy(property_item->blob.format, other_item->blob.format, INDIGO_NAME_SIZE);
+				strncpy(property_item->blob.url, other_item->blob.url, INDIGO_VALUE_SIZE);
+				property_item->blob.size = other_item->blob.size;
+				property_cache_release_blob(entry, property_item);
+				if (other_item->blob.encoded_value != NULL) {
+					/* payload kept encoded is moved to the cache without copy, it is decoded only if somebody asks for raw data (see indigo_populate_http_blob_item()) */
+					property_item->blob.encoded_value = other_item->blob.encoded_value;
+					property_item->blob.encoded_size = other_item->blob.encoded_size;
+					other_item->blob.encoded_value = NULL;
+				} else if (context->shared_blobs[i] != NULL || context->shared_used[i] != NULL) {
+					/* shared memory stays referenced by the cache until the next value arrives */
+					if (entry->shared_references == NULL) {
+						entry->shared_references = calloc(property->count, sizeof(shared_blob_reference));
+						assert(entry->shared_references != NULL);
+					}
+					shared_blob_reference *reference = entry->shared_references + (property_item - property->items);
+					if (context->shared_blobs[i] != NULL) {
+						reference->mapping = context->shared_blobs[i];
+						reference->length = other_item->blob.size;
+						context->shared_blobs[i] = NULL;
+					} else {
+						reference->buffer = context->shared_used[i];
+						context->shared_used[i] = NULL;
 					}
+					property_item->blob.value = other_item->blob.value;
+				} else if (other_item->blob.value != NULL && property_item->blob.size > 0) {
+					property_item->blob.value = malloc(property_item->blob.size);
+					assert(property_item->blob.value != NULL);
+					memcpy(property_item->blob.value, other_item->blob.value, property_item->blob.size);
 				}
-			}
-			INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: set_property '%s' '%s' %d", property->device, property->name, index));
-			indigo_update_property(context->device, property, *message ? message : NULL);
-			break;
+				break;
 		}
 	}
+	INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: set_property '%s' '%s'", property->device, property->name));
+	indigo_update_property(context->device, property, *message ? message : NULL);
 }
 
 static void *set_one_text_vector_handler(parser_state state, parser_context *context, char *name, char *value, char *message) {
@@ -601,10 +767,75 @@ static void *set_one_blob_vector_handler(parser_state state, parser_context *con
 			snprintf(property->items[property->count-1].blob.url, INDIGO_VALUE_SIZE, "%s%s", ((indigo_adapter_context *)context->device->device_context)->url_prefix, value);
 		} else if (!strcmp(name, "url")) {
 			strncpy(property->items[property->count-1].blob.url, value, INDIGO_VALUE_SIZE);
+		} else if (!strcmp(name, "shared")) {
+			context->shared_blob = true;
+		} else if (!strcmp(name, "slot")) {
+			context->shared_slot = atoi(value);
+			if (context->shared_slot < 0 || context->shared_slot >= INDIGO_SHARED_BUFFER_SLOTS) {
+				INDIGO_ERROR(indigo_error("XML Parser: invalid shared BLOB slot %s", value));
+				context->shared_slot = -1;
+				property->items[property->count-1].blob.size = 0;
+			}
 		}
 	} else if (state == BLOB) {
 		property->items[property->count-1].blob.value = value;
+		property->items[property->count-1].blob.encoded_value = context->encoded_blob;
+		property->items[property->count-1].blob.encoded_size = context->encoded_size;
 	} else if (state == END_TAG) {
+		if (context->shared_slot >= 0) {
+			int slot = context->shared_slot;
+			indigo_item *item = property->items + property->count - 1;
+			context->shared_slot = -1;
+			if (context->shared_blob) {
+				/* new or reallocated reusable buffer for the slot */
+				context->shared_blob = false;
+				if (context->shared_fd_count > 0) {
+					int fd = context->shared_fds[0];
+					memmove(context->shared_fds, context->shared_fds + 1, --context->shared_fd_count * sizeof(int));
+					if (context->shared_buffers[slot] != NULL)
+						munmap(context->shared_buffers[slot], INDIGO_SHARED_BUFFER_HEADER + context->shared_capacities[slot]);
+					context->shared_buffers[slot] = indigo_shared_buffer_map(fd, &context->shared_capacities[slot]);
+					if (context->shared_buffers[slot] == NULL)
+						INDIGO_ERROR(indigo_error("XML Parser: can't map shared BLOB buffer (%s)", strerror(errno)));
+					close(fd);
+				} else {
+					/* descriptors are paired with elements by order, so the stream can't be trusted any more */
+					indigo_error("XML Parser: shared BLOB descriptor missing");
+					context->protocol_error = true;
+				}
+			}
+			indigo_shared_buffer *buffer = context->shared_buffers[slot];
+			if (buffer != NULL && item->blob.size <= context->shared_capacities[slot]) {
+				item->blob.value = (char *)buffer + INDIGO_SHARED_BUFFER_HEADER;
+				context->shared_used[property->count - 1] = buffer;
+			} else {
+				if (buffer != NULL)
+					buffer->busy = 0;
+				item->blob.size = 0;
+			}
+		} else if (context->shared_blob) {
+			context->shared_blob = false;
+			if (context->shared_fd_count > 0) {
+				int fd = context->shared_fds[0];
+				memmove(context->shared_fds, context->shared_fds + 1, --context->shared_fd_count * sizeof(int));
+				indigo_item *item = property->items + property->count - 1;
+				if (item->blob.size > 0) {
+					void *blob = mmap(NULL, item->blob.size, PROT_READ, MAP_SHARED, fd, 0);
+					if (blob != MAP_FAILED) {
+						item->blob.value = blob;
+						context->shared_blobs[property->count - 1] = blob;
+					} else {
+						INDIGO_ERROR(indigo_error("XML Parser: can't map shared BLOB (%s)", strerror(errno)));
+						item->blob.size = 0;
+					}
+				}
+				close(fd);
+			} else {
+				indigo_error("XML Parser: shared BLOB descriptor missing");
+				property->items[property->count-1].blob.size = 0;
+				context->protocol_error = true;
+			}
+		}
 		return set_blob_vector_handler;
 	}
 	return set_one_blob_vector_handler;
@@ -633,7 +864,31 @@ static void *set_blob_vector_handler(parser_state state, parser_context *context
 			strncpy(message, value, INDIGO_VALUE_SIZE);
 		}
 	} else if (state == END_TAG) {
+		if (indigo_prefetch_blob_urls && context->device != NULL && property->state == INDIGO_OK_STATE) {
+			for (int i = 0; i < property->count; i++) {
+				indigo_item *item = property->items + i;
+				if (item->blob.value == NULL && item->blob.url[0] != '\0')
+					indigo_prefetch_http_blob(item->blob.url);
+			}
+		}
 		set_property(context, property, message);
+		for (int i = 0; i < property->count; i++) {
+			/* encoded payload not taken by the cache (e.g. for unknown property) */
+			if (property->items[i].blob.encoded_value != NULL) {
+				free(property->items[i].blob.encoded_value);
+				property->items[i].blob.encoded_value = NULL;
+			}
+			if (context->shared_blobs[i] != NULL) {
+				munmap(context->shared_blobs[i], property->items[i].blob.size);
+				context->shared_blobs[i] = NULL;
+			}
+			if (context->shared_used[i] != NULL) {
+				/* content was consumed, sender can reuse the buffer */
+				__sync_synchronize();
+				context->shared_used[i]->busy = 0;
+				context->shared_used[i] = NULL;
+			}
+		}
 		memset(property, 0, PROPERTY_SIZE);
 		return top_level_handler;
 	}
@@ -641,21 +896,8 @@ static void *set_blob_vector_handler(parser_state state, parser_context *context
 }
 
 static void def_property(parser_context *context, indigo_property *other, char *message) {
-	indigo_property *property = NULL;
-	int index;
-	for (index = 0; index < context->count; index++) {
-		property = context->properties[index];
-		if (property == NULL)
-			break;
-		if (!strncmp(property->device, other->device, INDIGO_NAME_SIZE) && !strncmp(property->name, other->name, INDIGO_NAME_SIZE))
-			break;
-	}
-	if (index == context->count) {
-		context->properties = realloc(context->properties, context->count * 2 * sizeof(indigo_property *));
-		memset(context->properties + context->count, 0, context->count * sizeof(indigo_property *));
-		context->count *= 2;
-		property = NULL;
-	}
+	property_cache_entry *entry = *property_cache_lookup(context, other->device, other->name);
+	indigo_property *property = entry != NULL ? entry->property : NULL;
 	if (property == NULL) {
 		switch (other->type) {
 			case INDIGO_TEXT_VECTOR:
@@ -684,10 +926,14 @@ static void def_property(parser_context *context, indigo_property *other, char *
 						memcpy(tmp, item->blob.value, item->blob.size);
 						item->blob.value = tmp;
 					}
+					item->blob.encoded_value = NULL;
+					item->blob.encoded_size = 0;
 				}
 				if (context->device != NULL) {
 					int handle = ((indigo_adapter_context *)context->device->device_context)->output;
 					int use_url = indigo_use_blob_urls && *((indigo_adapter_context *)context->device->device_context)->url_prefix != 0 && other->version != INDIGO_VERSION_LEGACY;
+					/* shared BLOBs are requested only from peers which answered getProperties with switchProtocol */
+					int use_shared = indigo_use_shared_blobs && indigo_is_unix_socket(handle) && context->device->version != INDIGO_VERSION_LEGACY;
 					char device_name[INDIGO_NAME_SIZE];
 					strcpy(device_name, property->device);
 					if (indigo_use_host_suffix) {
@@ -698,13 +944,13 @@ static void def_property(parser_context *context, indigo_property *other, char *
 							*at = 0;
 						}
 					}
-					indigo_printf(handle, "<enableBLOB device='%s' name='%s'>%s</enableBLOB>\n", device_name, indigo_property_name(context->device->version, property), use_url ? "URL" : "Also");
+					indigo_printf(handle, "<enableBLOB device='%s' name='%s'>%s</enableBLOB>\n", device_name, indigo_property_name(context->device->version, property), use_shared ? "Shared" : use_url ? "URL" : "Also");
 				}
 				break;
 		}
-		context->properties[index] = property;
+		property_cache_add(context, property);
 	}
-	INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: def_property '%s' '%s' %d", property->device, property->name, index));
+	INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: def_property '%s' '%s'", property->device, property->name));
 	indigo_define_property(context->device, property, *message ? message : NULL);
 }
 
@@ -1005,22 +1251,25 @@ static void *del_property_handler(parser_state state, parser_context *context, c
 		}
 	} else if (state == END_TAG) {
 		if (*property->name) {
-			for (int i = 0; i < context->count; i++) {
-				indigo_property *tmp = context->properties[i];
-				if (tmp != NULL && !strncmp(tmp->device, property->device, INDIGO_NAME_SIZE) && !strncmp(tmp->name, property->name, INDIGO_NAME_SIZE)) {
-					indigo_delete_property(device, tmp, *message ? message : NULL);
-					indigo_release_property(tmp);
-					context->properties[i] = NULL;
-					break;
-				}
+			property_cache_entry **link = property_cache_lookup(context, property->device, property->name);
+			if (*link != NULL) {
+				indigo_property *tmp = (*link)->property;
+				indigo_delete_property(device, tmp, *message ? message : NULL);
+				property_cache_remove(context, link);
+				indigo_release_property(tmp);
 			}
 		} else {
-			for (int i = 0; i < context->count; i++) {
-				indigo_property *tmp = context->properties[i];
-				if (tmp != NULL && !strncmp(tmp->device, property->device, INDIGO_NAME_SIZE)) {
-					indigo_delete_property(device, tmp, *message ? message : NULL);
-					indigo_release_property(tmp);
-					context->properties[i] = NULL;
+			for (int i = 0; i < context->size; i++) {
+				property_cache_entry **link = &context->properties[i];
+				while (*link != NULL) {
+					indigo_property *tmp = (*link)->property;
+					if (!strncmp(tmp->device, property->device, INDIGO_NAME_SIZE)) {
+						indigo_delete_property(device, tmp, *message ? message : NULL);
+						property_cache_remove(context, link);
+						indigo_release_property(tmp);
+					} else {
+						link = &(*link)->next;
+					}
 				}
 			}
 		}
@@ -1118,73 +1367,92 @@ static void *top_level_handler(parser_state state, parser_context *context, char
 	return top_level_handler;
 }
 
-void indigo_xml_parse(indigo_device *device, indigo_client *client) {
-	char *buffer = malloc(BUFFER_SIZE+3); /* BUFFER_SIZE % 4 == 0 and keep always +3 for base64 alignmet */
-	assert(buffer != NULL);
-	char *value_buffer = malloc(BUFFER_SIZE+1); /* +1 to accomodate \0" */
-	assert(value_buffer != NULL);
+struct indigo_xml_parser {
+	parser_context context;
+	parser_handler handler;
+	parser_state state;
+	bool compact;
+	long value_size;
+	char *value_buffer;
+	char *value_pointer;
 	char name_buffer[INDIGO_NAME_SIZE];
-	unsigned char *blob_buffer = NULL;
-	char *pointer = buffer;
-	char *buffer_end = NULL;
-	char *name_pointer = name_buffer;
-	char *value_pointer = value_buffer;
-	unsigned char *blob_pointer = NULL;
-	long blob_size = 0;
+	char *name_pointer;
+	unsigned char *blob_buffer;
+	unsigned char *blob_pointer;
+	long blob_size;
+	unsigned long blob_remains;
+	char blob_carry[4];
+	int blob_carry_count;
+	char *encoded_buffer;
+	char *encoded_pointer;
 	char message[INDIGO_VALUE_SIZE];
-	char q = '"';
-	int depth = 0;
-	char c = 0;
+	char q;
+	int depth;
 	char entity_buffer[8];
-	char *entity_pointer = NULL;
-	bool is_escaped = false;
-	/* (void)parser_state_name; */
-
-	parser_handler handler = top_level_handler;
-
-	parser_state state = IDLE;
+	char *entity_pointer;
+	bool is_escaped;
+};
 
-	parser_context context;
-	context.client = client;
-	context.device = device;
+indigo_xml_parser *indigo_xml_parser_create(indigo_device *device, indigo_client *client, bool compact) {
+	indigo_xml_parser *parser = malloc(sizeof(indigo_xml_parser));
+	assert(parser != NULL);
+	memset(parser, 0, sizeof(indigo_xml_parser));
+	parser->context.client = client;
+	parser->context.device = device;
+	parser->context.shared_slot = -1;
 	if (device != NULL) {
-		context.count = 32;
-		context.properties = malloc(context.count * sizeof(indigo_property *));
-	} else {
-		context.count = 0;
-		context.properties = NULL;
+		parser->context.size = PROPERTY_CACHE_SIZE;
+		parser->context.properties = malloc(parser->context.size * sizeof(property_cache_entry *));
+		assert(parser->context.properties != NULL);
+		memset(parser->context.properties, 0, parser->context.size * sizeof(property_cache_entry *));
 	}
-	memset(context.properties, 0, context.count * sizeof(indigo_property *));
-
-	indigo_property *property = (indigo_property *)&context.property_buffer;
-	memset(context.property_buffer, 0, PROPERTY_SIZE);
-
-	int handle = 0;
-	if (device != NULL) {
-		handle = ((indigo_adapter_context *)device->device_context)->input;
-		device->enumerate_properties(device, client, NULL);
-	} else {
-		handle = ((indigo_adapter_context *)client->client_context)->input;
+	/* compact parser keeps property buffer only while a message is being parsed */
+	if (!compact) {
+		parser->context.property_buffer = malloc(PROPERTY_SIZE);
+		assert(parser->context.property_buffer != NULL);
+		memset(parser->context.property_buffer, 0, PROPERTY_SIZE);
 	}
-	*pointer = 0;
-	while (true) {
-		assert(pointer - buffer <= BUFFER_SIZE);
-		assert(value_pointer - value_buffer <= BUFFER_SIZE);
+	parser->compact = compact;
+	parser->value_size = compact ? COMPACT_VALUE_BUFFER_SIZE : BUFFER_SIZE;
+	parser->value_buffer = malloc(parser->value_size + 1); /* +1 to accomodate \0" */
+	assert(parser->value_buffer != NULL);
+	parser->value_pointer = parser->value_buffer;
+	parser->name_pointer = parser->name_buffer;
+	parser->handler = top_level_handler;
+	parser->state = IDLE;
+	parser->q = '"';
+	return parser;
+}
+
+bool indigo_xml_parser_feed(indigo_xml_parser *parser, char *data, long length) {
+	parser_context *context = &parser->context;
+	indigo_device *device = context->device;
+	parser_handler handler = parser->handler;
+	parser_state state = parser->state;
+	char *value_buffer = parser->value_buffer;
+	char *value_pointer = parser->value_pointer;
+	char *name_buffer = parser->name_buffer;
+	char *name_pointer = parser->name_pointer;
+	unsigned char *blob_buffer = parser->blob_buffer;
+	unsigned char *blob_pointer = parser->blob_pointer;
+	char *message = parser->message;
+	char *entity_buffer = parser->entity_buffer;
+	char *entity_pointer = parser->entity_pointer;
+	bool is_escaped = parser->is_escaped;
+	int depth = parser->depth;
+	char q = parser->q;
+	char *pointer = data;
+	char *buffer_end = data + length;
+	char c = 0;
+	if (state != BLOB)
+		INDIGO_DEBUG_PROTOCOL(indigo_debug("received: %.*s", (int)length, data));
+	while (pointer < buffer_end) {
+		assert(value_pointer - value_buffer <= parser->value_size);
 		assert(name_pointer - name_buffer <= INDIGO_NAME_SIZE);
-		if (state == ERROR) {
-			indigo_error("XML Parser: syntax error");
-			goto exit_loop;
-		}
-		while ((c = *pointer++) == 0) {
-			ssize_t count = (int)read(handle, (void *)buffer, (ssize_t)BUFFER_SIZE);
-			if (count <= 0) {
-				goto exit_loop;
-			}
-			pointer = buffer;
-			buffer_end = buffer + count;
-			buffer[count] = 0;
-			INDIGO_DEBUG_PROTOCOL(indigo_debug("received: %s", buffer));
-		}
+		if (state == ERROR)
+			break;
+		if ((c = *pointer++) == 0)
+			continue;
 		if (c == '&') {
 			entity_pointer = entity_buffer;
 			continue;
@@ -1204,7 +1472,7 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 					c = '\'';
 				entity_pointer = NULL;
 				is_escaped = true;
-			} else if (isalpha(c) && entity_pointer - entity_buffer < sizeof(entity_buffer)) {
+			} else if (isalpha(c) && entity_pointer - entity_buffer < sizeof(parser->entity_buffer)) {
 				*entity_pointer++ = c;
 				continue;
 			} else {
@@ -1259,7 +1527,12 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 				} else {
 					*name_pointer = 0;
 					depth++;
-					handler = handler(BEGIN_TAG, &context, name_buffer, NULL, message);
+					if (context->property_buffer == NULL) {
+						context->property_buffer = malloc(PROPERTY_SIZE);
+						assert(context->property_buffer != NULL);
+						memset(context->property_buffer, 0, PROPERTY_SIZE);
+					}
+					handler = handler(BEGIN_TAG, context, name_buffer, NULL, message);
 					if (isspace(c)) {
 						state = ATTRIBUTE_NAME1;
 						INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' BEGIN_TAG -> ATTRIBUTE_NAME1", c));
@@ -1279,7 +1552,7 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 			case END_TAG1:
 				if (c == '>') {
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' END_TAG1 -> IDLE", c));
-					handler = handler(END_TAG, &context, NULL, NULL, message);
+					handler = handler(END_TAG, context, NULL, NULL, message);
 					depth--;
 					state = IDLE;
 				} else {
@@ -1300,7 +1573,7 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 				if (isalpha(c)) {
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' END_TAG", c));
 				} else if (c == '>') {
-					handler = handler(END_TAG, &context, NULL, NULL, message);
+					handler = handler(END_TAG, context, NULL, NULL, message);
 					depth--;
 					state = IDLE;
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' END_TAG -> IDLE", c));
@@ -1318,7 +1591,7 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 						value_pointer = value_buffer;
 						while (*value_pointer && isspace(*value_pointer))
 							value_pointer++;
-						handler = handler(TEXT, &context, NULL, value_pointer, message);
+						handler = handler(TEXT, context, NULL, value_pointer, message);
 					}
 					state = TEXT1;
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' %d TEXT -> TEXT1", c, depth));
@@ -1348,63 +1621,71 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 					state = TEXT1;
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' BLOB_END -> TEXT1", c));
 				}
-				*name_pointer++ = c;
 				break;
 			case BLOB:
 				if (device->version >= INDIGO_VERSION_2_0) {
-					ssize_t count;
+					/* decode directly from the input chunk, only a partial quadruple is carried to the next one */
 					pointer--;
-					while (isspace(*pointer)) pointer++;
-					unsigned long blob_len = (blob_size + 2) / 3 * 4;
-					unsigned long len = (long)(buffer_end - pointer);
-					len = (len < blob_len) ? len : blob_len;
-					ssize_t bytes_needed = len % 4;
-					if(bytes_needed) bytes_needed = 4 - bytes_needed;
-					while (bytes_needed) {
-						count = (int)read(handle, (void *)buffer_end, bytes_needed);
-						if (count <= 0)
-							goto exit_loop;
-						len += count;
-						bytes_needed -= count;
-						buffer_end += count;
+					if (parser->blob_carry_count == 0 && (parser->encoded_pointer != NULL ? parser->encoded_pointer == parser->encoded_buffer : blob_pointer == blob_buffer))
+						while (pointer < buffer_end && isspace(*pointer))
+							pointer++;
+					if (parser->encoded_pointer != NULL) {
+						/* payload is kept encoded and decoded lazily */
+						unsigned long len = (unsigned long)(buffer_end - pointer);
+						len = (len < parser->blob_remains) ? len : parser->blob_remains;
+						memcpy(parser->encoded_pointer, pointer, len);
+						parser->encoded_pointer += len;
+						pointer += len;
+						parser->blob_remains -= len;
 					}
-					blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)pointer, len);
-					pointer += len;
-					blob_len -= len;
-					while(blob_len) {
-						len = ((BUFFER_SIZE) < blob_len) ? (BUFFER_SIZE) : blob_len;
-						ssize_t to_read = len;
-						char *ptr = buffer;
-						while(to_read) {
-							count = (int)read(handle, (void *)ptr, to_read);
-							if (count <= 0)
-								goto exit_loop;
-							ptr += count;
-							to_read -= count;
+					while (pointer < buffer_end && parser->blob_remains > 0) {
+						if (parser->blob_carry_count > 0 || buffer_end - pointer < 4) {
+							parser->blob_carry[parser->blob_carry_count++] = *pointer++;
+							if (parser->blob_carry_count == 4) {
+								blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)parser->blob_carry, 4);
+								parser->blob_remains -= 4;
+								parser->blob_carry_count = 0;
+							}
+						} else {
+							unsigned long len = (unsigned long)(buffer_end - pointer);
+							len = (len < parser->blob_remains) ? len : parser->blob_remains;
+							len -= len % 4;
+							blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)pointer, len);
+							pointer += len;
+							parser->blob_remains -= len;
 						}
-						blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)buffer, len);
-						blob_len -= len;
 					}
-
-					handler = handler(BLOB, &context, NULL, (char *)blob_buffer, message);
-					pointer = buffer;
-					*pointer = 0;
-					state = BLOB_END;
-					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' %d BLOB -> BLOB_END", c, depth));
+					if (parser->blob_remains == 0) {
+						char *value = (char *)blob_buffer;
+						if (parser->encoded_pointer != NULL) {
+							/* ownership of encoded payload is passed to the property */
+							context->encoded_blob = parser->encoded_buffer;
+							context->encoded_size = parser->encoded_pointer - parser->encoded_buffer;
+							parser->encoded_buffer = NULL;
+							value = NULL;
+						}
+						handler = handler(BLOB, context, NULL, value, message);
+						context->encoded_blob = NULL;
+						context->encoded_size = 0;
+						parser->encoded_pointer = NULL;
+						state = BLOB_END;
+						INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' %d BLOB -> BLOB_END", c, depth));
+					}
 					break;
 				} else {
 					if (c == '<') {
 						if (depth == 2) {
 							*value_pointer = 0;
-							blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)value_buffer, (int)(value_pointer-value_buffer));
-							handler = handler(BLOB, &context, NULL, (char *)blob_buffer, message);
+							if (value_pointer > value_buffer)
+								blob_pointer += base64_decode_fast((unsigned char*)blob_pointer, (unsigned char*)value_buffer, (int)(value_pointer-value_buffer));
+							handler = handler(BLOB, context, NULL, (char *)blob_buffer, message);
 						}
 						state = TEXT1;
 						INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' %d BLOB -> TEXT1", c, depth));
 						break;
 					} else if (c != '\n') {
 						if (depth == 2) {
-							if (value_pointer - value_buffer < BUFFER_SIZE) {
+							if (value_pointer - value_buffer < parser->value_size) {
 								*value_pointer++ = c;
 							} else {
 								*value_pointer = 0;
@@ -1430,18 +1711,28 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 				} else if (c == '>') {
 					value_pointer = value_buffer;
 					if (handler == set_one_blob_vector_handler) {
-						blob_size = property->items[property->count-1].blob.size;
-						if (blob_size > 0) {
+						indigo_property *property = (indigo_property *)context->property_buffer;
+						parser->blob_size = property->items[property->count-1].blob.size;
+						if (parser->blob_size > 0) {
 							state = BLOB;
-							if (blob_buffer != NULL) {
-								unsigned char *ptmp = realloc(blob_buffer, blob_size);
-								assert(ptmp != NULL);
-								blob_buffer = ptmp;
+							parser->blob_remains = (parser->blob_size + 2) / 3 * 4;
+							if (indigo_keep_encoded_blobs && device != NULL && device->version >= INDIGO_VERSION_2_0) {
+								/* keep payload as received to forward it without re-encoding, it is not decoded here */
+								parser->encoded_buffer = malloc(parser->blob_remains);
+								assert(parser->encoded_buffer != NULL);
+								parser->encoded_pointer = parser->encoded_buffer;
 							} else {
-								blob_buffer = malloc(blob_size);
-								assert(blob_buffer != NULL);
+								if (blob_buffer != NULL) {
+									unsigned char *ptmp = realloc(blob_buffer, parser->blob_size);
+									assert(ptmp != NULL);
+									blob_buffer = ptmp;
+								} else {
+									blob_buffer = malloc(parser->blob_size);
+									assert(blob_buffer != NULL);
+								}
 							}
 							blob_pointer = blob_buffer;
+							parser->blob_carry_count = 0;
 						} else {
 							state = TEXT;
 						}
@@ -1478,9 +1769,9 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 				if (c == q && !is_escaped) {
 					*value_pointer = 0;
 					state = ATTRIBUTE_NAME1;
-					handler = handler(ATTRIBUTE_VALUE, &context, name_buffer, value_buffer, message);
+					handler = handler(ATTRIBUTE_VALUE, context, name_buffer, value_buffer, message);
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' ATTRIBUTE_VALUE -> ATTRIBUTE_NAME1", c));
-				} else {
+				} else if (value_pointer - value_buffer < parser->value_size) {
 					*value_pointer++ = c;
 					INDIGO_TRACE_PROTOCOL(indigo_trace("XML Parser: '%c' ATTRIBUTE_VALUE", c));
 				}
@@ -1488,43 +1779,111 @@ void indigo_xml_parse(indigo_device *device, indigo_client *client) {
 			default:
 				break;
 		}
+		if (context->protocol_error)
+			state = ERROR;
+		if (parser->compact && depth <= 0 && state == IDLE && context->property_buffer != NULL) {
+			free(context->property_buffer);
+			context->property_buffer = NULL;
+		}
 	}
-exit_loop:
-	while (true) {
+	parser->handler = handler;
+	parser->state = state;
+	parser->value_pointer = value_pointer;
+	parser->name_pointer = name_pointer;
+	parser->blob_buffer = blob_buffer;
+	parser->blob_pointer = blob_pointer;
+	parser->entity_pointer = entity_pointer;
+	parser->is_escaped = is_escaped;
+	parser->depth = depth;
+	parser->q = q;
+	if (state == ERROR) {
+		if (!context->protocol_error)
+			indigo_error("XML Parser: syntax error");
+		return false;
+	}
+	return true;
+}
+
+void indigo_xml_parser_release(indigo_xml_parser *parser) {
+	parser_context *context = &parser->context;
+	for (int i = 0; i < context->shared_fd_count; i++)
+		close(context->shared_fds[i]);
+	while (context->count > 0) {
 		indigo_property *property = NULL;
-		int index;
-		for (index = 0; index < context.count; index++) {
-			property = context.properties[index];
-			if (property != NULL)
-				break;
+		for (int i = 0; i < context->size && property == NULL; i++) {
+			if (context->properties[i] != NULL)
+				property = context->properties[i]->property;
 		}
-		if (property == NULL)
-			break;
 		indigo_device remote_device;
 		strncpy(remote_device.name, property->device, INDIGO_NAME_SIZE);
 		remote_device.version = property->version;
 		indigo_property *all_properties = indigo_init_text_property(NULL, remote_device.name, "", "", "", INDIGO_OK_STATE, INDIGO_RO_PERM, 0);
 		indigo_delete_property(&remote_device, all_properties, NULL);
 		indigo_release_property(all_properties);
-		for (; index < context.count; index++) {
-			indigo_property *property = context.properties[index];
-			if (property != NULL && !strncmp(remote_device.name, property->device, INDIGO_NAME_SIZE)) {
-				if (property->type == INDIGO_BLOB_VECTOR) {
-					for (int i = 0; i < property->count; i++) {
-						void *blob = property->items[i].blob.value;
-						if (blob)
-							free(blob);
-					}
+		for (int i = 0; i < context->size; i++) {
+			property_cache_entry **link = &context->properties[i];
+			while (*link != NULL) {
+				indigo_property *property = (*link)->property;
+				if (strncmp(remote_device.name, property->device, INDIGO_NAME_SIZE)) {
+					link = &(*link)->next;
+					continue;
 				}
+				property_cache_remove(context, link);
 				indigo_release_property(property);
-				context.properties[index] = NULL;
 			}
 		}
 	}
-	if (blob_buffer != NULL)
-		free(blob_buffer);
+	/* reusable buffers can be referenced by cached BLOBs, so they are unmapped last */
+	for (int i = 0; i < INDIGO_SHARED_BUFFER_SLOTS; i++) {
+		if (context->shared_buffers[i] != NULL)
+			munmap(context->shared_buffers[i], INDIGO_SHARED_BUFFER_HEADER + context->shared_capacities[i]);
+	}
+	if (context->properties != NULL)
+		free(context->properties);
+	if (context->property_buffer != NULL)
+		free(context->property_buffer);
+	if (parser->blob_buffer != NULL)
+		free(parser->blob_buffer);
+	if (parser->encoded_buffer != NULL)
+		free(parser->encoded_buffer);
+	free(parser->value_buffer);
+	free(parser);
+}
+
+void indigo_xml_parse(indigo_device *device, indigo_client *client) {
+	char *buffer = malloc(BUFFER_SIZE);
+	assert(buffer != NULL);
+	indigo_xml_parser *parser = indigo_xml_parser_create(device, client, false);
+	int handle = 0;
+	if (device != NULL) {
+		handle = ((indigo_adapter_context *)device->device_context)->input;
+		device->enumerate_properties(device, client, NULL);
+	} else {
+		handle = ((indigo_adapter_context *)client->client_context)->input;
+	}
+	bool unix_socket = device != NULL && indigo_is_unix_socket(handle);
+	while (true) {
+		ssize_t count;
+		if (unix_socket) {
+			parser_context *context = &parser->context;
+			int fd_count = INDIGO_MAX_RECEIVED_FDS - context->shared_fd_count;
+			count = indigo_recv_fds(handle, buffer, BUFFER_SIZE, context->shared_fds + context->shared_fd_count, &fd_count);
+			if (count < 0 && errno == EMSGSIZE) {
+				/* more descriptors than pending shared BLOBs can use, pairing by order is lost */
+				indigo_error("XML Parser: too many shared BLOB descriptors received");
+				break;
+			}
+			context->shared_fd_count += fd_count;
+		} else {
+			count = (int)read(handle, (void *)buffer, (ssize_t)BUFFER_SIZE);
+		}
+		if (count <= 0)
+			break;
+		if (!indigo_xml_parser_feed(parser, buffer, count))
+			break;
+	}
+	indigo_xml_parser_release(parser);
 	free(buffer);
-	free(value_buffer);
 	close(handle);
 	indigo_log("XML Parser: parser finished");
 }
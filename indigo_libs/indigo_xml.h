@@ -38,10 +38,34 @@ extern "C" {
 
 extern bool indigo_use_blob_urls;
 
+/** Use <enableBLOB>Shared</enableBLOB> (BLOBs passed as shared memory descriptors) for INDIGO servers connected over unix domain socket.
+ */
+extern bool indigo_use_shared_blobs;
+
+/** Keep base64 encoded BLOBs received from remote INDIGO servers in blob.encoded_value to forward them without re-encoding, blob.value is NULL until indigo_populate_http_blob_item() is called.
+ */
+extern bool indigo_keep_encoded_blobs;
+
 /** XML wire protocol parser.
  */
 extern void indigo_xml_parse(indigo_device *device, indigo_client *client);
 
+/** Incremental XML wire protocol parser state.
+ */
+typedef struct indigo_xml_parser indigo_xml_parser;
+
+/** Create incremental XML parser (compact parser allocates its buffers on demand only, for use with many idle connections).
+ */
+extern indigo_xml_parser *indigo_xml_parser_create(indigo_device *device, indigo_client *client, bool compact);
+
+/** Feed incremental XML parser with next chunk of data (returns false on syntax error).
+ */
+extern bool indigo_xml_parser_feed(indigo_xml_parser *parser, char *data, long length);
+
+/** Release incremental XML parser and all remote properties defined through it.
+ */
+extern void indigo_xml_parser_release(indigo_xml_parser *parser);
+
 /** Escape XML string.
  */
 extern char *indigo_xml_escape(char *string);
@@ -40,6 +40,7 @@
 #include "indigo_driver.h"
 #include "indigo_client.h"
 #include "indigo_xml.h"
+#include "indigo_driver_xml.h"
 
 #include "ccd_simulator/indigo_ccd_simulator.h"
 #include "mount_simulator/indigo_mount_simulator.h"
@@ -94,6 +95,11 @@ static indigo_property *servers_property;
 static indigo_property *load_property;
 static indigo_property *unload_property;
 static indigo_property *restart_property;
+static indigo_property *blob_policy_property;
+static pthread_mutex_t servers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drivers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t drivers_thread;
+static bool drivers_thread_started = false;
 static DNSServiceRef sd_http;
 static DNSServiceRef sd_indigo;
 static char servicename[INDIGO_NAME_SIZE] = "";
@@ -116,7 +122,8 @@ static indigo_device server_device = {
 	attach,
 	enumerate_properties,
 	change_property,
-	detach
+	detach,
+	NULL
 };
 
 static unsigned char ctrl[] = {
@@ -166,6 +173,58 @@ static void server_callback(int count) {
 	}
 }
 
+static void server_item_name(indigo_server_entry *entry, char *name) {
+	if (entry->port == 7624)
+		strncpy(name, entry->host, INDIGO_NAME_SIZE);
+	else {
+		/* too long host name is shortened, so port is always part of the name */
+		char port[16];
+		int port_length = snprintf(port, sizeof(port), ":%d", entry->port);
+		snprintf(name, INDIGO_NAME_SIZE, "%.*s%s", INDIGO_NAME_SIZE - 1 - port_length, entry->host, port);
+	}
+}
+
+static indigo_property_state server_light(indigo_server_state state) {
+	switch (state) {
+		case INDIGO_SERVER_CONNECTING:
+			return INDIGO_BUSY_STATE;
+		case INDIGO_SERVER_CONNECTED:
+			return INDIGO_OK_STATE;
+		case INDIGO_SERVER_FAILED:
+			return INDIGO_ALERT_STATE;
+		default:
+			return INDIGO_IDLE_STATE;
+	}
+}
+
+static void update_servers_state() {
+	/* the worst light of remote servers is state of the whole property */
+	servers_property->state = INDIGO_IDLE_STATE;
+	for (int i = 0; i < servers_property->count; i++) {
+		indigo_property_state light = servers_property->items[i].light.value;
+		if (light == INDIGO_ALERT_STATE || (light == INDIGO_BUSY_STATE && servers_property->state != INDIGO_ALERT_STATE) || (light == INDIGO_OK_STATE && servers_property->state == INDIGO_IDLE_STATE))
+			servers_property->state = light;
+	}
+}
+
+static void server_state_changed(indigo_server_entry *server) {
+	char name[INDIGO_NAME_SIZE];
+	server_item_name(server, name);
+	pthread_mutex_lock(&servers_mutex);
+	if (indigo_server_state_handler != NULL) {
+		for (int i = 0; i < servers_property->count; i++) {
+			indigo_item *item = servers_property->items + i;
+			if (!strcmp(item->name, name)) {
+				item->light.value = server_light(server->state);
+				update_servers_state();
+				indigo_update_property(&server_device, servers_property, NULL);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&servers_mutex);
+}
+
 static indigo_result attach(indigo_device *device) {
 	assert(device != NULL);
 	drivers_property = indigo_init_switch_property(NULL, server_device.name, "DRIVERS", "Main", "Active drivers", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ANY_OF_MANY_RULE, INDIGO_MAX_DRIVERS);
@@ -173,17 +232,15 @@ static indigo_result attach(indigo_device *device) {
 	for (int i = 0; i < INDIGO_MAX_DRIVERS; i++)
 		if (indigo_available_drivers[i].driver != NULL)
 			indigo_init_switch_item(&drivers_property->items[drivers_property->count++], indigo_available_drivers[i].description, indigo_available_drivers[i].description, true);
+	pthread_mutex_lock(&servers_mutex);
 	servers_property = indigo_init_light_property(NULL, server_device.name, "SERVERS", "Main", "Active servers", INDIGO_IDLE_STATE, 2 * INDIGO_MAX_SERVERS);
 	servers_property->count = 0;
 	for (int i = 0; i < INDIGO_MAX_SERVERS; i++) {
 		indigo_server_entry *entry = indigo_available_servers + i;
 		if (*entry->host) {
 			char buf[INDIGO_NAME_SIZE];
-			if (entry->port == 7624)
-				strncpy(buf, entry->host, sizeof(buf));
-			else
-				snprintf(buf, sizeof(buf), "%s:%d", entry->host, entry->port);
-			indigo_init_light_item(&servers_property->items[servers_property->count++], buf, buf, INDIGO_IDLE_STATE);
+			server_item_name(entry, buf);
+			indigo_init_light_item(&servers_property->items[servers_property->count++], buf, buf, server_light(entry->state));
 		}
 	}
 	for (int i = 0; i < INDIGO_MAX_SERVERS; i++) {
@@ -192,12 +249,18 @@ static indigo_result attach(indigo_device *device) {
 			indigo_init_light_item(&servers_property->items[servers_property->count++], entry->executable, entry->executable, INDIGO_IDLE_STATE);
 		}
 	}
+	update_servers_state();
+	indigo_server_state_handler = server_state_changed;
+	pthread_mutex_unlock(&servers_mutex);
 	load_property = indigo_init_text_property(NULL, server_device.name, "LOAD", "Main", "Load driver", INDIGO_IDLE_STATE, INDIGO_RW_PERM, 1);
 	indigo_init_text_item(&load_property->items[0], "DRIVER", "Load driver", "");
 	unload_property = indigo_init_text_property(NULL, server_device.name, "UNLOAD", "Main", "Unload driver", INDIGO_IDLE_STATE, INDIGO_RW_PERM, 1);
 	indigo_init_text_item(&unload_property->items[0], "DRIVER", "Unload driver", "");
 	restart_property = indigo_init_switch_property(NULL, server_device.name, "RESTART", "Main", "Restart", INDIGO_IDLE_STATE, INDIGO_RW_PERM, INDIGO_ANY_OF_MANY_RULE, 1);
 	indigo_init_switch_item(restart_property->items, "RESTART", "Restart server", false);
+	blob_policy_property = indigo_init_switch_property(NULL, server_device.name, "BLOB_POLICY", "Main", "BLOB delivery policy", INDIGO_OK_STATE, INDIGO_RW_PERM, INDIGO_ONE_OF_MANY_RULE, 2);
+	indigo_init_switch_item(&blob_policy_property->items[0], "DELIVER_ALL", "Deliver all BLOBs", indigo_xml_blob_policy == INDIGO_BLOB_POLICY_DELIVER_ALL);
+	indigo_init_switch_item(&blob_policy_property->items[1], "SKIP_STALE", "Skip stale BLOBs for slow clients", indigo_xml_blob_policy == INDIGO_BLOB_POLICY_SKIP_STALE);
 	if (indigo_load_properties(device, false) == INDIGO_FAILED)
 		change_property(device, NULL, drivers_property);
 	INDIGO_LOG(indigo_log("%s attached", device->name));
@@ -212,29 +275,69 @@ static indigo_result enumerate_properties(indigo_device *device, indigo_client *
 	indigo_define_property(device, load_property, NULL);
 	indigo_define_property(device, unload_property, NULL);
 	indigo_define_property(device, restart_property, NULL);
+	indigo_define_property(device, blob_policy_property, NULL);
 	return INDIGO_OK;
 }
 
+static void save_config(indigo_device *device) {
+	/* all persistent properties have to be saved together, config file is truncated */
+	int handle = 0;
+	indigo_save_property(device, &handle, drivers_property);
+	indigo_save_property(device, &handle, blob_policy_property);
+	close(handle);
+}
+
+/* drivers_mutex has to be locked */
+static void drivers_join() {
+	if (drivers_thread_started) {
+		pthread_join(drivers_thread, NULL);
+		drivers_thread_started = false;
+	}
+}
+
+static void drivers_wait() {
+	pthread_mutex_lock(&drivers_mutex);
+	drivers_join();
+	pthread_mutex_unlock(&drivers_mutex);
+}
+
+static void *drivers_init_thread(indigo_device *device) {
+	indigo_driver_entry *drivers[INDIGO_MAX_DRIVERS];
+	int count = 0;
+	for (int i = 0; i < drivers_property->count; i++)
+		if (drivers_property->items[i].sw.value) {
+			drivers[count++] = &indigo_available_drivers[i];
+		} else {
+			indigo_available_drivers[i].driver(INDIGO_DRIVER_SHUTDOWN, NULL);
+			indigo_available_drivers[i].initialized = false;
+		}
+	indigo_init_drivers(drivers, count);
+	drivers_property->state = INDIGO_OK_STATE;
+	indigo_update_property(device, drivers_property, NULL);
+	return NULL;
+}
+
 static indigo_result change_property(indigo_device *device, indigo_client *client, indigo_property *property) {
 	assert(device != NULL);
 	assert(property != NULL);
 	if (indigo_property_match(drivers_property, property)) {
 	// -------------------------------------------------------------------------------- DRIVERS
+		/* mutex is held until new init thread is registered, so concurrent change can't join it twice or lose it */
+		pthread_mutex_lock(&drivers_mutex);
+		drivers_join();
 		indigo_property_copy_values(drivers_property, property, false);
-		for (int i = 0; i < drivers_property->count; i++)
-			if (drivers_property->items[i].sw.value) {
-				indigo_available_drivers[i].initialized = indigo_available_drivers[i].driver(INDIGO_DRIVER_INIT, NULL) == INDIGO_OK;
-			} else {
-				indigo_available_drivers[i].driver(INDIGO_DRIVER_SHUTDOWN, NULL);
-				indigo_available_drivers[i].initialized = false;
-			}
-		drivers_property->state = INDIGO_OK_STATE;
+		drivers_property->state = INDIGO_BUSY_STATE;
 		indigo_update_property(device, drivers_property, NULL);
-		int handle = 0;
-		indigo_save_property(device, &handle, drivers_property);
-		close(handle);
+		save_config(device);
+		/* server accepts clients while drivers are initialized, devices appear as they get ready */
+		if (pthread_create(&drivers_thread, NULL, (void *(*)(void *))drivers_init_thread, device) == 0)
+			drivers_thread_started = true;
+		else
+			drivers_init_thread(device);
+		pthread_mutex_unlock(&drivers_mutex);
 	} else if (indigo_property_match(load_property, property)) {
 		// -------------------------------------------------------------------------------- LOAD
+		drivers_wait();
 		indigo_property_copy_values(load_property, property, false);
 		if (*load_property->items[0].text.value) {
 			if (indigo_load_driver(load_property->items[0].text.value, true, NULL) == INDIGO_OK) {
@@ -257,6 +360,7 @@ static indigo_result change_property(indigo_device *device, indigo_client *clien
 		}
 	} else if (indigo_property_match(unload_property, property)) {
 		// -------------------------------------------------------------------------------- UNLOAD
+		drivers_wait();
 		indigo_property_copy_values(unload_property, property, false);
 		if (*unload_property->items[0].text.value) {
 			indigo_driver_entry *driver = NULL;
@@ -280,6 +384,13 @@ static indigo_result change_property(indigo_device *device, indigo_client *clien
 				indigo_update_property(device, unload_property, indigo_last_message);
 			}
 		}
+	} else if (indigo_property_match(blob_policy_property, property)) {
+		// -------------------------------------------------------------------------------- BLOB_POLICY
+		indigo_property_copy_values(blob_policy_property, property, false);
+		indigo_xml_blob_policy = blob_policy_property->items[1].sw.value ? INDIGO_BLOB_POLICY_SKIP_STALE : INDIGO_BLOB_POLICY_DELIVER_ALL;
+		blob_policy_property->state = INDIGO_OK_STATE;
+		indigo_update_property(device, blob_policy_property, NULL);
+		save_config(device);
 	} else if (indigo_property_match(restart_property, property)) {
 	// -------------------------------------------------------------------------------- RESTART
 		indigo_property_copy_values(restart_property, property, false);
@@ -295,10 +406,14 @@ static indigo_result change_property(indigo_device *device, indigo_client *clien
 static indigo_result detach(indigo_device *device) {
 	assert(device != NULL);
 	indigo_delete_property(device, drivers_property, NULL);
+	pthread_mutex_lock(&servers_mutex);
+	indigo_server_state_handler = NULL;
 	if (servers_property->count > 0)
 		indigo_delete_property(device, servers_property, NULL);
+	pthread_mutex_unlock(&servers_mutex);
 	indigo_delete_property(device, load_property, NULL);
 	indigo_delete_property(device, unload_property, NULL);
+	indigo_delete_property(device, blob_policy_property, NULL);
 	INDIGO_LOG(indigo_log("%s detached", device->name));
 	return INDIGO_OK;
 }
@@ -308,6 +423,9 @@ static void server_main(int argc, const char * argv[]) {
 
 	indigo_start_usb_event_handler();
 
+	/* BLOBs from remote servers are forwarded to clients without re-encoding */
+	indigo_keep_encoded_blobs = true;
+
 	indigo_start();
 
 	for (int i = 1; i < argc; i++) {
@@ -341,6 +459,33 @@ static void server_main(int argc, const char * argv[]) {
 			use_control_panel = false;
 		} else if (!strcmp(argv[i], "-u-") || !strcmp(argv[i], "--disable-blob-urls")) {
 			indigo_use_blob_urls = false;
+		} else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--use-event-loop")) {
+			indigo_server_use_event_loop = true;
+		} else if ((!strcmp(argv[i], "-w") || !strcmp(argv[i], "--workers")) && i < argc - 1) {
+			indigo_server_worker_count = atoi(argv[i + 1]);
+			i++;
+		} else if ((!strcmp(argv[i], "-W") || !strcmp(argv[i], "--http-workers")) && i < argc - 1) {
+			indigo_server_http_worker_count = atoi(argv[i + 1]);
+			i++;
+		} else if ((!strcmp(argv[i], "-U") || !strcmp(argv[i], "--unix-socket")) && i < argc - 1) {
+			indigo_server_unix_socket = argv[i + 1];
+			i++;
+		} else if ((!strcmp(argv[i], "-L") || !strcmp(argv[i], "--listen")) && i < argc - 1) {
+			indigo_server_listen_addresses = argv[i + 1];
+			i++;
+		} else if ((!strcmp(argv[i], "-B") || !strcmp(argv[i], "--backlog")) && i < argc - 1) {
+			indigo_server_listen_backlog = atoi(argv[i + 1]);
+			i++;
+		} else if ((!strcmp(argv[i], "-a") || !strcmp(argv[i], "--accept-threads")) && i < argc - 1) {
+			indigo_server_accept_thread_count = atoi(argv[i + 1]);
+			i++;
+		} else if ((!strcmp(argv[i], "-t") || !strcmp(argv[i], "--connect-timeout")) && i < argc - 1) {
+			indigo_server_connect_timeout = atoi(argv[i + 1]);
+			i++;
+		} else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--serialize-devices")) {
+			indigo_use_device_executors = true;
+		} else if (!strcmp(argv[i], "-P") || !strcmp(argv[i], "--pipeline-images")) {
+			indigo_use_image_pipeline = true;
 		} else if(argv[i][0] != '-') {
 			indigo_load_driver(argv[i], false, NULL);
 		}
@@ -368,6 +513,7 @@ static void server_main(int argc, const char * argv[]) {
 	DNSServiceRefDeallocate(sd_http);
 #endif
 
+	drivers_wait();
 	for (int i = 0; i < INDIGO_MAX_DRIVERS; i++) {
 		if (indigo_available_drivers[i].driver) {
 			indigo_remove_driver(&indigo_available_drivers[i]);
@@ -421,7 +567,7 @@ int main(int argc, const char * argv[]) {
 			indigo_use_syslog = true;
 		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			printf("%s [-h|--help]\n", argv[0]);
-			printf("%s [--|--do-not-fork] [-l|--use-syslog] [-s|--enable-simulators] [-p|--port port] [-u-|--disable-blob-urls] [-b|--bonjour name] [-b-|--disable-bonjour] [-c-|--disable-control-panel] [-v|--enable-log] [-vv|--enable-debug] [-vvv|--enable-trace] [-r|--remote-server host:port] [-i|--indi-driver driver_executable] indigo_driver_name indigo_driver_name ...\n", argv[0]);
+			printf("%s [--|--do-not-fork] [-l|--use-syslog] [-s|--enable-simulators] [-p|--port port] [-u-|--disable-blob-urls] [-e|--use-event-loop] [-w|--workers count] [-W|--http-workers count] [-U|--unix-socket path] [-L|--listen address,...] [-B|--backlog length] [-a|--accept-threads count] [-b|--bonjour name] [-b-|--disable-bonjour] [-c-|--disable-control-panel] [-v|--enable-log] [-vv|--enable-debug] [-vvv|--enable-trace] [-t|--connect-timeout ms] [-x|--serialize-devices] [-P|--pipeline-images] [-r|--remote-server host:port|socket_path] [-i|--indi-driver driver_executable] indigo_driver_name indigo_driver_name ...\n", argv[0]);
 			return 0;
 		} else {
 			server_argv[server_argc++] = argv[i];
@@ -0,0 +1,157 @@
+// Copyright (c) 2016 CloudMakers, s. r. o.
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 2.0 Build 0 - PoC by Peter Polakovic <peter.polakovic@cloudmakers.eu>
+
+/* pixel conversion benchmark, frames are passed through indigo_process_image() of dummy CCD device
+   and converted frame is checked against source, usage: benchmark [width height [count]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+
+#include "indigo_bus.h"
+#include "indigo_driver.h"
+#include "indigo_ccd_driver.h"
+
+static indigo_result benchmark_attach(indigo_device *device) {
+	return indigo_ccd_attach(device, INDIGO_VERSION_CURRENT);
+}
+
+static indigo_result benchmark_enumerate_properties(indigo_device *device, indigo_client *client, indigo_property *property) {
+	return INDIGO_OK;
+}
+
+static indigo_result benchmark_change_property(indigo_device *device, indigo_client *client, indigo_property *property) {
+	return indigo_ccd_change_property(device, client, property);
+}
+
+static indigo_result benchmark_detach(indigo_device *device) {
+	return indigo_ccd_detach(device);
+}
+
+static indigo_device benchmark_device = {
+	"Benchmark CCD", NULL, NULL, INDIGO_OK, INDIGO_VERSION_CURRENT,
+	benchmark_attach,
+	benchmark_enumerate_properties,
+	benchmark_change_property,
+	benchmark_detach,
+	NULL
+};
+
+typedef struct {
+	const char *name;
+	int bits_per_pixel;
+	bool fits;
+	bool little_endian;
+} benchmark_case;
+
+static benchmark_case cases[] = {
+	{ "16-bit LE to FITS", 16, true, true },
+	{ "16-bit BE to FITS", 16, true, false },
+	{ "RGB24 to FITS", 24, true, false },
+	{ "BGR24 to FITS", 24, true, true },
+	{ "RGB24 to RAW", 24, false, false },
+};
+
+static bool check(benchmark_case *c, const unsigned char *source, const unsigned char *image, long size) {
+	if (c->bits_per_pixel == 16) {
+		for (long i = 0; i < size; i++) {
+			uint16_t value = c->little_endian ? source[2 * i] | source[2 * i + 1] << 8 : source[2 * i] << 8 | source[2 * i + 1];
+			/* FITS is big endian signed with BZERO 32768 */
+			if (image[2 * i] != ((value >> 8) ^ 0x80) || image[2 * i + 1] != (value & 0xFF))
+				return false;
+		}
+	} else if (c->fits) {
+		for (long i = 0; i < size; i++)
+			for (int plane = 0; plane < 3; plane++)
+				if (image[plane * size + i] != source[3 * i + (c->little_endian ? 2 - plane : plane)])
+					return false;
+	} else {
+		/* RAW RGB24 components are swapped if frame is not little endian */
+		for (long i = 0; i < size; i++)
+			for (int component = 0; component < 3; component++)
+				if (image[3 * i + component] != source[3 * i + (c->little_endian ? component : 2 - component)])
+					return false;
+	}
+	return true;
+}
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, const char * argv[]) {
+	indigo_main_argc = argc;
+	indigo_main_argv = argv;
+	/* 60 MP full frame sensor by default */
+	int width = argc > 2 ? atoi(argv[1]) : 9504;
+	int height = argc > 2 ? atoi(argv[2]) : 6336;
+	int count = argc > 3 ? atoi(argv[3]) : 5;
+	if (width <= 0 || height <= 0 || count <= 0) {
+		fprintf(stderr, "usage: %s [width height [count]]\n", argv[0]);
+		return 1;
+	}
+	long size = (long)width * height;
+	long length = FITS_HEADER_SIZE + 3 * size + 2880;
+	unsigned char *source = malloc(length);
+	unsigned char *frame = malloc(length);
+	assert(source != NULL && frame != NULL);
+	srand(1);
+	for (long i = 0; i < length; i++)
+		source[i] = rand();
+	indigo_start();
+	indigo_device *device = &benchmark_device;
+	indigo_attach_device(device);
+	CONNECTION_CONNECTED_ITEM->sw.value = true;
+	CONNECTION_PROPERTY->state = INDIGO_OK_STATE;
+	indigo_set_switch(CCD_UPLOAD_MODE_PROPERTY, CCD_UPLOAD_MODE_CLIENT_ITEM, true);
+	bool passed = true;
+	printf("%d x %d frame, %d runs\n", width, height, count);
+	for (int i = 0; i < sizeof(cases) / sizeof(benchmark_case); i++) {
+		benchmark_case *c = cases + i;
+		CCD_FRAME_BITS_PER_PIXEL_ITEM->number.value = c->bits_per_pixel;
+		indigo_set_switch(CCD_IMAGE_FORMAT_PROPERTY, c->fits ? CCD_IMAGE_FORMAT_FITS_ITEM : CCD_IMAGE_FORMAT_RAW_ITEM, true);
+		double min = 0, total = 0;
+		bool ok = true;
+		for (int run = 0; run < count; run++) {
+			/* conversion is done in place, so source has to be restored for each run */
+			memcpy(frame, source, length);
+			double start = now();
+			indigo_process_image(device, frame, width, height, c->little_endian, NULL);
+			double time = now() - start;
+			total += time;
+			if (run == 0 || time < min)
+				min = time;
+			ok = ok && check(c, source + FITS_HEADER_SIZE, frame + FITS_HEADER_SIZE, size);
+		}
+		printf("%-20s min %7.1fms  mean %7.1fms  %s\n", c->name, min * 1000, total / count * 1000, ok ? "ok" : "FAILED");
+		passed = passed && ok;
+	}
+	indigo_detach_device(device);
+	indigo_stop();
+	free(frame);
+	free(source);
+	return passed ? 0 : 1;
+}
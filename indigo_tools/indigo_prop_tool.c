@@ -463,6 +463,7 @@ int main(int argc, const char * argv[]) {
 			print_verbose = true;
 		} else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--save-blobs")) {
 			save_blobs = true;
+			indigo_prefetch_blob_urls = true;
 		} else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--use_legacy-blobs")) {
 			indigo_use_blob_urls = false;
 		} else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--remote-server")) {